@@ -21,6 +21,15 @@
 #include "inasm64/common.h"
 #include "inasm64/x64.h"
 #include "inasm64/runtime.h"
+#include "inasm64/decoder.h"
+#include "inasm64/benchmark.h"
+#include "inasm64/hazards.h"
+#include "inasm64/superopt.h"
+#include "inasm64/tune.h"
+#include "inasm64/loader.h"
+#include "inasm64/exporter.h"
+#include "inasm64/history.h"
+#include "inasm64/memdiff.h"
 #include "inasm64/assembler.h"
 #include "inasm64/assembler_driver.h"
 #include "inasm64/cli.h"
@@ -172,6 +181,39 @@ void DumpDeltaRegs()
     }
 }
 
+void DumpRegisterChange(const RegisterInfo& reg, const history::change_t& change)
+{
+    std::cout << "\tstep " << std::dec << std::setw(6) << change._step << "  ";
+    if(reg._class == RegisterInfo::RegClass::kXmm)
+        cout_bytes_as_number(std::cout, reinterpret_cast<const uint8_t*>(change._value), 16);
+    else
+        std::cout << "0x" << cout_64_bits << change._value[0];
+    std::cout << std::setfill(' ');
+    switch(change._source)
+    {
+    case history::Source::kStart:
+        std::cout << "  start";
+        break;
+    case history::Source::kWrite:
+        std::cout << "  set";
+        break;
+    case history::Source::kRun:
+        std::cout << "  run from ";
+        break;
+    default:
+        std::cout << "  ";
+        break;
+    }
+    if(change._source == history::Source::kInstruction || change._source == history::Source::kRun)
+    {
+        if(change._has_line)
+            std::cout << "line " << std::dec << change._line;
+        else
+            std::cout << "0x" << std::hex << change._address;
+    }
+    std::cout << std::dec << "\n";
+}
+
 void DumpReg(const char* regName_, uint64_t value)
 {
     char regName[64];
@@ -296,6 +338,19 @@ void DumpMemory(cli::DataType type, const void* remote_address, size_t size_)
     constexpr auto kBytesPerRow = 16;
     constexpr auto kRows = 4;
 
+    runtime::allocation_info_t alloc_info;
+    if(runtime::QueryAllocation(remote_address, alloc_info))
+    {
+        std::cout << console::yellow_lo << std::dec << alloc_info._size << " bytes, ";
+        if(alloc_info._page_size >= (1ull << 20))
+            std::cout << (alloc_info._page_size >> 20) << "MB pages";
+        else
+            std::cout << (alloc_info._page_size >> 10) << "KB pages";
+        if(alloc_info._node >= 0)
+            std::cout << ", NUMA node " << alloc_info._node;
+        std::cout << console::reset_colours << "\n";
+    }
+
     // we don't display all the data (yet), so pick smallest of window
     auto size = std::min<size_t>(kBytesPerRow * kRows, size_);
     // create padding to nearest 8 bytes, so that we can 0 out top bytes in >1 byte types if they go outside the range
@@ -475,6 +530,36 @@ void DisplaySystemInformation()
             std::cout << "AVX512 ";
     }
 
+    CacheInfo caches[8];
+    const auto num_caches = GetCacheInfo(caches, sizeof(caches) / sizeof(caches[0]));
+    if(num_caches)
+    {
+        std::cout << "\ncaches (CPUID): ";
+        for(size_t n = 0; n < num_caches; ++n)
+        {
+            const auto& cache = caches[n];
+            std::cout << "L" << cache._level;
+            switch(cache._type)
+            {
+            case CacheInfo::Type::kData:
+                std::cout << "d";
+                break;
+            case CacheInfo::Type::kInstruction:
+                std::cout << "i";
+                break;
+            default:;
+            }
+            if(cache._size >= (size_t(1) << 20))
+                std::cout << " " << std::dec << (cache._size >> 20) << "MB ";
+            else
+                std::cout << " " << std::dec << (cache._size >> 10) << "KB ";
+            std::cout << cache._ways << "-way " << cache._line_size << "B lines";
+            if(cache._shared_by > 1)
+                std::cout << " shared by " << cache._shared_by;
+            std::cout << (n + 1 < num_caches ? ", " : "");
+        }
+    }
+
     std::cout << std::endl;
 }
 
@@ -535,6 +620,8 @@ int main(int argc, char* argv[])
 
     if(assembler::Initialise() && runtime::Start() && cli::Initialise())
     {
+        // keep a debuggee waiting so that "restart" doesn't have to launch one
+        runtime::WarmDebuggeePool(1);
         DisplaySystemInformation();
 
         cli::OnDataValueSet = [](const char* name, uintptr_t value) {
@@ -560,6 +647,323 @@ int main(int argc, char* argv[])
             std::cout << "\n";
             DumpDeltaRegs();
         };
+        cli::OnInterference = [](const benchmark::interference_t& result) {
+            std::cout << "\ncpus " << int(result._pair._primary) << " and " << int(result._pair._sibling) << " (group " << result._pair._group << "), " << std::dec << result._iterations << " iterations\n";
+            std::cout << std::fixed << std::setprecision(2) << "\talone:   " << result._alone << " ticks/iteration\n";
+            std::cout << "\tshared:  " << result._shared << " ticks/iteration";
+            if(result._alone > 0)
+                std::cout << " (" << (result._shared / result._alone) << "x)";
+            std::cout << "\n\toverhead " << result._overhead << " ticks/iteration of loop subtracted\n";
+            std::cout << std::defaultfloat;
+        };
+        cli::OnCoreTimings = [](const benchmark::core_timings_t& result) {
+            const auto type_name = [](CoreInfo::Type type) {
+                switch(type)
+                {
+                case CoreInfo::Type::kCore:
+                    return "performance";
+                case CoreInfo::Type::kAtom:
+                    return "efficiency";
+                default:
+                    return "";
+                }
+            };
+            std::cout << "\n" << std::dec << result._iterations << " iterations\n";
+            for(const auto& timing : result._processors)
+            {
+                std::cout << "\tcpu " << std::setw(3) << int(timing._processor) << " (group " << timing._group << ") package " << timing._core._package_id << " core " << std::setw(3) << timing._core._core_id << " smt " << timing._core._smt_id;
+                std::cout << std::fixed << std::setprecision(2) << ": " << std::setw(8) << timing._ticks << " ticks/iteration\n";
+            }
+            std::cout << "\n";
+            for(const auto& group : result._groups)
+            {
+                if(group._type != CoreInfo::Type::kUnknown)
+                    std::cout << "\t" << type_name(group._type) << " cores, ";
+                else
+                    std::cout << "\tefficiency class " << int(group._efficiency_class) << ", ";
+                std::cout << group._processors << " cpus: " << group._min << " / " << group._mean << " / " << group._max << " ticks/iteration (min/mean/max)\n";
+            }
+            std::cout << std::defaultfloat;
+        };
+        cli::OnBandwidth = [](const std::vector<benchmark::bandwidth_t>& results) {
+            std::cout << "\n";
+            for(const auto& result : results)
+            {
+                std::cout << std::dec << "\t" << result._threads << (result._threads == 1 ? " thread:  " : " threads: ");
+                std::cout << std::fixed << std::setprecision(2) << result._gb_per_second << " GB/s (" << result._bytes << " bytes in " << result._ticks << " ticks)\n";
+            }
+            std::cout << std::defaultfloat;
+        };
+        cli::OnLatency = [](const std::vector<benchmark::latency_t>& results) {
+            std::cout << "\n";
+            for(const auto& result : results)
+            {
+                if(result._size >= (size_t(1) << 20))
+                    std::cout << std::dec << "\t" << std::setw(6) << (result._size >> 20) << "MB ";
+                else
+                    std::cout << std::dec << "\t" << std::setw(6) << (result._size >> 10) << "KB ";
+                std::cout << std::fixed << std::setprecision(2) << std::setw(8) << result._ticks << " ticks " << std::setw(8) << result._ns << " ns/load\n";
+            }
+            std::cout << std::defaultfloat;
+        };
+        cli::OnCacheTiming = [](const benchmark::cache_timing_t& result) {
+            std::cout << "\n" << std::dec << result._runs << " runs of " << result._iterations << " iterations\n";
+            std::cout << std::fixed << std::setprecision(2) << "\thot:      " << result._hot << " ticks/iteration\n";
+            std::cout << "\tprepared: " << result._prepared << " ticks/iteration (" << result._buffers << " buffers)\n";
+            std::cout << "\toverhead " << result._overhead << " ticks/iteration of loop subtracted\n";
+            std::cout << std::defaultfloat;
+        };
+        cli::OnFloatHazards = [](const std::vector<hazards::transition_t>& transitions, const benchmark::mxcsr_timing_t* timing) {
+            std::cout << "\n";
+            if(transitions.empty())
+                std::cout << "\tno SSE/AVX transitions\n";
+            for(const auto& transition : transitions)
+                std::cout << "\tline " << std::dec << transition._line << ": legacy SSE with dirty upper halves from line " << transition._dirty_line << ", missing vzeroupper\n";
+            if(timing)
+            {
+                std::cout << "\tmxcsr 0x" << std::hex << timing->_mxcsr << std::dec << " (FTZ " << ((timing->_mxcsr & hazards::kMxcsrFtz) ? "on" : "off") << ", DAZ " << ((timing->_mxcsr & hazards::kMxcsrDaz) ? "on" : "off") << ")\n";
+                std::cout << std::fixed << std::setprecision(2) << "\tas is:   " << timing->_as_is << " ticks/iteration\n";
+                std::cout << "\tFTZ/DAZ: " << timing->_ftz_daz << " ticks/iteration";
+                if(timing->_ftz_daz > 0)
+                    std::cout << " (" << (timing->_as_is / timing->_ftz_daz) << "x)";
+                std::cout << "\n" << std::defaultfloat;
+            }
+        };
+        cli::OnProfile = [](const benchmark::profile_t& result) {
+            std::cout << "\n" << std::dec << result._samples << " samples over " << result._iterations << " iterations\n";
+            if(!result._samples)
+                return;
+            const auto percent = [&result](uint64_t samples) { return 100.0 * double(samples) / double(result._samples); };
+            std::cout << std::fixed << std::setprecision(1);
+            std::cout << "\t  line  sampled  attrib.\n";
+            for(const auto& line : result._lines)
+            {
+                const auto attributed = percent(line._attributed);
+                std::cout << "\t" << std::setw(6) << line._line._line << std::setw(8) << percent(line._samples) << "%" << std::setw(8) << attributed << "% ";
+                // heat bar, one block per 5% of the attributed samples
+                std::cout << console::red << std::left << std::setw(20) << std::string(size_t(attributed / 5.0 + 0.5), '#') << std::right << console::reset_colours << " ";
+                const auto source = _asm_history.find(line._line._address);
+                if(source != _asm_history.end())
+                {
+                    std::cout << source->second << "\n";
+                    continue;
+                }
+                char text[128];
+                if(decoder::Disassemble(line._line._bytes, line._line._size, line._line._address, text, sizeof(text)))
+                    std::cout << text;
+                std::cout << "\n";
+            }
+            std::cout << "\t  loop" << std::setw(8) << percent(result._loop) << "%" << std::setw(8) << percent(result._loop_attributed) << "%\n";
+            std::cout << std::defaultfloat;
+        };
+        cli::OnVerify = [](const benchmark::verify_t& result) {
+            std::cout << "\n" << std::dec << result._trials << " trials on " << result._threads << " threads, " << result._buffers << " input buffers, ";
+            std::cout << std::fixed << std::setprecision(1) << result._run_ms << " ms (" << result._total_ms << " ms in all)\n" << std::defaultfloat;
+            if(result._equivalent)
+            {
+                std::cout << console::green << "\tequivalent\n" << console::reset_colours;
+                return;
+            }
+            static const char* kGprNames[16] = { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15" };
+            const auto xmm = [](const uint64_t(&value)[2]) {
+                std::cout << "0x" << std::setw(16) << std::setfill('0') << value[1] << std::setw(16) << value[0] << std::setfill(' ');
+            };
+            std::cout << console::red << "\tdiverges at trial " << result._trial << ": " << console::reset_colours << std::hex;
+            if(result._register)
+            {
+                std::cout << result._register._name << " ";
+                if(result._register._class == RegisterInfo::RegClass::kXmm)
+                {
+                    const auto index = int(result._register._register) - int(RegisterInfo::Register::xmm0);
+                    xmm(result._reference._xmm[index]);
+                    std::cout << " vs ";
+                    xmm(result._candidate._xmm[index]);
+                }
+                else
+                {
+                    const auto index = int(std::find(std::begin(kGprNames), std::end(kGprNames), std::string(result._register._name)) - std::begin(kGprNames));
+                    std::cout << "0x" << result._reference._gpr[index] << " vs 0x" << result._candidate._gpr[index];
+                }
+            }
+            else if(result._flags)
+                std::cout << "rflags 0x" << result._reference._rflags << " vs 0x" << result._candidate._rflags;
+            else
+                std::cout << "byte 0x" << result._offset << " of buffer 0x" << uintptr_t(result._buffer) << ", 0x" << int(result._reference_byte) << " vs 0x" << int(result._candidate_byte) << " (input 0x" << int(result._input_byte) << ")";
+            std::cout << "\n\tinput:";
+            for(auto gpr = 0; gpr < 16; ++gpr)
+            {
+                if(gpr != 4)
+                    std::cout << ((gpr % 4) ? " " : "\n\t") << std::setw(3) << kGprNames[gpr] << " 0x" << std::setw(16) << std::setfill('0') << result._input._gpr[gpr] << std::setfill(' ');
+            }
+            std::cout << "\n\trflags 0x" << result._input._rflags;
+            for(auto index = 0; index < 16; ++index)
+            {
+                std::cout << ((index % 2) ? " " : "\n\t") << "xmm" << std::dec << std::left << std::setw(2) << index << std::right << std::hex << " ";
+                xmm(result._input._xmm[index]);
+            }
+            std::cout << std::dec << "\n";
+        };
+        cli::OnSuperoptimise = [](const superopt::search_t& result) {
+            const auto print_cost = [](const superopt::cost_t& cost) {
+                std::cout << "(" << cost._latency << " cycles, " << cost._size << " bytes)";
+            };
+            std::cout << "\n" << std::dec << "\t";
+            for(size_t n = 0; n < result._target.size(); ++n)
+                std::cout << (n ? "; " : "") << result._target[n];
+            std::cout << " ";
+            print_cost(result._target_cost);
+            std::cout << "\n\t" << result._tested << " sequences from " << result._pool << " instructions on " << result._threads << " threads, ";
+            std::cout << std::fixed << std::setprecision(1) << result._ms << " ms\n" << std::defaultfloat;
+            if(result._candidates.empty())
+                std::cout << "\tnothing cheaper found\n";
+            for(const auto& candidate : result._candidates)
+            {
+                std::cout << console::green << "\t";
+                for(size_t n = 0; n < candidate._instructions.size(); ++n)
+                    std::cout << (n ? "; " : "") << candidate._instructions[n];
+                std::cout << console::reset_colours << " ";
+                print_cost(candidate._cost);
+                std::cout << "\n";
+            }
+        };
+        cli::OnLitmus = [](const benchmark::litmus_t& result) {
+            std::cout << "\n" << std::dec << result._iterations << " iterations on cpus";
+            for(const auto& thread : result._threads)
+                std::cout << " " << int(thread._processor) << (thread._group ? " (group " + std::to_string(thread._group) + ")" : "");
+            std::cout << ", " << result._variables << " shared buffers\n\toutcome (";
+            for(size_t n = 0; n < result._outputs.size(); ++n)
+                std::cout << (n ? "," : "") << result._outputs[n]._name;
+            std::cout << " of each proc)\n" << std::fixed << std::setprecision(3);
+            for(const auto& outcome : result._outcomes)
+            {
+                std::cout << "\t" << std::hex;
+                for(size_t n = 0; n < outcome._values.size(); ++n)
+                    std::cout << ((n && !(n % result._outputs.size())) ? " | " : (n ? "," : "")) << outcome._values[n];
+                std::cout << std::dec << ": " << outcome._count << " (" << (100.0 * double(outcome._count) / double(result._iterations)) << "%)\n";
+            }
+            if(result._other)
+                std::cout << "\tother outcomes: " << result._other << "\n";
+            std::cout << std::setprecision(2);
+            for(size_t n = 0; n < result._threads.size(); ++n)
+                std::cout << "\tproc " << n << ": " << result._threads[n]._ticks << " ticks/call\n";
+            std::cout << "\t" << result._iteration_ticks << " ticks/iteration with the barriers, " << std::setprecision(1) << result._ms << " ms\n";
+            std::cout << std::setprecision(2) << "\toverhead " << result._overhead << " ticks/call subtracted\n";
+            std::cout << std::defaultfloat;
+        };
+        cli::OnTune = [](const tune::tuning_t& result) {
+            // the fastest, the rest are summarised
+            constexpr size_t kListed = 20;
+            std::cout << "\n" << std::dec << (result._ranked.size() + result._failed) << " variants of " << result._iterations << " iterations, assembled on " << result._threads << " threads, ";
+            std::cout << std::fixed << std::setprecision(1) << result._ms << " ms\n\t";
+            for(const auto& name : result._parameters)
+                std::cout << std::setw(8) << name << " ";
+            std::cout << "   ticks    bytes\n" << std::setprecision(2);
+            for(size_t n = 0; n < result._ranked.size() && n < kListed; ++n)
+            {
+                const auto& variant = result._ranked[n];
+                if(!n)
+                    std::cout << console::green;
+                std::cout << "\t";
+                for(auto value : variant._values)
+                    std::cout << std::setw(8) << value << " ";
+                std::cout << std::setw(8) << variant._ticks << " " << std::setw(8) << variant._size << console::reset_colours << "\n";
+            }
+            if(result._ranked.size() > kListed)
+                std::cout << "\t... " << (result._ranked.size() - kListed) << " more, the slowest " << result._ranked.back()._ticks << " ticks\n";
+            if(result._failed)
+            {
+                std::cout << console::yellow << "\t" << result._failed << " failed, the first with";
+                for(size_t p = 0; p < result._parameters.size(); ++p)
+                    std::cout << " " << result._parameters[p] << "=" << result._first_failed[p];
+                std::cout << ": " << ErrorMessage(result._error) << console::reset_colours << "\n";
+            }
+            std::cout << "\toverhead " << result._overhead << " ticks/iteration of loop subtracted\n";
+            std::cout << std::defaultfloat;
+        };
+        cli::OnLoad = [](const loader::load_t& result) {
+            std::cout << "\n" << std::dec << result._lines << " lines, " << result._size << " bytes at 0x" << std::hex << result._address << std::dec << "\n";
+            std::vector<runtime::line_t> lines;
+            if(!runtime::CommittedLines(lines))
+                return;
+            // the listing doubles as the source of the lines, as if they had been typed
+            for(const auto& line : lines)
+            {
+                if(line._line < result._first_line || line._line >= result._first_line + result._lines)
+                    continue;
+                char text[128];
+                if(!decoder::Disassemble(line._bytes, line._size, line._address, text, sizeof(text)))
+                    continue;
+                _asm_history[line._address] = text;
+                std::cout << "\t" << std::setw(6) << line._line << "  " << text << "\n";
+            }
+        };
+        cli::OnExport = [](const exporter::export_t& result) {
+            std::cout << "\n" << std::dec << result._code_size << " bytes of code in " << result._lines << " lines, " << result._data_size << " bytes of data, " << result._relocations << " relocations\n";
+            std::cout << "\tsymbols:";
+            for(const auto& symbol : result._symbols)
+                std::cout << " " << symbol;
+            if(!result._variables.empty())
+            {
+                std::cout << "\n\tvariables:";
+                for(const auto& variable : result._variables)
+                    std::cout << " " << variable;
+            }
+            std::cout << "\n\tlines refer to " << result._listing << "\n";
+        };
+        cli::OnPerfMap = [](const std::string& mapPath, const std::string& jitdumpPath) {
+            if(mapPath.empty())
+            {
+                std::cout << "\nperf map off\n";
+                return;
+            }
+            std::cout << "\n\tperf map: " << mapPath << "\n";
+            if(!jitdumpPath.empty())
+                std::cout << "\tjitdump:  " << jitdumpPath << "\n";
+        };
+        cli::OnPerfMapError = [](Error error) {
+            std::cerr << console::yellow << "\n\tperf map not updated: " << ErrorMessage(error) << console::reset_colours << "\n";
+        };
+        cli::OnRegisterHistory = [](const RegisterInfo& reg, const std::vector<history::change_t>& changes) {
+            // sub-registers are answered for their full register
+            const auto full = reg._class == RegisterInfo::RegClass::kGpr ? RegisterInfo{ reg._greatest_enclosing_register } : reg;
+            std::cout << "\n" << full._name << ", " << std::dec << history::Steps() << " steps\n";
+            for(const auto& change : changes)
+                DumpRegisterChange(full, change);
+        };
+        cli::OnLastChange = [](const RegisterInfo& reg, const history::change_t& change) {
+            const auto full = reg._class == RegisterInfo::RegClass::kGpr ? RegisterInfo{ reg._greatest_enclosing_register } : reg;
+            std::cout << "\n" << full._name << " last changed\n";
+            DumpRegisterChange(full, change);
+        };
+        cli::OnMemoryDiff = [](const memdiff::diff_t& result) {
+            std::cout << "\n" << std::dec << result._pages << " pages written, " << result._compared << " bytes compared\n";
+            for(const auto& variable : result._variables)
+            {
+                if(variable._name.empty())
+                    std::cout << "\t0x" << std::hex << variable._address;
+                else
+                    std::cout << "\t$" << variable._name;
+                std::cout << std::dec << ": " << variable._changed << " bytes changed at";
+                for(const auto& range : variable._ranges)
+                {
+                    std::cout << " +" << range._offset;
+                    if(range._size > 1)
+                        std::cout << ".." << range._offset + range._size - 1;
+                }
+                std::cout << "\n";
+            }
+        };
+        cli::OnDenormals = [](const std::vector<hazards::denormal_t>& denormals) {
+            for(const auto& denormal : denormals)
+            {
+                // name the narrowest register the element is in
+                const auto per_xmm = denormal._double ? 2u : 4u;
+                const auto reg = denormal._element < per_xmm ? " in xmm" : (denormal._element < per_xmm * 2 ? " in ymm" : " in zmm");
+                std::cout << console::yellow << "\tdenormal " << (denormal._output ? "output" : "input") << reg << std::dec << denormal._register << "[" << denormal._element << "] ("
+                          << (denormal._double ? "double" : "single") << ") at line " << denormal._line << "\n"
+                          << console::reset_colours;
+            }
+        };
         cli::OnDisplayGPRegisters = DumpRegs;
         cli::OnDisplayXMMRegisters = DumpXmmRegisters;
         cli::OnDisplayYMMRegisters = DumpYmmRegisters;
@@ -323,6 +323,13 @@ namespace inasm64
                 return (op._base[0] != 0 || op._reg_imm[0] != 0);
             }
 
+            // jmp, jcc, loop[cc], j[e|r]cxz and call take a relative branch target; the loop family and j[e|r]cxz only have 8 bit displacements
+            bool is_relative_branch(const char* instruction, bool& shortOnly)
+            {
+                shortOnly = strncmp(instruction, "loop", 4) == 0 || strcmp(instruction, "jrcxz") == 0 || strcmp(instruction, "jecxz") == 0;
+                return shortOnly || instruction[0] == 'j' || strcmp(instruction, "call") == 0;
+            }
+
         }  // namespace
 
         bool Initialise()
@@ -339,6 +346,10 @@ namespace inasm64
             memset(&statement, 0, sizeof(statement));
             std::vector<char*> part[kMaxOperands];
             int rip_rel_op = -1;
+            // relative branch operand, and its target if it is a label/line or an absolute address
+            int rel_op = -1;
+            const char* branch_target = nullptr;
+            uint64_t branch_address = 0;
 
             if(tokenise(assembly, part, 3, statement._input_tokens))
             {
@@ -416,6 +427,8 @@ namespace inasm64
                     // instruction
                     statement._instruction = part[0][instr_index++];
                     statement._operand_count = 0;
+                    auto short_branch = false;
+                    const auto relative_branch = is_relative_branch(statement._instruction, short_branch);
                     if(instr_index < part[0].size())
                     {
                         // assume error
@@ -434,7 +447,7 @@ namespace inasm64
                             return false;
                         }
 
-                        const auto setup_statement = [instructionRip](char type, Statement::operand& op, const TokenisedOperand& op_info) -> short {
+                        const auto setup_statement = [instructionRip, short_branch, &branch_target, &branch_address](char type, Statement::operand& op, const TokenisedOperand& op_info) -> short {
                             //NOTE: we can safely pass pointers to op_info fields around here, they'll never leave the scope of the parent function and it's descendants
                             short width_bits = 0;
                             switch(type)
@@ -467,10 +480,8 @@ namespace inasm64
                                         detail::set_error(Error::kInvalidAddress);
                                         return 0;
                                     }
-                                    unsigned long msb_index;
-                                    _BitScanReverse64(&msb_index, long_disp > 0 ? long_disp : -long_disp);
-                                    op._op._mem._disp_width_bits = char((msb_index + 8) & ~7);
-                                    if(op._op._mem._disp_width_bits > 32)
+                                    // NOTE: anything that doesn't fit in a *signed* 32 bit displacement, which includes addresses in [2^31, 2^32)
+                                    if(long_disp > INT32_MAX || long_disp < INT32_MIN)
                                     {
                                         // > 32 bit displacements need to be converted into RIP relative offsets
                                         // NOTE: we calculate the offset here, relative to the passed-in instruction IP, but
@@ -498,7 +509,11 @@ namespace inasm64
                                         //NOTE: we can use strtol here because the displacement can never be > 32 bits
                                         op._op._mem._displacement = int(long_disp);
                                     }
-                                    op._op._mem._disp_width_bits = 32;
+                                    // the shortest encoding, so that code is laid out as a real assembler would lay it out. RIP relative operands only have a 32 bit form,
+                                    // and are the ones re-patched when the code moves, and without a base register the SIB/ModRM forms need a 32 bit displacement too
+                                    const auto rip_relative = op._op._mem._base && _stricmp(op._op._mem._base, "rip") == 0;
+                                    const auto disp8 = op._op._mem._displacement >= INT8_MIN && op._op._mem._displacement <= INT8_MAX;
+                                    op._op._mem._disp_width_bits = op._op._mem._base && !rip_relative && disp8 ? 8 : 32;
                                 }
                                 else
                                 {
@@ -509,6 +524,29 @@ namespace inasm64
                                 width_bits = 32;
                             }
                             break;
+                            case Statement::kRel:
+                            {
+                                // the displacement is calculated once we know the size of the instruction, see below
+                                op._op._imm = 0;
+                                if(isalpha(op_info._reg_imm[0]))
+                                {
+                                    // label or line, resolved by the runtime
+                                    branch_target = op_info._reg_imm;
+                                }
+                                else
+                                {
+                                    if(!instructionRip)
+                                    {
+                                        detail::set_error(Error::kInvalidAddress);
+                                        return 0;
+                                    }
+                                    const auto imm_len = strlen(op_info._reg_imm);
+                                    const auto base = (op_info._reg_imm[imm_len - 1] != 'h') ? 0 : 16;
+                                    branch_address = ::strtoull(op_info._reg_imm, nullptr, base);
+                                }
+                                width_bits = short_branch ? 8 : 32;
+                            }
+                            break;
                             }
                             return width_bits;
                         };
@@ -524,6 +562,12 @@ namespace inasm64
                             if(!result)
                                 break;
                             statement._operands[p]._type = op_tokens[p]._reg_imm[0] ? (isalpha(op_tokens[p]._reg_imm[0]) ? Statement::kReg : Statement::kImm) : Statement::kMem;
+                            // anything but a register or memory operand to a relative branch is its target
+                            if(relative_branch && statement._operands[p]._type != Statement::kMem && !(statement._operands[p]._type == Statement::kReg && GetRegisterInfo(op_tokens[p]._reg_imm)))
+                            {
+                                statement._operands[p]._type = Statement::kRel;
+                                rel_op = p;
+                            }
                             // break down each operand, and aggregate and adjust the widths of each to match the overall statement (addressing width, operand widths)
                             statement._operands[p]._width_bits = std::max<short>(setup_statement(statement._operands[p]._type, statement._operands[p], op_tokens[p]), statement._operands[p]._width_bits);
                             if(GetError() != Error::kNoError)
@@ -574,8 +618,33 @@ namespace inasm64
                         // a simple fixup should never cause this to fail
                         assert(instr_len);
                     }
+                    if(rel_op >= 0 && !branch_target)
+                    {
+                        // branch displacements are relative to the next instruction
+                        const auto displacement = (long long)(branch_address) - (long long)(instructionRip + instr_len);
+                        const auto limit = 1ll << (statement._operands[rel_op]._width_bits - 1);
+                        if(displacement < -limit || displacement >= limit)
+                        {
+                            detail::set_error(Error::kBranchTargetOutOfRange);
+                            result = false;
+                        }
+                        else
+                        {
+                            statement._operands[rel_op]._op._imm = uint64_t(displacement);
+                            instr_len = driver::Assemble(statement, buffer, driver::MaxInstructionSize());
+                            assert(instr_len);
+                        }
+                    }
+                }
+                if(result)
+                {
                     memcpy(const_cast<uint8_t*>(info._instruction), buffer, instr_len);
                     const_cast<size_t&>(info._size) = instr_len;
+                    auto target = const_cast<char*>(info._branch_target);
+                    if(branch_target)
+                        strncpy_s(target, sizeof(info._branch_target), branch_target, _TRUNCATE);
+                    else
+                        target[0] = 0;
                 }
                 _freea(buffer);
             }
@@ -22,6 +22,8 @@ namespace inasm64
             const uint8_t _instruction[kMaxAssembledInstructionSize] = { 0 };
             // the number of instruction bytes
             const size_t _size = 0;
+            // for relative branches to a label, or a line (l<N>), the name of the target. The displacement is left as 0 and resolved by the runtime when the instruction is committed
+            const char _branch_target[32] = { 0 };
         };
 
         ///<summary>
@@ -33,6 +35,8 @@ namespace inasm64
         /// assemble a given, single line, input statement into x64 instruction bytes
         ///</summary>
         // NOTE: if instructionRip != 0 it will be used to generate a RIP relative address, iff the instruction requires it.
+        // Relative branches (jmp, jcc, loop, jrcxz, call) take either an absolute target address, which requires instructionRip, or a label/line name (see AssembledInstructionInfo::_branch_target).
+        // jmp, jcc and call are always encoded with 32 bit displacements so that they can be patched when the target is resolved.
         bool Assemble(const char* assembly, AssembledInstructionInfo& asm_info, uintptr_t instrutionRip);
     }  // namespace assembler
 }  // namespace inasm64
@@ -53,10 +53,12 @@ namespace inasm64
             static constexpr char kReg = 0;
             static constexpr char kImm = 1;
             static constexpr char kMem = 2;
+            // relative branch target, _op._imm holds the displacement
+            static constexpr char kRel = 3;
 
             struct operand
             {
-                // 0 = reg, 1 = imm, 2 = mem
+                // 0 = reg, 1 = imm, 2 = mem, 3 = relative branch
                 char _type;
                 short _width_bits;
 
@@ -0,0 +1,2007 @@
+// MIT License
+// Copyright 2019 Jarl Ostensen
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+// ===================================================================================================================
+// Native timing harnesses, built around the committed code and executed in the runtime process (see runtime::ExecuteHarness)
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <intrin.h>
+#include <vector>
+#include <initializer_list>
+#include <algorithm>
+#include <random>
+#include <cstring>
+#include <cstddef>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "common.h"
+#include "x64.h"
+#include "runtime.h"
+#include "benchmark.h"
+
+namespace inasm64
+{
+    namespace benchmark
+    {
+        namespace
+        {
+            // the harness data, at the start of the harness area's data page
+            constexpr size_t kCounterOffset = 0;
+            constexpr size_t kStartOffset = 8;
+            constexpr size_t kEndOffset = 16;
+            // rax, rcx, and rdx while rdtsc(p) uses them
+            constexpr size_t kSavedOffset = 24;
+            // bandwidth harness: threads that have arrived at the start, and that have finished
+            constexpr size_t kReadyOffset = 48;
+            constexpr size_t kDoneOffset = 56;
+            // verify and litmus harnesses: set to make the runtime thread give up waiting for the worker threads, they don't run a counted loop
+            constexpr size_t kAbortOffset = kCounterOffset;
+            // bandwidth harness: start and end timestamps of each thread
+            constexpr size_t kSlotsOffset = 64;
+
+            constexpr uint8_t kRax = 0;
+            constexpr uint8_t kRcx = 1;
+            constexpr uint8_t kRdx = 2;
+
+            struct harness_t
+            {
+                uintptr_t _entry = 0;
+                // the int3 it ends on
+                uintptr_t _exit = 0;
+                // where the main code is in a timed loop, and the end of it
+                uintptr_t _body = 0;
+                uintptr_t _body_end = 0;
+            };
+
+            // assembles harness code at a given address
+            struct code_builder_t
+            {
+                uintptr_t _address = 0;
+                std::vector<uint8_t> _code;
+
+                uintptr_t next() const
+                {
+                    return _address + _code.size();
+                }
+
+                void emit(std::initializer_list<uint8_t> bytes)
+                {
+                    _code.insert(_code.end(), bytes);
+                }
+
+                void emit_rel32(uintptr_t target)
+                {
+                    const auto rel32 = int32_t((long long)(target) - (long long)(next() + 4));
+                    emit_imm(uint64_t(rel32), 4);
+                }
+
+                // little endian, size bytes
+                void emit_imm(uint64_t value, size_t size)
+                {
+                    const auto bytes = reinterpret_cast<const uint8_t*>(&value);
+                    _code.insert(_code.end(), bytes, bytes + size);
+                }
+
+                // opcode followed by a [rip + disp32] ModRM with reg. The harness area and its data are in the same reservation, so disp32 always reaches.
+                // If the instruction has an immediate operand its size must be given, since disp32 is relative to the end of the instruction, and the caller emits it
+                void emit_rip_relative(std::initializer_list<uint8_t> opcode, uint8_t reg, uintptr_t target, size_t immediateSize = 0)
+                {
+                    emit(opcode);
+                    _code.push_back(uint8_t(0x05 | (reg << 3)));
+                    emit_rel32(target - immediateSize);
+                }
+
+                // pause, cmp qword [rip + counter], count, jb until it has been reached
+                void spin_until(uintptr_t counter, uint8_t count)
+                {
+                    const auto top = next();
+                    emit({ 0xf3, 0x90 });
+                    emit_rip_relative({ 0x48, 0x83 }, 7, counter, 1);
+                    emit({ count });
+                    emit({ 0x0f, 0x82 });
+                    emit_rel32(top);
+                }
+
+                void save(uint8_t reg, uintptr_t data)
+                {
+                    // mov [rip + saved], reg
+                    emit_rip_relative({ 0x48, 0x89 }, reg, data + kSavedOffset + reg * 8);
+                }
+
+                void restore(uint8_t reg, uintptr_t data)
+                {
+                    // mov reg, [rip + saved]
+                    emit_rip_relative({ 0x48, 0x8b }, reg, data + kSavedOffset + reg * 8);
+                }
+
+                // edx:eax to [rip + at]
+                void store_timestamp(uintptr_t at)
+                {
+                    emit_rip_relative({ 0x89 }, kRax, at);
+                    emit_rip_relative({ 0x89 }, kRdx, at + 4);
+                }
+
+                // opcode with a [rax + disp32] ModRM for reg, which can be r8-r15 or xmm8-xmm15. A mandatory prefix (i.e. f3) goes before the REX prefix
+                void emit_rax_relative(uint8_t prefix, bool wide, std::initializer_list<uint8_t> opcode, uint8_t reg, size_t disp)
+                {
+                    if(prefix)
+                        _code.push_back(prefix);
+                    const auto rex = uint8_t(0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0));
+                    if(rex != 0x40)
+                        _code.push_back(rex);
+                    emit(opcode);
+                    _code.push_back(uint8_t(0x80 | ((reg & 7) << 3)));
+                    emit_imm(disp, 4);
+                }
+
+                void align(size_t alignment)
+                {
+                    while(next() & (alignment - 1))
+                        _code.push_back(0xcc);
+                }
+            };
+
+            // the start of a timed loop, up to the top of the loop where its body goes
+            uintptr_t begin_timed_loop(code_builder_t& builder, uintptr_t data, harness_t& harness)
+            {
+                builder.align(64);
+                harness._entry = builder.next();
+                builder.save(kRax, data);
+                builder.save(kRdx, data);
+                // lfence, rdtsc
+                builder.emit({ 0x0f, 0xae, 0xe8, 0x0f, 0x31 });
+                builder.store_timestamp(data + kStartOffset);
+                builder.restore(kRax, data);
+                builder.restore(kRdx, data);
+                harness._body = builder.next();
+                return harness._body;
+            }
+
+            // the end of a timed loop, following its body
+            void end_timed_loop(code_builder_t& builder, uintptr_t data, harness_t& harness)
+            {
+                harness._body_end = builder.next();
+                // dec qword [rip + counter], jnz top
+                builder.emit_rip_relative({ 0x48, 0xff }, 1, data + kCounterOffset);
+                builder.emit({ 0x0f, 0x85 });
+                builder.emit_rel32(harness._body);
+
+                builder.save(kRax, data);
+                builder.save(kRcx, data);
+                builder.save(kRdx, data);
+                // rdtscp, lfence
+                builder.emit({ 0x0f, 0x01, 0xf9, 0x0f, 0xae, 0xe8 });
+                builder.store_timestamp(data + kEndOffset);
+                builder.restore(kRax, data);
+                builder.restore(kRcx, data);
+                builder.restore(kRdx, data);
+                harness._exit = builder.next();
+                builder.emit({ 0xcc });
+            }
+
+            // a loop around the main code, or around nothing if body is false, timed with rdtsc and rdtscp.
+            // The registers rdtsc(p) clobber are saved to, and restored from, the data page so the main code sees its own values
+            bool build_timed_loop(code_builder_t& builder, uintptr_t data, bool body, harness_t& harness)
+            {
+                const auto top = begin_timed_loop(builder, data, harness);
+                if(body)
+                {
+                    std::vector<uint8_t> code;
+                    if(!runtime::RelocatedMainCode(top, code))
+                        return false;
+                    builder._code.insert(builder._code.end(), code.begin(), code.end());
+                }
+                end_timed_loop(builder, data, harness);
+                return true;
+            }
+
+            // call the co-runner forever
+            uintptr_t build_co_runner(code_builder_t& builder, uintptr_t coRunner)
+            {
+                builder.align(64);
+                const auto entry = builder.next();
+                // call co-runner, jmp entry
+                builder.emit({ 0xe8 });
+                builder.emit_rel32(coRunner);
+                builder.emit({ 0xe9 });
+                builder.emit_rel32(entry);
+                return entry;
+            }
+
+            // a thread's part of the bandwidth harness
+            struct slice_t
+            {
+                uintptr_t _begin = 0;
+                uintptr_t _end = 0;
+            };
+
+            // the streaming loop around the main code, shared by all threads and called from each thread's entry with
+            // [rsp + 8] passes, [rsp + 16] the slice begin, [rsp + 24] the thread's timestamp slot, and rdi the slice end.
+            // The threads wait for each other before starting the clock, so their start times are as close together as the scheduler allows
+            bool build_streaming_loop(code_builder_t& builder, uintptr_t data, uint8_t threads, size_t stride, uintptr_t& loop)
+            {
+                builder.align(64);
+                loop = builder.next();
+                // lock inc qword [rip + ready]
+                builder.emit_rip_relative({ 0xf0, 0x48, 0xff }, 0, data + kReadyOffset);
+                builder.spin_until(data + kReadyOffset, threads);
+                // mov r8, [rsp + 24], lfence, rdtsc, mov [r8], eax, mov [r8 + 4], edx
+                builder.emit({ 0x4c, 0x8b, 0x44, 0x24, 0x18, 0x0f, 0xae, 0xe8, 0x0f, 0x31, 0x41, 0x89, 0x00, 0x41, 0x89, 0x50, 0x04 });
+
+                const auto pass = builder.next();
+                // mov rsi, [rsp + 16]
+                builder.emit({ 0x48, 0x8b, 0x74, 0x24, 0x10 });
+                const auto top = builder.next();
+                std::vector<uint8_t> code;
+                if(!runtime::RelocatedMainCode(top, code))
+                    return false;
+                builder._code.insert(builder._code.end(), code.begin(), code.end());
+                // add rsi, stride, cmp rsi, rdi, jb top
+                builder.emit({ 0x48, 0x81, 0xc6 });
+                builder.emit_imm(stride, 4);
+                builder.emit({ 0x48, 0x39, 0xfe, 0x0f, 0x82 });
+                builder.emit_rel32(top);
+                // dec qword [rsp + 8], jnz pass
+                builder.emit({ 0x48, 0xff, 0x4c, 0x24, 0x08, 0x0f, 0x85 });
+                builder.emit_rel32(pass);
+
+                // rdtscp, lfence, mov r8, [rsp + 24] (the main code may have used it), mov [r8 + 8], eax, mov [r8 + 12], edx
+                builder.emit({ 0x0f, 0x01, 0xf9, 0x0f, 0xae, 0xe8, 0x4c, 0x8b, 0x44, 0x24, 0x18, 0x41, 0x89, 0x40, 0x08, 0x41, 0x89, 0x50, 0x0c });
+                // lock inc qword [rip + done], ret
+                builder.emit_rip_relative({ 0xf0, 0x48, 0xff }, 0, data + kDoneOffset);
+                builder.emit({ 0xc3 });
+                return true;
+            }
+
+            // an entry for each thread that calls the streaming loop for its slice. The first is run by the runtime thread and waits for the others
+            // before ending on an int3, the others spin once done until they are terminated
+            void build_thread_entries(code_builder_t& builder, uintptr_t data, uintptr_t loop, const std::vector<slice_t>& slices, unsigned passes, std::vector<uintptr_t>& entries, uintptr_t& exit)
+            {
+                entries.clear();
+                for(size_t n = 0; n < slices.size(); ++n)
+                {
+                    builder.align(16);
+                    entries.push_back(builder.next());
+                    // mov rax, slot, push rax, mov rax, begin, push rax, mov rax, passes, push rax, mov rdi, end
+                    builder.emit({ 0x48, 0xb8 });
+                    builder.emit_imm(data + kSlotsOffset + n * 16, 8);
+                    builder.emit({ 0x50, 0x48, 0xb8 });
+                    builder.emit_imm(slices[n]._begin, 8);
+                    builder.emit({ 0x50, 0x48, 0xb8 });
+                    builder.emit_imm(passes, 8);
+                    builder.emit({ 0x50, 0x48, 0xbf });
+                    builder.emit_imm(slices[n]._end, 8);
+                    // call loop, add rsp, 24
+                    builder.emit({ 0xe8 });
+                    builder.emit_rel32(loop);
+                    builder.emit({ 0x48, 0x83, 0xc4, 0x18 });
+                    if(n)
+                    {
+                        // pause, jmp pause
+                        builder.emit({ 0xf3, 0x90, 0xeb, 0xfc });
+                    }
+                    else
+                    {
+                        builder.spin_until(data + kDoneOffset, uint8_t(slices.size()));
+                        exit = builder.next();
+                        builder.emit({ 0xcc });
+                    }
+                }
+            }
+
+            // run the bandwidth harness once, with the extra threads created in the runtime process before the runtime thread joins them.
+            // If affinities are given, the thread for entries[n] is pinned to affinities[n - 1]
+            bool run_threads(void* process, const std::vector<uintptr_t>& entries, uintptr_t data, uintptr_t exit, const std::vector<GROUP_AFFINITY>& affinities = {})
+            {
+                const uint64_t counters[2] = { 0 };
+                if(!runtime::WriteHarness(data + kReadyOffset, counters, sizeof(counters)))
+                    return false;
+                std::vector<HANDLE> threads;
+                auto created = true;
+                for(size_t n = 1; created && n < entries.size(); ++n)
+                {
+                    const auto thread = CreateRemoteThread(HANDLE(process), nullptr, 0, LPTHREAD_START_ROUTINE(entries[n]), nullptr, CREATE_SUSPENDED, nullptr);
+                    if(thread)
+                        threads.push_back(thread);
+                    created = thread != nullptr && (affinities.empty() || SetThreadGroupAffinity(thread, &affinities[n - 1], nullptr));
+                }
+                // none of them may start unless all of them can, or the ones that did would wait for the rest forever
+                for(auto thread : threads)
+                    created = created && ResumeThread(thread) != DWORD(-1);
+                auto result = false;
+                if(created)
+                    result = runtime::ExecuteHarness(entries[0], exit);
+                else
+                    detail::set_error(Error::kSystemError);
+                for(auto thread : threads)
+                {
+                    TerminateThread(thread, 0);
+                    CloseHandle(thread);
+                }
+                return result;
+            }
+
+            // run_threads for a harness whose runtime thread waits in a coordinator (see build_coordinator), which is told to give up after the timeout
+            // in case a block doesn't terminate. Fails with Error::kIterationLimitReached unless all the worker threads finished
+            bool run_workers(void* process, const std::vector<uintptr_t>& entries, uintptr_t data, uintptr_t exit, unsigned timeoutMs, const std::vector<GROUP_AFFINITY>& affinities = {})
+            {
+                uint64_t abort = 0;
+                if(!runtime::WriteHarness(data + kAbortOffset, &abort, sizeof(abort)))
+                    return false;
+                const auto finished = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+                std::thread watchdog([finished, data, timeoutMs]() {
+                    if(WaitForSingleObject(finished, timeoutMs) == WAIT_TIMEOUT)
+                    {
+                        const uint64_t abort = 1;
+                        runtime::WriteHarness(data + kAbortOffset, &abort, sizeof(abort));
+                    }
+                });
+                auto ran = run_threads(process, entries, data, exit, affinities);
+                SetEvent(finished);
+                watchdog.join();
+                CloseHandle(finished);
+                uint64_t done = 0;
+                if(ran && (!runtime::ReadHarness(data + kDoneOffset, &done, sizeof(done)) || done < entries.size() - 1))
+                {
+                    detail::set_error(Error::kIterationLimitReached);
+                    ran = false;
+                }
+                return ran;
+            }
+
+            // the runtime thread's entry for a harness with worker threads, waiting until they are all done or it is told to give up
+            void build_coordinator(code_builder_t& builder, uintptr_t data, size_t workers, uintptr_t& entry, uintptr_t& exit)
+            {
+                builder.align(16);
+                entry = builder.next();
+                // pause, cmp qword [rip + done], workers, jae exit (over the 8 byte cmp and 6 byte je), cmp qword [rip + abort], 0, je entry
+                builder.emit({ 0xf3, 0x90 });
+                builder.emit_rip_relative({ 0x48, 0x83 }, 7, data + kDoneOffset, 1);
+                builder.emit({ uint8_t(workers), 0x73, 0x0e });
+                builder.emit_rip_relative({ 0x48, 0x83 }, 7, data + kAbortOffset, 1);
+                builder.emit({ 0x00, 0x0f, 0x84 });
+                builder.emit_rel32(entry);
+                exit = builder.next();
+                builder.emit({ 0xcc });
+            }
+
+            // the parts of a verify trial record, see build_trial_loop
+            constexpr size_t kStateSize = sizeof(register_state_t);
+            constexpr size_t kFlagsOffset = offsetof(register_state_t, _rflags);
+            constexpr size_t kXmmOffset = offsetof(register_state_t, _xmm);
+            constexpr uint8_t kRsp = 4;
+            constexpr unsigned kMaxVerifyThreads = 64;
+            // the general purpose registers in encoding order, i.e. as register_state_t has them
+            const RegisterInfo::Register kGprs[16] = { RegisterInfo::Register::rax, RegisterInfo::Register::rcx, RegisterInfo::Register::rdx, RegisterInfo::Register::rbx,
+                RegisterInfo::Register::rsp, RegisterInfo::Register::rbp, RegisterInfo::Register::rsi, RegisterInfo::Register::rdi, RegisterInfo::Register::r8, RegisterInfo::Register::r9,
+                RegisterInfo::Register::r10, RegisterInfo::Register::r11, RegisterInfo::Register::r12, RegisterInfo::Register::r13, RegisterInfo::Register::r14, RegisterInfo::Register::r15 };
+            // the flags an instruction can change, the rest are left as they were (and DF must be clear)
+            constexpr uint64_t kArithmeticFlags = 0x8d5;
+            static_assert(kStateSize == 400, "the verify harness loads and stores register_state_t as is");
+
+            // a trial record is the input registers, the output registers of the reference and the candidate, then the buffer images in the same order.
+            // An image is all the buffers back to back, laid out like the thread's own copy of them
+            struct trial_layout_t
+            {
+                size_t _image = 0;
+                size_t _record = 0;
+
+                size_t state(unsigned which) const
+                {
+                    return which * kStateSize;
+                }
+                size_t image(unsigned which) const
+                {
+                    return 3 * kStateSize + which * _image;
+                }
+            };
+
+            // the trial loop shared by all worker threads, called with [rsp + 8] the first trial record, [rsp + 16] the number of trials, and [rsp + 24] the thread's copy of the buffers.
+            // For each block of each trial the input image is copied to the buffers and the input registers loaded, the block is called,
+            // and the registers stored and the buffers copied out again
+            void build_trial_loop(code_builder_t& builder, uintptr_t data, const trial_layout_t& layout, const uintptr_t (&blocks)[2], uintptr_t& loop)
+            {
+                builder.align(64);
+                loop = builder.next();
+                const auto top = builder.next();
+                for(unsigned block = 0; block < 2; ++block)
+                {
+                    const auto out = layout.state(block + 1);
+                    // mov rax, [rsp + 8]
+                    builder.emit({ 0x48, 0x8b, 0x44, 0x24, 0x08 });
+                    if(layout._image)
+                    {
+                        // lea rsi, [rax + input image], mov rdi, [rsp + 24], mov ecx, image size, rep movsb
+                        builder.emit_rax_relative(0, true, { 0x8d }, 6, layout.image(0));
+                        builder.emit({ 0x48, 0x8b, 0x7c, 0x24, 0x18, 0xb9 });
+                        builder.emit_imm(layout._image, 4);
+                        builder.emit({ 0xf3, 0xa4 });
+                    }
+                    // push qword [rax + flags], popfq
+                    builder.emit_rax_relative(0, false, { 0xff }, 6, kFlagsOffset);
+                    builder.emit({ 0x9d });
+                    for(uint8_t xmm = 0; xmm < 16; ++xmm)
+                    {
+                        // movdqu xmm, [rax + xmm offset]
+                        builder.emit_rax_relative(0xf3, false, { 0x0f, 0x6f }, xmm, kXmmOffset + xmm * 16);
+                    }
+                    for(uint8_t gpr = 1; gpr < 16; ++gpr)
+                    {
+                        // mov gpr, [rax + gpr offset]
+                        if(gpr != kRsp)
+                            builder.emit_rax_relative(0, true, { 0x8b }, gpr, gpr * 8);
+                    }
+                    // mov rax, [rax], call block
+                    builder.emit_rax_relative(0, true, { 0x8b }, kRax, 0);
+                    builder.emit({ 0xe8 });
+                    builder.emit_rel32(blocks[block]);
+
+                    // push rax, mov rax, [rsp + 16]
+                    builder.emit({ 0x50, 0x48, 0x8b, 0x44, 0x24, 0x10 });
+                    for(uint8_t gpr = 1; gpr < 16; ++gpr)
+                    {
+                        // mov [rax + out + gpr offset], gpr
+                        if(gpr != kRsp)
+                            builder.emit_rax_relative(0, true, { 0x89 }, gpr, out + gpr * 8);
+                    }
+                    for(uint8_t xmm = 0; xmm < 16; ++xmm)
+                    {
+                        // movdqu [rax + out + xmm offset], xmm
+                        builder.emit_rax_relative(0xf3, false, { 0x0f, 0x7f }, xmm, out + kXmmOffset + xmm * 16);
+                    }
+                    // pushfq, pop rcx, mov [rax + out + flags], rcx, pop rcx, mov [rax + out], rcx, cld
+                    builder.emit({ 0x9c, 0x59 });
+                    builder.emit_rax_relative(0, true, { 0x89 }, kRcx, out + kFlagsOffset);
+                    builder.emit({ 0x59 });
+                    builder.emit_rax_relative(0, true, { 0x89 }, kRcx, out);
+                    builder.emit({ 0xfc });
+                    if(layout._image)
+                    {
+                        // mov rsi, [rsp + 24], lea rdi, [rax + output image], mov ecx, image size, rep movsb
+                        builder.emit({ 0x48, 0x8b, 0x74, 0x24, 0x18 });
+                        builder.emit_rax_relative(0, true, { 0x8d }, 7, layout.image(block + 1));
+                        builder.emit({ 0xb9 });
+                        builder.emit_imm(layout._image, 4);
+                        builder.emit({ 0xf3, 0xa4 });
+                    }
+                }
+                // add qword [rsp + 8], record size, dec qword [rsp + 16], jnz top
+                builder.emit({ 0x48, 0x81, 0x44, 0x24, 0x08 });
+                builder.emit_imm(layout._record, 4);
+                builder.emit({ 0x48, 0xff, 0x4c, 0x24, 0x10, 0x0f, 0x85 });
+                builder.emit_rel32(top);
+                // lock inc qword [rip + done], ret
+                builder.emit_rip_relative({ 0xf0, 0x48, 0xff }, 0, data + kDoneOffset);
+                builder.emit({ 0xc3 });
+            }
+
+            // a worker thread's part of the verify harness
+            struct worker_t
+            {
+                uintptr_t _records = 0;
+                uint64_t _trials = 0;
+                uintptr_t _buffers = 0;
+            };
+
+            // the coordinator, followed by an entry for each worker that calls the trial loop.
+            // The stack is aligned so that the blocks are called with it aligned as any function would be, and workers spin once done until they are terminated
+            void build_verify_entries(code_builder_t& builder, uintptr_t data, uintptr_t loop, const std::vector<worker_t>& workers, std::vector<uintptr_t>& entries, uintptr_t& exit)
+            {
+                entries.assign(1, 0);
+                build_coordinator(builder, data, workers.size(), entries[0], exit);
+
+                for(const auto& worker : workers)
+                {
+                    builder.align(16);
+                    entries.push_back(builder.next());
+                    // and rsp, -16, mov rax, buffers, push rax, mov rax, trials, push rax, mov rax, records, push rax
+                    builder.emit({ 0x48, 0x83, 0xe4, 0xf0, 0x48, 0xb8 });
+                    builder.emit_imm(worker._buffers, 8);
+                    builder.emit({ 0x50, 0x48, 0xb8 });
+                    builder.emit_imm(worker._trials, 8);
+                    builder.emit({ 0x50, 0x48, 0xb8 });
+                    builder.emit_imm(worker._records, 8);
+                    // push rax, call loop, pause, jmp pause
+                    builder.emit({ 0x50, 0xe8 });
+                    builder.emit_rel32(loop);
+                    builder.emit({ 0xf3, 0x90, 0xeb, 0xfc });
+                }
+            }
+
+            // iterations per litmus batch, the outputs of a batch are read back and tallied before the next is run
+            constexpr uint64_t kLitmusBatch = 0x10000;
+
+            // a shared variable, copied back from a pristine copy before each litmus iteration
+            struct litmus_variable_t
+            {
+                uintptr_t _address = 0;
+                uintptr_t _pristine = 0;
+                size_t _size = 0;
+            };
+
+            // an entry for each litmus thread, after the coordinator, that calls its block once per iteration with the registers loaded from state
+            // and stores the outputs of each call to its results. The threads meet at two barriers on the ready counter before each call, the first
+            // thread puts the variables back in between. Each thread's frame is [rsp] the ready count of the next barrier, [rsp + 8] where the next
+            // outputs go, [rsp + 16] the iterations left, [rsp + 24] the ticks of the calls, [rsp + 32] the timestamp before the call,
+            // [rsp + 40] the start of the loop, and [rsp + 48] scratch. Its slot gets the ticks of the calls and of the whole loop once done
+            void build_litmus_entries(code_builder_t& builder, uintptr_t data, const std::vector<uintptr_t>& blocks, const std::vector<uintptr_t>& results, uint64_t iterations,
+                uintptr_t state, const std::vector<uint8_t>& outputs, const std::vector<litmus_variable_t>& variables, std::vector<uintptr_t>& entries, uintptr_t& exit)
+            {
+                entries.assign(1, 0);
+                build_coordinator(builder, data, blocks.size(), entries[0], exit);
+                // a block of 0 is an empty one, to time the calls themselves
+                const auto empty = builder.next();
+                builder.emit({ 0xc3 });
+                const auto threads = uint8_t(blocks.size());
+                // lfence, rdtsc, shl rdx, 32, or rax, rdx
+                const auto start_timestamp = [&builder]() { builder.emit({ 0x0f, 0xae, 0xe8, 0x0f, 0x31, 0x48, 0xc1, 0xe2, 0x20, 0x48, 0x09, 0xd0 }); };
+                // rdtscp, lfence, shl rdx, 32, or rax, rdx
+                const auto end_timestamp = [&builder]() { builder.emit({ 0x0f, 0x01, 0xf9, 0x0f, 0xae, 0xe8, 0x48, 0xc1, 0xe2, 0x20, 0x48, 0x09, 0xd0 }); };
+                const auto barrier = [&builder, data, threads]() {
+                    // add qword [rsp], threads, lock inc qword [rip + ready], mov rax, [rsp]
+                    builder.emit({ 0x48, 0x83, 0x04, 0x24, threads });
+                    builder.emit_rip_relative({ 0xf0, 0x48, 0xff }, 0, data + kReadyOffset);
+                    builder.emit({ 0x48, 0x8b, 0x04, 0x24 });
+                    // pause, cmp [rip + ready], rax, jb until everyone has arrived
+                    const auto wait = builder.next();
+                    builder.emit({ 0xf3, 0x90 });
+                    builder.emit_rip_relative({ 0x48, 0x39 }, kRax, data + kReadyOffset);
+                    builder.emit({ 0x0f, 0x82 });
+                    builder.emit_rel32(wait);
+                };
+
+                for(size_t n = 0; n < blocks.size(); ++n)
+                {
+                    builder.align(16);
+                    entries.push_back(builder.next());
+                    // and rsp, -16, sub rsp, 64, xor eax, eax, mov [rsp], rax, mov [rsp + 24], rax
+                    builder.emit({ 0x48, 0x83, 0xe4, 0xf0, 0x48, 0x83, 0xec, 0x40, 0x31, 0xc0, 0x48, 0x89, 0x04, 0x24, 0x48, 0x89, 0x44, 0x24, 0x18 });
+                    // mov rax, results, mov [rsp + 8], rax, mov rax, iterations, mov [rsp + 16], rax
+                    builder.emit({ 0x48, 0xb8 });
+                    builder.emit_imm(results[n], 8);
+                    builder.emit({ 0x48, 0x89, 0x44, 0x24, 0x08, 0x48, 0xb8 });
+                    builder.emit_imm(iterations, 8);
+                    builder.emit({ 0x48, 0x89, 0x44, 0x24, 0x10 });
+                    // mov [rsp + 40], timestamp
+                    start_timestamp();
+                    builder.emit({ 0x48, 0x89, 0x44, 0x24, 0x28 });
+
+                    const auto top = builder.next();
+                    // everyone is done with the previous iteration
+                    barrier();
+                    if(!n)
+                    {
+                        for(const auto& variable : variables)
+                        {
+                            // mov rsi, pristine, mov rdi, variable, mov ecx, size, rep movsb
+                            builder.emit({ 0x48, 0xbe });
+                            builder.emit_imm(variable._pristine, 8);
+                            builder.emit({ 0x48, 0xbf });
+                            builder.emit_imm(variable._address, 8);
+                            builder.emit({ 0xb9 });
+                            builder.emit_imm(variable._size, 4);
+                            builder.emit({ 0xf3, 0xa4 });
+                        }
+                    }
+                    // the variables are ready, and the lock inc has made them visible
+                    barrier();
+
+                    // mov [rsp + 32], timestamp, mov rax, state
+                    start_timestamp();
+                    builder.emit({ 0x48, 0x89, 0x44, 0x24, 0x20, 0x48, 0xb8 });
+                    builder.emit_imm(state, 8);
+                    for(uint8_t gpr = 1; gpr < 16; ++gpr)
+                    {
+                        // mov gpr, [rax + gpr offset]
+                        if(gpr != kRsp)
+                            builder.emit_rax_relative(0, true, { 0x8b }, gpr, gpr * 8);
+                    }
+                    // mov rax, [rax], call block
+                    builder.emit_rax_relative(0, true, { 0x8b }, kRax, 0);
+                    builder.emit({ 0xe8 });
+                    builder.emit_rel32(blocks[n] ? blocks[n] : empty);
+
+                    // mov [rsp + 48], rax, mov rax, [rsp + 8]
+                    builder.emit({ 0x48, 0x89, 0x44, 0x24, 0x30, 0x48, 0x8b, 0x44, 0x24, 0x08 });
+                    for(size_t output = 0; output < outputs.size(); ++output)
+                    {
+                        if(outputs[output] == kRax)
+                        {
+                            // push qword [rsp + 48], pop qword [rax + output offset]
+                            builder.emit({ 0xff, 0x74, 0x24, 0x30 });
+                            builder.emit_rax_relative(0, false, { 0x8f }, 0, output * 8);
+                        }
+                        else
+                        {
+                            // mov [rax + output offset], output
+                            builder.emit_rax_relative(0, true, { 0x89 }, outputs[output], output * 8);
+                        }
+                    }
+                    // add rax, outputs size, mov [rsp + 8], rax
+                    builder.emit({ 0x48, 0x83, 0xc0, uint8_t(outputs.size() * 8), 0x48, 0x89, 0x44, 0x24, 0x08 });
+                    // sub timestamp, [rsp + 32], add [rsp + 24], timestamp
+                    end_timestamp();
+                    builder.emit({ 0x48, 0x2b, 0x44, 0x24, 0x20, 0x48, 0x01, 0x44, 0x24, 0x18 });
+                    // dec qword [rsp + 16], jnz top
+                    builder.emit({ 0x48, 0xff, 0x4c, 0x24, 0x10, 0x0f, 0x85 });
+                    builder.emit_rel32(top);
+
+                    // sub timestamp, [rsp + 40], mov [rip + slot + 8], rax, mov rax, [rsp + 24], mov [rip + slot], rax
+                    end_timestamp();
+                    builder.emit({ 0x48, 0x2b, 0x44, 0x24, 0x28 });
+                    builder.emit_rip_relative({ 0x48, 0x89 }, kRax, data + kSlotsOffset + n * 16 + 8);
+                    builder.emit({ 0x48, 0x8b, 0x44, 0x24, 0x18 });
+                    builder.emit_rip_relative({ 0x48, 0x89 }, kRax, data + kSlotsOffset + n * 16);
+                    // lock inc qword [rip + done], pause, jmp pause
+                    builder.emit_rip_relative({ 0xf0, 0x48, 0xff }, 0, data + kDoneOffset);
+                    builder.emit({ 0xf3, 0x90, 0xeb, 0xfc });
+                }
+            }
+
+            // one logical processor on each of count physical cores, from the last core back to stay clear of processor 0
+            bool distinct_cores(size_t count, std::vector<GROUP_AFFINITY>& affinities)
+            {
+                DWORD length = 0;
+                GetLogicalProcessorInformationEx(RelationProcessorCore, nullptr, &length);
+                std::vector<uint8_t> buffer(length);
+                if(!length || !GetLogicalProcessorInformationEx(RelationProcessorCore, reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(buffer.data()), &length))
+                {
+                    detail::set_error(Error::kSystemError);
+                    return false;
+                }
+                std::vector<GROUP_AFFINITY> cores;
+                for(DWORD offset = 0; offset < length;)
+                {
+                    const auto info = reinterpret_cast<const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data() + offset);
+                    offset += info->Size;
+                    GROUP_AFFINITY core = { 0 };
+                    core.Group = info->Processor.GroupMask[0].Group;
+                    core.Mask = info->Processor.GroupMask[0].Mask & (~info->Processor.GroupMask[0].Mask + 1);
+                    cores.push_back(core);
+                }
+                if(cores.size() < count)
+                {
+                    detail::set_error(Error::kUnsupportedCpuFeature);
+                    return false;
+                }
+                affinities.assign(cores.rbegin(), cores.rbegin() + count);
+                return true;
+            }
+
+            // an input value with a good chance of being small or an edge case, which random 64 bit values almost never are
+            uint64_t random_input(std::mt19937_64& random)
+            {
+                static const uint64_t kEdges[] = { 0, 1, ~0ull, 0x8000000000000000ull, 0x7fffffffffffffffull, 0xffffffffull, 0x80000000ull };
+                switch(random() & 3)
+                {
+                case 0:
+                    return random() & 0xff;
+                case 1:
+                    return kEdges[random() % (sizeof(kEdges) / sizeof(kEdges[0]))];
+                default:
+                    return random();
+                }
+            }
+
+            // TSC ticks per second, calibrated once against the performance counter
+            double tsc_frequency()
+            {
+                static double frequency = 0;
+                if(frequency == 0)
+                {
+                    LARGE_INTEGER qpc_frequency, qpc_start, qpc_now;
+                    QueryPerformanceFrequency(&qpc_frequency);
+                    QueryPerformanceCounter(&qpc_start);
+                    const auto tsc_start = __rdtsc();
+                    // 50ms
+                    do
+                    {
+                        QueryPerformanceCounter(&qpc_now);
+                    } while(qpc_now.QuadPart - qpc_start.QuadPart < qpc_frequency.QuadPart / 20);
+                    const auto tsc_end = __rdtsc();
+                    frequency = double(tsc_end - tsc_start) * double(qpc_frequency.QuadPart) / double(qpc_now.QuadPart - qpc_start.QuadPart);
+                }
+                return frequency;
+            }
+
+            // the order a pointer chain visits its elements in, starting at element 0
+            std::vector<uint32_t> chain_order(size_t elements, size_t perPage, PageCrossing crossing)
+            {
+                // a fixed seed so that runs are repeatable
+                std::mt19937_64 random(0x696e61736d3634);
+                std::vector<uint32_t> order;
+                order.reserve(elements);
+                const auto pages = (elements + perPage - 1) / perPage;
+                std::vector<uint32_t> page_order(pages);
+                for(size_t page = 0; page < pages; ++page)
+                    page_order[page] = uint32_t(page);
+                switch(crossing)
+                {
+                case PageCrossing::kRandom:
+                    for(size_t element = 0; element < elements; ++element)
+                        order.push_back(uint32_t(element));
+                    std::shuffle(order.begin(), order.end(), random);
+                    break;
+                case PageCrossing::kWithinPage:
+                    std::shuffle(page_order.begin(), page_order.end(), random);
+                    for(auto page : page_order)
+                    {
+                        const auto first = order.size();
+                        for(auto element = page * perPage; element < (std::min)(elements, (page + 1) * perPage); ++element)
+                            order.push_back(uint32_t(element));
+                        std::shuffle(order.begin() + first, order.end(), random);
+                    }
+                    break;
+                case PageCrossing::kEveryLoad:
+                {
+                    // the same slot in every page, in random page order, then the next slot.
+                    // Each round starts on a different page than the one before ended on, and the last ends on a different page than the first
+                    // started on where the cycle wraps. Slot 0 goes last since every page has it, which leaves room for both with 3 pages or more,
+                    // with fewer a single page is the same page for every load and two only alternate when the second is full
+                    std::vector<uint32_t> slot_order(perPage);
+                    for(size_t slot = 0; slot < perPage; ++slot)
+                        slot_order[slot] = uint32_t(slot);
+                    std::shuffle(slot_order.begin(), slot_order.end(), random);
+                    std::swap(*std::find(slot_order.begin(), slot_order.end(), 0u), slot_order.back());
+                    std::vector<uint32_t> round;
+                    round.reserve(pages);
+                    for(auto slot : slot_order)
+                    {
+                        round.clear();
+                        for(auto page : page_order)
+                        {
+                            if(page * perPage + slot < elements)
+                                round.push_back(page);
+                        }
+                        std::shuffle(round.begin(), round.end(), random);
+                        if(!order.empty() && round.size() > 1)
+                        {
+                            // the pages in a round are distinct, so swapping with any other moves the repeat away
+                            const auto previous = uint32_t(order.back() / perPage);
+                            if(round.front() == previous)
+                                std::swap(round.front(), round.back());
+                            const auto first = uint32_t(order.front() / perPage);
+                            if(slot == slot_order.back() && round.back() == first)
+                            {
+                                if(round.size() > 2)
+                                    std::swap(round[1], round.back());
+                                else if(first != previous)
+                                    std::swap(round.front(), round.back());
+                            }
+                        }
+                        for(auto page : round)
+                            order.push_back(uint32_t(page * perPage + slot));
+                    }
+                }
+                break;
+                }
+                // it's a cycle, so it can start anywhere
+                std::rotate(order.begin(), std::find(order.begin(), order.end(), 0u), order.end());
+                return order;
+            }
+
+            // a chain of 16 dependent loads per iteration from the head of a pointer chain, timed with rdtsc and rdtscp
+            void build_pointer_chase(code_builder_t& builder, uintptr_t data, uintptr_t head, harness_t& harness)
+            {
+                builder.align(64);
+                harness._entry = builder.next();
+                // lfence, rdtsc
+                builder.emit({ 0x0f, 0xae, 0xe8, 0x0f, 0x31 });
+                builder.store_timestamp(data + kStartOffset);
+                // mov rax, head
+                builder.emit({ 0x48, 0xb8 });
+                builder.emit_imm(head, 8);
+                const auto top = builder.next();
+                for(auto load = 0; load < 16; ++load)
+                {
+                    // mov rax, [rax]
+                    builder.emit({ 0x48, 0x8b, 0x00 });
+                }
+                // dec qword [rip + counter], jnz top
+                builder.emit_rip_relative({ 0x48, 0xff }, 1, data + kCounterOffset);
+                builder.emit({ 0x0f, 0x85 });
+                builder.emit_rel32(top);
+                // rdtscp waits for the last load, lfence
+                builder.emit({ 0x0f, 0x01, 0xf9, 0x0f, 0xae, 0xe8 });
+                builder.store_timestamp(data + kEndOffset);
+                harness._exit = builder.next();
+                builder.emit({ 0xcc });
+            }
+
+            // op applied to [rax] for every line from begin to end
+            void emit_line_loop(code_builder_t& builder, uintptr_t begin, uintptr_t end, size_t lineSize, std::initializer_list<uint8_t> op)
+            {
+                // mov rax, begin, mov rcx, end
+                builder.emit({ 0x48, 0xb8 });
+                builder.emit_imm(begin, 8);
+                builder.emit({ 0x48, 0xb9 });
+                builder.emit_imm(end, 8);
+                const auto top = builder.next();
+                builder.emit(op);
+                // add rax, line size, cmp rax, rcx, jb top
+                builder.emit({ 0x48, 0x05 });
+                builder.emit_imm(lineSize, 4);
+                builder.emit({ 0x48, 0x39, 0xc8, 0x0f, 0x82 });
+                builder.emit_rel32(top);
+            }
+
+            // cache sizes the eviction buffers are based on
+            struct cache_levels_t
+            {
+                size_t _line_size = 64;
+                size_t _l1 = 0;
+                size_t _l2 = 0;
+            };
+
+            cache_levels_t cache_levels()
+            {
+                cache_levels_t levels;
+                CacheInfo caches[8];
+                const auto count = GetCacheInfo(caches, sizeof(caches) / sizeof(caches[0]));
+                for(size_t n = 0; n < count; ++n)
+                {
+                    if(caches[n]._type == CacheInfo::Type::kInstruction)
+                        continue;
+                    if(caches[n]._level == 1)
+                    {
+                        levels._l1 = caches[n]._size;
+                        levels._line_size = caches[n]._line_size;
+                    }
+                    else if(caches[n]._level == 2)
+                        levels._l2 = caches[n]._size;
+                }
+                return levels;
+            }
+
+            // puts each buffer in its cache state, from the outermost level in. Buffers for L3 are read and pushed out of L2 (and L1) by reading an eviction buffer
+            // twice the size of L2, then those for L2 are read and pushed out of L1 the same way, then the warm ones are read, and finally the cold ones flushed.
+            // The eviction buffer is at least twice the size of L2
+            void build_cache_prologue(code_builder_t& builder, const std::vector<runtime::buffer_cache_state_t>& buffers, const cache_levels_t& levels, uintptr_t eviction, harness_t& harness)
+            {
+                using CacheState = runtime::CacheState;
+                // mov rdx, [rax]
+                const std::initializer_list<uint8_t> read = { 0x48, 0x8b, 0x10 };
+                const auto read_buffers = [&](CacheState state) {
+                    for(const auto& buffer : buffers)
+                    {
+                        if(buffer._state == state)
+                            emit_line_loop(builder, uintptr_t(buffer._handle), uintptr_t(buffer._handle) + buffer._size, levels._line_size, read);
+                    }
+                };
+
+                builder.align(64);
+                harness._entry = builder.next();
+                read_buffers(CacheState::kL3);
+                emit_line_loop(builder, eviction, eviction + levels._l2 * 2, levels._line_size, read);
+                read_buffers(CacheState::kL2);
+                emit_line_loop(builder, eviction, eviction + levels._l1 * 2, levels._line_size, read);
+                read_buffers(CacheState::kWarm);
+                for(const auto& buffer : buffers)
+                {
+                    if(buffer._state != CacheState::kCold)
+                        continue;
+                    if(ExtendedCpuFeatureSupported(ExtendedCpuFeature::kClflushopt))
+                        emit_line_loop(builder, uintptr_t(buffer._handle), uintptr_t(buffer._handle) + buffer._size, levels._line_size, { 0x66, 0x0f, 0xae, 0x38 });
+                    else
+                        emit_line_loop(builder, uintptr_t(buffer._handle), uintptr_t(buffer._handle) + buffer._size, levels._line_size, { 0x0f, 0xae, 0x38 });
+                }
+                // mfence, clflushopt is only ordered by fences
+                builder.emit({ 0x0f, 0xae, 0xf0 });
+                harness._exit = builder.next();
+                builder.emit({ 0xcc });
+            }
+
+            // ticks per iteration over a number of runs of a timed loop, each run preceded by the prologue if there is one. One untimed run warms up the predictors first
+            bool time_runs(const harness_t& harness, const harness_t* prologue, uintptr_t data, uint64_t iterations, uint64_t runs, double& ticks)
+            {
+                uint64_t total = 0;
+                for(uint64_t run = 0; run <= runs; ++run)
+                {
+                    if(run && prologue && !runtime::ExecuteHarness(prologue->_entry, prologue->_exit))
+                        return false;
+                    if(!runtime::WriteHarness(data + kCounterOffset, &iterations, sizeof(iterations)) || !runtime::ExecuteHarness(harness._entry, harness._exit))
+                        return false;
+                    uint64_t start, end;
+                    if(!runtime::ReadHarness(data + kStartOffset, &start, sizeof(start)) || !runtime::ReadHarness(data + kEndOffset, &end, sizeof(end)))
+                        return false;
+                    if(run)
+                        total += end - start;
+                }
+                ticks = double(total) / double(iterations * runs);
+                return true;
+            }
+
+            // instruction pointers of a thread, sampled by suspending it every interval until stopped
+            struct sampler_t
+            {
+                HANDLE _thread = nullptr;
+                double _interval_ticks = 0;
+                std::atomic<bool> _stop{ false };
+                std::vector<uint64_t> _rips;
+
+                void operator()()
+                {
+                    alignas(16) CONTEXT ctx;
+                    auto next = double(__rdtsc());
+                    while(!_stop.load(std::memory_order_relaxed))
+                    {
+                        next += _interval_ticks;
+                        while(double(__rdtsc()) < next)
+                            _mm_pause();
+                        if(SuspendThread(_thread) == DWORD(-1))
+                            continue;
+                        ctx.ContextFlags = CONTEXT_CONTROL;
+                        if(GetThreadContext(_thread, &ctx))
+                            _rips.push_back(ctx.Rip);
+                        ResumeThread(_thread);
+                    }
+                }
+            };
+
+            // ticks per iteration of a timed loop. The loop is run twice and the second run is used, the first warms up caches and predictors
+            // (and gives a co-runner time to get going). Each run fails with Error::kIterationLimitReached if it takes longer than timeoutMs, unless that is 0
+            bool time_loop(const harness_t& harness, uintptr_t data, uint64_t iterations, double& ticks, unsigned timeoutMs = 0)
+            {
+                for(auto run = 0; run < 2; ++run)
+                {
+                    if(!runtime::WriteHarness(data + kCounterOffset, &iterations, sizeof(iterations)) || !runtime::ExecuteHarness(harness._entry, harness._exit, timeoutMs))
+                        return false;
+                }
+                uint64_t start, end;
+                if(!runtime::ReadHarness(data + kStartOffset, &start, sizeof(start)) || !runtime::ReadHarness(data + kEndOffset, &end, sizeof(end)))
+                    return false;
+                ticks = double(end - start) / double(iterations);
+                return true;
+            }
+        }  // namespace
+
+        bool FindSmtSiblings(smt_pair_t& pair)
+        {
+            DWORD length = 0;
+            GetLogicalProcessorInformationEx(RelationProcessorCore, nullptr, &length);
+            std::vector<uint8_t> buffer(length);
+            if(!length || !GetLogicalProcessorInformationEx(RelationProcessorCore, reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(buffer.data()), &length))
+            {
+                detail::set_error(Error::kSystemError);
+                return false;
+            }
+            auto found = false;
+            for(DWORD offset = 0; offset < length;)
+            {
+                const auto info = reinterpret_cast<const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data() + offset);
+                offset += info->Size;
+                auto mask = uint64_t(info->Processor.GroupMask[0].Mask);
+                if(!(info->Processor.Flags & LTP_PC_SMT) || __popcnt64(mask) < 2)
+                    continue;
+                unsigned long primary, sibling;
+                _BitScanForward64(&primary, mask);
+                mask &= mask - 1;
+                _BitScanForward64(&sibling, mask);
+                pair._group = info->Processor.GroupMask[0].Group;
+                pair._primary = uint8_t(primary);
+                pair._sibling = uint8_t(sibling);
+                found = true;
+            }
+            if(!found)
+                detail::set_error(Error::kUnsupportedCpuFeature);
+            return found;
+        }
+
+        bool MeasureInterference(const char* coRunner, uint64_t iterations, interference_t& result)
+        {
+            if(!iterations)
+            {
+                detail::set_error(Error::kInvalidCommandFormat);
+                return false;
+            }
+            uintptr_t co_runner;
+            void* process;
+            void* thread;
+            smt_pair_t pair;
+            runtime::harness_area_t area;
+            if(!runtime::LabelAddress(coRunner, co_runner) || !runtime::RuntimeProcess(process, thread) || !FindSmtSiblings(pair) || !runtime::HarnessArea(0, area))
+                return false;
+
+            // the harness is built in place at the start of the area, which doesn't move as long as the code doesn't
+            code_builder_t builder;
+            builder._address = area._code;
+            harness_t empty, body;
+            if(!build_timed_loop(builder, area._data, false, empty) || !build_timed_loop(builder, area._data, true, body))
+                return false;
+            const auto co_entry = build_co_runner(builder, co_runner);
+            if(!runtime::HarnessArea(builder._code.size(), area) || area._code != builder._address || !runtime::WriteHarness(area._code, builder._code.data(), builder._code.size()))
+                return false;
+
+            GROUP_AFFINITY primary = { 0 };
+            primary.Group = pair._group;
+            primary.Mask = KAFFINITY(1) << pair._primary;
+            GROUP_AFFINITY previous = { 0 };
+            if(!SetThreadGroupAffinity(HANDLE(thread), &primary, &previous))
+            {
+                detail::set_error(Error::kSystemError);
+                return false;
+            }
+
+            result = {};
+            result._iterations = iterations;
+            result._pair = pair;
+            double alone = 0, shared = 0;
+            auto measured = time_loop(empty, area._data, iterations, result._overhead) && time_loop(body, area._data, iterations, alone);
+            if(measured)
+            {
+                // the co-runner only starts running once the harness lets the runtime process go
+                const auto co_thread = CreateRemoteThread(HANDLE(process), nullptr, 0, LPTHREAD_START_ROUTINE(co_entry), nullptr, CREATE_SUSPENDED, nullptr);
+                GROUP_AFFINITY sibling = { 0 };
+                sibling.Group = pair._group;
+                sibling.Mask = KAFFINITY(1) << pair._sibling;
+                if(co_thread && SetThreadGroupAffinity(co_thread, &sibling, nullptr) && ResumeThread(co_thread) != DWORD(-1))
+                {
+                    measured = time_loop(body, area._data, iterations, shared);
+                }
+                else
+                {
+                    detail::set_error(Error::kSystemError);
+                    measured = false;
+                }
+                if(co_thread)
+                {
+                    TerminateThread(co_thread, 0);
+                    CloseHandle(co_thread);
+                }
+            }
+            SetThreadGroupAffinity(HANDLE(thread), &previous, nullptr);
+            if(!measured)
+                return false;
+
+            result._alone = alone > result._overhead ? alone - result._overhead : 0;
+            result._shared = shared > result._overhead ? shared - result._overhead : 0;
+            return true;
+        }
+
+        bool MeasureCores(uint64_t iterations, core_timings_t& result)
+        {
+            if(!iterations)
+            {
+                detail::set_error(Error::kInvalidCommandFormat);
+                return false;
+            }
+            void* process;
+            void* thread;
+            runtime::harness_area_t area;
+            if(!runtime::RuntimeProcess(process, thread) || !runtime::HarnessArea(0, area))
+                return false;
+
+            DWORD length = 0;
+            GetLogicalProcessorInformationEx(RelationProcessorCore, nullptr, &length);
+            std::vector<uint8_t> buffer(length);
+            if(!length || !GetLogicalProcessorInformationEx(RelationProcessorCore, reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(buffer.data()), &length))
+            {
+                detail::set_error(Error::kSystemError);
+                return false;
+            }
+            result = {};
+            result._iterations = iterations;
+            for(DWORD offset = 0; offset < length;)
+            {
+                const auto info = reinterpret_cast<const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data() + offset);
+                offset += info->Size;
+                for(auto mask = uint64_t(info->Processor.GroupMask[0].Mask); mask; mask &= mask - 1)
+                {
+                    unsigned long processor;
+                    _BitScanForward64(&processor, mask);
+                    core_timing_t timing;
+                    timing._group = info->Processor.GroupMask[0].Group;
+                    timing._processor = uint8_t(processor);
+                    timing._efficiency_class = info->Processor.EfficiencyClass;
+                    result._processors.push_back(timing);
+                }
+            }
+            std::sort(result._processors.begin(), result._processors.end(), [](const core_timing_t& a, const core_timing_t& b) {
+                return a._group != b._group ? a._group < b._group : a._processor < b._processor;
+            });
+
+            code_builder_t builder;
+            builder._address = area._code;
+            harness_t empty, body;
+            if(!build_timed_loop(builder, area._data, false, empty) || !build_timed_loop(builder, area._data, true, body))
+                return false;
+            if(!runtime::HarnessArea(builder._code.size(), area) || area._code != builder._address || !runtime::WriteHarness(area._code, builder._code.data(), builder._code.size()))
+                return false;
+
+            GROUP_AFFINITY previous = { 0 };
+            GROUP_AFFINITY previous_host = { 0 };
+            if(!GetThreadGroupAffinity(HANDLE(thread), &previous) || !GetThreadGroupAffinity(GetCurrentThread(), &previous_host))
+            {
+                detail::set_error(Error::kSystemError);
+                return false;
+            }
+            auto measured = true;
+            for(auto& timing : result._processors)
+            {
+                GROUP_AFFINITY affinity = { 0 };
+                affinity.Group = timing._group;
+                affinity.Mask = KAFFINITY(1) << timing._processor;
+                // CPUID describes the processor it executes on, so the topology is read from this thread while it is pinned there
+                if(!SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) || !SetThreadGroupAffinity(HANDLE(thread), &affinity, nullptr))
+                {
+                    detail::set_error(Error::kSystemError);
+                    measured = false;
+                    break;
+                }
+                GetCoreInfo(timing._core);
+                double overhead = 0, ticks = 0;
+                if(!time_loop(empty, area._data, iterations, overhead) || !time_loop(body, area._data, iterations, ticks))
+                {
+                    measured = false;
+                    break;
+                }
+                timing._ticks = ticks > overhead ? ticks - overhead : 0;
+            }
+            SetThreadGroupAffinity(GetCurrentThread(), &previous_host, nullptr);
+            SetThreadGroupAffinity(HANDLE(thread), &previous, nullptr);
+            if(!measured)
+                return false;
+
+            // the CPUID core type is only reported by hybrid parts, if it is missing the OS's efficiency class is the best guess at the kind of core
+            for(const auto& timing : result._processors)
+            {
+                auto group = std::find_if(result._groups.begin(), result._groups.end(), [&timing](const core_group_t& group) {
+                    return timing._core._type != CoreInfo::Type::kUnknown ? group._type == timing._core._type : group._efficiency_class == timing._efficiency_class;
+                });
+                if(group == result._groups.end())
+                {
+                    core_group_t new_group;
+                    new_group._type = timing._core._type;
+                    new_group._efficiency_class = timing._efficiency_class;
+                    new_group._min = new_group._max = timing._ticks;
+                    result._groups.push_back(new_group);
+                    group = result._groups.end() - 1;
+                }
+                ++group->_processors;
+                group->_mean += timing._ticks;
+                group->_min = (std::min)(group->_min, timing._ticks);
+                group->_max = (std::max)(group->_max, timing._ticks);
+            }
+            for(auto& group : result._groups)
+                group._mean /= double(group._processors);
+            std::sort(result._groups.begin(), result._groups.end(), [](const core_group_t& a, const core_group_t& b) { return a._mean < b._mean; });
+            return true;
+        }
+
+        bool MeasureBandwidth(const void* buffer, const bandwidth_options_t& options, std::vector<bandwidth_t>& results)
+        {
+            results.clear();
+            // the stride is an imm32 of add rsi, stride
+            if(!options._stride || options._stride > 0x7fffffff || !options._passes)
+            {
+                detail::set_error(Error::kInvalidCommandFormat);
+                return false;
+            }
+            const auto allocated = runtime::AllocationSize(buffer);
+            const auto size = options._size ? options._size : allocated;
+            if(!allocated || size > allocated)
+            {
+                detail::set_error(Error::kInvalidAddress);
+                return false;
+            }
+            auto max_threads = options._max_threads ? options._max_threads : unsigned(GetActiveProcessorCount(ALL_PROCESSOR_GROUPS));
+            if(max_threads > kMaxBandwidthThreads)
+                max_threads = kMaxBandwidthThreads;
+
+            void* process;
+            void* thread;
+            runtime::harness_area_t area;
+            if(!runtime::RuntimeProcess(process, thread) || !runtime::HarnessArea(0, area))
+                return false;
+
+            for(unsigned threads = 1; threads <= max_threads; ++threads)
+            {
+                const auto slice_size = (size / threads) / options._stride * options._stride;
+                if(!slice_size)
+                {
+                    if(threads == 1)
+                    {
+                        detail::set_error(Error::kInvalidCommandFormat);
+                        return false;
+                    }
+                    // the slices can't get any smaller
+                    break;
+                }
+                std::vector<slice_t> slices(threads);
+                for(unsigned n = 0; n < threads; ++n)
+                {
+                    slices[n]._begin = uintptr_t(buffer) + n * slice_size;
+                    slices[n]._end = slices[n]._begin + slice_size;
+                }
+
+                code_builder_t builder;
+                builder._address = area._code;
+                uintptr_t loop;
+                uintptr_t exit = 0;
+                std::vector<uintptr_t> entries;
+                if(!build_streaming_loop(builder, area._data, uint8_t(threads), options._stride, loop))
+                    return false;
+                build_thread_entries(builder, area._data, loop, slices, options._passes, entries, exit);
+                if(!runtime::HarnessArea(builder._code.size(), area) || area._code != builder._address || !runtime::WriteHarness(area._code, builder._code.data(), builder._code.size()))
+                    return false;
+
+                // the first run warms up the caches, TLBs, and predictors
+                for(auto run = 0; run < 2; ++run)
+                {
+                    if(!run_threads(process, entries, area._data, exit))
+                        return false;
+                }
+                std::vector<uint64_t> slots(threads * 2);
+                if(!runtime::ReadHarness(area._data + kSlotsOffset, slots.data(), slots.size() * sizeof(uint64_t)))
+                    return false;
+                auto start = slots[0];
+                auto end = slots[1];
+                for(unsigned n = 1; n < threads; ++n)
+                {
+                    start = (std::min)(start, slots[n * 2]);
+                    end = (std::max)(end, slots[n * 2 + 1]);
+                }
+
+                bandwidth_t result;
+                result._threads = threads;
+                result._bytes = uint64_t(slice_size) * threads * options._passes;
+                result._ticks = end - start;
+                if(result._ticks)
+                    result._gb_per_second = double(result._bytes) * tsc_frequency() / double(result._ticks) / 1e9;
+                results.push_back(result);
+            }
+            return true;
+        }
+
+        bool BuildPointerChain(const void* buffer, size_t size, size_t stride, PageCrossing crossing)
+        {
+            runtime::allocation_info_t info;
+            if(!runtime::QueryAllocation(buffer, info))
+                return false;
+            const auto elements = stride ? size / stride : 0;
+            if(!stride || (stride & 7) || elements < 2 || elements > UINT32_MAX || size > info._size)
+            {
+                detail::set_error(Error::kInvalidCommandFormat);
+                return false;
+            }
+            const auto per_page = stride < info._page_size ? info._page_size / stride : 1;
+
+            std::vector<uint32_t> next(elements);
+            {
+                const auto order = chain_order(elements, per_page, crossing);
+                for(size_t n = 0; n < elements; ++n)
+                    next[order[n]] = order[(n + 1) % elements];
+            }
+
+            // written a chunk at a time, chunks are a multiple of 8 so elements never straddle them
+            constexpr size_t kChunkSize = size_t(1) << 20;
+            std::vector<uint8_t> chunk;
+            const auto chain_size = elements * stride;
+            for(size_t offset = 0; offset < chain_size; offset += kChunkSize)
+            {
+                const auto length = (std::min)(kChunkSize, chain_size - offset);
+                chunk.assign(length, 0);
+                for(auto element = (offset + stride - 1) / stride; element * stride < offset + length; ++element)
+                {
+                    const auto address = uint64_t(uintptr_t(buffer) + next[element] * stride);
+                    memcpy(chunk.data() + element * stride - offset, &address, sizeof(address));
+                }
+                if(!runtime::WriteBytes(buffer, offset, chunk.data(), length))
+                    return false;
+            }
+            return true;
+        }
+
+        bool MeasureLatency(const latency_options_t& options, std::vector<latency_t>& results)
+        {
+            results.clear();
+            if(!options._min_size || options._min_size > options._max_size)
+            {
+                detail::set_error(Error::kInvalidCommandFormat);
+                return false;
+            }
+            runtime::harness_area_t area;
+            if(!runtime::HarnessArea(0, area))
+                return false;
+            const auto buffer = runtime::AllocateMemory(options._max_size, options._allocation);
+            if(!buffer)
+                return false;
+
+            // the chain always starts at the buffer, so one harness does for all sizes
+            code_builder_t builder;
+            builder._address = area._code;
+            harness_t chase;
+            build_pointer_chase(builder, area._data, uintptr_t(buffer), chase);
+            auto result = runtime::HarnessArea(builder._code.size(), area) && area._code == builder._address && runtime::WriteHarness(area._code, builder._code.data(), builder._code.size());
+
+            for(auto size = options._min_size; result && size <= options._max_size;)
+            {
+                result = BuildPointerChain(buffer, size, options._stride, options._crossing);
+                if(result)
+                {
+                    const auto elements = size / options._stride;
+                    const auto iterations = ((std::max)(uint64_t(elements), uint64_t(1) << 20) + 15) / 16;
+                    double ticks;
+                    result = time_loop(chase, area._data, iterations, ticks);
+                    if(result)
+                    {
+                        latency_t latency;
+                        latency._size = size;
+                        latency._loads = iterations * 16;
+                        latency._ticks = ticks / 16;
+                        latency._ns = latency._ticks * 1e9 / tsc_frequency();
+                        results.push_back(latency);
+                    }
+                }
+                // 4K, 6K, 8K, 12K, ...
+                unsigned long msb;
+                _BitScanReverse64(&msb, size);
+                const auto power_of_2 = size_t(1) << msb;
+                size = size == power_of_2 ? size + size / 2 : power_of_2 * 2;
+            }
+            runtime::FreeMemory(buffer);
+            return result;
+        }
+
+        bool MeasureCacheStates(uint64_t iterations, uint64_t runs, cache_timing_t& result)
+        {
+            if(!iterations || !runs)
+            {
+                detail::set_error(Error::kInvalidCommandFormat);
+                return false;
+            }
+            runtime::harness_area_t area;
+            if(!runtime::HarnessArea(0, area))
+                return false;
+            const auto buffers = runtime::BufferCacheStates();
+            const auto levels = cache_levels();
+            if(!levels._l1 || !levels._l2)
+            {
+                detail::set_error(Error::kUnsupportedCpuFeature);
+                return false;
+            }
+            const auto eviction = runtime::AllocateMemory(levels._l2 * 2);
+            if(!eviction)
+                return false;
+
+            code_builder_t builder;
+            builder._address = area._code;
+            harness_t empty, body, prologue;
+            auto measured = build_timed_loop(builder, area._data, false, empty) && build_timed_loop(builder, area._data, true, body);
+            if(measured)
+            {
+                build_cache_prologue(builder, buffers, levels, uintptr_t(eviction), prologue);
+                measured = runtime::HarnessArea(builder._code.size(), area) && area._code == builder._address && runtime::WriteHarness(area._code, builder._code.data(), builder._code.size());
+            }
+
+            result = {};
+            result._iterations = iterations;
+            result._runs = runs;
+            result._buffers = buffers.size();
+            double hot = 0, prepared = 0;
+            measured = measured && time_runs(empty, nullptr, area._data, iterations, runs, result._overhead) && time_runs(body, nullptr, area._data, iterations, runs, hot) && time_runs(body, &prologue, area._data, iterations, runs, prepared);
+            runtime::FreeMemory(eviction);
+            if(!measured)
+                return false;
+
+            result._hot = hot > result._overhead ? hot - result._overhead : 0;
+            result._prepared = prepared > result._overhead ? prepared - result._overhead : 0;
+            return true;
+        }
+
+        bool MeasureFlushToZero(uint64_t iterations, mxcsr_timing_t& result)
+        {
+            if(!iterations)
+            {
+                detail::set_error(Error::kInvalidCommandFormat);
+                return false;
+            }
+            uint32_t mxcsr;
+            runtime::harness_area_t area;
+            if(!runtime::GetMxcsr(mxcsr) || !runtime::HarnessArea(0, area))
+                return false;
+
+            code_builder_t builder;
+            builder._address = area._code;
+            harness_t empty, body;
+            if(!build_timed_loop(builder, area._data, false, empty) || !build_timed_loop(builder, area._data, true, body))
+                return false;
+            if(!runtime::HarnessArea(builder._code.size(), area) || area._code != builder._address || !runtime::WriteHarness(area._code, builder._code.data(), builder._code.size()))
+                return false;
+
+            result = {};
+            result._iterations = iterations;
+            result._mxcsr = mxcsr;
+            double as_is = 0, ftz_daz = 0;
+            // the harness runs on a copy of the runtime context, MXCSR included
+            auto measured = time_loop(empty, area._data, iterations, result._overhead) && time_loop(body, area._data, iterations, as_is) && runtime::SetMxcsr(mxcsr | kMxcsrFtzDaz);
+            measured = measured && time_loop(body, area._data, iterations, ftz_daz);
+            runtime::SetMxcsr(mxcsr);
+            if(!measured)
+                return false;
+
+            result._as_is = as_is > result._overhead ? as_is - result._overhead : 0;
+            result._ftz_daz = ftz_daz > result._overhead ? ftz_daz - result._overhead : 0;
+            return true;
+        }
+
+        bool Profile(uint64_t samples, unsigned intervalMicroseconds, profile_t& result)
+        {
+            if(!samples || !intervalMicroseconds)
+            {
+                detail::set_error(Error::kInvalidCommandFormat);
+                return false;
+            }
+            void* process;
+            void* thread;
+            std::vector<runtime::line_t> lines;
+            runtime::harness_area_t area;
+            if(!runtime::RuntimeProcess(process, thread) || !runtime::CommittedLines(lines) || !runtime::HarnessArea(0, area))
+                return false;
+            code_builder_t builder;
+            builder._address = area._code;
+            harness_t body;
+            if(!build_timed_loop(builder, area._data, true, body))
+                return false;
+            if(!runtime::HarnessArea(builder._code.size(), area) || area._code != builder._address || !runtime::WriteHarness(area._code, builder._code.data(), builder._code.size()))
+                return false;
+
+            // enough iterations to take samples * interval
+            double ticks;
+            if(!time_loop(body, area._data, 1000, ticks))
+                return false;
+            sampler_t sampler;
+            sampler._thread = HANDLE(thread);
+            sampler._interval_ticks = tsc_frequency() * intervalMicroseconds / 1e6;
+            const auto iterations = (std::max)(uint64_t(1000), uint64_t(double(samples) * sampler._interval_ticks / (std::max)(ticks, 1.0)));
+
+            std::thread sampling(std::ref(sampler));
+            const auto executed = runtime::WriteHarness(area._data + kCounterOffset, &iterations, sizeof(iterations)) && runtime::ExecuteHarness(body._entry, body._exit);
+            sampler._stop = true;
+            sampling.join();
+            if(!executed)
+                return false;
+
+            // the main code is the lines before the first fence, copied as is to the body of the loop
+            size_t main_lines = 0;
+            while(main_lines < lines.size() && !lines[main_lines]._fence)
+                ++main_lines;
+            result = {};
+            result._iterations = iterations;
+            result._lines.resize(main_lines);
+            for(size_t l = 0; l < main_lines; ++l)
+                result._lines[l]._line = lines[l];
+            for(auto rip : sampler._rips)
+            {
+                // the thread is also sampled while the runtime waits for it to start and after it has finished
+                if(rip < body._entry || rip > body._exit)
+                    continue;
+                ++result._samples;
+                if(rip < body._body || rip >= body._body_end)
+                {
+                    ++result._loop;
+                    // just past the last line, so it is the most likely culprit
+                    if(rip == body._body_end && main_lines)
+                        ++result._lines[main_lines - 1]._attributed;
+                    else
+                        ++result._loop_attributed;
+                    continue;
+                }
+                const auto address = lines[0]._address + (rip - body._body);
+                const auto line = std::lower_bound(lines.begin(), lines.begin() + main_lines, address, [](const runtime::line_t& l, uintptr_t at) { return l._address < at; });
+                if(line == lines.begin() + main_lines || line->_address != address)
+                {
+                    ++result._loop;
+                    ++result._loop_attributed;
+                    continue;
+                }
+                const auto index = size_t(line - lines.begin());
+                ++result._lines[index]._samples;
+                // the interrupted instruction is usually one behind the sampled one
+                if(index)
+                    ++result._lines[index - 1]._attributed;
+                else
+                    ++result._loop_attributed;
+            }
+            return true;
+        }
+
+        bool Verify(const char* reference, const char* candidate, const verify_options_t& options, verify_t& result)
+        {
+            if(!options._trials || (options._registers.empty() && !options._flags && !options._memory))
+            {
+                detail::set_error(Error::kInvalidCommandFormat);
+                return false;
+            }
+            for(const auto& reg : options._registers)
+            {
+                if((reg._class != RegisterInfo::RegClass::kGpr || reg._bit_width != 64 || reg._register == RegisterInfo::Register::rsp) && reg._class != RegisterInfo::RegClass::kXmm)
+                {
+                    detail::set_error(Error::kInvalidRegisterName);
+                    return false;
+                }
+            }
+            LARGE_INTEGER qpc_frequency, qpc_start, qpc_run, qpc_ran, qpc_end;
+            QueryPerformanceFrequency(&qpc_frequency);
+            QueryPerformanceCounter(&qpc_start);
+
+            uintptr_t blocks[2];
+            void* process;
+            void* thread;
+            runtime::harness_area_t area;
+            if(!runtime::LabelAddress(reference, blocks[0]) || !runtime::LabelAddress(candidate, blocks[1]) || !runtime::RuntimeProcess(process, thread) || !runtime::HarnessArea(0, area))
+                return false;
+
+            // registers pointing into a buffer designate the input buffers, and keep pointing at the same offset in each thread's copy
+            using Register = RegisterInfo::Register;
+            struct buffer_t
+            {
+                uintptr_t _address = 0;
+                size_t _size = 0;
+                // in the image
+                size_t _offset = 0;
+            };
+            std::vector<buffer_t> buffers;
+            uint64_t values[16] = { 0 };
+            int pointers[16];
+            trial_layout_t layout;
+            for(uint8_t gpr = 0; gpr < 16; ++gpr)
+            {
+                pointers[gpr] = -1;
+                if(gpr == kRsp || !runtime::GetReg(RegisterInfo{ kGprs[gpr] }, values[gpr]))
+                    continue;
+                const auto handle = runtime::FindAllocation(uintptr_t(values[gpr]));
+                if(!handle)
+                    continue;
+                auto buffer = std::find_if(buffers.begin(), buffers.end(), [handle](const buffer_t& b) { return b._address == uintptr_t(handle); });
+                if(buffer == buffers.end())
+                {
+                    buffers.push_back({ uintptr_t(handle), runtime::AllocationSize(handle), layout._image });
+                    layout._image += (buffers.back()._size + 63) & ~size_t(63);
+                    buffer = buffers.end() - 1;
+                }
+                pointers[gpr] = int(buffer - buffers.begin());
+            }
+            layout._record = (3 * kStateSize + 3 * layout._image + 63) & ~size_t(63);
+
+            auto threads = options._max_threads ? options._max_threads : unsigned(GetActiveProcessorCount(ALL_PROCESSOR_GROUPS));
+            threads = unsigned((std::min)(uint64_t((std::min)(threads, kMaxVerifyThreads)), options._trials));
+            const auto size = threads * layout._image + options._trials * layout._record;
+            // everything lives in the runtime process at once, so keep it within reason
+            if(layout._image > 0xffffffff || size > (size_t(1) << 30))
+            {
+                detail::set_error(Error::kInvalidCommandFormat);
+                return false;
+            }
+            const auto memory = runtime::AllocateMemory(size);
+            if(!memory)
+                return false;
+            const auto records = uintptr_t(memory) + threads * layout._image;
+            std::vector<worker_t> workers(threads);
+            for(unsigned n = 0; n < threads; ++n)
+            {
+                const auto first = options._trials * n / threads;
+                workers[n] = { records + first * layout._record, options._trials * (n + 1) / threads - first, uintptr_t(memory) + n * layout._image };
+            }
+            const auto worker_of = [&](uint64_t trial) -> const worker_t& {
+                const auto record = records + trial * layout._record;
+                return *(std::upper_bound(workers.begin(), workers.end(), record, [](uintptr_t at, const worker_t& worker) { return at < worker._records; }) - 1);
+            };
+
+            // the inputs, written in chunks of trials
+            std::mt19937_64 random(0x696e61736d3634);
+            std::vector<uint8_t> chunk;
+            const auto chunk_trials = (std::max)(uint64_t(1), uint64_t((size_t(1) << 20) / layout._record));
+            auto written = true;
+            for(uint64_t first = 0; written && first < options._trials; first += chunk_trials)
+            {
+                const auto count = (std::min)(chunk_trials, options._trials - first);
+                chunk.assign(size_t(count * layout._record), 0);
+                for(uint64_t trial = first; trial < first + count; ++trial)
+                {
+                    const auto record = chunk.data() + (trial - first) * layout._record;
+                    register_state_t input;
+                    const auto work = worker_of(trial)._buffers;
+                    for(uint8_t gpr = 0; gpr < 16; ++gpr)
+                    {
+                        if(pointers[gpr] >= 0)
+                        {
+                            const auto& buffer = buffers[pointers[gpr]];
+                            input._gpr[gpr] = work + buffer._offset + (values[gpr] - buffer._address);
+                        }
+                        else if(gpr != kRsp)
+                            input._gpr[gpr] = random_input(random);
+                    }
+                    input._rflags = 0x202 | (random() & kArithmeticFlags);
+                    for(auto& xmm : input._xmm)
+                    {
+                        xmm[0] = random_input(random);
+                        xmm[1] = random_input(random);
+                    }
+                    memcpy(record + layout.state(0), &input, sizeof(input));
+                    for(size_t byte = 0; byte < layout._image; byte += 8)
+                    {
+                        const auto value = random_input(random);
+                        memcpy(record + layout.image(0) + byte, &value, (std::min)(size_t(8), layout._image - byte));
+                    }
+                }
+                written = runtime::WriteBytes(memory, size_t(first * layout._record + threads * layout._image), chunk.data(), chunk.size());
+            }
+
+            code_builder_t builder;
+            builder._address = area._code;
+            uintptr_t loop, exit;
+            std::vector<uintptr_t> entries;
+            build_trial_loop(builder, area._data, layout, blocks, loop);
+            build_verify_entries(builder, area._data, loop, workers, entries, exit);
+            auto ran = written && runtime::HarnessArea(builder._code.size(), area) && area._code == builder._address && runtime::WriteHarness(area._code, builder._code.data(), builder._code.size());
+
+            QueryPerformanceCounter(&qpc_run);
+            ran = ran && run_workers(process, entries, area._data, exit, options._timeout_ms);
+            QueryPerformanceCounter(&qpc_ran);
+
+            result = {};
+            result._trials = options._trials;
+            result._threads = threads;
+            result._buffers = buffers.size();
+            // back from a thread's copy of the buffers to the buffers themselves
+            const auto to_buffer = [&](uint64_t& value, uintptr_t work) {
+                if(value < work || value >= work + layout._image)
+                    return;
+                for(const auto& buffer : buffers)
+                {
+                    if(value - work >= buffer._offset && value - work < buffer._offset + buffer._size)
+                    {
+                        value = buffer._address + (value - work - buffer._offset);
+                        return;
+                    }
+                }
+            };
+            for(uint64_t first = 0; ran && result._equivalent && first < options._trials; first += chunk_trials)
+            {
+                const auto count = (std::min)(chunk_trials, options._trials - first);
+                chunk.resize(size_t(count * layout._record));
+                if(!runtime::ReadBytes(memory, size_t(threads * layout._image + first * layout._record), chunk.data(), chunk.size()))
+                {
+                    ran = false;
+                    break;
+                }
+                for(uint64_t trial = first; result._equivalent && trial < first + count; ++trial)
+                {
+                    const auto record = chunk.data() + (trial - first) * layout._record;
+                    register_state_t states[3];
+                    for(unsigned which = 0; which < 3; ++which)
+                        memcpy(states + which, record + layout.state(which), sizeof(register_state_t));
+                    for(const auto& reg : options._registers)
+                    {
+                        const auto index = reg._class == RegisterInfo::RegClass::kXmm ? int(reg._register) - int(Register::xmm0) : int(std::find(std::begin(kGprs), std::end(kGprs), reg._register) - std::begin(kGprs));
+                        const auto differs = reg._class == RegisterInfo::RegClass::kXmm ? memcmp(states[1]._xmm[index], states[2]._xmm[index], 16) != 0 : states[1]._gpr[index] != states[2]._gpr[index];
+                        if(differs)
+                        {
+                            result._equivalent = false;
+                            result._register = reg;
+                            break;
+                        }
+                    }
+                    if(result._equivalent && options._flags && ((states[1]._rflags ^ states[2]._rflags) & kArithmeticFlags))
+                    {
+                        result._equivalent = false;
+                        result._flags = true;
+                    }
+                    if(result._equivalent && options._memory && layout._image)
+                    {
+                        const auto images = std::mismatch(record + layout.image(1), record + layout.image(2), record + layout.image(2));
+                        if(images.first != record + layout.image(2))
+                        {
+                            result._equivalent = false;
+                            const auto offset = size_t(images.first - (record + layout.image(1)));
+                            for(const auto& buffer : buffers)
+                            {
+                                if(offset >= buffer._offset && offset < buffer._offset + buffer._size)
+                                {
+                                    result._buffer = reinterpret_cast<const void*>(buffer._address);
+                                    result._offset = offset - buffer._offset;
+                                }
+                            }
+                            result._input_byte = record[layout.image(0) + offset];
+                            result._reference_byte = *images.first;
+                            result._candidate_byte = *images.second;
+                        }
+                    }
+                    if(!result._equivalent)
+                    {
+                        result._trial = trial;
+                        result._input = states[0];
+                        result._reference = states[1];
+                        result._candidate = states[2];
+                        const auto work = worker_of(trial)._buffers;
+                        for(auto state : { &result._input, &result._reference, &result._candidate })
+                        {
+                            for(auto& value : state->_gpr)
+                                to_buffer(value, work);
+                        }
+                    }
+                }
+            }
+            runtime::FreeMemory(memory);
+            QueryPerformanceCounter(&qpc_end);
+            result._run_ms = double(qpc_ran.QuadPart - qpc_run.QuadPart) * 1000.0 / double(qpc_frequency.QuadPart);
+            result._total_ms = double(qpc_end.QuadPart - qpc_start.QuadPart) * 1000.0 / double(qpc_frequency.QuadPart);
+            return ran;
+        }
+
+        bool Litmus(const std::vector<const char*>& procedures, const litmus_options_t& options, litmus_t& result)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            auto outputs = options._outputs;
+            if(outputs.empty())
+                outputs.push_back(RegisterInfo{ RegisterInfo::Register::rax });
+            if(procedures.size() < 2 || procedures.size() > kMaxLitmusThreads || outputs.size() > kMaxLitmusOutputs || !options._iterations)
+            {
+                detail::set_error(Error::kInvalidCommandFormat);
+                return false;
+            }
+            std::vector<uint8_t> output_gprs;
+            for(const auto& reg : outputs)
+            {
+                if(reg._class != RegisterInfo::RegClass::kGpr || reg._bit_width != 64 || reg._register == RegisterInfo::Register::rsp)
+                {
+                    detail::set_error(Error::kInvalidRegisterName);
+                    return false;
+                }
+                output_gprs.push_back(uint8_t(std::find(std::begin(kGprs), std::end(kGprs), reg._register) - std::begin(kGprs)));
+            }
+            std::vector<uintptr_t> blocks(procedures.size());
+            for(size_t n = 0; n < procedures.size(); ++n)
+            {
+                if(!runtime::LabelAddress(procedures[n], blocks[n]))
+                    return false;
+            }
+            void* process;
+            void* thread;
+            std::vector<GROUP_AFFINITY> affinities;
+            runtime::harness_area_t area;
+            if(!runtime::RuntimeProcess(process, thread) || !distinct_cores(procedures.size(), affinities) || !runtime::HarnessArea(0, area))
+                return false;
+
+            // the runtime's registers, and the buffers they point into are the shared variables
+            register_state_t state;
+            std::vector<litmus_variable_t> variables;
+            size_t pristine_size = 0;
+            for(uint8_t gpr = 0; gpr < 16; ++gpr)
+            {
+                if(gpr == kRsp || !runtime::GetReg(RegisterInfo{ kGprs[gpr] }, state._gpr[gpr]))
+                    continue;
+                const auto handle = runtime::FindAllocation(uintptr_t(state._gpr[gpr]));
+                if(handle && std::none_of(variables.begin(), variables.end(), [handle](const litmus_variable_t& v) { return v._address == uintptr_t(handle); }))
+                {
+                    variables.push_back({ uintptr_t(handle), pristine_size, runtime::AllocationSize(handle) });
+                    pristine_size += (variables.back()._size + 63) & ~size_t(63);
+                }
+            }
+            // the memory is the registers, the pristine copies of the variables, then each thread's outputs for a batch
+            const auto batch_size = size_t(kLitmusBatch) * outputs.size() * 8;
+            const auto pristine_offset = size_t(64);
+            const auto results_offset = pristine_offset + pristine_size;
+            if(pristine_size > 0xffffffff)
+            {
+                detail::set_error(Error::kInvalidCommandFormat);
+                return false;
+            }
+            const auto memory = runtime::AllocateMemory(results_offset + procedures.size() * batch_size);
+            if(!memory)
+                return false;
+            auto ran = runtime::WriteBytes(memory, &state._gpr, sizeof(state._gpr));
+            std::vector<uint8_t> bytes;
+            for(auto& variable : variables)
+            {
+                bytes.resize(variable._size);
+                ran = ran && runtime::ReadBytes(reinterpret_cast<const void*>(variable._address), bytes.data(), bytes.size()) &&
+                    runtime::WriteBytes(memory, pristine_offset + variable._pristine, bytes.data(), bytes.size());
+                variable._pristine += uintptr_t(memory) + pristine_offset;
+            }
+            std::vector<uintptr_t> results(procedures.size());
+            for(size_t n = 0; n < procedures.size(); ++n)
+                results[n] = uintptr_t(memory) + results_offset + n * batch_size;
+
+            // a batch of iterations of the blocks, with the ticks of the calls and of the loops of each thread added up
+            std::vector<uint64_t> call_ticks(procedures.size()), loop_ticks(procedures.size());
+            const auto run_batch = [&](const std::vector<uintptr_t>& batch_blocks, uint64_t iterations) {
+                code_builder_t builder;
+                builder._address = area._code;
+                std::vector<uintptr_t> entries;
+                uintptr_t exit;
+                build_litmus_entries(builder, area._data, batch_blocks, results, iterations, uintptr_t(memory), output_gprs, variables, entries, exit);
+                if(!runtime::HarnessArea(builder._code.size(), area) || area._code != builder._address || !runtime::WriteHarness(area._code, builder._code.data(), builder._code.size()) ||
+                    !run_workers(process, entries, area._data, exit, options._timeout_ms, affinities))
+                    return false;
+                for(size_t n = 0; n < batch_blocks.size(); ++n)
+                {
+                    uint64_t slot[2];
+                    if(!runtime::ReadHarness(area._data + kSlotsOffset + n * 16, slot, sizeof(slot)))
+                        return false;
+                    call_ticks[n] += slot[0];
+                    loop_ticks[n] += slot[1];
+                }
+                return true;
+            };
+
+            result = {};
+            result._iterations = options._iterations;
+            result._outputs = outputs;
+            result._variables = variables.size();
+            // the cost of timing the calls, from a batch with every block an empty one
+            const auto empty_iterations = (std::min)(options._iterations, kLitmusBatch);
+            ran = ran && run_batch(std::vector<uintptr_t>(procedures.size(), 0), empty_iterations);
+            std::vector<double> overheads(procedures.size());
+            for(size_t n = 0; n < procedures.size(); ++n)
+            {
+                overheads[n] = double(call_ticks[n]) / double(empty_iterations);
+                result._overhead += overheads[n] / double(procedures.size());
+            }
+            std::fill(call_ticks.begin(), call_ticks.end(), 0);
+            std::fill(loop_ticks.begin(), loop_ticks.end(), 0);
+
+            // each batch's outcomes are tallied before the next is run
+            const auto per_iteration = procedures.size() * outputs.size();
+            std::vector<uint64_t> batch_results;
+            std::vector<uint64_t> values(per_iteration);
+            size_t last = 0;
+            for(uint64_t first = 0; ran && first < options._iterations; first += kLitmusBatch)
+            {
+                const auto count = (std::min)(kLitmusBatch, options._iterations - first);
+                ran = run_batch(blocks, count);
+                batch_results.resize(size_t(count * per_iteration));
+                for(size_t n = 0; ran && n < procedures.size(); ++n)
+                    ran = runtime::ReadBytes(memory, results_offset + n * batch_size, batch_results.data() + n * count * outputs.size(), size_t(count * outputs.size() * 8));
+                for(uint64_t iteration = 0; ran && iteration < count; ++iteration)
+                {
+                    for(size_t n = 0; n < procedures.size(); ++n)
+                        memcpy(values.data() + n * outputs.size(), batch_results.data() + (n * count + iteration) * outputs.size(), outputs.size() * 8);
+                    // runs of the same outcome are common, so the last one is tried first
+                    if(last < result._outcomes.size() && result._outcomes[last]._values == values)
+                    {
+                        ++result._outcomes[last]._count;
+                        continue;
+                    }
+                    const auto outcome = std::find_if(result._outcomes.begin(), result._outcomes.end(), [&values](const litmus_outcome_t& o) { return o._values == values; });
+                    if(outcome != result._outcomes.end())
+                    {
+                        ++outcome->_count;
+                        last = size_t(outcome - result._outcomes.begin());
+                    }
+                    else if(result._outcomes.size() < kMaxLitmusOutcomes)
+                    {
+                        last = result._outcomes.size();
+                        result._outcomes.push_back({ values, 1 });
+                    }
+                    else
+                        ++result._other;
+                }
+            }
+
+            // the variables are left as they were
+            for(const auto& variable : variables)
+            {
+                bytes.resize(variable._size);
+                if(runtime::ReadBytes(memory, size_t(variable._pristine - uintptr_t(memory)), bytes.data(), bytes.size()))
+                    runtime::WriteBytes(reinterpret_cast<const void*>(variable._address), bytes.data(), bytes.size());
+            }
+            runtime::FreeMemory(memory);
+            if(!ran)
+                return false;
+
+            for(size_t n = 0; n < procedures.size(); ++n)
+            {
+                const auto ticks = double(call_ticks[n]) / double(options._iterations);
+                unsigned long processor;
+                _BitScanForward64(&processor, uint64_t(affinities[n].Mask));
+                result._threads.push_back({ affinities[n].Group, uint8_t(processor), ticks > overheads[n] ? ticks - overheads[n] : 0 });
+                result._iteration_ticks += double(loop_ticks[n]) / double(options._iterations) / double(procedures.size());
+            }
+            std::stable_sort(result._outcomes.begin(), result._outcomes.end(), [](const litmus_outcome_t& a, const litmus_outcome_t& b) { return a._count > b._count; });
+            result._ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            return true;
+        }
+
+        bool TimeVariants(size_t variants, const variant_assembler_t& assembler, uint64_t iterations, unsigned maxThreads, unsigned timeoutMs, std::vector<variant_timing_t>& results, double& overhead)
+        {
+            if(!variants || !iterations)
+            {
+                detail::set_error(Error::kInvalidCommandFormat);
+                return false;
+            }
+            runtime::harness_area_t area;
+            if(!runtime::HarnessArea(0, area))
+                return false;
+
+            // the empty loop, and the start of the loop each variant is put in
+            code_builder_t builder;
+            builder._address = area._code;
+            harness_t empty, loop;
+            build_timed_loop(builder, area._data, false, empty);
+            const auto top = begin_timed_loop(builder, area._data, loop);
+            const auto prologue_size = builder._code.size();
+            if(!runtime::HarnessArea(builder._code.size(), area) || area._code != builder._address || !runtime::WriteHarness(area._code, builder._code.data(), builder._code.size()) ||
+                !time_loop(empty, area._data, iterations, overhead))
+                return false;
+
+            // the assemblers run ahead, each taking the next variant from a shared counter, and the runtime thread waits for the variants in order
+            enum class State : uint8_t
+            {
+                kPending,
+                kAssembled,
+                kFailed
+            };
+            std::vector<std::vector<uint8_t>> codes(variants);
+            std::vector<State> states(variants, State::kPending);
+            results.assign(variants, {});
+            std::mutex mutex;
+            std::condition_variable assembled;
+            std::atomic<size_t> next_variant{ 0 };
+            std::atomic<bool> stop{ false };
+            auto threads = maxThreads ? maxThreads : (std::max)(2u, std::thread::hardware_concurrency()) - 1;
+            threads = unsigned((std::min)(size_t(threads), variants));
+            std::vector<std::thread> workers;
+            for(unsigned n = 0; n < threads; ++n)
+            {
+                workers.emplace_back([&]() {
+                    for(auto variant = next_variant++; variant < variants && !stop; variant = next_variant++)
+                    {
+                        std::vector<uint8_t> code;
+                        const auto ok = assembler(variant, top, code);
+                        const auto error = ok ? Error::kNoError : GetError();
+                        {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            codes[variant] = std::move(code);
+                            states[variant] = ok ? State::kAssembled : State::kFailed;
+                            results[variant]._error = error;
+                        }
+                        assembled.notify_all();
+                    }
+                });
+            }
+
+            auto measured = true;
+            for(size_t variant = 0; measured && variant < variants; ++variant)
+            {
+                std::vector<uint8_t> code;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    assembled.wait(lock, [&]() { return states[variant] != State::kPending; });
+                    if(states[variant] == State::kFailed)
+                        continue;
+                    code = std::move(codes[variant]);
+                }
+                builder._code.resize(prologue_size);
+                builder._code.insert(builder._code.end(), code.begin(), code.end());
+                end_timed_loop(builder, area._data, loop);
+                measured = runtime::HarnessArea(builder._code.size(), area) && area._code == builder._address && runtime::WriteHarness(area._code, builder._code.data(), builder._code.size());
+                double ticks = 0;
+                auto& result = results[variant];
+                result._size = code.size();
+                result._timed = measured && time_loop(loop, area._data, iterations, ticks, timeoutMs);
+                if(result._timed)
+                    result._ticks = ticks > overhead ? ticks - overhead : 0;
+                else if(measured)
+                    result._error = GetError();
+            }
+            stop = true;
+            for(auto& worker : workers)
+                worker.join();
+            return measured;
+        }
+    }  // namespace benchmark
+}  // namespace inasm64
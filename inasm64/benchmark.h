@@ -0,0 +1,447 @@
+// MIT License
+// Copyright 2019 Jarl Ostensen
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <functional>
+
+namespace inasm64
+{
+    ///<summary>
+    /// native timing of the committed code
+    ///</summary>
+    /// The main code (see runtime::RelocatedMainCode) is copied into a harness that runs it as the body of a counted loop in the runtime process, timed with rdtsc.
+    /// Times are in TSC ticks, i.e. reference cycles, per iteration with the cost of the loop itself subtracted.
+    /// The same harnesses also run procedures natively for other checks, such as Verify.
+    namespace benchmark
+    {
+        ///<summary>
+        /// default number of iterations of the main code
+        ///</summary>
+        constexpr uint64_t kDefaultIterations = 100000;
+        ///<summary>
+        /// two logical processors sharing a physical core
+        ///</summary>
+        struct smt_pair_t
+        {
+            unsigned short _group = 0;
+            // processor numbers within the group
+            unsigned char _primary = 0;
+            unsigned char _sibling = 0;
+        };
+        ///<summary>
+        /// find a pair of SMT (hyperthread) siblings, fails with Error::kUnsupportedCpuFeature if SMT is off or unavailable
+        ///</summary>
+        /// The last core with more than one logical processor is used, to stay clear of processor 0 where most of the system's interrupt work lands.
+        bool FindSmtSiblings(smt_pair_t& pair);
+        ///<summary>
+        /// result of MeasureInterference
+        ///</summary>
+        struct interference_t
+        {
+            uint64_t _iterations = 0;
+            // ticks per iteration with the sibling idle, and with the co-runner looping on it
+            double _alone = 0;
+            double _shared = 0;
+            // ticks per iteration of the empty loop, subtracted from the above
+            double _overhead = 0;
+            smt_pair_t _pair;
+        };
+        ///<summary>
+        /// time the main code with the SMT sibling idle and with coRunner, a procedure (see runtime::BeginProc), called in a loop on the sibling
+        ///</summary>
+        /// The runtime thread is pinned to the primary processor of the pair for the duration, and the co-runner thread is terminated afterwards.
+        /// Registers are restored after each timed run, memory written by the code is not.
+        bool MeasureInterference(const char* coRunner, uint64_t iterations, interference_t& result);
+
+        ///<summary>
+        /// the main code timed on one logical processor
+        ///</summary>
+        struct core_timing_t
+        {
+            unsigned short _group = 0;
+            unsigned char _processor = 0;
+            // Windows' ranking of the core, higher is faster; all cores are 0 on non-hybrid systems
+            unsigned char _efficiency_class = 0;
+            CoreInfo _core;
+            // ticks per iteration, with the loop overhead measured on the same processor subtracted
+            double _ticks = 0;
+        };
+        ///<summary>
+        /// logical processors of the same kind, by CPUID core type or, when the CPU doesn't report one, by efficiency class
+        ///</summary>
+        struct core_group_t
+        {
+            CoreInfo::Type _type = CoreInfo::Type::kUnknown;
+            unsigned char _efficiency_class = 0;
+            unsigned _processors = 0;
+            double _min = 0;
+            double _mean = 0;
+            double _max = 0;
+        };
+        ///<summary>
+        /// result of MeasureCores
+        ///</summary>
+        struct core_timings_t
+        {
+            uint64_t _iterations = 0;
+            // in group and processor number order
+            std::vector<core_timing_t> _processors;
+            // fastest kind of core first
+            std::vector<core_group_t> _groups;
+        };
+        ///<summary>
+        /// time the main code on each logical processor in turn and group the results by kind of core, e.g. performance and efficiency cores of a hybrid part
+        ///</summary>
+        /// The runtime thread is pinned to each processor in turn for the duration, the calling thread as well while it reads the processor's CPUID topology (see GetCoreInfo).
+        /// Registers are restored after each timed run, memory written by the code is not.
+        bool MeasureCores(uint64_t iterations, core_timings_t& result);
+
+        ///<summary>
+        /// upper limit on the number of threads MeasureBandwidth uses
+        ///</summary>
+        constexpr unsigned kMaxBandwidthThreads = 64;
+        ///<summary>
+        /// how MeasureBandwidth streams over its buffer
+        ///</summary>
+        struct bandwidth_options_t
+        {
+            // measure with 1.._max_threads threads, 0 means one per logical processor
+            unsigned _max_threads = 0;
+            // bytes the main code consumes per iteration
+            size_t _stride = 64;
+            // bytes of the buffer to stream over, 0 means all of it
+            size_t _size = 0;
+            // times each thread streams over its slice
+            unsigned _passes = 10;
+        };
+        ///<summary>
+        /// result of MeasureBandwidth for one thread count
+        ///</summary>
+        struct bandwidth_t
+        {
+            unsigned _threads = 0;
+            // bytes streamed by all threads together
+            uint64_t _bytes = 0;
+            // ticks from the first thread starting to the last one finishing
+            uint64_t _ticks = 0;
+            // 10^9 bytes per second, using the TSC frequency
+            double _gb_per_second = 0;
+        };
+        ///<summary>
+        /// stream the main code over a buffer (see runtime::AllocateMemory) on 1..N threads, each over its own slice, and report the combined bandwidth for each thread count
+        ///</summary>
+        /// The main code is the body of the streaming loop; on entry rsi points at the current element and rdi at the end of the thread's slice,
+        /// it must preserve both (and the stack) and the loop advances rsi by the stride. All other registers are undefined on the extra threads.
+        /// Each thread count is run twice and the second run is used, slices are the size divided between the threads and rounded down to the stride.
+        bool MeasureBandwidth(const void* buffer, const bandwidth_options_t& options, std::vector<bandwidth_t>& results);
+
+        ///<summary>
+        /// the order a pointer chain visits pages in
+        ///</summary>
+        enum class PageCrossing
+        {
+            // a random permutation of all elements
+            kRandom,
+            // all the elements of a page in random order, then on to another random page, i.e. one TLB miss per page
+            kWithinPage,
+            // every load goes to a different page than the one before it, including from the last element back to the first, given 3 pages or more
+            kEveryLoad,
+        };
+        ///<summary>
+        /// fill the first size bytes of a buffer (see runtime::AllocateMemory) with a randomly permuted cycle of pointers, one every stride bytes
+        ///</summary>
+        /// Each element holds the address of the next, starting at the buffer itself, so that mov rax, [rax] from the buffer address walks the whole chain.
+        /// The stride is a multiple of 8 and pages are the pages actually backing the buffer (see runtime::QueryAllocation).
+        bool BuildPointerChain(const void* buffer, size_t size, size_t stride, PageCrossing crossing);
+        ///<summary>
+        /// how MeasureLatency sweeps the buffer size
+        ///</summary>
+        struct latency_options_t
+        {
+            // from _min_size to _max_size in steps of 1.5x and 2x of the previous power of 2
+            size_t _min_size = size_t(4) << 10;
+            size_t _max_size = size_t(1) << 30;
+            size_t _stride = 64;
+            PageCrossing _crossing = PageCrossing::kRandom;
+            // allocation for the buffer, i.e. large pages to take the TLB out of the picture
+            runtime::allocation_options_t _allocation;
+        };
+        ///<summary>
+        /// result of MeasureLatency for one buffer size
+        ///</summary>
+        struct latency_t
+        {
+            size_t _size = 0;
+            uint64_t _loads = 0;
+            // per load
+            double _ticks = 0;
+            double _ns = 0;
+        };
+        ///<summary>
+        /// time a chain of dependent loads (mov rax, [rax]) over pointer chains of growing size, i.e. the load-to-use latency of each level of the memory hierarchy
+        ///</summary>
+        /// The chain is run natively in the runtime process and doesn't involve the committed code. Each size is walked at least once, and at least 2^20 loads,
+        /// before being timed over the same number of loads. The buffer is allocated at the largest size in the runtime process and released afterwards.
+        bool MeasureLatency(const latency_options_t& options, std::vector<latency_t>& results);
+
+        ///<summary>
+        /// default number of runs for MeasureCacheStates
+        ///</summary>
+        constexpr uint64_t kDefaultRuns = 1000;
+        ///<summary>
+        /// result of MeasureCacheStates
+        ///</summary>
+        struct cache_timing_t
+        {
+            uint64_t _iterations = 0;
+            uint64_t _runs = 0;
+            // number of buffers with a cache state
+            size_t _buffers = 0;
+            // ticks per iteration with everything left in cache by the previous run
+            double _hot = 0;
+            // ticks per iteration with each buffer put in its cache state before every run
+            double _prepared = 0;
+            // ticks per iteration of the empty loop, subtracted from the above
+            double _overhead = 0;
+        };
+        ///<summary>
+        /// time the main code hot, and with the allocations put in their cache states (see runtime::SetCacheState) before each run
+        ///</summary>
+        /// Each run is a loop of iterations over the main code, so with a single iteration every execution sees the buffers in their chosen state.
+        /// Fails with Error::kUnsupportedCpuFeature if the CPU doesn't report its L1 and L2 sizes, which the eviction buffer is based on.
+        bool MeasureCacheStates(uint64_t iterations, uint64_t runs, cache_timing_t& result);
+
+        ///<summary>
+        /// MXCSR flush-to-zero and denormals-are-zero bits
+        ///</summary>
+        constexpr uint32_t kMxcsrFtzDaz = 0x8040;
+        ///<summary>
+        /// result of MeasureFlushToZero
+        ///</summary>
+        struct mxcsr_timing_t
+        {
+            uint64_t _iterations = 0;
+            // MXCSR of the runtime context
+            uint32_t _mxcsr = 0;
+            // ticks per iteration with the runtime's MXCSR, and with FTZ and DAZ set
+            double _as_is = 0;
+            double _ftz_daz = 0;
+            // ticks per iteration of the empty loop, subtracted from the above
+            double _overhead = 0;
+        };
+        ///<summary>
+        /// time the main code with the runtime's MXCSR and again with flush-to-zero and denormals-are-zero set, i.e. the cost of any denormals it works on
+        ///</summary>
+        /// The runtime's MXCSR is left as it was.
+        bool MeasureFlushToZero(uint64_t iterations, mxcsr_timing_t& result);
+
+        ///<summary>
+        /// samples for a line of the main code
+        ///</summary>
+        struct line_profile_t
+        {
+            runtime::line_t _line;
+            // samples with the instruction pointer at the line
+            uint64_t _samples = 0;
+            // samples attributed to it allowing for skid, i.e. with the instruction pointer at the line that follows it
+            uint64_t _attributed = 0;
+        };
+        ///<summary>
+        /// result of Profile
+        ///</summary>
+        struct profile_t
+        {
+            uint64_t _iterations = 0;
+            // samples taken while the loop ran
+            uint64_t _samples = 0;
+            // samples in the loop around the main code, and those attributed to it
+            uint64_t _loop = 0;
+            uint64_t _loop_attributed = 0;
+            std::vector<line_profile_t> _lines;
+        };
+        ///<summary>
+        /// run the main code in a timed loop for about samples * interval, sampling the instruction pointer of the runtime thread every interval
+        ///</summary>
+        /// The thread is briefly suspended for each sample, so samples land where it was interrupted. That is normally just past the instruction that was
+        /// holding things up, so each sample is also attributed to the line before the sampled one. With branches in the code "the line before" is only a guess.
+        bool Profile(uint64_t samples, unsigned intervalMicroseconds, profile_t& result);
+
+        ///<summary>
+        /// default number of randomised trials for Verify
+        ///</summary>
+        constexpr uint64_t kDefaultTrials = 10000;
+        ///<summary>
+        /// registers as a Verify trial loads and stores them
+        ///</summary>
+        struct register_state_t
+        {
+            // in encoding order, i.e. rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi, r8 - r15. rsp is neither loaded nor stored
+            uint64_t _gpr[16] = { 0 };
+            uint64_t _rflags = 0;
+            uint64_t _reserved = 0;
+            uint64_t _xmm[16][2] = { { 0 } };
+        };
+        ///<summary>
+        /// what Verify runs and compares
+        ///</summary>
+        struct verify_options_t
+        {
+            uint64_t _trials = kDefaultTrials;
+            // output registers, 64 bit general purpose and xmm registers only
+            std::vector<RegisterInfo> _registers;
+            // compare the arithmetic flags (CF, PF, AF, ZF, SF, OF)
+            bool _flags = false;
+            // compare the contents of the buffers
+            bool _memory = true;
+            // 0 means one per logical processor
+            unsigned _max_threads = 0;
+            // give up if the trials haven't finished by then, i.e. if one of the blocks doesn't terminate for some input
+            unsigned _timeout_ms = 10000;
+        };
+        ///<summary>
+        /// result of Verify
+        ///</summary>
+        struct verify_t
+        {
+            uint64_t _trials = 0;
+            unsigned _threads = 0;
+            // buffers pointed to by registers, i.e. the input buffers
+            size_t _buffers = 0;
+            // wall clock time of the native runs, and of the whole check
+            double _run_ms = 0;
+            double _total_ms = 0;
+            bool _equivalent = true;
+            // the first trial the blocks diverge on, its input and the outputs of both blocks.
+            // Registers that point into a buffer are given as addresses in the buffer, not in the copy the trial ran on
+            uint64_t _trial = 0;
+            register_state_t _input;
+            register_state_t _reference;
+            register_state_t _candidate;
+            // the first output that differs: a register, the flags, or a byte of a buffer
+            RegisterInfo _register;
+            bool _flags = false;
+            const void* _buffer = nullptr;
+            size_t _offset = 0;
+            uint8_t _input_byte = 0;
+            uint8_t _reference_byte = 0;
+            uint8_t _candidate_byte = 0;
+        };
+        ///<summary>
+        /// run two procedures (see runtime::BeginProc), a reference and a candidate, natively from the same randomised states and compare their outputs
+        ///</summary>
+        /// Every register but rsp is randomised for each trial, except those that point into a buffer (see runtime::AllocateMemory) when Verify is called.
+        /// Those buffers are the inputs: their contents are randomised, and the registers point at the same offset in a private copy of each of them.
+        /// Buffers have to be reached through these registers, code that loads the address of a buffer itself would have all the threads share it.
+        /// Trials are spread across worker threads in the runtime process. Each trial copies its input into the thread's buffers and loads the registers
+        /// before calling a block, and stores the registers and copies the buffers out afterwards. Trials are repeatable, the inputs come from a fixed seed.
+        /// A fault in either block fails with the error it raised, and a block that doesn't return within the timeout fails with Error::kIterationLimitReached.
+        bool Verify(const char* reference, const char* candidate, const verify_options_t& options, verify_t& result);
+
+        ///<summary>
+        /// most blocks Litmus runs at once, and most output registers of each
+        ///</summary>
+        constexpr size_t kMaxLitmusThreads = 8;
+        constexpr size_t kMaxLitmusOutputs = 4;
+        ///<summary>
+        /// default number of Litmus iterations
+        ///</summary>
+        constexpr uint64_t kDefaultLitmusIterations = 1000000;
+        ///<summary>
+        /// what Litmus runs and tallies
+        ///</summary>
+        struct litmus_options_t
+        {
+            uint64_t _iterations = kDefaultLitmusIterations;
+            // 64 bit general purpose registers the outcome is made of, the same for every block. rax if none are given
+            std::vector<RegisterInfo> _outputs;
+            // give up if a batch of iterations hasn't finished by then, i.e. if one of the blocks doesn't terminate
+            unsigned _timeout_ms = 10000;
+        };
+        ///<summary>
+        /// a final state and the number of iterations that ended in it
+        ///</summary>
+        struct litmus_outcome_t
+        {
+            // the outputs of each block in turn
+            std::vector<uint64_t> _values;
+            uint64_t _count = 0;
+        };
+        ///<summary>
+        /// a block's thread
+        ///</summary>
+        struct litmus_thread_t
+        {
+            unsigned short _group = 0;
+            unsigned char _processor = 0;
+            // ticks per call of the block, less an empty block's
+            double _ticks = 0;
+        };
+        ///<summary>
+        /// the most outcomes Litmus tells apart, any others are counted together
+        ///</summary>
+        constexpr size_t kMaxLitmusOutcomes = 64;
+        ///<summary>
+        /// result of Litmus
+        ///</summary>
+        struct litmus_t
+        {
+            uint64_t _iterations = 0;
+            std::vector<RegisterInfo> _outputs;
+            // buffers put back as they were before each iteration, i.e. the shared variables
+            size_t _variables = 0;
+            std::vector<litmus_thread_t> _threads;
+            // ticks per call of an empty block, subtracted from each thread's
+            double _overhead = 0;
+            // ticks per iteration, including the barriers the threads meet at and resetting the variables
+            double _iteration_ticks = 0;
+            double _ms = 0;
+            // most frequent first
+            std::vector<litmus_outcome_t> _outcomes;
+            uint64_t _other = 0;
+        };
+        ///<summary>
+        /// run two or more procedures (see runtime::BeginProc) concurrently, each on its own thread pinned to its own physical core, and tally the final states
+        ///</summary>
+        /// Every iteration starts with the shared variables put back as they were, then all the threads meet at a barrier and call their block at the same time.
+        /// The shared variables are the buffers (see runtime::AllocateMemory) that registers point into when Litmus is called, and every block is called with
+        /// the runtime's general purpose registers. The outcome of an iteration is the output registers of all the blocks after it, e.g. the store buffering
+        /// outcome of two blocks that each store to one variable and load the other is both loads reading 0. Each block is also timed with rdtsc around its call,
+        /// so the cost of fences and locked instructions in it can be compared across runs. Iterations run in batches, each one within the timeout.
+        /// Fails with Error::kUnsupportedCpuFeature if there are fewer physical cores than blocks.
+        bool Litmus(const std::vector<const char*>& procedures, const litmus_options_t& options, litmus_t& result);
+
+        ///<summary>
+        /// assembles a variant to run at address, for TimeVariants
+        ///</summary>
+        using variant_assembler_t = std::function<bool(size_t variant, uintptr_t address, std::vector<uint8_t>& code)>;
+        ///<summary>
+        /// timing of a variant
+        ///</summary>
+        struct variant_timing_t
+        {
+            bool _timed = false;
+            // if it wasn't, the error the assembler failed with or the fault it raised when run
+            Error _error = Error::kNoError;
+            size_t _size = 0;
+            // ticks per iteration, less the empty loop's
+            double _ticks = 0;
+        };
+        ///<summary>
+        /// time variants of a block of code natively, each in a loop in place of the main code
+        ///</summary>
+        /// Variants are assembled on up to maxThreads host threads (0 means one per logical processor, less one for the runtime thread) ahead of the runtime thread,
+        /// which times them one after the other as they become ready, so assembler has to be safe to call concurrently. Each is timed like smt and fp do,
+        /// a warm-up run of the loop and then a timed run. A variant that faults, or whose runs don't finish within timeoutMs (Error::kIterationLimitReached), is skipped,
+        /// the others are still timed.
+        bool TimeVariants(size_t variants, const variant_assembler_t& assembler, uint64_t iterations, unsigned maxThreads, unsigned timeoutMs, std::vector<variant_timing_t>& results, double& overhead);
+    }  // namespace benchmark
+}  // namespace inasm64
@@ -33,6 +33,14 @@
 #include "common.h"
 #include "x64.h"
 #include "runtime.h"
+#include "benchmark.h"
+#include "hazards.h"
+#include "superopt.h"
+#include "tune.h"
+#include "loader.h"
+#include "exporter.h"
+#include "history.h"
+#include "memdiff.h"
 #include "assembler.h"
 #include "assembler_driver.h"
 #include "globvars.h"
@@ -58,6 +66,25 @@ namespace inasm64
         std::function<void(DataType, const void*, size_t)> OnDisplayData;
         std::function<void(const std::vector<const char*>&)> OnFindInstruction;
         std::function<bool(const char*)> OnUnknownCommand;
+        std::function<void(const benchmark::interference_t&)> OnInterference;
+        std::function<void(const benchmark::core_timings_t&)> OnCoreTimings;
+        std::function<void(const loader::load_t&)> OnLoad;
+        std::function<void(const exporter::export_t&)> OnExport;
+        std::function<void(const std::string&, const std::string&)> OnPerfMap;
+        std::function<void(Error)> OnPerfMapError;
+        std::function<void(const RegisterInfo&, const std::vector<history::change_t>&)> OnRegisterHistory;
+        std::function<void(const RegisterInfo&, const history::change_t&)> OnLastChange;
+        std::function<void(const memdiff::diff_t&)> OnMemoryDiff;
+        std::function<void(const std::vector<benchmark::bandwidth_t>&)> OnBandwidth;
+        std::function<void(const std::vector<benchmark::latency_t>&)> OnLatency;
+        std::function<void(const benchmark::cache_timing_t&)> OnCacheTiming;
+        std::function<void(const std::vector<hazards::transition_t>&, const benchmark::mxcsr_timing_t*)> OnFloatHazards;
+        std::function<void(const benchmark::profile_t&)> OnProfile;
+        std::function<void(const benchmark::verify_t&)> OnVerify;
+        std::function<void(const superopt::search_t&)> OnSuperoptimise;
+        std::function<void(const tune::tuning_t&)> OnTune;
+        std::function<void(const benchmark::litmus_t&)> OnLitmus;
+        std::function<void(const std::vector<hazards::denormal_t>&)> OnDenormals;
 
         namespace
         {
@@ -68,6 +95,10 @@ namespace inasm64
 
             const void* _last_dump_address = nullptr;
             auto _initialised = false;
+            // check floating point operands for denormals when stepping ("fp on")
+            auto _check_denormals = false;
+            // the rest of the assembly input goes to the template, from the first template line on
+            auto _recording_template = false;
 
             // commands are of two types:
             //  type 0 are a command followed by parameters, i.e. "r eax 1234"
@@ -503,10 +534,97 @@ namespace inasm64
                 return type;
             }
 
+            // consumes leading allocation modifiers from params, any of
+            // large | huge
+            // local | interleave | node=<n>
+            // params is set to the first non-modifier token, or nullptr if there are none
+            bool parse_allocation_options(char*& params, runtime::allocation_options_t& options)
+            {
+                using PageSize = runtime::allocation_options_t::PageSize;
+                using NumaPolicy = runtime::allocation_options_t::NumaPolicy;
+                while(params && isalpha(int(params[0])))
+                {
+                    auto end = params;
+                    while(end[0] && end[0] != ' ')
+                        ++end;
+                    const auto token_len = size_t(end - params);
+                    const auto is_token = [params, token_len](const char* token) {
+                        return strlen(token) == token_len && strncmp(params, token, token_len) == 0;
+                    };
+                    if(is_token("large"))
+                        options._page_size = PageSize::kLarge;
+                    else if(is_token("huge"))
+                        options._page_size = PageSize::kHuge;
+                    else if(is_token("local"))
+                        options._numa_policy = NumaPolicy::kLocal;
+                    else if(is_token("interleave"))
+                        options._numa_policy = NumaPolicy::kInterleave;
+                    else if(token_len > 5 && strncmp(params, "node=", 5) == 0 && detail::starts_with_decimal_integer(params + 5))
+                    {
+                        options._numa_policy = NumaPolicy::kNode;
+                        options._node = unsigned(::strtoul(params + 5, nullptr, 10));
+                    }
+                    else
+                    {
+                        detail::set_error(Error::kInvalidCommandFormat);
+                        return false;
+                    }
+                    while(end[0] == ' ')
+                        ++end;
+                    params = end[0] ? end : nullptr;
+                }
+                return true;
+            }
+
+            // optional [random|page|cross] page crossing policy of a pointer chain
+            bool parse_page_crossing(char*& params, benchmark::PageCrossing& crossing)
+            {
+                if(!params)
+                    return true;
+                auto end = params;
+                while(end[0] && end[0] != ' ')
+                    ++end;
+                const auto token_len = size_t(end - params);
+                const auto is_token = [params, token_len](const char* token) {
+                    return strlen(token) == token_len && strncmp(params, token, token_len) == 0;
+                };
+                if(is_token("random"))
+                    crossing = benchmark::PageCrossing::kRandom;
+                else if(is_token("page"))
+                    crossing = benchmark::PageCrossing::kWithinPage;
+                else if(is_token("cross"))
+                    crossing = benchmark::PageCrossing::kEveryLoad;
+                else
+                    return true;
+                while(end[0] == ' ')
+                    ++end;
+                params = end[0] ? end : nullptr;
+                return true;
+            }
+
+            // optional size, i.e. a stride, advancing params past it
+            bool parse_optional_size(char*& params, size_t& size)
+            {
+                if(!params || !isdigit(int(params[0])))
+                    return true;
+                if(!detail::parse_size(params, size))
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return false;
+                }
+                while(params[0] && params[0] != ' ')
+                    ++params;
+                while(params[0] == ' ')
+                    ++params;
+                if(!params[0])
+                    params = nullptr;
+                return true;
+            }
+
             // =========================================================================================
             // command handlers
 
-            // <varname> d[b|w|d...] <values>
+            // <varname> d[b|w|d...] [allocation modifiers] <values>
             void data_value_handler(const char* argname, const char* cmd, char* params)
             {
                 std::vector<uint8_t> data;
@@ -516,11 +634,15 @@ namespace inasm64
                     detail::set_error(Error::kInvalidCommandFormat);
                     return;
                 }
-                parse_values(type, params, data);
+                runtime::allocation_options_t options;
+                if(!parse_allocation_options(params, options))
+                    return;
+                if(params)
+                    parse_values(type, params, data);
 
                 if(!data.empty())
                 {
-                    const auto handle = runtime::AllocateMemory(data.size());
+                    const auto handle = runtime::AllocateMemory(data.size(), options);
                     if(handle)
                     {
                         runtime::WriteBytes(handle, data.data(), data.size());
@@ -536,6 +658,72 @@ namespace inasm64
                 }
             }
 
+            // <varname> buf <size> [allocation modifiers]
+            void buffer_handler(const char* argname, const char*, char* params)
+            {
+                size_t size = 0;
+                if(!params || !detail::parse_size(params, size) || !size)
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                while(params[0] && params[0] != ' ')
+                    ++params;
+                while(params[0] == ' ')
+                    ++params;
+                if(!params[0])
+                    params = nullptr;
+
+                runtime::allocation_options_t options;
+                if(!parse_allocation_options(params, options))
+                    return;
+                if(params)
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                // allocations are always zero initialised
+                const auto handle = runtime::AllocateMemory(size, options);
+                if(handle)
+                {
+                    globvars::Set(argname, uintptr_t(handle));
+                    if(OnDataValueSet)
+                        OnDataValueSet(argname, uintptr_t(handle));
+                }
+            }
+
+            // <varname> chain <size> [stride] [random|page|cross] [allocation modifiers]
+            void pointer_chain_handler(const char* argname, const char*, char* params)
+            {
+                size_t size = 0;
+                if(!params || !isdigit(int(params[0])))
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                size_t stride = 64;
+                auto crossing = benchmark::PageCrossing::kRandom;
+                runtime::allocation_options_t options;
+                if(!parse_optional_size(params, size) || !parse_optional_size(params, stride) || !parse_page_crossing(params, crossing) || !parse_allocation_options(params, options))
+                    return;
+                if(params || !size)
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                const auto handle = runtime::AllocateMemory(size, options);
+                if(!handle)
+                    return;
+                if(!benchmark::BuildPointerChain(handle, size, stride, crossing))
+                {
+                    runtime::FreeMemory(handle);
+                    return;
+                }
+                globvars::Set(argname, uintptr_t(handle));
+                if(OnDataValueSet)
+                    OnDataValueSet(argname, uintptr_t(handle));
+            }
+
             // r <regname> [value| d[b|w|...] values]
             void register_handler(const char* cmd, char* params)
             {
@@ -590,7 +778,8 @@ namespace inasm64
                                 {
                                     data.push_back(0);
                                 }
-                                runtime::SetReg(reg_info, data.data(), data.size());
+                                if(runtime::SetReg(reg_info, data.data(), data.size()))
+                                    history::Sync();
                             }
                         }
                         if(GetError() == Error::kNoError)
@@ -667,11 +856,559 @@ namespace inasm64
                     }
                 }
                 const auto address = runtime::InstructionPointer();
-                const auto stepped = runtime::Step();
+                history::Begin();
+                std::vector<hazards::denormal_t> denormals;
+                const auto stepped = _check_denormals ? hazards::CheckedStep(denormals) : runtime::Step();
+                if(stepped)
+                    history::Record(history::Source::kInstruction, address);
                 if(stepped && OnStep)
                 {
                     OnStep(address);
                 }
+                if(!denormals.empty() && OnDenormals)
+                    OnDenormals(denormals);
+            }
+
+            // g, go <iteration limit>
+            void go_handler(const char*, char* limit)
+            {
+                auto iteration_limit = runtime::kDefaultIterationLimit;
+                if(limit)
+                {
+                    if(!detail::starts_with_decimal_integer(limit))
+                    {
+                        detail::set_error(Error::kInvalidCommandFormat);
+                        return;
+                    }
+                    iteration_limit = ::strtoull(limit, nullptr, 10);
+                }
+                const auto address = runtime::InstructionPointer();
+                history::Begin();
+                const auto ran = runtime::Run(iteration_limit);
+                if(ran || GetError() == Error::kIterationLimitReached)
+                    history::Record(history::Source::kRun, address);
+                // also report where we stopped if the iteration limit was reached
+                if((ran || GetError() == Error::kIterationLimitReached) && OnStep)
+                {
+                    OnStep(address);
+                }
+            }
+
+            // splits "<reg> [rest]" and looks up the register
+            bool history_register(char* params, RegisterInfo& reg, char*& rest)
+            {
+                if(!params)
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return false;
+                }
+                rest = strchr(params, ' ');
+                if(rest)
+                {
+                    *rest++ = 0;
+                    while(rest[0] == ' ')
+                        ++rest;
+                    if(!rest[0])
+                        rest = nullptr;
+                }
+                reg = GetRegisterInfo(params);
+                if(!reg)
+                {
+                    detail::set_error(Error::kInvalidRegisterName);
+                    return false;
+                }
+                return true;
+            }
+
+            // hist <reg> [from[-to]]
+            void register_history_handler(const char*, char* params)
+            {
+                RegisterInfo reg;
+                char* range;
+                if(!history_register(params, reg, range))
+                    return;
+                uint64_t from = 0;
+                auto to = history::Steps();
+                if(range)
+                {
+                    if(!detail::starts_with_decimal_integer(range))
+                    {
+                        detail::set_error(Error::kInvalidCommandFormat);
+                        return;
+                    }
+                    char* end;
+                    from = ::strtoull(range, &end, 10);
+                    if(end[0] == '-')
+                    {
+                        if(!detail::starts_with_decimal_integer(end + 1))
+                        {
+                            detail::set_error(Error::kInvalidCommandFormat);
+                            return;
+                        }
+                        to = ::strtoull(end + 1, &end, 10);
+                    }
+                    if(end[0])
+                    {
+                        detail::set_error(Error::kInvalidCommandFormat);
+                        return;
+                    }
+                }
+                std::vector<history::change_t> changes;
+                if(history::Changes(reg, from, to, changes) && OnRegisterHistory)
+                    OnRegisterHistory(reg, changes);
+            }
+
+            // who <reg> [step]
+            void last_change_handler(const char*, char* params)
+            {
+                RegisterInfo reg;
+                char* at;
+                if(!history_register(params, reg, at))
+                    return;
+                auto step = history::Steps();
+                if(at)
+                {
+                    char* end;
+                    step = ::strtoull(at, &end, 10);
+                    if(!detail::starts_with_decimal_integer(at) || end[0])
+                    {
+                        detail::set_error(Error::kInvalidCommandFormat);
+                        return;
+                    }
+                }
+                history::change_t change;
+                if(history::LastChange(reg, step, change) && OnLastChange)
+                    OnLastChange(reg, change);
+            }
+
+            // bp <line> [condition]
+            void breakpoint_handler(const char*, char* params)
+            {
+                if(!params || !detail::starts_with_decimal_integer(params))
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                char* condition;
+                const auto line = size_t(::strtoull(params, &condition, 10));
+                while(condition[0] == ' ')
+                    ++condition;
+                runtime::SetBreakpoint(line, condition);
+            }
+
+            // bc <line>
+            void clear_breakpoint_handler(const char*, char* params)
+            {
+                if(!params || !detail::starts_with_decimal_integer(params))
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                runtime::ClearBreakpoint(size_t(::strtoull(params, nullptr, 10)));
+            }
+
+            // smt <proc> [iterations]
+            void interference_handler(const char*, char* params)
+            {
+                if(!params)
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                auto iterations = benchmark::kDefaultIterations;
+                const auto separator = strchr(params, ' ');
+                if(separator)
+                {
+                    *separator = 0;
+                    auto count = separator + 1;
+                    while(count[0] == ' ')
+                        ++count;
+                    if(!detail::starts_with_decimal_integer(count))
+                    {
+                        detail::set_error(Error::kInvalidCommandFormat);
+                        return;
+                    }
+                    iterations = ::strtoull(count, nullptr, 10);
+                }
+                benchmark::interference_t result;
+                if(benchmark::MeasureInterference(params, iterations, result) && OnInterference)
+                    OnInterference(result);
+            }
+
+            // cores [iterations]
+            void cores_handler(const char*, char* params)
+            {
+                auto iterations = benchmark::kDefaultIterations;
+                if(params)
+                {
+                    if(!detail::starts_with_decimal_integer(params))
+                    {
+                        detail::set_error(Error::kInvalidCommandFormat);
+                        return;
+                    }
+                    iterations = ::strtoull(params, nullptr, 10);
+                }
+                benchmark::core_timings_t result;
+                if(benchmark::MeasureCores(iterations, result) && OnCoreTimings)
+                    OnCoreTimings(result);
+            }
+
+            // bw <buffer> [threads] [stride] [size]
+            void bandwidth_handler(const char*, char* params)
+            {
+                if(!params)
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                const auto tokens = detail::simple_tokenise(params, 4);
+                size_t values[4] = { 0 };
+                if(tokens._num_tokens > 4)
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                for(unsigned n = 0; n < tokens._num_tokens; ++n)
+                {
+                    if(!detail::parse_size(params + tokens._token_idx[n], values[n]))
+                    {
+                        detail::set_error(Error::kInvalidCommandFormat);
+                        return;
+                    }
+                }
+                benchmark::bandwidth_options_t options;
+                options._max_threads = unsigned(values[1]);
+                if(tokens._num_tokens > 2)
+                    options._stride = values[2];
+                options._size = values[3];
+                std::vector<benchmark::bandwidth_t> results;
+                if(benchmark::MeasureBandwidth(reinterpret_cast<const void*>(values[0]), options, results) && OnBandwidth)
+                    OnBandwidth(results);
+            }
+
+            // lat [max size] [stride] [random|page|cross] [allocation modifiers]
+            void latency_handler(const char*, char* params)
+            {
+                benchmark::latency_options_t options;
+                if(!parse_optional_size(params, options._max_size) || !parse_optional_size(params, options._stride) || !parse_page_crossing(params, options._crossing) || !parse_allocation_options(params, options._allocation))
+                    return;
+                if(params)
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                std::vector<benchmark::latency_t> results;
+                if(benchmark::MeasureLatency(options, results) && OnLatency)
+                    OnLatency(results);
+            }
+
+            // cache <buffer> <none|cold|warm|l2|l3>
+            void cache_state_handler(const char*, char* params)
+            {
+                const auto tokens = detail::simple_tokenise(params ? params : "", 2);
+                size_t buffer;
+                if(tokens._num_tokens != 2 || !detail::parse_size(params + tokens._token_idx[0], buffer))
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                const auto state = params + tokens._token_idx[1];
+                const auto state_len = size_t(tokens._token_end_idx[1] - tokens._token_idx[1]);
+                const auto is_state = [state, state_len](const char* name) {
+                    return strlen(name) == state_len && strncmp(state, name, state_len) == 0;
+                };
+                using CacheState = runtime::CacheState;
+                if(is_state("none"))
+                    runtime::SetCacheState(reinterpret_cast<const void*>(buffer), CacheState::kAsIs);
+                else if(is_state("cold"))
+                    runtime::SetCacheState(reinterpret_cast<const void*>(buffer), CacheState::kCold);
+                else if(is_state("warm"))
+                    runtime::SetCacheState(reinterpret_cast<const void*>(buffer), CacheState::kWarm);
+                else if(is_state("l2"))
+                    runtime::SetCacheState(reinterpret_cast<const void*>(buffer), CacheState::kL2);
+                else if(is_state("l3"))
+                    runtime::SetCacheState(reinterpret_cast<const void*>(buffer), CacheState::kL3);
+                else
+                    detail::set_error(Error::kInvalidCommandFormat);
+            }
+
+            // time [iterations] [runs]
+            void cache_timing_handler(const char*, char* params)
+            {
+                size_t iterations = 1;
+                size_t runs = benchmark::kDefaultRuns;
+                if(!parse_optional_size(params, iterations) || !parse_optional_size(params, runs))
+                    return;
+                if(params)
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                benchmark::cache_timing_t result;
+                if(benchmark::MeasureCacheStates(iterations, runs, result) && OnCacheTiming)
+                    OnCacheTiming(result);
+            }
+
+            // fp [iterations] | fp on|off
+            void float_hazards_handler(const char*, char* params)
+            {
+                if(params && (strcmp(params, "on") == 0 || strcmp(params, "off") == 0))
+                {
+                    _check_denormals = params[1] == 'n';
+                    return;
+                }
+                size_t iterations = benchmark::kDefaultIterations;
+                if(!parse_optional_size(params, iterations))
+                    return;
+                if(params)
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                std::vector<hazards::transition_t> transitions;
+                if(!hazards::FindSseAvxTransitions(transitions))
+                    return;
+                benchmark::mxcsr_timing_t timing;
+                const auto timed = runtime::ActiveBackend() == runtime::Backend::kDebuggee;
+                if(timed && !benchmark::MeasureFlushToZero(iterations, timing))
+                    return;
+                if(OnFloatHazards)
+                    OnFloatHazards(transitions, timed ? &timing : nullptr);
+            }
+
+            // prof [samples] [interval us]
+            void profile_handler(const char*, char* params)
+            {
+                size_t samples = 10000;
+                size_t interval = 100;
+                if(!parse_optional_size(params, samples) || !parse_optional_size(params, interval))
+                    return;
+                if(params || !interval || interval > 1000000)
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                benchmark::profile_t result;
+                if(benchmark::Profile(samples, unsigned(interval), result) && OnProfile)
+                    OnProfile(result);
+            }
+
+            // verify <reference> <candidate> [trials] [outputs]
+            void verify_handler(const char*, char* params)
+            {
+                if(!params)
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                const auto tokens = detail::simple_tokenise(params, 4);
+                if(tokens._num_tokens < 2 || tokens._num_tokens > 4)
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                for(unsigned n = 0; n < tokens._num_tokens; ++n)
+                    params[tokens._token_end_idx[n]] = 0;
+                benchmark::verify_options_t options;
+                // the return value and the buffers
+                char default_outputs[] = "rax,mem";
+                auto outputs = default_outputs;
+                for(unsigned n = 2; n < tokens._num_tokens; ++n)
+                {
+                    const auto token = params + tokens._token_idx[n];
+                    if(isdigit(int(token[0])))
+                    {
+                        size_t trials;
+                        if(!detail::parse_size(token, trials))
+                        {
+                            detail::set_error(Error::kInvalidCommandFormat);
+                            return;
+                        }
+                        options._trials = trials;
+                    }
+                    else
+                        outputs = token;
+                }
+                // comma separated registers, "flags", and "mem"
+                options._memory = false;
+                for(auto output = outputs; output;)
+                {
+                    const auto comma = strchr(output, ',');
+                    if(comma)
+                        *comma = 0;
+                    if(strcmp(output, "flags") == 0)
+                        options._flags = true;
+                    else if(strcmp(output, "mem") == 0)
+                        options._memory = true;
+                    else
+                    {
+                        const auto reg = GetRegisterInfo(output);
+                        if(!reg)
+                        {
+                            detail::set_error(Error::kInvalidRegisterName);
+                            return;
+                        }
+                        options._registers.push_back(reg);
+                    }
+                    output = comma ? comma + 1 : nullptr;
+                }
+                benchmark::verify_t result;
+                if(benchmark::Verify(params + tokens._token_idx[0], params + tokens._token_idx[1], options, result) && OnVerify)
+                    OnVerify(result);
+            }
+
+            // sopt <proc> [max length] [flags]
+            void superoptimise_handler(const char*, char* params)
+            {
+                if(!params)
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                const auto tokens = detail::simple_tokenise(params, 3);
+                if(tokens._num_tokens > 3)
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                for(unsigned n = 0; n < tokens._num_tokens; ++n)
+                    params[tokens._token_end_idx[n]] = 0;
+                superopt::options_t options;
+                for(unsigned n = 1; n < tokens._num_tokens; ++n)
+                {
+                    const auto token = params + tokens._token_idx[n];
+                    if(strcmp(token, "flags") == 0)
+                        options._flags = true;
+                    else if(detail::starts_with_decimal_integer(token))
+                        options._max_length = unsigned(::strtoul(token, nullptr, 10));
+                    else
+                    {
+                        detail::set_error(Error::kInvalidCommandFormat);
+                        return;
+                    }
+                }
+                superopt::search_t result;
+                if(superopt::Search(params, options, result) && OnSuperoptimise)
+                    OnSuperoptimise(result);
+            }
+
+            // litmus <proc> <proc> ... [iterations] [outputs]
+            void litmus_handler(const char*, char* params)
+            {
+                if(!params)
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                benchmark::litmus_options_t options;
+                std::vector<const char*> procedures;
+                for(auto token = params; token[0];)
+                {
+                    const auto length = strcspn(token, " ");
+                    auto next = token + length + (token[length] ? 1 : 0);
+                    token[length] = 0;
+                    while(next[0] == ' ')
+                        ++next;
+                    if(isdigit(int(token[0])))
+                    {
+                        size_t iterations;
+                        if(!detail::parse_size(token, iterations))
+                        {
+                            detail::set_error(Error::kInvalidCommandFormat);
+                            return;
+                        }
+                        options._iterations = iterations;
+                    }
+                    else if(!strchr(token, ',') && !GetRegisterInfo(token))
+                        procedures.push_back(token);
+                    else
+                    {
+                        // comma separated registers
+                        for(auto output = token; output;)
+                        {
+                            const auto comma = strchr(output, ',');
+                            if(comma)
+                                *comma = 0;
+                            const auto reg = GetRegisterInfo(output);
+                            if(!reg)
+                            {
+                                detail::set_error(Error::kInvalidRegisterName);
+                                return;
+                            }
+                            options._outputs.push_back(reg);
+                            output = comma ? comma + 1 : nullptr;
+                        }
+                    }
+                    token = next;
+                }
+                benchmark::litmus_t result;
+                if(benchmark::Litmus(procedures, options, result) && OnLitmus)
+                    OnLitmus(result);
+            }
+
+            // tune <name>=<values> ... [iterations], values are comma separated numbers or ranges (lo..hi)
+            void tune_handler(const char*, char* params)
+            {
+                if(!params)
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                std::vector<tune::parameter_t> grid;
+                auto iterations = benchmark::kDefaultIterations;
+                for(auto token = params; token[0];)
+                {
+                    const auto length = strcspn(token, " ");
+                    const auto next = token + length + (token[length] ? 1 : 0);
+                    token[length] = 0;
+                    const auto equals = strchr(token, '=');
+                    if(!equals)
+                    {
+                        if(!detail::starts_with_decimal_integer(token))
+                        {
+                            detail::set_error(Error::kInvalidCommandFormat);
+                            return;
+                        }
+                        iterations = ::strtoull(token, nullptr, 10);
+                    }
+                    else
+                    {
+                        *equals = 0;
+                        tune::parameter_t parameter;
+                        parameter._name = token;
+                        for(auto value = equals + 1; value;)
+                        {
+                            const auto comma = strchr(value, ',');
+                            if(comma)
+                                *comma = 0;
+                            char* end;
+                            const auto low = int64_t(::strtoll(value, &end, 0));
+                            auto high = low;
+                            if(end != value && end[0] == '.' && end[1] == '.')
+                            {
+                                const auto from = end + 2;
+                                high = int64_t(::strtoll(from, &end, 0));
+                                if(end == from)
+                                    end = value;
+                            }
+                            if(end == value || end[0] || high < low || size_t(high - low) >= tune::kMaxVariants)
+                            {
+                                detail::set_error(Error::kInvalidCommandFormat);
+                                return;
+                            }
+                            for(auto v = low; v <= high; ++v)
+                                parameter._values.push_back(v);
+                            value = comma ? comma + 1 : nullptr;
+                        }
+                        grid.push_back(std::move(parameter));
+                    }
+                    token = next;
+                    while(token[0] == ' ')
+                        ++token;
+                }
+                tune::tuning_t result;
+                if(tune::Tune(grid, iterations, result) && OnTune)
+                    OnTune(result);
             }
 
             // varname d[b|w|....]
@@ -755,6 +1492,128 @@ namespace inasm64
                 }
             }
 
+            // load <file> [symbol], the file name can be in quotes
+            void load_handler(const char*, char* params)
+            {
+                if(!params)
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                auto path = params;
+                char* symbol = nullptr;
+                const auto path_end = path[0] == '"' ? strchr(++path, '"') : strchr(path, ' ');
+                if(params[0] == '"' && !path_end)
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                if(path_end)
+                {
+                    *path_end = 0;
+                    symbol = path_end + 1;
+                    while(symbol[0] == ' ')
+                        ++symbol;
+                    symbol[strcspn(symbol, " ")] = 0;
+                }
+                loader::load_t result;
+                if(loader::Load(path, symbol, result) && OnLoad)
+                    OnLoad(result);
+            }
+
+            // export <file> [block ...], the file name can be in quotes
+            void export_handler(const char*, char* params)
+            {
+                if(!params)
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                auto path = params;
+                const auto path_end = path[0] == '"' ? strchr(++path, '"') : strchr(path, ' ');
+                if(params[0] == '"' && !path_end)
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                std::vector<std::string> blocks;
+                if(path_end)
+                {
+                    *path_end = 0;
+                    auto name = path_end + 1;
+                    while(name[0])
+                    {
+                        while(name[0] == ' ')
+                            ++name;
+                        const auto length = strcspn(name, " ");
+                        if(length)
+                            blocks.emplace_back(name, length);
+                        name += length;
+                    }
+                }
+                exporter::export_t result;
+                if(exporter::Export(path, blocks, result) && OnExport)
+                    OnExport(result);
+            }
+
+            // mdiff [on|off]
+            void memory_diff_handler(const char*, char* params)
+            {
+                if(params)
+                {
+                    if(_stricmp(params, "on") == 0)
+                        memdiff::Begin();
+                    else if(_stricmp(params, "off") == 0)
+                        memdiff::End();
+                    else
+                        detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                memdiff::diff_t result;
+                if(memdiff::Diff(result) && OnMemoryDiff)
+                    OnMemoryDiff(result);
+            }
+
+            // perfmap <off|lines|blocks> [jitdump]
+            void perf_map_handler(const char*, char* params)
+            {
+                if(!params)
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                auto jitdump = false;
+                const auto separator = strchr(params, ' ');
+                if(separator)
+                {
+                    *separator = 0;
+                    auto option = separator + 1;
+                    while(option[0] == ' ')
+                        ++option;
+                    if(_stricmp(option, "jitdump") != 0)
+                    {
+                        detail::set_error(Error::kInvalidCommandFormat);
+                        return;
+                    }
+                    jitdump = true;
+                }
+                runtime::PerfMap map;
+                if(_stricmp(params, "off") == 0)
+                    map = runtime::PerfMap::kOff;
+                else if(_stricmp(params, "lines") == 0)
+                    map = runtime::PerfMap::kLines;
+                else if(_stricmp(params, "blocks") == 0)
+                    map = runtime::PerfMap::kBlocks;
+                else
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return;
+                }
+                std::string map_path, jitdump_path;
+                if(runtime::SetPerfMap(map, jitdump, map_path, jitdump_path) && OnPerfMap)
+                    OnPerfMap(map_path, jitdump_path);
+            }
+
             void assemble_handler(const char*, char* loc)
             {
                 if(loc)
@@ -787,10 +1646,21 @@ namespace inasm64
             {
                 Type1Command cmd1;
                 cmd1.set_aliases(8, "db", "dw", "dd", "dq", "dx", "dy", "dfs", "dfd");
-                _help_texts.emplace_back("varname d[b|w|d|q|fs|fd] <data...>", "create a variable \"$varname\" pointing to data");
+                _help_texts.emplace_back("varname d[b|w|d|q|fs|fd] [alloc] <data...>", "create a variable \"$varname\" pointing to data");
                 cmd1._handler = data_value_handler;
                 _type_1_handlers.emplace_back(std::move(cmd1));
 
+                cmd1.set_aliases(2, "buf", "buffer");
+                _help_texts.emplace_back("varname buf <size[k|m|g]> [alloc]", "create a variable \"$varname\" pointing to a zeroed buffer");
+                cmd1._handler = buffer_handler;
+                _type_1_handlers.emplace_back(std::move(cmd1));
+
+                cmd1.set_aliases(1, "chain");
+                _help_texts.emplace_back("varname chain <size> [stride] [random|page|cross] [alloc]", "create a variable \"$varname\" pointing to a random cycle of pointers, one every stride (64) bytes");
+                cmd1._handler = pointer_chain_handler;
+                _type_1_handlers.emplace_back(std::move(cmd1));
+                _help_texts.emplace_back("  [alloc]", "[large|huge] [local|interleave|node=N] page size and NUMA placement");
+
                 Type0Command cmd0;
                 cmd0.set_aliases(3, "r", "rX", "rY");
                 _help_texts.emplace_back("r[X|Y] [regName] <value>", "display or set GPR, XMM, or YMM register(s)");
@@ -808,6 +1678,111 @@ namespace inasm64
                 cmd0._handler = step_handler;
                 _type_0_handlers.emplace_back(std::move(cmd0));
 
+                cmd0.set_aliases(2, "g", "go");
+                _help_texts.emplace_back("g|go [limit]", "run to the end of the code, stops after limit loop iterations (default 1000000, 0 = no limit)");
+                cmd0._handler = go_handler;
+                _type_0_handlers.emplace_back(std::move(cmd0));
+
+                cmd0.set_aliases(1, "hist");
+                _help_texts.emplace_back("hist <regName> [from[-to]]", "values of a GPR, XMM or eflags register over the steps taken, from the value it had at step from");
+                cmd0._handler = register_history_handler;
+                _type_0_handlers.emplace_back(std::move(cmd0));
+
+                cmd0.set_aliases(1, "who");
+                _help_texts.emplace_back("who <regName> [step]", "the step and line that last changed a register, up to step");
+                cmd0._handler = last_change_handler;
+                _type_0_handlers.emplace_back(std::move(cmd0));
+
+                cmd0.set_aliases(1, "bp");
+                _help_texts.emplace_back("bp <line> [condition]", "stop g|go before line when condition (e.g. rcx == 0) is true, or always");
+                cmd0._handler = breakpoint_handler;
+                _type_0_handlers.emplace_back(std::move(cmd0));
+
+                cmd0.set_aliases(1, "bc");
+                _help_texts.emplace_back("bc <line>", "clear the breakpoint at line");
+                cmd0._handler = clear_breakpoint_handler;
+                _type_0_handlers.emplace_back(std::move(cmd0));
+
+                cmd0.set_aliases(1, "smt");
+                _help_texts.emplace_back("smt <proc> [iterations]", "time the code natively, alone and with procedure proc looping on the SMT sibling core");
+                cmd0._handler = interference_handler;
+                _type_0_handlers.emplace_back(std::move(cmd0));
+
+                cmd0.set_aliases(1, "cores");
+                _help_texts.emplace_back("cores [iterations]", "time the code natively on each logical processor in turn, grouped by kind of core");
+                cmd0._handler = cores_handler;
+                _type_0_handlers.emplace_back(std::move(cmd0));
+
+                cmd0.set_aliases(1, "bw");
+                _help_texts.emplace_back("bw <buffer> [threads] [stride] [size]", "stream the code over buffer (rsi = element, rdi = slice end) on 1..threads threads and report GB/s");
+                cmd0._handler = bandwidth_handler;
+                _type_0_handlers.emplace_back(std::move(cmd0));
+
+                cmd0.set_aliases(1, "lat");
+                _help_texts.emplace_back("lat [max size] [stride] [random|page|cross] [alloc]", "time mov rax, [rax] over pointer chains from 4K to max size (1G) and report the load latency");
+                cmd0._handler = latency_handler;
+                _type_0_handlers.emplace_back(std::move(cmd0));
+
+                cmd0.set_aliases(1, "cache");
+                _help_texts.emplace_back("cache <buffer> <none|cold|warm|l2|l3>", "the cache state time puts buffer in before each run");
+                cmd0._handler = cache_state_handler;
+                _type_0_handlers.emplace_back(std::move(cmd0));
+
+                cmd0.set_aliases(1, "time");
+                _help_texts.emplace_back("time [iterations] [runs]", "time runs of the code (1, 1000), hot and with buffers in their cache states");
+                cmd0._handler = cache_timing_handler;
+                _type_0_handlers.emplace_back(std::move(cmd0));
+
+                cmd0.set_aliases(1, "fp");
+                _help_texts.emplace_back("fp [iterations] | fp on|off", "report SSE/AVX transitions and time the code with FTZ/DAZ, or check for denormals when stepping");
+                cmd0._handler = float_hazards_handler;
+                _type_0_handlers.emplace_back(std::move(cmd0));
+
+                cmd0.set_aliases(1, "prof");
+                _help_texts.emplace_back("prof [samples] [interval us]", "sample the code run in a loop (10000, 100) and show where the time goes, line by line");
+                cmd0._handler = profile_handler;
+                _type_0_handlers.emplace_back(std::move(cmd0));
+
+                cmd0.set_aliases(1, "verify");
+                _help_texts.emplace_back("verify <reference> <candidate> [trials] [outputs]", "run two procs from randomised inputs (10000) and compare outputs (rax,mem), e.g. rax,rdx,xmm0,flags,mem");
+                cmd0._handler = verify_handler;
+                _type_0_handlers.emplace_back(std::move(cmd0));
+
+                cmd0.set_aliases(1, "sopt");
+                _help_texts.emplace_back("sopt <proc> [max length] [flags]", "search for cheaper sequences (up to 2 instructions) computing the same registers (and flags) as proc");
+                cmd0._handler = superoptimise_handler;
+                _type_0_handlers.emplace_back(std::move(cmd0));
+
+                cmd0.set_aliases(1, "litmus");
+                _help_texts.emplace_back("litmus <proc> <proc> ... [iterations] [outputs]", "run procs together on separate cores (1000000 times) and tally their outputs (rax), e.g. rax,rdx");
+                cmd0._handler = litmus_handler;
+                _type_0_handlers.emplace_back(std::move(cmd0));
+
+                cmd0.set_aliases(1, "tune");
+                _help_texts.emplace_back("tune <name>=<values> ... [iterations]", "time the template for every combination of values (e.g. U=1,2,4 D=0..3), ranked fastest first");
+                cmd0._handler = tune_handler;
+                _type_0_handlers.emplace_back(std::move(cmd0));
+
+                cmd0.set_aliases(1, "load");
+                _help_texts.emplace_back("load <file> [symbol]", "load a flat binary, or a function from an ELF object, as lines from the next line on");
+                cmd0._handler = load_handler;
+                _type_0_handlers.emplace_back(std::move(cmd0));
+
+                cmd0.set_aliases(1, "export");
+                _help_texts.emplace_back("export <file> [block ...]", "write the code as an ELF object with a symbol per block (main code and procedures) and a DWARF line table");
+                cmd0._handler = export_handler;
+                _type_0_handlers.emplace_back(std::move(cmd0));
+
+                cmd0.set_aliases(1, "mdiff");
+                _help_texts.emplace_back("mdiff [on|off]", "track writes to allocations from now (on), or list the bytes of each variable changed since");
+                cmd0._handler = memory_diff_handler;
+                _type_0_handlers.emplace_back(std::move(cmd0));
+
+                cmd0.set_aliases(1, "perfmap");
+                _help_texts.emplace_back("perfmap <off|lines|blocks> [jitdump]", "on every commit write a perf map (and jitdump) with a symbol per line or block to %TEMP%");
+                cmd0._handler = perf_map_handler;
+                _type_0_handlers.emplace_back(std::move(cmd0));
+
                 cmd0.set_aliases(2, "a", "asm");
                 _help_texts.emplace_back("a|asm [address|line]", "enter assembly mode, next or at address/line");
                 cmd0._handler = assemble_handler;
@@ -816,12 +1791,22 @@ namespace inasm64
                 cmd0.set_aliases(2, "q", "quit");
                 _help_texts.emplace_back("q|quit", "quit inasm64");
                 cmd0._handler = [](const char*, char*) {
-                    runtime::Shutdown();
+                    runtime::Shutdown(false);
                     if(OnQuit)
                         OnQuit();
                 };
                 _type_0_handlers.emplace_back(std::move(cmd0));
 
+                cmd0.set_aliases(1, "restart");
+                _help_texts.emplace_back("restart", "start a fresh runtime process, e.g. after a fault; code, buffers and history are discarded");
+                cmd0._handler = [](const char*, char*) {
+                    const auto backend = runtime::ActiveBackend();
+                    runtime::Shutdown();
+                    history::Clear();
+                    runtime::Start(8192, backend);
+                };
+                _type_0_handlers.emplace_back(std::move(cmd0));
+
                 cmd0.set_aliases(2, "h", "help");
                 _help_texts.emplace_back("h|help", "display help on commands");
                 cmd0._handler = [](const char*, char*) {
@@ -834,6 +1819,7 @@ namespace inasm64
                 _help_texts.emplace_back("cc|clearcode", "clear and reset all assembled code");
                 cmd0._handler = [](const char*, char*) {
                     runtime::Reset();
+                    history::Clear();
                 };
                 _type_0_handlers.emplace_back(std::move(cmd0));
 
@@ -949,17 +1935,68 @@ namespace inasm64
             {
                 if(is_empty)
                 {
-                    runtime::CommmitInstructions();
+                    if(runtime::CommmitInstructions() && runtime::PerfMapError() != Error::kNoError && OnPerfMapError)
+                        OnPerfMapError(runtime::PerfMapError());
                     _mode = Mode::Processing;
+                    _recording_template = false;
                     result = true;
                     if(OnStopAssembling)
                         OnStopAssembling();
                 }
+                else if(_recording_template || tune::IsTemplateLine(cmdLineBuffer))
+                {
+                    // template lines are assembled by tune, for each variant
+                    tune::AddTemplateLine(cmdLineBuffer, !_recording_template);
+                    _recording_template = true;
+                    result = true;
+                }
                 else
                 {
+                    // "label:" labels the next instruction, which can follow on the same line
+                    auto instruction = cmdLineBuffer;
+                    const auto token_length = strcspn(cmdLineBuffer, " \t");
+                    if(token_length > 1 && cmdLineBuffer[token_length - 1] == ':')
+                    {
+                        cmdLineBuffer[token_length - 1] = 0;
+                        _strlwr_s(cmdLineBuffer, token_length);
+                        if(!runtime::AddLabel(cmdLineBuffer))
+                        {
+                            _freea(cmdLineBuffer);
+                            return false;
+                        }
+                        instruction += token_length;
+                        while(instruction[0] == ' ' || instruction[0] == '\t')
+                            ++instruction;
+                        if(!instruction[0])
+                        {
+                            _freea(cmdLineBuffer);
+                            return true;
+                        }
+                    }
+
+                    // "proc name" ... "endp" delimit a procedure
+                    if(_strnicmp(instruction, "proc ", 5) == 0 || _stricmp(instruction, "endp") == 0)
+                    {
+                        if(instruction[0] == 'e' || instruction[0] == 'E')
+                        {
+                            result = runtime::EndProc();
+                        }
+                        else
+                        {
+                            auto name = instruction + 5;
+                            while(name[0] == ' ')
+                                ++name;
+                            name[strcspn(name, " \t")] = 0;
+                            _strlwr_s(name, strlen(name) + 1);
+                            result = runtime::BeginProc(name);
+                        }
+                        _freea(cmdLineBuffer);
+                        return result;
+                    }
+
                     auto index = runtime::NextInstructionIndex();
                     assembler::AssembledInstructionInfo asm_info;
-                    if(!assembler::Assemble(cmdLineBuffer, asm_info, index._address))
+                    if(!assembler::Assemble(instruction, asm_info, index._address))
                     {
                         if(OnAssembleError)
                             _mode = OnAssembleError() ? Mode::Assembling : Mode::Processing;
@@ -968,7 +2005,7 @@ namespace inasm64
                     }
                     else
                     {
-                        index = runtime::AddInstruction(asm_info._instruction, asm_info._size);
+                        index = runtime::AddInstruction(asm_info._instruction, asm_info._size, asm_info._branch_target);
                         result = index._address != 0;
                         if(!result)
                         {
@@ -158,6 +158,63 @@ namespace inasm64
         // invoked on instruction find with the list of prefix-matching instructions supported by the driver
         extern std::function<void(const std::vector<const char*>&)> OnFindInstruction;
 
+        // result of timing the code with a co-runner on the SMT sibling (the smt command)
+        extern std::function<void(const benchmark::interference_t&)> OnInterference;
+
+        // result of timing the code on each logical processor in turn (the cores command)
+        extern std::function<void(const benchmark::core_timings_t&)> OnCoreTimings;
+
+        // result of streaming the code over a buffer on 1..N threads (the bw command)
+        extern std::function<void(const std::vector<benchmark::bandwidth_t>&)> OnBandwidth;
+
+        // result of timing pointer chains of growing size (the lat command)
+        extern std::function<void(const std::vector<benchmark::latency_t>&)> OnLatency;
+
+        // result of timing the code hot and with buffers in their cache states (the time command)
+        extern std::function<void(const benchmark::cache_timing_t&)> OnCacheTiming;
+
+        // SSE/AVX transitions, and the FTZ/DAZ timing unless it isn't available with the active backend (the fp command)
+        extern std::function<void(const std::vector<hazards::transition_t>&, const benchmark::mxcsr_timing_t*)> OnFloatHazards;
+
+        // samples per line of the code run in a loop (the prof command)
+        extern std::function<void(const benchmark::profile_t&)> OnProfile;
+
+        // result of checking a candidate block against a reference from randomised inputs (the verify command)
+        extern std::function<void(const benchmark::verify_t&)> OnVerify;
+
+        // cheaper sequences found for a procedure (the sopt command)
+        extern std::function<void(const superopt::search_t&)> OnSuperoptimise;
+
+        // final states tallied over concurrent runs of procedures, and their timings (the litmus command)
+        extern std::function<void(const benchmark::litmus_t&)> OnLitmus;
+
+        // variants of the template ranked by their timings (the tune command)
+        extern std::function<void(const tune::tuning_t&)> OnTune;
+
+        // lines loaded from a file (the load command)
+        extern std::function<void(const loader::load_t&)> OnLoad;
+
+        // object file written from the code (the export command)
+        extern std::function<void(const exporter::export_t&)> OnExport;
+
+        // files written for profilers, the jitdump path is empty without one (the perfmap command)
+        extern std::function<void(const std::string&, const std::string&)> OnPerfMap;
+
+        // the code was committed but publishing it for profilers failed, see runtime::PerfMapError
+        extern std::function<void(Error)> OnPerfMapError;
+
+        // values of a register over a range of steps, the first is the value at the start of the range (the hist command)
+        extern std::function<void(const RegisterInfo&, const std::vector<history::change_t>&)> OnRegisterHistory;
+
+        // the step that last changed a register (the who command)
+        extern std::function<void(const RegisterInfo&, const history::change_t&)> OnLastChange;
+
+        // bytes of each variable changed since writes started being tracked (the mdiff command)
+        extern std::function<void(const memdiff::diff_t&)> OnMemoryDiff;
+
+        // denormal operands of the instruction just stepped, with checking enabled by "fp on"
+        extern std::function<void(const std::vector<hazards::denormal_t>&)> OnDenormals;
+
         // invoked if no CLI handler handles a command
         extern std::function<bool(const char*)> OnUnknownCommand;
 
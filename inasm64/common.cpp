@@ -10,13 +10,15 @@
 
 #include "common.h"
 #include <cassert>
+#include <cerrno>
 #include <string>
 
 namespace inasm64
 {
     namespace detail
     {
-        Error _error = Error::kNoError;
+        // per thread, since the superoptimiser and tune workers assemble and interpret concurrently
+        thread_local Error _error = Error::kNoError;
 
         void set_error(Error error)
         {
@@ -86,6 +88,37 @@ namespace inasm64
             return !str[0];
         }
 
+        bool parse_size(const char* str, size_t& size)
+        {
+            if(!str || !isdigit(str[0]))
+                return false;
+            char* end;
+            errno = 0;
+            auto value = size_t(::strtoull(str, &end, 0));
+            if(errno)
+                return false;
+            switch(tolower(end[0]))
+            {
+            case 'k':
+                value <<= 10;
+                ++end;
+                break;
+            case 'm':
+                value <<= 20;
+                ++end;
+                break;
+            case 'g':
+                value <<= 30;
+                ++end;
+                break;
+            default:;
+            }
+            if(end[0] && end[0] != ' ' && end[0] != ',')
+                return false;
+            size = value;
+            return true;
+        }
+
         simple_tokens_t simple_tokenise(const char* str_, size_t max_tokens)
         {
             const auto str_len = strlen(str_);
@@ -142,6 +175,28 @@ namespace inasm64
             return "invalid address";
         case Error::kAccessViolation:
             return "access violation";
+        case Error::kUnsupportedAllocationOptions:
+            return "allocation options are unsupported, or not permitted, on this system";
+        case Error::kUndefinedBranchTarget:
+            return "undefined branch target label or line";
+        case Error::kBranchTargetOutOfRange:
+            return "branch target is outside the code, or out of range for the instruction";
+        case Error::kIterationLimitReached:
+            return "run stopped; the iteration limit was reached";
+        case Error::kInvalidBreakpoint:
+            return "invalid breakpoint condition, or a breakpoint can't be placed at this line";
+        case Error::kInvalidProcedure:
+            return "procedures can't be nested, and endp has to follow a proc";
+        case Error::kDivideError:
+            return "divide error; division by zero or quotient overflow";
+        case Error::kUnsupportedByBackend:
+            return "not supported by the active runtime backend";
+        case Error::kInvalidTemplate:
+            return "invalid template; a placeholder names no parameter, or .rep and .endr don't pair up";
+        case Error::kInvalidObjectFile:
+            return "not an x86-64 ELF file, or it has no function of that name";
+        case Error::kWritesNotTracked:
+            return "writes to memory aren't being tracked";
         case Error::kInvalidCommandFormat:
             return "invalid or unrecognized command format";
         case Error::kNoMoreCode:
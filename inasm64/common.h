@@ -48,9 +48,21 @@ namespace inasm64
         kInvalidInputValueFormat,
         kUnsupportedCpuFeature,
         kAccessViolation,
+        kUnsupportedAllocationOptions,
+        kUndefinedBranchTarget,
+        kBranchTargetOutOfRange,
+        kIterationLimitReached,
+        kInvalidBreakpoint,
+        kInvalidProcedure,
+        kDivideError,
+        kUnsupportedByBackend,
         kSystemError,
+        kInvalidTemplate,
+        kInvalidObjectFile,
+        kWritesNotTracked,
     };
 
+    // the last error set on the calling thread
     Error GetError();
     const std::string ErrorMessage(Error error);
 
@@ -99,6 +111,9 @@ namespace inasm64
         // true if string is just whitespace, or 0 length
         bool is_null_or_empty(const char* str);
 
+        // a decimal or 0x hex integer optionally followed by a k, m, or g multiplier, i.e. 64k, 0x1000, 2m
+        bool parse_size(const char* str, size_t& size);
+
         // stores a small set of tokenised string components, split by 0
         struct simple_tokens_t
         {
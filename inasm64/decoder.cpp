@@ -179,6 +179,8 @@ namespace inasm64
                 }
 
                 info._ring0 = xed_decoded_inst_get_attribute(&xedd, XED_ATTRIBUTE_RING0) != 0;
+                info._zeroes_upper = iclass == XED_ICLASS_VZEROUPPER || iclass == XED_ICLASS_VZEROALL;
+                info._dirties_upper = false;
 
                 //ZZZ: the XED enums are interleaved with some VT-X instructions, is this check going to be reliable or is there a XED function to get the ranges?
                 if((iclass >= XED_ICLASS_INT && iclass <= XED_ICLASS_INTO) || (iclass >= XED_ICLASS_IRET && iclass <= XED_ICLASS_JZ) ||
@@ -203,15 +205,213 @@ namespace inasm64
                     else if(xed_classify_avx(&xedd))
                     {
                         info._class = InstructionInfo::InstructionClass::kAvx;
+                        info._dirties_upper = !info._zeroes_upper && xed_decoded_inst_vector_length_bits(&xedd) > 128;
                     }
                     else if(xed_classify_avx512(&xedd))
                     {
                         info._class = InstructionInfo::InstructionClass::kAvx512;
+                        info._dirties_upper = xed_decoded_inst_vector_length_bits(&xedd) > 128;
                     }
                 }
                 return info;
             }
             return {};
         }
+
+        size_t InstructionLength(const void* instr, size_t length)
+        {
+            xed_decoded_inst_t xedd;
+            xed_decoded_inst_zero_set_mode(&xedd, &_dstate);
+            xed_decoded_inst_set_input_chip(&xedd, XED_CHIP_ALL);
+            if(xed_decode(&xedd, XED_REINTERPRET_CAST(const xed_uint8_t*, instr), (const unsigned int)(length < XED_MAX_INSTRUCTION_BYTES ? length : XED_MAX_INSTRUCTION_BYTES)) != XED_ERROR_NONE)
+                return 0;
+            return xed_decoded_inst_get_length(&xedd);
+        }
+
+        bool DecodeRelativeBranch(const void* instr, size_t length, RelativeBranchInfo& info)
+        {
+            xed_decoded_inst_t xedd;
+            xed_decoded_inst_zero_set_mode(&xedd, &_dstate);
+            xed_decoded_inst_set_input_chip(&xedd, XED_CHIP_ALL);
+            if(xed_decode(&xedd, XED_REINTERPRET_CAST(const xed_uint8_t*, instr), (const unsigned int)(length)) != XED_ERROR_NONE)
+                return false;
+            const auto category = xed_decoded_inst_get_category(&xedd);
+            info._call = xed_decoded_inst_get_iclass(&xedd) == XED_ICLASS_CALL_NEAR;
+            if(category != XED_CATEGORY_COND_BR && category != XED_CATEGORY_UNCOND_BR && !info._call)
+                return false;
+            info._displacement_bytes = xed_decoded_inst_get_branch_displacement_width(&xedd);
+            if(!info._displacement_bytes)
+                // indirect
+                return false;
+            info._displacement = xed_decoded_inst_get_branch_displacement(&xedd);
+            return true;
+        }
+
+        bool DecodeAddressReference(const void* instr, size_t length, AddressReferenceInfo& info)
+        {
+            xed_decoded_inst_t xedd;
+            xed_decoded_inst_zero_set_mode(&xedd, &_dstate);
+            xed_decoded_inst_set_input_chip(&xedd, XED_CHIP_ALL);
+            if(xed_decode(&xedd, XED_REINTERPRET_CAST(const xed_uint8_t*, instr), (const unsigned int)(length)) != XED_ERROR_NONE)
+                return false;
+
+            for(unsigned mem_op = 0; mem_op < xed_decoded_inst_number_of_memory_operands(&xedd); ++mem_op)
+            {
+                if(xed_decoded_inst_get_base_reg(&xedd, mem_op) != XED_REG_RIP)
+                    continue;
+                info._rip_relative = true;
+                info._offset = xed3_operand_get_pos_disp(&xedd);
+                info._bytes = xed_decoded_inst_get_memory_displacement_width(&xedd, mem_op);
+                info._value = xed_decoded_inst_get_memory_displacement(&xedd, mem_op);
+                return true;
+            }
+            if(xed_decoded_inst_get_immediate_width_bits(&xedd) == 64)
+            {
+                info._rip_relative = false;
+                info._offset = xed3_operand_get_pos_imm(&xedd);
+                info._bytes = 8;
+                info._value = (long long)(xed_decoded_inst_get_unsigned_immediate(&xedd));
+                return true;
+            }
+            return false;
+        }
+
+        bool Relocate(void* instr, size_t length, uintptr_t oldAddress, uintptr_t newAddress, uintptr_t regionBegin, uintptr_t regionEnd)
+        {
+            xed_decoded_inst_t xedd;
+            xed_decoded_inst_zero_set_mode(&xedd, &_dstate);
+            xed_decoded_inst_set_input_chip(&xedd, XED_CHIP_ALL);
+            const auto itext = XED_REINTERPRET_CAST(xed_uint8_t*, instr);
+            if(xed_decode(&xedd, itext, (const unsigned int)(length)) != XED_ERROR_NONE)
+                return false;
+
+            for(unsigned mem_op = 0; mem_op < xed_decoded_inst_number_of_memory_operands(&xedd); ++mem_op)
+            {
+                if(xed_decoded_inst_get_base_reg(&xedd, mem_op) != XED_REG_RIP)
+                    continue;
+
+                // RIP relative addresses are relative to the *next* instruction
+                const auto disp = xed_decoded_inst_get_memory_displacement(&xedd, mem_op);
+                const auto target = uintptr_t((long long)(oldAddress + length) + disp);
+                if(target >= regionBegin && target < regionEnd)
+                    // moves along with us
+                    continue;
+
+                const auto new_disp = (long long)(target) - (long long)(newAddress + length);
+                const auto disp_bits = xed_decoded_inst_get_memory_displacement_width_bits(&xedd, mem_op);
+                const auto disp_limit = 1ll << (disp_bits - 1);
+                if(new_disp < -disp_limit || new_disp >= disp_limit)
+                    return false;
+
+                xed_enc_displacement_t enc_disp;
+                enc_disp.displacement = xed_uint64_t(new_disp);
+                enc_disp.displacement_bits = disp_bits;
+                if(!xed_patch_disp(&xedd, itext, enc_disp))
+                    return false;
+            }
+            return true;
+        }
+
+        bool DecodeFloatOperands(const void* instr, size_t length, FloatOperandsInfo& info)
+        {
+            xed_decoded_inst_t xedd;
+            xed_decoded_inst_zero_set_mode(&xedd, &_dstate);
+            xed_decoded_inst_set_input_chip(&xedd, XED_CHIP_ALL);
+            if(xed_decode(&xedd, XED_REINTERPRET_CAST(const xed_uint8_t*, instr), (const unsigned int)(length)) != XED_ERROR_NONE)
+                return false;
+
+            info._count = 0;
+            const auto xi = xed_decoded_inst_inst(&xedd);
+            for(unsigned i = 0; i < xed_inst_noperands(xi) && info._count < 4; ++i)
+            {
+                const auto op = xed_inst_operand(xi, i);
+                const auto name = xed_operand_name(op);
+                if(!xed_operand_is_register(name))
+                    continue;
+                const auto element_type = xed_decoded_inst_operand_element_type(&xedd, i);
+                if(element_type != XED_OPERAND_ELEMENT_TYPE_SINGLE && element_type != XED_OPERAND_ELEMENT_TYPE_DOUBLE)
+                    continue;
+                const auto reg = xed_decoded_inst_get_reg(&xedd, name);
+                auto& operand = info._operands[info._count];
+                switch(xed_reg_class(reg))
+                {
+                case XED_REG_CLASS_XMM:
+                    operand._index = unsigned(reg - XED_REG_XMM0);
+                    break;
+                case XED_REG_CLASS_YMM:
+                    operand._index = unsigned(reg - XED_REG_YMM0);
+                    break;
+                case XED_REG_CLASS_ZMM:
+                    operand._index = unsigned(reg - XED_REG_ZMM0);
+                    break;
+                default:
+                    continue;
+                }
+                operand._bits = xed_decoded_inst_operand_length_bits(&xedd, i);
+                operand._double = element_type == XED_OPERAND_ELEMENT_TYPE_DOUBLE;
+                operand._read = xed_operand_read(op) != 0;
+                operand._written = xed_operand_written(op) != 0;
+                ++info._count;
+            }
+            return info._count > 0;
+        }
+
+        bool DecodeGprOperands(const void* instr, size_t length, GprOperandsInfo& info)
+        {
+            xed_decoded_inst_t xedd;
+            xed_decoded_inst_zero_set_mode(&xedd, &_dstate);
+            xed_decoded_inst_set_input_chip(&xedd, XED_CHIP_ALL);
+            if(xed_decode(&xedd, XED_REINTERPRET_CAST(const xed_uint8_t*, instr), (const unsigned int)(length)) != XED_ERROR_NONE)
+                return false;
+
+            const auto gpr_bit = [](xed_reg_enum_t reg) {
+                const auto enclosing = xed_get_largest_enclosing_register(reg);
+                return uint16_t((enclosing >= XED_REG_RAX && enclosing <= XED_REG_R15) ? (1u << (enclosing - XED_REG_RAX)) : 0);
+            };
+            info = {};
+            const auto xi = xed_decoded_inst_inst(&xedd);
+            for(unsigned i = 0; i < xed_inst_noperands(xi); ++i)
+            {
+                const auto op = xed_inst_operand(xi, i);
+                const auto name = xed_operand_name(op);
+                if(name == XED_OPERAND_MEM0 || name == XED_OPERAND_MEM1)
+                {
+                    info._memory = true;
+                    continue;
+                }
+                if(!xed_operand_is_register(name))
+                    continue;
+                const auto reg = xed_decoded_inst_get_reg(&xedd, name);
+                const auto bit = gpr_bit(reg);
+                if(xed_operand_read(op))
+                    info._read |= bit;
+                if(xed_operand_written(op))
+                {
+                    info._written |= bit;
+                    // the rest of the register is left as it was
+                    if(xed_get_register_width_bits64(reg) < 32)
+                        info._read |= bit;
+                }
+            }
+            for(unsigned mem = 0; mem < xed_decoded_inst_number_of_memory_operands(&xedd); ++mem)
+                info._read |= gpr_bit(xed_decoded_inst_get_base_reg(&xedd, mem)) | gpr_bit(xed_decoded_inst_get_index_reg(&xedd, mem));
+            const auto rflags = xed_decoded_inst_get_rflags_info(&xedd);
+            if(rflags)
+            {
+                info._reads_flags = xed_simple_flag_reads_flags(rflags) != 0;
+                info._writes_flags = xed_simple_flag_writes_flags(rflags) != 0;
+            }
+            return true;
+        }
+
+        bool Disassemble(const void* instr, size_t length, uintptr_t address, char* buffer, size_t bufferSize)
+        {
+            xed_decoded_inst_t xedd;
+            xed_decoded_inst_zero_set_mode(&xedd, &_dstate);
+            xed_decoded_inst_set_input_chip(&xedd, XED_CHIP_ALL);
+            if(xed_decode(&xedd, XED_REINTERPRET_CAST(const xed_uint8_t*, instr), (const unsigned int)(length)) != XED_ERROR_NONE)
+                return false;
+            return xed_format_context(XED_SYNTAX_INTEL, &xedd, buffer, int(bufferSize), xed_uint64_t(address), nullptr, nullptr) != 0;
+        }
     }  // namespace decoder
 }  // namespace inasm64
\ No newline at end of file
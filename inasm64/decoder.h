@@ -34,6 +34,10 @@ namespace inasm64
             // if supported natively by the active CPU (via CPUID)
             bool _supported : 1;
             bool _ring0 : 1;
+            // a 256 or 512 bit VEX/EVEX instruction, i.e. one that leaves the upper halves of the vector registers dirty
+            bool _dirties_upper : 1;
+            // vzeroupper or vzeroall
+            bool _zeroes_upper : 1;
 
             InstructionInfo() = default;
         };
@@ -41,6 +45,94 @@ namespace inasm64
         /// Decode instruction bytes and return information about it
         ///</summary>
         InstructionInfo Decode(const void* instruction, size_t length);
+        ///<summary>
+        /// length of the instruction at the start of the bytes, or 0 if they don't start with a valid instruction
+        ///</summary>
+        size_t InstructionLength(const void* instruction, size_t length);
+        ///<summary>
+        /// information about a relative jmp, jcc, loop, jrcxz or call
+        ///</summary>
+        struct RelativeBranchInfo
+        {
+            // relative to the address of the next instruction
+            int64_t _displacement = 0;
+            // width of the displacement field, always the last bytes of the instruction
+            unsigned _displacement_bytes = 0;
+            bool _call = false;
+        };
+        ///<summary>
+        /// returns true if the instruction is a relative (near) jmp, jcc, loop, jrcxz or call
+        ///</summary>
+        /// NOTE: indirect branches and calls, and far calls, are not included
+        bool DecodeRelativeBranch(const void* instruction, size_t length, RelativeBranchInfo& info);
+        ///<summary>
+        /// a field of an instruction that can hold an address: a RIP-relative displacement, or a 64 bit immediate (as in mov r64, imm64)
+        ///</summary>
+        struct AddressReferenceInfo
+        {
+            bool _rip_relative = false;
+            // position and width of the field in the instruction bytes
+            size_t _offset = 0;
+            size_t _bytes = 0;
+            // the displacement, relative to the address of the next instruction, or the immediate
+            long long _value = 0;
+        };
+        ///<summary>
+        /// returns true if the instruction has a RIP-relative memory operand or a 64 bit immediate
+        ///</summary>
+        bool DecodeAddressReference(const void* instruction, size_t length, AddressReferenceInfo& info);
+        ///<summary>
+        /// re-encode an instruction that is moving from oldAddress to newAddress
+        ///</summary>
+        /// RIP-relative memory operands are adjusted so that they keep referring to the same absolute address, unless that address is
+        /// inside [regionBegin, regionEnd) in which case it is assumed to move along with the instruction.
+        /// Returns false if the adjusted displacement doesn't fit in the instruction's displacement field.
+        bool Relocate(void* instruction, size_t length, uintptr_t oldAddress, uintptr_t newAddress, uintptr_t regionBegin, uintptr_t regionEnd);
+        ///<summary>
+        /// the single and double precision floating point vector register operands of an instruction
+        ///</summary>
+        struct FloatOperandsInfo
+        {
+            struct operand_t
+            {
+                // xmm/ymm/zmm register number
+                unsigned _index = 0;
+                // width of the operand, i.e. 32 for a scalar single
+                unsigned _bits = 0;
+                bool _double = false;
+                bool _read = false;
+                bool _written = false;
+            };
+            operand_t _operands[4];
+            unsigned _count = 0;
+        };
+        ///<summary>
+        /// returns true if the instruction has floating point vector register operands
+        ///</summary>
+        /// NOTE: memory operands are not included
+        bool DecodeFloatOperands(const void* instruction, size_t length, FloatOperandsInfo& info);
+        ///<summary>
+        /// the general purpose registers and flags an instruction uses
+        ///</summary>
+        struct GprOperandsInfo
+        {
+            // masks of the 64 bit registers read and written, bit n is register n in encoding order (rax, rcx, rdx, rbx, rsp, ...).
+            // Implicit operands and address registers are included, and a write of less than 32 bits also counts as a read
+            uint16_t _read = 0;
+            uint16_t _written = 0;
+            // reads or writes memory, lea only computes an address
+            bool _memory = false;
+            bool _reads_flags = false;
+            bool _writes_flags = false;
+        };
+        ///<summary>
+        /// decode the general purpose register, flags, and memory operands of an instruction
+        ///</summary>
+        bool DecodeGprOperands(const void* instruction, size_t length, GprOperandsInfo& info);
+        ///<summary>
+        /// Intel syntax text of an instruction at address, for listings
+        ///</summary>
+        bool Disassemble(const void* instruction, size_t length, uintptr_t address, char* buffer, size_t bufferSize);
 
     }  // namespace decoder
 }  // namespace inasm64
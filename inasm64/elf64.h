@@ -0,0 +1,110 @@
+// MIT License
+// Copyright 2019 Jarl Ostensen
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+#pragma once
+
+#include <cstdint>
+
+namespace inasm64
+{
+    ///<summary>
+    /// the parts of the 64 bit ELF format (see the System V ABI and its x86-64 supplement) that the loader reads and the exporter writes
+    ///</summary>
+    namespace elf64
+    {
+        struct header_t
+        {
+            uint8_t _ident[16];
+            uint16_t _type;
+            uint16_t _machine;
+            uint32_t _version;
+            uint64_t _entry;
+            uint64_t _phoff;
+            uint64_t _shoff;
+            uint32_t _flags;
+            uint16_t _ehsize;
+            uint16_t _phentsize;
+            uint16_t _phnum;
+            uint16_t _shentsize;
+            uint16_t _shnum;
+            uint16_t _shstrndx;
+        };
+        static_assert(sizeof(header_t) == 64, "ELF64 header layout");
+        struct section_t
+        {
+            uint32_t _name;
+            uint32_t _type;
+            uint64_t _flags;
+            uint64_t _addr;
+            uint64_t _offset;
+            uint64_t _size;
+            uint32_t _link;
+            uint32_t _info;
+            uint64_t _addralign;
+            uint64_t _entsize;
+        };
+        static_assert(sizeof(section_t) == 64, "ELF64 section header layout");
+        struct symbol_t
+        {
+            uint32_t _name;
+            uint8_t _info;
+            uint8_t _other;
+            uint16_t _shndx;
+            uint64_t _value;
+            uint64_t _size;
+        };
+        static_assert(sizeof(symbol_t) == 24, "ELF64 symbol layout");
+        struct rela_t
+        {
+            uint64_t _offset;
+            uint64_t _info;
+            int64_t _addend;
+        };
+        static_assert(sizeof(rela_t) == 24, "ELF64 relocation layout");
+
+        // header
+        constexpr uint8_t kClass64 = 2;
+        constexpr uint8_t kLittleEndian = 1;
+        constexpr uint8_t kCurrentVersion = 1;
+        constexpr uint16_t kRelocatable = 1;
+        constexpr uint16_t kMachineX64 = 62;
+        // section types
+        constexpr uint32_t kProgBits = 1;
+        constexpr uint32_t kSymbolTable = 2;
+        constexpr uint32_t kStringTable = 3;
+        constexpr uint32_t kRela = 4;
+        constexpr uint32_t kNoBits = 8;
+        constexpr uint32_t kDynamicSymbolTable = 11;
+        // section flags
+        constexpr uint64_t kAlloc = 2;
+        constexpr uint64_t kExecutable = 4;
+        constexpr uint64_t kInfoLink = 0x40;
+        // section indices from here on are reserved (absolute, common, etc.)
+        constexpr uint16_t kReservedSections = 0xff00;
+        // symbol binding and type, packed into symbol_t::_info
+        constexpr uint8_t kLocal = 0;
+        constexpr uint8_t kGlobal = 1;
+        constexpr uint8_t kNoType = 0;
+        constexpr uint8_t kObject = 1;
+        constexpr uint8_t kFunction = 2;
+        constexpr uint8_t kSection = 3;
+        constexpr uint8_t symbol_info(uint8_t binding, uint8_t type)
+        {
+            return uint8_t((binding << 4) | type);
+        }
+        // x86-64 relocation types
+        constexpr uint32_t kReloc64 = 1;
+        constexpr uint32_t kRelocPc32 = 2;
+        constexpr uint32_t kReloc32 = 10;
+        constexpr uint64_t rela_info(uint32_t symbol, uint32_t type)
+        {
+            return (uint64_t(symbol) << 32) | type;
+        }
+    }  // namespace elf64
+}  // namespace inasm64
@@ -0,0 +1,763 @@
+// MIT License
+// Copyright 2019 Jarl Ostensen
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include "common.h"
+#include "emulator.h"
+
+extern "C" {
+#include "xed-interface.h"
+}
+
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+
+namespace inasm64
+{
+    namespace emulator
+    {
+        namespace
+        {
+            const xed_state_t _dstate = { XED_MACHINE_MODE_LONG_64, XED_ADDRESS_WIDTH_64b };
+
+            // one vector register worth of data, accessed as lanes of any type
+            struct vec_t
+            {
+                alignas(64) uint8_t _bytes[64] = { 0 };
+
+                template <typename T>
+                T& lane(size_t i)
+                {
+                    return reinterpret_cast<T*>(_bytes)[i];
+                }
+                template <typename T>
+                const T& lane(size_t i) const
+                {
+                    return reinterpret_cast<const T*>(_bytes)[i];
+                }
+            };
+
+            enum class OperationType
+            {
+                kNone,
+                // dest = op(src1, src2)
+                kBinary,
+                // dest = op(dest, src1, src2), i.e. FMA and dot product accumulation
+                kAccumulate,
+                // dest = src, loads, stores and register moves
+                kMove,
+                // dest = src[0] in every element
+                kBroadcast,
+                // movss/movsd: a scalar kBinary (dest = src1 with element 0 from src2) between registers, a scalar kMove for loads (zeroing the rest) and stores
+                kScalarMove,
+            };
+
+            // computes element i of result, d is the original destination value
+            using lane_op_t = void (*)(vec_t& result, const vec_t& d, const vec_t& a, const vec_t& b, size_t i);
+
+            struct operation_t
+            {
+                OperationType _type = OperationType::kNone;
+                // element size in bytes, the granularity of write masking and broadcasting
+                unsigned _element_size = 0;
+                lane_op_t _op = nullptr;
+                // only element 0 is computed, the rest of the destination comes from the first source
+                bool _scalar = false;
+            };
+
+            enum class MaskOperation
+            {
+                kNone,
+                kMove,
+                kAnd,
+                kOr,
+                kXor,
+                kNot,
+            };
+
+            struct mask_operation_t
+            {
+                MaskOperation _op = MaskOperation::kNone;
+                unsigned _bits = 0;
+            };
+
+            // indexed by iclass
+            operation_t _operations[XED_ICLASS_LAST];
+            mask_operation_t _mask_operations[XED_ICLASS_LAST];
+
+#define INASM64_EMU_LANE(type, expr)                                                        \
+    [](vec_t& r, const vec_t& d, const vec_t& a, const vec_t& b, size_t i) {               \
+        const auto acc = d.lane<type>(i);                                                   \
+        const auto x = a.lane<type>(i);                                                     \
+        const auto y = b.lane<type>(i);                                                     \
+        (void)acc;                                                                          \
+        (void)x;                                                                            \
+        (void)y;                                                                            \
+        r.lane<type>(i) = type(expr);                                                       \
+    }
+
+            int32_t saturate_int32(int64_t value)
+            {
+                if(value > INT32_MAX)
+                    return INT32_MAX;
+                if(value < INT32_MIN)
+                    return INT32_MIN;
+                return int32_t(value);
+            }
+
+            // unsigned bytes of a times signed bytes of b, summed per dword
+            int64_t dot_bytes(const vec_t& a, const vec_t& b, size_t i)
+            {
+                int64_t sum = 0;
+                for(size_t j = 0; j < 4; ++j)
+                    sum += int64_t(a.lane<uint8_t>(4 * i + j)) * int64_t(b.lane<int8_t>(4 * i + j));
+                return sum;
+            }
+
+            // signed words of a times signed words of b, summed per dword
+            int64_t dot_words(const vec_t& a, const vec_t& b, size_t i)
+            {
+                return int64_t(a.lane<int16_t>(2 * i)) * int64_t(b.lane<int16_t>(2 * i)) +
+                    int64_t(a.lane<int16_t>(2 * i + 1)) * int64_t(b.lane<int16_t>(2 * i + 1));
+            }
+
+            bool initialise()
+            {
+                static auto initialised = false;
+                if(initialised)
+                    return true;
+                xed_tables_init();
+
+                const auto set = [](xed_iclass_enum_t iclass, OperationType type, unsigned elementSize, lane_op_t op) {
+                    _operations[iclass] = { type, elementSize, op };
+                };
+                const auto set_scalar = [](xed_iclass_enum_t iclass, OperationType type, unsigned elementSize, lane_op_t op) {
+                    _operations[iclass] = { type, elementSize, op, true };
+                };
+
+                // integer arithmetic and logic
+                set(XED_ICLASS_VPADDD, OperationType::kBinary, 4, INASM64_EMU_LANE(uint32_t, x + y));
+                set(XED_ICLASS_VPADDQ, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, x + y));
+                set(XED_ICLASS_VPSUBD, OperationType::kBinary, 4, INASM64_EMU_LANE(uint32_t, x - y));
+                set(XED_ICLASS_VPSUBQ, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, x - y));
+                set(XED_ICLASS_VPMULLD, OperationType::kBinary, 4, INASM64_EMU_LANE(uint32_t, uint64_t(x) * uint64_t(y)));
+                set(XED_ICLASS_VPMULLQ, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, x * y));
+                set(XED_ICLASS_VPMAXSD, OperationType::kBinary, 4, INASM64_EMU_LANE(int32_t, x > y ? x : y));
+                set(XED_ICLASS_VPMINSD, OperationType::kBinary, 4, INASM64_EMU_LANE(int32_t, x < y ? x : y));
+                set(XED_ICLASS_VPMAXUD, OperationType::kBinary, 4, INASM64_EMU_LANE(uint32_t, x > y ? x : y));
+                set(XED_ICLASS_VPMINUD, OperationType::kBinary, 4, INASM64_EMU_LANE(uint32_t, x < y ? x : y));
+                set(XED_ICLASS_VPAND, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, x & y));
+                set(XED_ICLASS_VPANDD, OperationType::kBinary, 4, INASM64_EMU_LANE(uint32_t, x & y));
+                set(XED_ICLASS_VPANDQ, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, x & y));
+                set(XED_ICLASS_VPOR, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, x | y));
+                set(XED_ICLASS_VPORD, OperationType::kBinary, 4, INASM64_EMU_LANE(uint32_t, x | y));
+                set(XED_ICLASS_VPORQ, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, x | y));
+                set(XED_ICLASS_VPXOR, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, x ^ y));
+                set(XED_ICLASS_VPXORD, OperationType::kBinary, 4, INASM64_EMU_LANE(uint32_t, x ^ y));
+                set(XED_ICLASS_VPXORQ, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, x ^ y));
+                set(XED_ICLASS_VPANDN, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, ~x & y));
+                set(XED_ICLASS_VPADDB, OperationType::kBinary, 1, INASM64_EMU_LANE(uint8_t, x + y));
+                set(XED_ICLASS_VPADDW, OperationType::kBinary, 2, INASM64_EMU_LANE(uint16_t, x + y));
+                set(XED_ICLASS_VPSUBB, OperationType::kBinary, 1, INASM64_EMU_LANE(uint8_t, x - y));
+                set(XED_ICLASS_VPSUBW, OperationType::kBinary, 2, INASM64_EMU_LANE(uint16_t, x - y));
+                set(XED_ICLASS_VPMULLW, OperationType::kBinary, 2, INASM64_EMU_LANE(uint16_t, uint32_t(x) * uint32_t(y)));
+                set(XED_ICLASS_VPCMPEQB, OperationType::kBinary, 1, INASM64_EMU_LANE(uint8_t, x == y ? ~0u : 0));
+                set(XED_ICLASS_VPCMPEQW, OperationType::kBinary, 2, INASM64_EMU_LANE(uint16_t, x == y ? ~0u : 0));
+                set(XED_ICLASS_VPCMPEQD, OperationType::kBinary, 4, INASM64_EMU_LANE(uint32_t, x == y ? ~0u : 0));
+                set(XED_ICLASS_VPCMPEQQ, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, x == y ? ~0ull : 0));
+                set(XED_ICLASS_VPCMPGTB, OperationType::kBinary, 1, INASM64_EMU_LANE(int8_t, x > y ? -1 : 0));
+                set(XED_ICLASS_VPCMPGTW, OperationType::kBinary, 2, INASM64_EMU_LANE(int16_t, x > y ? -1 : 0));
+                set(XED_ICLASS_VPCMPGTD, OperationType::kBinary, 4, INASM64_EMU_LANE(int32_t, x > y ? -1 : 0));
+                set(XED_ICLASS_VPCMPGTQ, OperationType::kBinary, 8, INASM64_EMU_LANE(int64_t, x > y ? -1 : 0));
+
+                // SSE(2) integer, the legacy encodings of the above
+                set(XED_ICLASS_PADDB, OperationType::kBinary, 1, INASM64_EMU_LANE(uint8_t, x + y));
+                set(XED_ICLASS_PADDW, OperationType::kBinary, 2, INASM64_EMU_LANE(uint16_t, x + y));
+                set(XED_ICLASS_PADDD, OperationType::kBinary, 4, INASM64_EMU_LANE(uint32_t, x + y));
+                set(XED_ICLASS_PADDQ, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, x + y));
+                set(XED_ICLASS_PSUBB, OperationType::kBinary, 1, INASM64_EMU_LANE(uint8_t, x - y));
+                set(XED_ICLASS_PSUBW, OperationType::kBinary, 2, INASM64_EMU_LANE(uint16_t, x - y));
+                set(XED_ICLASS_PSUBD, OperationType::kBinary, 4, INASM64_EMU_LANE(uint32_t, x - y));
+                set(XED_ICLASS_PSUBQ, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, x - y));
+                set(XED_ICLASS_PMULLW, OperationType::kBinary, 2, INASM64_EMU_LANE(uint16_t, uint32_t(x) * uint32_t(y)));
+                set(XED_ICLASS_PMULLD, OperationType::kBinary, 4, INASM64_EMU_LANE(uint32_t, uint64_t(x) * uint64_t(y)));
+                set(XED_ICLASS_PMAXSD, OperationType::kBinary, 4, INASM64_EMU_LANE(int32_t, x > y ? x : y));
+                set(XED_ICLASS_PMINSD, OperationType::kBinary, 4, INASM64_EMU_LANE(int32_t, x < y ? x : y));
+                set(XED_ICLASS_PMAXUD, OperationType::kBinary, 4, INASM64_EMU_LANE(uint32_t, x > y ? x : y));
+                set(XED_ICLASS_PMINUD, OperationType::kBinary, 4, INASM64_EMU_LANE(uint32_t, x < y ? x : y));
+                set(XED_ICLASS_PAND, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, x & y));
+                set(XED_ICLASS_PANDN, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, ~x & y));
+                set(XED_ICLASS_POR, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, x | y));
+                set(XED_ICLASS_PXOR, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, x ^ y));
+                set(XED_ICLASS_PCMPEQB, OperationType::kBinary, 1, INASM64_EMU_LANE(uint8_t, x == y ? ~0u : 0));
+                set(XED_ICLASS_PCMPEQW, OperationType::kBinary, 2, INASM64_EMU_LANE(uint16_t, x == y ? ~0u : 0));
+                set(XED_ICLASS_PCMPEQD, OperationType::kBinary, 4, INASM64_EMU_LANE(uint32_t, x == y ? ~0u : 0));
+                set(XED_ICLASS_PCMPEQQ, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, x == y ? ~0ull : 0));
+                set(XED_ICLASS_PCMPGTB, OperationType::kBinary, 1, INASM64_EMU_LANE(int8_t, x > y ? -1 : 0));
+                set(XED_ICLASS_PCMPGTW, OperationType::kBinary, 2, INASM64_EMU_LANE(int16_t, x > y ? -1 : 0));
+                set(XED_ICLASS_PCMPGTD, OperationType::kBinary, 4, INASM64_EMU_LANE(int32_t, x > y ? -1 : 0));
+                set(XED_ICLASS_PCMPGTQ, OperationType::kBinary, 8, INASM64_EMU_LANE(int64_t, x > y ? -1 : 0));
+
+                // floating point
+                set(XED_ICLASS_VADDPS, OperationType::kBinary, 4, INASM64_EMU_LANE(float, x + y));
+                set(XED_ICLASS_VADDPD, OperationType::kBinary, 8, INASM64_EMU_LANE(double, x + y));
+                set(XED_ICLASS_VSUBPS, OperationType::kBinary, 4, INASM64_EMU_LANE(float, x - y));
+                set(XED_ICLASS_VSUBPD, OperationType::kBinary, 8, INASM64_EMU_LANE(double, x - y));
+                set(XED_ICLASS_VMULPS, OperationType::kBinary, 4, INASM64_EMU_LANE(float, x * y));
+                set(XED_ICLASS_VMULPD, OperationType::kBinary, 8, INASM64_EMU_LANE(double, x * y));
+                set(XED_ICLASS_VDIVPS, OperationType::kBinary, 4, INASM64_EMU_LANE(float, x / y));
+                set(XED_ICLASS_VDIVPD, OperationType::kBinary, 8, INASM64_EMU_LANE(double, x / y));
+                // NOTE: as per the SDM; the second operand is returned if either is a NaN, or both are 0
+                set(XED_ICLASS_VMAXPS, OperationType::kBinary, 4, INASM64_EMU_LANE(float, x > y ? x : y));
+                set(XED_ICLASS_VMAXPD, OperationType::kBinary, 8, INASM64_EMU_LANE(double, x > y ? x : y));
+                set(XED_ICLASS_VMINPS, OperationType::kBinary, 4, INASM64_EMU_LANE(float, x < y ? x : y));
+                set(XED_ICLASS_VMINPD, OperationType::kBinary, 8, INASM64_EMU_LANE(double, x < y ? x : y));
+                set(XED_ICLASS_VFMADD231PS, OperationType::kAccumulate, 4, INASM64_EMU_LANE(float, std::fma(x, y, acc)));
+                set(XED_ICLASS_VFMADD231PD, OperationType::kAccumulate, 8, INASM64_EMU_LANE(double, std::fma(x, y, acc)));
+                set(XED_ICLASS_VSQRTPS, OperationType::kMove, 4, INASM64_EMU_LANE(float, std::sqrt(x)));
+                set(XED_ICLASS_VSQRTPD, OperationType::kMove, 8, INASM64_EMU_LANE(double, std::sqrt(x)));
+                set(XED_ICLASS_VANDPS, OperationType::kBinary, 4, INASM64_EMU_LANE(uint32_t, x & y));
+                set(XED_ICLASS_VANDPD, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, x & y));
+                set(XED_ICLASS_VANDNPS, OperationType::kBinary, 4, INASM64_EMU_LANE(uint32_t, ~x & y));
+                set(XED_ICLASS_VANDNPD, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, ~x & y));
+                set(XED_ICLASS_VORPS, OperationType::kBinary, 4, INASM64_EMU_LANE(uint32_t, x | y));
+                set(XED_ICLASS_VORPD, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, x | y));
+                set(XED_ICLASS_VXORPS, OperationType::kBinary, 4, INASM64_EMU_LANE(uint32_t, x ^ y));
+                set(XED_ICLASS_VXORPD, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, x ^ y));
+                set_scalar(XED_ICLASS_VADDSS, OperationType::kBinary, 4, INASM64_EMU_LANE(float, x + y));
+                set_scalar(XED_ICLASS_VADDSD, OperationType::kBinary, 8, INASM64_EMU_LANE(double, x + y));
+                set_scalar(XED_ICLASS_VSUBSS, OperationType::kBinary, 4, INASM64_EMU_LANE(float, x - y));
+                set_scalar(XED_ICLASS_VSUBSD, OperationType::kBinary, 8, INASM64_EMU_LANE(double, x - y));
+                set_scalar(XED_ICLASS_VMULSS, OperationType::kBinary, 4, INASM64_EMU_LANE(float, x * y));
+                set_scalar(XED_ICLASS_VMULSD, OperationType::kBinary, 8, INASM64_EMU_LANE(double, x * y));
+                set_scalar(XED_ICLASS_VDIVSS, OperationType::kBinary, 4, INASM64_EMU_LANE(float, x / y));
+                set_scalar(XED_ICLASS_VDIVSD, OperationType::kBinary, 8, INASM64_EMU_LANE(double, x / y));
+                set_scalar(XED_ICLASS_VSQRTSS, OperationType::kBinary, 4, INASM64_EMU_LANE(float, std::sqrt(y)));
+                set_scalar(XED_ICLASS_VSQRTSD, OperationType::kBinary, 8, INASM64_EMU_LANE(double, std::sqrt(y)));
+
+                // SSE(2) floating point
+                set(XED_ICLASS_ADDPS, OperationType::kBinary, 4, INASM64_EMU_LANE(float, x + y));
+                set(XED_ICLASS_ADDPD, OperationType::kBinary, 8, INASM64_EMU_LANE(double, x + y));
+                set(XED_ICLASS_SUBPS, OperationType::kBinary, 4, INASM64_EMU_LANE(float, x - y));
+                set(XED_ICLASS_SUBPD, OperationType::kBinary, 8, INASM64_EMU_LANE(double, x - y));
+                set(XED_ICLASS_MULPS, OperationType::kBinary, 4, INASM64_EMU_LANE(float, x * y));
+                set(XED_ICLASS_MULPD, OperationType::kBinary, 8, INASM64_EMU_LANE(double, x * y));
+                set(XED_ICLASS_DIVPS, OperationType::kBinary, 4, INASM64_EMU_LANE(float, x / y));
+                set(XED_ICLASS_DIVPD, OperationType::kBinary, 8, INASM64_EMU_LANE(double, x / y));
+                set(XED_ICLASS_MAXPS, OperationType::kBinary, 4, INASM64_EMU_LANE(float, x > y ? x : y));
+                set(XED_ICLASS_MAXPD, OperationType::kBinary, 8, INASM64_EMU_LANE(double, x > y ? x : y));
+                set(XED_ICLASS_MINPS, OperationType::kBinary, 4, INASM64_EMU_LANE(float, x < y ? x : y));
+                set(XED_ICLASS_MINPD, OperationType::kBinary, 8, INASM64_EMU_LANE(double, x < y ? x : y));
+                set(XED_ICLASS_SQRTPS, OperationType::kMove, 4, INASM64_EMU_LANE(float, std::sqrt(x)));
+                set(XED_ICLASS_SQRTPD, OperationType::kMove, 8, INASM64_EMU_LANE(double, std::sqrt(x)));
+                set(XED_ICLASS_ANDPS, OperationType::kBinary, 4, INASM64_EMU_LANE(uint32_t, x & y));
+                set(XED_ICLASS_ANDPD, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, x & y));
+                set(XED_ICLASS_ANDNPS, OperationType::kBinary, 4, INASM64_EMU_LANE(uint32_t, ~x & y));
+                set(XED_ICLASS_ANDNPD, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, ~x & y));
+                set(XED_ICLASS_ORPS, OperationType::kBinary, 4, INASM64_EMU_LANE(uint32_t, x | y));
+                set(XED_ICLASS_ORPD, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, x | y));
+                set(XED_ICLASS_XORPS, OperationType::kBinary, 4, INASM64_EMU_LANE(uint32_t, x ^ y));
+                set(XED_ICLASS_XORPD, OperationType::kBinary, 8, INASM64_EMU_LANE(uint64_t, x ^ y));
+                set_scalar(XED_ICLASS_ADDSS, OperationType::kBinary, 4, INASM64_EMU_LANE(float, x + y));
+                set_scalar(XED_ICLASS_ADDSD, OperationType::kBinary, 8, INASM64_EMU_LANE(double, x + y));
+                set_scalar(XED_ICLASS_SUBSS, OperationType::kBinary, 4, INASM64_EMU_LANE(float, x - y));
+                set_scalar(XED_ICLASS_SUBSD, OperationType::kBinary, 8, INASM64_EMU_LANE(double, x - y));
+                set_scalar(XED_ICLASS_MULSS, OperationType::kBinary, 4, INASM64_EMU_LANE(float, x * y));
+                set_scalar(XED_ICLASS_MULSD, OperationType::kBinary, 8, INASM64_EMU_LANE(double, x * y));
+                set_scalar(XED_ICLASS_DIVSS, OperationType::kBinary, 4, INASM64_EMU_LANE(float, x / y));
+                set_scalar(XED_ICLASS_DIVSD, OperationType::kBinary, 8, INASM64_EMU_LANE(double, x / y));
+                set_scalar(XED_ICLASS_MAXSS, OperationType::kBinary, 4, INASM64_EMU_LANE(float, x > y ? x : y));
+                set_scalar(XED_ICLASS_MAXSD, OperationType::kBinary, 8, INASM64_EMU_LANE(double, x > y ? x : y));
+                set_scalar(XED_ICLASS_MINSS, OperationType::kBinary, 4, INASM64_EMU_LANE(float, x < y ? x : y));
+                set_scalar(XED_ICLASS_MINSD, OperationType::kBinary, 8, INASM64_EMU_LANE(double, x < y ? x : y));
+                set_scalar(XED_ICLASS_SQRTSS, OperationType::kBinary, 4, INASM64_EMU_LANE(float, std::sqrt(y)));
+                set_scalar(XED_ICLASS_SQRTSD, OperationType::kBinary, 8, INASM64_EMU_LANE(double, std::sqrt(y)));
+
+                // VNNI
+                set(XED_ICLASS_VPDPBUSD, OperationType::kAccumulate, 4, [](vec_t& r, const vec_t& d, const vec_t& a, const vec_t& b, size_t i) {
+                    r.lane<uint32_t>(i) = uint32_t(int64_t(d.lane<int32_t>(i)) + dot_bytes(a, b, i));
+                });
+                set(XED_ICLASS_VPDPBUSDS, OperationType::kAccumulate, 4, [](vec_t& r, const vec_t& d, const vec_t& a, const vec_t& b, size_t i) {
+                    r.lane<int32_t>(i) = saturate_int32(int64_t(d.lane<int32_t>(i)) + dot_bytes(a, b, i));
+                });
+                set(XED_ICLASS_VPDPWSSD, OperationType::kAccumulate, 4, [](vec_t& r, const vec_t& d, const vec_t& a, const vec_t& b, size_t i) {
+                    r.lane<uint32_t>(i) = uint32_t(int64_t(d.lane<int32_t>(i)) + dot_words(a, b, i));
+                });
+                set(XED_ICLASS_VPDPWSSDS, OperationType::kAccumulate, 4, [](vec_t& r, const vec_t& d, const vec_t& a, const vec_t& b, size_t i) {
+                    r.lane<int32_t>(i) = saturate_int32(int64_t(d.lane<int32_t>(i)) + dot_words(a, b, i));
+                });
+
+                // moves
+                const lane_op_t move8 = INASM64_EMU_LANE(uint8_t, x);
+                const lane_op_t move16 = INASM64_EMU_LANE(uint16_t, x);
+                const lane_op_t move32 = INASM64_EMU_LANE(uint32_t, x);
+                const lane_op_t move64 = INASM64_EMU_LANE(uint64_t, x);
+                set(XED_ICLASS_VMOVDQU8, OperationType::kMove, 1, move8);
+                set(XED_ICLASS_VMOVDQU16, OperationType::kMove, 2, move16);
+                set(XED_ICLASS_VMOVDQU32, OperationType::kMove, 4, move32);
+                set(XED_ICLASS_VMOVDQU64, OperationType::kMove, 8, move64);
+                set(XED_ICLASS_VMOVDQA32, OperationType::kMove, 4, move32);
+                set(XED_ICLASS_VMOVDQA64, OperationType::kMove, 8, move64);
+                set(XED_ICLASS_VMOVDQU, OperationType::kMove, 8, move64);
+                set(XED_ICLASS_VMOVDQA, OperationType::kMove, 8, move64);
+                set(XED_ICLASS_VMOVUPS, OperationType::kMove, 4, move32);
+                set(XED_ICLASS_VMOVAPS, OperationType::kMove, 4, move32);
+                set(XED_ICLASS_VMOVUPD, OperationType::kMove, 8, move64);
+                set(XED_ICLASS_VMOVAPD, OperationType::kMove, 8, move64);
+                set(XED_ICLASS_MOVDQU, OperationType::kMove, 8, move64);
+                set(XED_ICLASS_MOVDQA, OperationType::kMove, 8, move64);
+                set(XED_ICLASS_MOVUPS, OperationType::kMove, 4, move32);
+                set(XED_ICLASS_MOVAPS, OperationType::kMove, 4, move32);
+                set(XED_ICLASS_MOVUPD, OperationType::kMove, 8, move64);
+                set(XED_ICLASS_MOVAPD, OperationType::kMove, 8, move64);
+                // movd/movq zero the rest of the register
+                const lane_op_t move_low32 = INASM64_EMU_LANE(uint32_t, i ? 0 : x);
+                const lane_op_t move_low64 = INASM64_EMU_LANE(uint64_t, i ? 0 : x);
+                set(XED_ICLASS_MOVD, OperationType::kMove, 4, move_low32);
+                set(XED_ICLASS_MOVQ, OperationType::kMove, 8, move_low64);
+                set(XED_ICLASS_VMOVD, OperationType::kMove, 4, move_low32);
+                set(XED_ICLASS_VMOVQ, OperationType::kMove, 8, move_low64);
+                const lane_op_t scalar_move32 = INASM64_EMU_LANE(uint32_t, y);
+                const lane_op_t scalar_move64 = INASM64_EMU_LANE(uint64_t, y);
+                set_scalar(XED_ICLASS_MOVSS, OperationType::kScalarMove, 4, scalar_move32);
+                set_scalar(XED_ICLASS_MOVSD_XMM, OperationType::kScalarMove, 8, scalar_move64);
+                set_scalar(XED_ICLASS_VMOVSS, OperationType::kScalarMove, 4, scalar_move32);
+                set_scalar(XED_ICLASS_VMOVSD, OperationType::kScalarMove, 8, scalar_move64);
+
+                // broadcasts
+                const lane_op_t broadcast32 = [](vec_t& r, const vec_t&, const vec_t& a, const vec_t&, size_t i) { r.lane<uint32_t>(i) = a.lane<uint32_t>(0); };
+                const lane_op_t broadcast64 = [](vec_t& r, const vec_t&, const vec_t& a, const vec_t&, size_t i) { r.lane<uint64_t>(i) = a.lane<uint64_t>(0); };
+                set(XED_ICLASS_VPBROADCASTD, OperationType::kBroadcast, 4, broadcast32);
+                set(XED_ICLASS_VPBROADCASTQ, OperationType::kBroadcast, 8, broadcast64);
+                set(XED_ICLASS_VBROADCASTSS, OperationType::kBroadcast, 4, broadcast32);
+                set(XED_ICLASS_VBROADCASTSD, OperationType::kBroadcast, 8, broadcast64);
+
+                // opmask register instructions
+                const auto set_mask = [](xed_iclass_enum_t b, xed_iclass_enum_t w, xed_iclass_enum_t d, xed_iclass_enum_t q, MaskOperation op) {
+                    _mask_operations[b] = { op, 8 };
+                    _mask_operations[w] = { op, 16 };
+                    _mask_operations[d] = { op, 32 };
+                    _mask_operations[q] = { op, 64 };
+                };
+                set_mask(XED_ICLASS_KMOVB, XED_ICLASS_KMOVW, XED_ICLASS_KMOVD, XED_ICLASS_KMOVQ, MaskOperation::kMove);
+                set_mask(XED_ICLASS_KANDB, XED_ICLASS_KANDW, XED_ICLASS_KANDD, XED_ICLASS_KANDQ, MaskOperation::kAnd);
+                set_mask(XED_ICLASS_KORB, XED_ICLASS_KORW, XED_ICLASS_KORD, XED_ICLASS_KORQ, MaskOperation::kOr);
+                set_mask(XED_ICLASS_KXORB, XED_ICLASS_KXORW, XED_ICLASS_KXORD, XED_ICLASS_KXORQ, MaskOperation::kXor);
+                set_mask(XED_ICLASS_KNOTB, XED_ICLASS_KNOTW, XED_ICLASS_KNOTD, XED_ICLASS_KNOTQ, MaskOperation::kNot);
+
+                return initialised = true;
+            }
+
+            bool decode(const void* instruction, size_t length, xed_decoded_inst_t& xedd)
+            {
+                initialise();
+                xed_decoded_inst_zero_set_mode(&xedd, &_dstate);
+                xed_decoded_inst_set_input_chip(&xedd, XED_CHIP_ALL);
+                return xed_decode(&xedd, reinterpret_cast<const xed_uint8_t*>(instruction), unsigned(length)) == XED_ERROR_NONE;
+            }
+
+            struct operand_t
+            {
+                enum class Kind
+                {
+                    kNone,
+                    kVector,
+                    kMask,
+                    kGpr,
+                    kMemory,
+                };
+                Kind _kind = Kind::kNone;
+                xed_reg_enum_t _reg = XED_REG_INVALID;
+            };
+
+            // collect the explicit operands, in order. If writeMask is non-null an opmask operand is treated as the write mask rather than an operand
+            bool collect_operands(const xed_decoded_inst_t& xedd, operand_t (&operands)[3], unsigned& count, xed_reg_enum_t* writeMask)
+            {
+                count = 0;
+                const auto xi = xed_decoded_inst_inst(&xedd);
+                for(unsigned i = 0; i < xed_inst_noperands(xi); ++i)
+                {
+                    const auto op = xed_inst_operand(xi, i);
+                    if(xed_operand_operand_visibility(op) == XED_OPVIS_SUPPRESSED)
+                        continue;
+                    const auto name = xed_operand_name(op);
+                    operand_t operand;
+                    if(name == XED_OPERAND_MEM0)
+                    {
+                        operand._kind = operand_t::Kind::kMemory;
+                    }
+                    else if(xed_operand_is_register(name))
+                    {
+                        operand._reg = xed_decoded_inst_get_reg(&xedd, name);
+                        switch(xed_reg_class(operand._reg))
+                        {
+                        case XED_REG_CLASS_XMM:
+                        case XED_REG_CLASS_YMM:
+                        case XED_REG_CLASS_ZMM:
+                            operand._kind = operand_t::Kind::kVector;
+                            break;
+                        case XED_REG_CLASS_MASK:
+                            if(writeMask)
+                            {
+                                *writeMask = operand._reg;
+                                continue;
+                            }
+                            operand._kind = operand_t::Kind::kMask;
+                            break;
+                        case XED_REG_CLASS_GPR:
+                            operand._kind = operand_t::Kind::kGpr;
+                            break;
+                        default:
+                            return false;
+                        }
+                    }
+                    else
+                    {
+                        // immediates etc. aren't used by anything we emulate
+                        return false;
+                    }
+                    if(count == 3)
+                        return false;
+                    operands[count++] = operand;
+                }
+                return count > 0;
+            }
+
+            // index into ExecutionContext::_zmm
+            size_t vector_index(xed_reg_enum_t reg)
+            {
+                switch(xed_reg_class(reg))
+                {
+                case XED_REG_CLASS_XMM:
+                    return size_t(reg - XED_REG_XMM0);
+                case XED_REG_CLASS_YMM:
+                    return size_t(reg - XED_REG_YMM0);
+                default:
+                    return size_t(reg - XED_REG_ZMM0);
+                }
+            }
+
+            uint64_t read_gpr(const ExecutionContext& ctx, xed_reg_enum_t reg)
+            {
+                const auto value = ctx._gpr[xed_get_largest_enclosing_register(reg) - XED_REG_RAX];
+                const auto bits = xed_get_register_width_bits64(reg);
+                return bits < 64 ? value & ((1ull << bits) - 1) : value;
+            }
+
+            void write_gpr(ExecutionContext& ctx, xed_reg_enum_t reg, uint64_t value)
+            {
+                // only 32- and 64 bit destinations are used by the instructions we emulate, and 32 bit writes zero extend
+                ctx._gpr[xed_get_largest_enclosing_register(reg) - XED_REG_RAX] = xed_get_register_width_bits64(reg) == 64 ? value : (value & 0xffffffff);
+            }
+
+            bool effective_address(const ExecutionContext& ctx, const xed_decoded_inst_t& xedd, uintptr_t& address)
+            {
+                const auto seg = xed_decoded_inst_get_seg_reg(&xedd, 0);
+                if(seg == XED_REG_FS || seg == XED_REG_GS)
+                    // we don't have the segment bases
+                    return false;
+
+                auto ea = uint64_t(xed_decoded_inst_get_memory_displacement(&xedd, 0));
+                const auto base = xed_decoded_inst_get_base_reg(&xedd, 0);
+                if(base == XED_REG_RIP || base == XED_REG_EIP)
+                    ea += ctx._next_rip;
+                else if(base != XED_REG_INVALID)
+                    ea += read_gpr(ctx, base);
+
+                const auto index = xed_decoded_inst_get_index_reg(&xedd, 0);
+                if(index != XED_REG_INVALID)
+                {
+                    // vector indices (gather/scatter) are not supported
+                    if(xed_reg_class(index) != XED_REG_CLASS_GPR)
+                        return false;
+                    ea += read_gpr(ctx, index) * xed_decoded_inst_get_scale(&xedd, 0);
+                }
+
+                if(xed_decoded_inst_get_memop_address_width(&xedd, 0) == 32)
+                    ea &= 0xffffffff;
+                address = uintptr_t(ea);
+                return true;
+            }
+
+            bool execute_vector(ExecutionContext& ctx, const xed_decoded_inst_t& xedd, const operation_t& operation)
+            {
+                operand_t operands[3];
+                unsigned count;
+                auto mask_reg = XED_REG_INVALID;
+                if(!collect_operands(xedd, operands, count, &mask_reg))
+                {
+                    detail::set_error(Error::kUnsupportedInstructionType);
+                    return false;
+                }
+                // legacy SSE encodings have no separate first source, it is the destination, and they preserve the destination above 128 bits
+                const auto legacy = xed3_operand_get_vexvalid(&xedd) == 0;
+                auto type = operation._type;
+                if(type == OperationType::kScalarMove)
+                    type = (count == 3 || (operands[0]._kind == operand_t::Kind::kVector && operands[1]._kind == operand_t::Kind::kVector)) ? OperationType::kBinary : OperationType::kMove;
+                if(legacy && count == 2 && (type == OperationType::kBinary || type == OperationType::kAccumulate))
+                {
+                    operands[2] = operands[1];
+                    operands[1] = operands[0];
+                    count = 3;
+                }
+                const auto sources_required = (type == OperationType::kBinary || type == OperationType::kAccumulate) ? 2u : 1u;
+                if(count != sources_required + 1)
+                {
+                    detail::set_error(Error::kUnsupportedInstructionType);
+                    return false;
+                }
+                const auto& dest = operands[0];
+
+                uintptr_t address = 0;
+                if(xed_decoded_inst_number_of_memory_operands(&xedd) && !effective_address(ctx, xedd, address))
+                {
+                    detail::set_error(Error::kUnsupportedInstructionType);
+                    return false;
+                }
+
+                const auto vl = legacy ? size_t(16) : size_t(xed_decoded_inst_vector_length_bits(&xedd) / 8);
+                const auto load = [&](const operand_t& operand, vec_t& value) -> bool {
+                    switch(operand._kind)
+                    {
+                    case operand_t::Kind::kVector:
+                        memcpy(value._bytes, ctx._zmm[vector_index(operand._reg)], sizeof(value._bytes));
+                        return true;
+                    case operand_t::Kind::kGpr:
+                        value.lane<uint64_t>(0) = read_gpr(ctx, operand._reg);
+                        return true;
+                    case operand_t::Kind::kMemory:
+                    {
+                        const auto length = size_t(xed_decoded_inst_get_memory_operand_length(&xedd, 0));
+                        if(length > sizeof(value._bytes) || !ctx._read_memory(address, value._bytes, length))
+                        {
+                            detail::set_error(Error::kAccessViolation);
+                            return false;
+                        }
+                        if(xed_decoded_inst_is_broadcast(&xedd))
+                        {
+                            // embedded broadcast, i.e. {1to16}
+                            for(auto offset = length; offset < vl; offset += length)
+                                memcpy(value._bytes + offset, value._bytes, length);
+                        }
+                        return true;
+                    }
+                    default:
+                        detail::set_error(Error::kUnsupportedInstructionType);
+                        return false;
+                    }
+                };
+
+                vec_t d, a, b;
+                if(dest._kind == operand_t::Kind::kVector)
+                    memcpy(d._bytes, ctx._zmm[vector_index(dest._reg)], sizeof(d._bytes));
+                if(!load(operands[1], a) || (sources_required == 2 && !load(operands[2], b)))
+                    return false;
+                // scalar move loads and stores take their element from the only source, and loads zero the rest
+                if(operation._type == OperationType::kScalarMove && type == OperationType::kMove)
+                {
+                    b = a;
+                    a = vec_t{};
+                }
+
+                const auto mask = (mask_reg == XED_REG_INVALID || mask_reg == XED_REG_K0) ? ~0ull : ctx._k[mask_reg - XED_REG_K0];
+                const auto zeroing = xed_decoded_inst_zeroing(&xedd) != 0;
+                const auto element_size = operation._element_size;
+                const auto elements = operation._scalar ? 1 : vl / element_size;
+
+                // start out with the original destination so that masked out elements are merged, scalar operations take the rest from the first source
+                auto result = operation._scalar ? a : d;
+                for(size_t i = 0; i < elements; ++i)
+                {
+                    if(mask & (1ull << i))
+                        operation._op(result, d, a, b, i);
+                    else if(zeroing)
+                        memset(result._bytes + i * element_size, 0, element_size);
+                    else
+                        memcpy(result._bytes + i * element_size, d._bytes + i * element_size, element_size);
+                }
+
+                if(dest._kind == operand_t::Kind::kVector)
+                {
+                    if(legacy)
+                    {
+                        memcpy(ctx._zmm[vector_index(dest._reg)], result._bytes, vl);
+                        return true;
+                    }
+                    // VEX and EVEX encoded instructions zero the destination above the vector length
+                    memset(result._bytes + vl, 0, sizeof(result._bytes) - vl);
+                    memcpy(ctx._zmm[vector_index(dest._reg)], result._bytes, sizeof(result._bytes));
+                    return true;
+                }
+
+                if(dest._kind == operand_t::Kind::kGpr)
+                {
+                    // movd/movq to a general purpose register
+                    write_gpr(ctx, dest._reg, result.lane<uint64_t>(0));
+                    return true;
+                }
+
+                if(dest._kind == operand_t::Kind::kMemory)
+                {
+                    const auto all = elements == 64 ? ~0ull : ((1ull << elements) - 1);
+                    if((mask & all) == all)
+                    {
+                        // which isn't always the vector length, i.e. movd and movss
+                        const auto length = size_t(xed_decoded_inst_get_memory_operand_length(&xedd, 0));
+                        if(!ctx._write_memory(address, result._bytes, length))
+                        {
+                            detail::set_error(Error::kAccessViolation);
+                            return false;
+                        }
+                        return true;
+                    }
+                    // masked stores only touch the selected elements
+                    for(size_t i = 0; i < elements; ++i)
+                    {
+                        if((mask & (1ull << i)) && !ctx._write_memory(address + i * element_size, result._bytes + i * element_size, element_size))
+                        {
+                            detail::set_error(Error::kAccessViolation);
+                            return false;
+                        }
+                    }
+                    return true;
+                }
+
+                detail::set_error(Error::kUnsupportedInstructionType);
+                return false;
+            }
+
+            bool execute_mask(ExecutionContext& ctx, const xed_decoded_inst_t& xedd, const mask_operation_t& operation)
+            {
+                operand_t operands[3];
+                unsigned count;
+                if(!collect_operands(xedd, operands, count, nullptr))
+                {
+                    detail::set_error(Error::kUnsupportedInstructionType);
+                    return false;
+                }
+
+                uintptr_t address = 0;
+                if(xed_decoded_inst_number_of_memory_operands(&xedd) && !effective_address(ctx, xedd, address))
+                {
+                    detail::set_error(Error::kUnsupportedInstructionType);
+                    return false;
+                }
+
+                const auto width_mask = operation._bits == 64 ? ~0ull : ((1ull << operation._bits) - 1);
+                const auto read = [&](const operand_t& operand, uint64_t& value) -> bool {
+                    value = 0;
+                    switch(operand._kind)
+                    {
+                    case operand_t::Kind::kMask:
+                        value = ctx._k[operand._reg - XED_REG_K0];
+                        break;
+                    case operand_t::Kind::kGpr:
+                        value = read_gpr(ctx, operand._reg);
+                        break;
+                    case operand_t::Kind::kMemory:
+                        if(!ctx._read_memory(address, &value, operation._bits / 8))
+                        {
+                            detail::set_error(Error::kAccessViolation);
+                            return false;
+                        }
+                        break;
+                    default:
+                        detail::set_error(Error::kUnsupportedInstructionType);
+                        return false;
+                    }
+                    value &= width_mask;
+                    return true;
+                };
+
+                uint64_t a = 0, b = 0;
+                if(count < 2 || !read(operands[1], a) || (count == 3 && !read(operands[2], b)))
+                    return false;
+
+                uint64_t value = 0;
+                switch(operation._op)
+                {
+                case MaskOperation::kMove:
+                    value = a;
+                    break;
+                case MaskOperation::kAnd:
+                    value = a & b;
+                    break;
+                case MaskOperation::kOr:
+                    value = a | b;
+                    break;
+                case MaskOperation::kXor:
+                    value = a ^ b;
+                    break;
+                case MaskOperation::kNot:
+                    value = ~a;
+                    break;
+                default:
+                    detail::set_error(Error::kUnsupportedInstructionType);
+                    return false;
+                }
+                value &= width_mask;
+
+                const auto& dest = operands[0];
+                switch(dest._kind)
+                {
+                case operand_t::Kind::kMask:
+                    ctx._k[dest._reg - XED_REG_K0] = value;
+                    return true;
+                case operand_t::Kind::kGpr:
+                    write_gpr(ctx, dest._reg, value);
+                    return true;
+                case operand_t::Kind::kMemory:
+                    if(!ctx._write_memory(address, &value, operation._bits / 8))
+                    {
+                        detail::set_error(Error::kAccessViolation);
+                        return false;
+                    }
+                    return true;
+                default:;
+                }
+                detail::set_error(Error::kUnsupportedInstructionType);
+                return false;
+            }
+        }  // namespace
+
+        bool CanEmulate(const void* instruction, size_t length)
+        {
+            xed_decoded_inst_t xedd;
+            if(!decode(instruction, length, xedd))
+                return false;
+            const auto iclass = xed_decoded_inst_get_iclass(&xedd);
+            if(_mask_operations[iclass]._op != MaskOperation::kNone)
+                return true;
+            if(_operations[iclass]._type == OperationType::kNone)
+                return false;
+            // EVEX.b on a register-only form selects embedded rounding or SAE, which we don't support
+            if(!xed_decoded_inst_number_of_memory_operands(&xedd) && xed3_operand_get_bcrc(&xedd))
+                return false;
+            return true;
+        }
+
+        bool Execute(ExecutionContext& ctx, const void* instruction, size_t length)
+        {
+            xed_decoded_inst_t xedd;
+            if(!decode(instruction, length, xedd))
+            {
+                detail::set_error(Error::kInvalidInstructionFormat);
+                return false;
+            }
+            const auto iclass = xed_decoded_inst_get_iclass(&xedd);
+            if(_mask_operations[iclass]._op != MaskOperation::kNone)
+                return execute_mask(ctx, xedd, _mask_operations[iclass]);
+            if(_operations[iclass]._type != OperationType::kNone)
+                return execute_vector(ctx, xedd, _operations[iclass]);
+            detail::set_error(Error::kUnsupportedInstructionType);
+            return false;
+        }
+    }  // namespace emulator
+}  // namespace inasm64
@@ -0,0 +1,56 @@
+// MIT License
+// Copyright 2019 Jarl Ostensen
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace inasm64
+{
+    ///<summary>
+    /// software execution of vector instructions that the host CPU doesn't support natively
+    ///</summary>
+    /// The runtime replaces these instructions with a trapping marker when they are committed and executes them here when the marker traps.
+    /// The SSE and AVX2 parts of the interpreter (see interpreter.h) are executed here as well.
+    namespace emulator
+    {
+        ///<summary>
+        /// the register file and memory an instruction is emulated against
+        ///</summary>
+        struct ExecutionContext
+        {
+            // general purpose registers in encoding order, i.e. rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi, r8 - r15
+            uint64_t _gpr[16] = { 0 };
+            // address of the instruction *following* the emulated one, used to resolve RIP relative operands.
+            // The interpreter (see interpreter.h) leaves it at the address execution continues at, i.e. the target of a taken branch
+            uint64_t _next_rip = 0;
+            // only used by the interpreter, the instructions emulated here don't change the flags
+            uint64_t _rflags = 0x202;
+            // full 512 bit vector registers, the xmm and ymm registers alias the low bytes
+            alignas(64) uint8_t _zmm[32][64] = { { 0 } };
+            // opmask registers
+            uint64_t _k[8] = { 0 };
+            // memory accessors, return false if the access fails
+            std::function<bool(uintptr_t address, void* dest, size_t size)> _read_memory;
+            std::function<bool(uintptr_t address, const void* src, size_t size)> _write_memory;
+        };
+        ///<summary>
+        /// true if the instruction can be executed by the emulator
+        ///</summary>
+        bool CanEmulate(const void* instruction, size_t length);
+        ///<summary>
+        /// execute a single instruction against ctx
+        ///</summary>
+        /// MXCSR rounding control and floating point exceptions are not emulated; results are rounded to nearest.
+        /// Returns false if the instruction isn't supported, or a memory access fails, in which case ctx may be partially updated.
+        bool Execute(ExecutionContext& ctx, const void* instruction, size_t length);
+    }  // namespace emulator
+}  // namespace inasm64
@@ -0,0 +1,482 @@
+// MIT License
+// Copyright 2019 Jarl Ostensen
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <windows.h>
+#include <cstring>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+
+#include "common.h"
+#include "x64.h"
+#include "runtime.h"
+#include "decoder.h"
+#include "globvars.h"
+#include "elf64.h"
+#include "exporter.h"
+
+namespace inasm64
+{
+    namespace exporter
+    {
+        namespace
+        {
+            // contents of a section, little endian as everything x86-64
+            struct section_writer_t
+            {
+                std::vector<uint8_t> _bytes;
+
+                template <typename T>
+                void put(const T& value)
+                {
+                    const auto bytes = reinterpret_cast<const uint8_t*>(&value);
+                    _bytes.insert(_bytes.end(), bytes, bytes + sizeof(T));
+                }
+                void put_string(const char* str)
+                {
+                    _bytes.insert(_bytes.end(), str, str + strlen(str) + 1);
+                }
+                void put_uleb(uint64_t value)
+                {
+                    do
+                    {
+                        auto byte = uint8_t(value & 0x7f);
+                        value >>= 7;
+                        if(value)
+                            byte |= 0x80;
+                        _bytes.push_back(byte);
+                    } while(value);
+                }
+                // patch a value put earlier, e.g. a length that is only known once the rest is written
+                template <typename T>
+                void patch(size_t offset, const T& value)
+                {
+                    memcpy(_bytes.data() + offset, &value, sizeof(T));
+                }
+                void align(size_t alignment)
+                {
+                    _bytes.resize((_bytes.size() + alignment - 1) / alignment * alignment, 0);
+                }
+            };
+
+            struct block_t
+            {
+                std::string _name;
+                size_t _first_line;
+                size_t _end_line;
+                bool _global;
+            };
+
+            struct variable_t
+            {
+                std::string _name;
+                uintptr_t _address;
+                size_t _size;
+                // in .rodata
+                size_t _offset;
+            };
+
+            struct relocation_t
+            {
+                // in .text
+                size_t _offset;
+                uint32_t _type;
+                size_t _variable;
+                int64_t _addend;
+            };
+
+            // the file name without directory and extension, as a C identifier
+            std::string symbol_name(const char* path)
+            {
+                std::string name = path;
+                const auto slash = name.find_last_of("\\/:");
+                if(slash != std::string::npos)
+                    name.erase(0, slash + 1);
+                const auto dot = name.find_last_of('.');
+                if(dot != std::string::npos && dot)
+                    name.erase(dot);
+                for(auto& c : name)
+                {
+                    if(!isalnum(uint8_t(c)))
+                        c = '_';
+                }
+                if(name.empty() || isdigit(uint8_t(name[0])))
+                    name.insert(name.begin(), '_');
+                return name;
+            }
+
+            // path with .inasm64.s appended, rather than its extension replaced, so it can't be an assembly source the object was built from
+            std::string listing_path(const char* path)
+            {
+                return std::string(path) + ".inasm64.s";
+            }
+
+            // DWARF constants, see the DWARF 4 standard
+            constexpr uint8_t kDwTagCompileUnit = 0x11;
+            constexpr uint8_t kDwAtName = 0x03;
+            constexpr uint8_t kDwAtStmtList = 0x10;
+            constexpr uint8_t kDwAtLowPc = 0x11;
+            constexpr uint8_t kDwAtHighPc = 0x12;
+            constexpr uint8_t kDwAtProducer = 0x25;
+            constexpr uint8_t kDwFormAddr = 0x01;
+            constexpr uint8_t kDwFormData8 = 0x07;
+            constexpr uint8_t kDwFormString = 0x08;
+            constexpr uint8_t kDwFormSecOffset = 0x17;
+            constexpr uint8_t kDwLnsCopy = 0x01;
+            constexpr uint8_t kDwLnsAdvancePc = 0x02;
+            constexpr uint8_t kDwLneEndSequence = 0x01;
+            constexpr uint8_t kDwLneSetAddress = 0x02;
+            // the line program's special opcodes; a line and up to 16 bytes forward fit in one, and instructions are at most 15 bytes
+            constexpr int kLineBase = -5;
+            constexpr uint8_t kLineRange = 14;
+            constexpr uint8_t kOpcodeBase = 13;
+
+            // a line program with one row per line: line n + 1 of the listing at the offset of line n in .text
+            void write_line_table(const std::vector<runtime::line_t>& lines, const std::string& source, section_writer_t& debug_line, size_t& address_offset)
+            {
+                debug_line.put(uint32_t(0));
+                debug_line.put(uint16_t(4));
+                const auto header_length_offset = debug_line._bytes.size();
+                debug_line.put(uint32_t(0));
+                // minimum instruction length, maximum operations per instruction, default is_stmt
+                debug_line.put(uint8_t(1));
+                debug_line.put(uint8_t(1));
+                debug_line.put(uint8_t(1));
+                debug_line.put(int8_t(kLineBase));
+                debug_line.put(kLineRange);
+                debug_line.put(kOpcodeBase);
+                // operand counts of the standard opcodes
+                const uint8_t standard_opcode_lengths[kOpcodeBase - 1] = { 0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1 };
+                for(auto length : standard_opcode_lengths)
+                    debug_line.put(length);
+                // no include directories, one file (in the compilation directory, modified whenever, of unknown size)
+                debug_line.put(uint8_t(0));
+                debug_line.put_string(source.c_str());
+                debug_line.put_uleb(0);
+                debug_line.put_uleb(0);
+                debug_line.put_uleb(0);
+                debug_line.put(uint8_t(0));
+                debug_line.patch(header_length_offset, uint32_t(debug_line._bytes.size() - header_length_offset - sizeof(uint32_t)));
+
+                debug_line.put(uint8_t(0));
+                debug_line.put_uleb(1 + sizeof(uint64_t));
+                debug_line.put(kDwLneSetAddress);
+                address_offset = debug_line._bytes.size();
+                debug_line.put(uint64_t(0));
+                // the line register starts at 1
+                debug_line.put(kDwLnsCopy);
+                for(size_t l = 1; l < lines.size(); ++l)
+                    debug_line.put(uint8_t((1 - kLineBase) + kLineRange * lines[l - 1]._size + kOpcodeBase));
+                debug_line.put(kDwLnsAdvancePc);
+                debug_line.put_uleb(lines.back()._size);
+                debug_line.put(uint8_t(0));
+                debug_line.put_uleb(1);
+                debug_line.put(kDwLneEndSequence);
+                debug_line.patch(0, uint32_t(debug_line._bytes.size() - sizeof(uint32_t)));
+            }
+        }  // namespace
+
+        bool Export(const char* path, const std::vector<std::string>& blocks, export_t& result)
+        {
+            result = {};
+            if(!path || !path[0])
+            {
+                detail::set_error(Error::kInvalidCommandFormat);
+                return false;
+            }
+            std::vector<runtime::line_t> lines;
+            std::vector<runtime::procedure_t> procedures;
+            if(!runtime::CommittedLines(lines) || !runtime::Procedures(procedures))
+                return false;
+            if(lines.empty())
+            {
+                detail::set_error(Error::kNoMoreCode);
+                return false;
+            }
+
+            // the main code is the lines up to the first procedure's fence
+            std::vector<block_t> all_blocks;
+            size_t main_end = 0;
+            while(main_end < lines.size() && !lines[main_end]._fence)
+                ++main_end;
+            if(main_end)
+                all_blocks.push_back({ symbol_name(path), 0, main_end, blocks.empty() });
+            for(const auto& procedure : procedures)
+                all_blocks.push_back({ procedure._name, procedure._first_line, procedure._end_line, blocks.empty() });
+            for(const auto& name : blocks)
+            {
+                const auto block = std::find_if(all_blocks.begin(), all_blocks.end(), [&name](const block_t& block) { return block._name == name; });
+                if(block == all_blocks.end())
+                {
+                    detail::set_error(Error::kInvalidProcedure);
+                    return false;
+                }
+                block->_global = true;
+            }
+
+            // lines are contiguous, so .text is the code region as it is
+            const auto code_begin = lines.front()._address;
+            const auto code_end = lines.back()._address + lines.back()._size;
+            std::vector<uint8_t> text;
+            text.reserve(code_end - code_begin);
+            for(const auto& line : lines)
+                text.insert(text.end(), line._bytes, line._bytes + line._size);
+
+            // references to variables become relocations, and the variables go into .rodata
+            const auto globals = globvars::All();
+            std::vector<variable_t> variables;
+            std::vector<relocation_t> relocations;
+            for(const auto& line : lines)
+            {
+                decoder::AddressReferenceInfo reference;
+                if(line._fence || !decoder::DecodeAddressReference(line._bytes, line._size, reference))
+                    continue;
+                const auto next = line._address + line._size;
+                const auto target = reference._rip_relative ? uintptr_t((long long)(next) + reference._value) : uintptr_t(reference._value);
+                // within the code, which keeps its layout
+                if(reference._rip_relative && target >= code_begin && target <= code_end)
+                    continue;
+                const auto allocation = uintptr_t(runtime::FindAllocation(target));
+                const auto global = std::find_if(globals.begin(), globals.end(), [allocation](const std::pair<std::string, uintptr_t>& global) { return allocation && global.second == allocation; });
+                if(global == globals.end())
+                {
+                    // an immediate that isn't a variable's address is just a number
+                    if(!reference._rip_relative)
+                        continue;
+                    detail::set_error(Error::kInvalidAddress);
+                    return false;
+                }
+                auto variable = std::find_if(variables.begin(), variables.end(), [allocation](const variable_t& variable) { return variable._address == allocation; });
+                if(variable == variables.end())
+                {
+                    variables.push_back({ global->first, allocation, runtime::AllocationSize(reinterpret_cast<const void*>(allocation)), 0 });
+                    variable = variables.end() - 1;
+                }
+                relocation_t relocation;
+                relocation._offset = line._address - code_begin + reference._offset;
+                relocation._variable = size_t(variable - variables.begin());
+                if(reference._rip_relative)
+                {
+                    // S + A - P, with P the address of the displacement field rather than of the next instruction
+                    relocation._type = elf64::kRelocPc32;
+                    relocation._addend = int64_t(target - allocation) - int64_t(line._size - reference._offset);
+                }
+                else
+                {
+                    relocation._type = elf64::kReloc64;
+                    relocation._addend = int64_t(target - allocation);
+                }
+                // the addend is in the relocation, not in the field
+                memset(text.data() + relocation._offset, 0, reference._bytes);
+                relocations.push_back(relocation);
+            }
+
+            section_writer_t rodata;
+            for(auto& variable : variables)
+            {
+                // cache line aligned, as buffers usually are
+                rodata.align(64);
+                variable._offset = rodata._bytes.size();
+                rodata._bytes.resize(variable._offset + variable._size);
+                if(!runtime::ReadBytes(reinterpret_cast<const void*>(variable._address), rodata._bytes.data() + variable._offset, variable._size))
+                    return false;
+            }
+
+            // the listing is the source of the line table, line n + 1 is line n of the code
+            const auto listing = listing_path(path);
+            char full_listing[MAX_PATH];
+            const auto source = GetFullPathNameA(listing.c_str(), DWORD(sizeof(full_listing)), full_listing, nullptr) ? std::string(full_listing) : listing;
+            {
+                std::ofstream file{ listing };
+                for(const auto& line : lines)
+                {
+                    char text_line[128] = { 0 };
+                    if(!decoder::Disassemble(line._bytes, line._size, line._address - code_begin, text_line, sizeof(text_line)))
+                        strcpy_s(text_line, "(bad)");
+                    file << "\t" << text_line;
+                    const auto block = std::find_if(all_blocks.begin(), all_blocks.end(), [&line](const block_t& block) { return block._first_line == line._line; });
+                    if(block != all_blocks.end())
+                        file << "\t; " << block->_name;
+                    file << "\n";
+                }
+                if(!file)
+                {
+                    detail::set_error(Error::kSystemError);
+                    return false;
+                }
+            }
+
+            // sections, in this order
+            enum : uint16_t
+            {
+                kText = 1,
+                kRodata,
+                kRelaText,
+                kDebugAbbrev,
+                kDebugInfo,
+                kRelaDebugInfo,
+                kDebugLine,
+                kRelaDebugLine,
+                kNoteGnuStack,
+                kSymtab,
+                kStrtab,
+                kShstrtab,
+                kSectionCount
+            };
+            // symbols: one per section that relocations refer to, then variables and local blocks, then global blocks
+            enum : uint32_t
+            {
+                kTextSymbol = 1,
+                kRodataSymbol,
+                kDebugAbbrevSymbol,
+                kDebugLineSymbol,
+                kFirstSymbol
+            };
+            section_writer_t symtab, strtab;
+            symtab.put(elf64::symbol_t{});
+            for(const auto section : { kText, kRodata, kDebugAbbrev, kDebugLine })
+                symtab.put(elf64::symbol_t{ 0, elf64::symbol_info(elf64::kLocal, elf64::kSection), 0, uint16_t(section), 0, 0 });
+            strtab.put(uint8_t(0));
+            const auto add_symbol = [&symtab, &strtab](const std::string& name, uint8_t info, uint16_t section, uint64_t value, uint64_t size) {
+                symtab.put(elf64::symbol_t{ uint32_t(strtab._bytes.size()), info, 0, section, value, size });
+                strtab.put_string(name.c_str());
+            };
+            for(const auto& variable : variables)
+                add_symbol(variable._name, elf64::symbol_info(elf64::kLocal, elf64::kObject), kRodata, variable._offset, variable._size);
+            for(const auto global : { false, true })
+            {
+                for(const auto& block : all_blocks)
+                {
+                    if(block._global != global)
+                        continue;
+                    const auto begin = lines[block._first_line]._address - code_begin;
+                    const auto end = block._end_line < lines.size() ? lines[block._end_line]._address - code_begin : text.size();
+                    add_symbol(block._name, elf64::symbol_info(global ? elf64::kGlobal : elf64::kLocal, elf64::kFunction), kText, begin, end - begin);
+                    if(global)
+                        result._symbols.push_back(block._name);
+                }
+            }
+            const auto first_global = uint32_t(symtab._bytes.size() / sizeof(elf64::symbol_t) - result._symbols.size());
+
+            section_writer_t rela_text;
+            for(const auto& relocation : relocations)
+                rela_text.put(elf64::rela_t{ relocation._offset, elf64::rela_info(uint32_t(kFirstSymbol + relocation._variable), relocation._type), relocation._addend });
+
+            // a compile unit covering .text, pointing at the line table
+            section_writer_t debug_abbrev;
+            debug_abbrev.put_uleb(1);
+            debug_abbrev.put_uleb(kDwTagCompileUnit);
+            // no children
+            debug_abbrev.put(uint8_t(0));
+            for(const auto& attribute : { std::make_pair(kDwAtProducer, kDwFormString), std::make_pair(kDwAtName, kDwFormString), std::make_pair(kDwAtStmtList, kDwFormSecOffset),
+                    std::make_pair(kDwAtLowPc, kDwFormAddr), std::make_pair(kDwAtHighPc, kDwFormData8) })
+            {
+                debug_abbrev.put_uleb(attribute.first);
+                debug_abbrev.put_uleb(attribute.second);
+            }
+            debug_abbrev.put(uint16_t(0));
+            debug_abbrev.put(uint8_t(0));
+
+            section_writer_t debug_info, rela_debug_info;
+            debug_info.put(uint32_t(0));
+            debug_info.put(uint16_t(4));
+            rela_debug_info.put(elf64::rela_t{ debug_info._bytes.size(), elf64::rela_info(kDebugAbbrevSymbol, elf64::kReloc32), 0 });
+            debug_info.put(uint32_t(0));
+            debug_info.put(uint8_t(sizeof(uint64_t)));
+            debug_info.put_uleb(1);
+            debug_info.put_string("inasm64");
+            debug_info.put_string(source.c_str());
+            rela_debug_info.put(elf64::rela_t{ debug_info._bytes.size(), elf64::rela_info(kDebugLineSymbol, elf64::kReloc32), 0 });
+            debug_info.put(uint32_t(0));
+            rela_debug_info.put(elf64::rela_t{ debug_info._bytes.size(), elf64::rela_info(kTextSymbol, elf64::kReloc64), 0 });
+            debug_info.put(uint64_t(0));
+            debug_info.put(uint64_t(text.size()));
+            debug_info.patch(0, uint32_t(debug_info._bytes.size() - sizeof(uint32_t)));
+
+            section_writer_t debug_line, rela_debug_line;
+            size_t address_offset;
+            write_line_table(lines, source, debug_line, address_offset);
+            rela_debug_line.put(elf64::rela_t{ address_offset, elf64::rela_info(kTextSymbol, elf64::kReloc64), 0 });
+
+            section_writer_t shstrtab;
+            shstrtab.put(uint8_t(0));
+            const auto section_name = [&shstrtab](const char* name) {
+                const auto offset = uint32_t(shstrtab._bytes.size());
+                shstrtab.put_string(name);
+                return offset;
+            };
+            struct section_t
+            {
+                elf64::section_t _header;
+                const std::vector<uint8_t>* _bytes;
+            };
+            section_t sections[kSectionCount] = {};
+            sections[kText] = { { section_name(".text"), elf64::kProgBits, elf64::kAlloc | elf64::kExecutable, 0, 0, 0, 0, 0, 16, 0 }, &text };
+            sections[kRodata] = { { section_name(".rodata"), elf64::kProgBits, elf64::kAlloc, 0, 0, 0, 0, 0, 64, 0 }, &rodata._bytes };
+            sections[kRelaText] = { { section_name(".rela.text"), elf64::kRela, elf64::kInfoLink, 0, 0, 0, kSymtab, uint32_t(kText), 8, sizeof(elf64::rela_t) }, &rela_text._bytes };
+            sections[kDebugAbbrev] = { { section_name(".debug_abbrev"), elf64::kProgBits, 0, 0, 0, 0, 0, 0, 1, 0 }, &debug_abbrev._bytes };
+            sections[kDebugInfo] = { { section_name(".debug_info"), elf64::kProgBits, 0, 0, 0, 0, 0, 0, 1, 0 }, &debug_info._bytes };
+            sections[kRelaDebugInfo] = { { section_name(".rela.debug_info"), elf64::kRela, elf64::kInfoLink, 0, 0, 0, kSymtab, uint32_t(kDebugInfo), 8, sizeof(elf64::rela_t) }, &rela_debug_info._bytes };
+            sections[kDebugLine] = { { section_name(".debug_line"), elf64::kProgBits, 0, 0, 0, 0, 0, 0, 1, 0 }, &debug_line._bytes };
+            sections[kRelaDebugLine] = { { section_name(".rela.debug_line"), elf64::kRela, elf64::kInfoLink, 0, 0, 0, kSymtab, uint32_t(kDebugLine), 8, sizeof(elf64::rela_t) }, &rela_debug_line._bytes };
+            // empty, to tell the linker the code doesn't need an executable stack
+            const std::vector<uint8_t> no_bytes;
+            sections[kNoteGnuStack] = { { section_name(".note.GNU-stack"), elf64::kProgBits, 0, 0, 0, 0, 0, 0, 1, 0 }, &no_bytes };
+            sections[kSymtab] = { { section_name(".symtab"), elf64::kSymbolTable, 0, 0, 0, 0, kStrtab, first_global, 8, sizeof(elf64::symbol_t) }, &symtab._bytes };
+            sections[kStrtab] = { { section_name(".strtab"), elf64::kStringTable, 0, 0, 0, 0, 0, 0, 1, 0 }, &strtab._bytes };
+            sections[kShstrtab] = { { section_name(".shstrtab"), elf64::kStringTable, 0, 0, 0, 0, 0, 0, 1, 0 }, &shstrtab._bytes };
+
+            // header, section contents, then the section headers
+            section_writer_t file;
+            file._bytes.resize(sizeof(elf64::header_t));
+            for(auto s = 1; s < kSectionCount; ++s)
+            {
+                auto& header = sections[s]._header;
+                file.align(size_t(header._addralign));
+                header._offset = file._bytes.size();
+                header._size = sections[s]._bytes->size();
+                file._bytes.insert(file._bytes.end(), sections[s]._bytes->begin(), sections[s]._bytes->end());
+            }
+            file.align(8);
+            elf64::header_t header = {};
+            const uint8_t ident[] = { 0x7f, 'E', 'L', 'F', elf64::kClass64, elf64::kLittleEndian, elf64::kCurrentVersion };
+            memcpy(header._ident, ident, sizeof(ident));
+            header._type = elf64::kRelocatable;
+            header._machine = elf64::kMachineX64;
+            header._version = elf64::kCurrentVersion;
+            header._shoff = file._bytes.size();
+            header._ehsize = sizeof(elf64::header_t);
+            header._shentsize = sizeof(elf64::section_t);
+            header._shnum = kSectionCount;
+            header._shstrndx = kShstrtab;
+            file.patch(0, header);
+            for(const auto& section : sections)
+                file.put(section._header);
+
+            std::ofstream object{ path, std::ios::binary };
+            object.write(reinterpret_cast<const char*>(file._bytes.data()), std::streamsize(file._bytes.size()));
+            if(!object)
+            {
+                detail::set_error(Error::kSystemError);
+                return false;
+            }
+            for(const auto& variable : variables)
+                result._variables.push_back(variable._name);
+            result._code_size = text.size();
+            result._data_size = rodata._bytes.size();
+            result._relocations = relocations.size();
+            result._lines = lines.size();
+            result._listing = listing;
+            return true;
+        }
+    }  // namespace exporter
+}  // namespace inasm64
@@ -0,0 +1,51 @@
+// MIT License
+// Copyright 2019 Jarl Ostensen
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace inasm64
+{
+    ///<summary>
+    /// writing the committed code out as a relocatable x86-64 ELF object, to link into a program as it is
+    ///</summary>
+    /// The object holds all the committed lines in .text, in the same layout as in the runtime, so branches and calls between blocks stay as they are.
+    /// Variables (see globvars) the code refers to, through a RIP-relative operand or a 64 bit immediate such as mov rsi, $buffer, are copied into .rodata
+    /// and the references become relocations against them. A DWARF line table maps each line to its line in a listing written next to the object,
+    /// so profilers and debuggers show the generated listing, not the lines as they were typed.
+    namespace exporter
+    {
+        ///<summary>
+        /// result of Export
+        ///</summary>
+        struct export_t
+        {
+            // global symbols
+            std::vector<std::string> _symbols;
+            // variables copied into .rodata
+            std::vector<std::string> _variables;
+            size_t _code_size = 0;
+            size_t _data_size = 0;
+            size_t _relocations = 0;
+            size_t _lines = 0;
+            // the source file of the line table
+            std::string _listing;
+        };
+        ///<summary>
+        /// write the committed code to path as an ELF object, with a global function symbol for each block and the listing next to it (path with .inasm64.s appended, e.g. kernel.o.inasm64.s)
+        ///</summary>
+        /// The blocks are the main code, named after the file (e.g. "kernel" for kernel.o), and the procedures. Without names all of them are exported,
+        /// otherwise only the named ones get global symbols and the rest local ones; fails with Error::kInvalidProcedure if a name is neither.
+        /// A RIP-relative operand that refers to neither the code nor a variable fails with Error::kInvalidAddress.
+        bool Export(const char* path, const std::vector<std::string>& blocks, export_t& result);
+    }  // namespace exporter
+}  // namespace inasm64
@@ -42,5 +42,14 @@ namespace inasm64
             }
             return false;
         }
+
+        std::vector<std::pair<std::string, uintptr_t>> All()
+        {
+            std::vector<std::pair<std::string, uintptr_t>> variables;
+            variables.reserve(detail::_glob_map.size());
+            for(const auto& kv : detail::_glob_map)
+                variables.emplace_back(kv.first, kv.second);
+            return variables;
+        }
     }  // namespace globvars
 }  // namespace inasm64
\ No newline at end of file
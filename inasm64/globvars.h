@@ -1,5 +1,9 @@
 #pragma once
 
+#include <string>
+#include <utility>
+#include <vector>
+
 namespace inasm64
 {
     namespace globvars
@@ -13,6 +17,10 @@ namespace inasm64
         /// Get a named global variable, returns true if exists
         ///</summary>
         bool Get(const char* name, uintptr_t& value);
+        ///<summary>
+        /// all named global variables, in no particular order
+        ///</summary>
+        std::vector<std::pair<std::string, uintptr_t>> All();
 
     }  // namespace globvars
 }  // namespace inasm64
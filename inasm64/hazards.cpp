@@ -0,0 +1,141 @@
+// MIT License
+// Copyright 2019 Jarl Ostensen
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <cstring>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+#include "common.h"
+#include "x64.h"
+#include "runtime.h"
+#include "decoder.h"
+#include "hazards.h"
+
+namespace inasm64
+{
+    namespace hazards
+    {
+        namespace
+        {
+            bool is_backward_branch(const runtime::line_t& line)
+            {
+                decoder::RelativeBranchInfo info;
+                return decoder::DecodeRelativeBranch(line._bytes, line._size, info) && !info._call && info._displacement < 0;
+            }
+
+            // lines [begin, end) in order, and again from the top with the state at the bottom if there is a loop
+            void check_segment(const std::vector<runtime::line_t>& lines, size_t begin, size_t end, std::vector<transition_t>& transitions)
+            {
+                const auto loops = std::any_of(lines.begin() + begin, lines.begin() + end, is_backward_branch);
+                auto dirty = false;
+                size_t dirty_line = 0;
+                for(auto pass = 0; pass < (loops ? 2 : 1); ++pass)
+                {
+                    for(auto l = begin; l < end; ++l)
+                    {
+                        const auto info = decoder::Decode(lines[l]._bytes, lines[l]._size);
+                        if(info._zeroes_upper)
+                        {
+                            dirty = false;
+                        }
+                        else if(info._dirties_upper)
+                        {
+                            dirty = true;
+                            dirty_line = l;
+                        }
+                        else if(dirty && info._class == decoder::InstructionInfo::InstructionClass::kSse)
+                        {
+                            const auto reported = std::any_of(transitions.begin(), transitions.end(), [l](const transition_t& transition) { return transition._line == l; });
+                            if(!reported)
+                                transitions.push_back({ l, dirty_line });
+                        }
+                    }
+                }
+            }
+
+            bool is_denormal(const uint8_t* element, bool isDouble)
+            {
+                if(isDouble)
+                {
+                    uint64_t bits;
+                    memcpy(&bits, element, sizeof(bits));
+                    return !(bits & 0x7ff0000000000000ull) && (bits & 0x000fffffffffffffull);
+                }
+                uint32_t bits;
+                memcpy(&bits, element, sizeof(bits));
+                return !(bits & 0x7f800000) && (bits & 0x007fffff);
+            }
+
+            void check_operands(const decoder::FloatOperandsInfo& operands, size_t line, bool outputs, std::vector<denormal_t>& denormals)
+            {
+                for(unsigned n = 0; n < operands._count; ++n)
+                {
+                    const auto& operand = operands._operands[n];
+                    if(outputs ? !operand._written : !operand._read)
+                        continue;
+                    // read through the narrowest register that holds the operand
+                    char name[8];
+                    sprintf_s(name, sizeof(name), "%cmm%u", operand._bits <= 128 ? 'x' : (operand._bits <= 256 ? 'y' : 'z'), operand._index);
+                    const auto reg_info = GetRegisterInfo(name);
+                    uint8_t value[64] = { 0 };
+                    if(reg_info._register == RegisterInfo::Register::kInvalid || !runtime::GetReg(reg_info, value, sizeof(value)))
+                        continue;
+                    const auto element_size = operand._double ? 8u : 4u;
+                    for(unsigned element = 0; element < operand._bits / 8 / element_size; ++element)
+                    {
+                        if(is_denormal(value + element * element_size, operand._double))
+                            denormals.push_back({ line, operand._index, element, operand._double, outputs });
+                    }
+                }
+            }
+        }  // namespace
+
+        bool FindSseAvxTransitions(std::vector<transition_t>& transitions)
+        {
+            transitions.clear();
+            std::vector<runtime::line_t> lines;
+            if(!runtime::CommittedLines(lines))
+                return false;
+            // the main code, then each procedure after its fence
+            size_t begin = 0;
+            for(size_t l = 0; l <= lines.size(); ++l)
+            {
+                if(l == lines.size() || lines[l]._fence)
+                {
+                    check_segment(lines, begin, l, transitions);
+                    begin = l + 1;
+                }
+            }
+            return true;
+        }
+
+        bool CheckedStep(std::vector<denormal_t>& denormals)
+        {
+            denormals.clear();
+            std::vector<runtime::line_t> lines;
+            uint32_t mxcsr;
+            if(!runtime::CommittedLines(lines) || !runtime::GetMxcsr(mxcsr))
+                return false;
+            const auto address = uintptr_t(runtime::InstructionPointer());
+            const auto line = std::find_if(lines.begin(), lines.end(), [address](const runtime::line_t& l) { return l._address == address; });
+
+            decoder::FloatOperandsInfo operands;
+            const auto check = line != lines.end() && decoder::DecodeFloatOperands(line->_bytes, line->_size, operands);
+            if(check && !(mxcsr & kMxcsrDaz))
+                check_operands(operands, line->_line, false, denormals);
+            if(!runtime::Step())
+                return false;
+            if(check && !(mxcsr & kMxcsrFtz))
+                check_operands(operands, line->_line, true, denormals);
+            return true;
+        }
+    }  // namespace hazards
+}  // namespace inasm64
@@ -0,0 +1,63 @@
+// MIT License
+// Copyright 2019 Jarl Ostensen
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace inasm64
+{
+    ///<summary>
+    /// floating point performance hazards in the committed code: SSE/AVX transitions, denormals, and the MXCSR modes that avoid them
+    ///</summary>
+    namespace hazards
+    {
+        ///<summary>
+        /// MXCSR denormals-are-zero and flush-to-zero bits
+        ///</summary>
+        constexpr uint32_t kMxcsrDaz = 0x40;
+        constexpr uint32_t kMxcsrFtz = 0x8000;
+        ///<summary>
+        /// a legacy SSE instruction that can execute with the upper halves of the vector registers dirty
+        ///</summary>
+        struct transition_t
+        {
+            // line of the SSE instruction
+            size_t _line = 0;
+            // line of the 256 or 512 bit instruction that last dirtied the upper halves before it
+            size_t _dirty_line = 0;
+        };
+        ///<summary>
+        /// find legacy SSE instructions that follow a 256 or 512 bit VEX/EVEX instruction without a vzeroupper or vzeroall in between
+        ///</summary>
+        /// The main code and each procedure are checked separately in line order, and a second time round if they contain a backward branch,
+        /// since a loop carries the dirty state from its bottom back to its top. Calls aren't followed.
+        bool FindSseAvxTransitions(std::vector<transition_t>& transitions);
+        ///<summary>
+        /// a denormal value in a floating point operand
+        ///</summary>
+        struct denormal_t
+        {
+            size_t _line = 0;
+            // xmm/ymm/zmm register number and the element in it
+            unsigned _register = 0;
+            unsigned _element = 0;
+            bool _double = false;
+            // an output of the instruction, otherwise an input
+            bool _output = false;
+        };
+        ///<summary>
+        /// runtime::Step, checking the floating point register operands of the instruction for denormals before (inputs) and after (outputs) it executes
+        ///</summary>
+        /// Inputs aren't reported if MXCSR.DAZ is set, since they are treated as 0 without a penalty, and with MXCSR.FTZ set the outputs won't be denormal.
+        /// Memory operands aren't checked.
+        bool CheckedStep(std::vector<denormal_t>& denormals);
+    }  // namespace hazards
+}  // namespace inasm64
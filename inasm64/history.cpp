@@ -0,0 +1,241 @@
+// MIT License
+// Copyright 2019 Jarl Ostensen
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include "common.h"
+#include "x64.h"
+#include "runtime.h"
+#include "history.h"
+
+namespace inasm64
+{
+    namespace history
+    {
+        namespace
+        {
+            // rax..r15, xmm0..xmm15, eflags
+            constexpr size_t kGprColumns = 16;
+            constexpr size_t kXmmColumns = 16;
+            constexpr size_t kColumnCount = kGprColumns + kXmmColumns + 1;
+
+            struct column_t
+            {
+                // ascending, one entry per change
+                std::vector<uint64_t> _steps;
+                // _words per entry
+                std::vector<uint64_t> _values;
+                size_t _words = 1;
+            };
+            column_t _columns[kColumnCount];
+            // indexed by step
+            std::vector<uintptr_t> _addresses;
+            std::vector<Source> _sources;
+
+            // the register a column holds
+            RegisterInfo column_register(size_t column)
+            {
+                if(column < kGprColumns)
+                    return RegisterInfo{ static_cast<RegisterInfo::Register>(static_cast<size_t>(RegisterInfo::Register::rax) + column) };
+                if(column < kGprColumns + kXmmColumns)
+                    return RegisterInfo{ static_cast<RegisterInfo::Register>(static_cast<size_t>(RegisterInfo::Register::xmm0) + column - kGprColumns) };
+                return RegisterInfo{ RegisterInfo::Register::eflags };
+            }
+
+            // the column of a register, or kColumnCount if it has none
+            size_t register_column(const RegisterInfo& reg)
+            {
+                switch(reg._class)
+                {
+                case RegisterInfo::RegClass::kGpr:
+                    return static_cast<size_t>(reg._greatest_enclosing_register) - static_cast<size_t>(RegisterInfo::Register::rax);
+                case RegisterInfo::RegClass::kXmm:
+                    return kGprColumns + static_cast<size_t>(reg._register) - static_cast<size_t>(RegisterInfo::Register::xmm0);
+                case RegisterInfo::RegClass::kFlags:
+                    return kColumnCount - 1;
+                default:
+                    return kColumnCount;
+                }
+            }
+
+            bool read_column(size_t column, uint64_t value[2])
+            {
+                const auto reg = column_register(column);
+                value[0] = value[1] = 0;
+                if(reg._class == RegisterInfo::RegClass::kFlags)
+                {
+                    // the context only holds 32 bits of them
+                    uint32_t flags;
+                    if(!runtime::GetReg(reg, flags))
+                        return false;
+                    value[0] = flags;
+                    return true;
+                }
+                return runtime::GetReg(reg, value, _columns[column]._words * sizeof(uint64_t));
+            }
+
+            void append(size_t column, uint64_t step, const uint64_t value[2])
+            {
+                auto& col = _columns[column];
+                col._steps.push_back(step);
+                col._values.insert(col._values.end(), value, value + col._words);
+            }
+
+            void new_step(Source source, uintptr_t address)
+            {
+                _sources.push_back(source);
+                _addresses.push_back(address);
+            }
+
+            change_t make_change(size_t column, size_t entry)
+            {
+                const auto& col = _columns[column];
+                change_t change;
+                change._step = col._steps[entry];
+                change._source = _sources[size_t(change._step)];
+                change._address = _addresses[size_t(change._step)];
+                memcpy(change._value, col._values.data() + entry * col._words, col._words * sizeof(uint64_t));
+                return change;
+            }
+
+            // fill in the lines of the instructions that made the changes
+            void resolve_lines(std::vector<change_t>& changes)
+            {
+                for(auto& change : changes)
+                {
+                    if(change._source != Source::kStart && change._source != Source::kWrite)
+                        change._has_line = runtime::LineAt(change._address, change._line);
+                }
+            }
+
+            size_t checked_column(const RegisterInfo& reg)
+            {
+                const auto column = register_column(reg);
+                if(column >= kColumnCount)
+                    detail::set_error(Error::kInvalidRegisterName);
+                else if(_sources.empty())
+                    // nothing has been stepped, the history is just the current registers
+                    Begin();
+                return column;
+            }
+        }  // namespace
+
+        bool Begin()
+        {
+            if(!_sources.empty())
+                return true;
+            for(size_t c = 0; c < kColumnCount; ++c)
+            {
+                _columns[c]._words = c >= kGprColumns && c < kGprColumns + kXmmColumns ? 2 : 1;
+                uint64_t value[2];
+                if(!read_column(c, value))
+                {
+                    Clear();
+                    return false;
+                }
+                append(c, 0, value);
+            }
+            new_step(Source::kStart, 0);
+            return true;
+        }
+
+        bool Record(Source source, const void* address)
+        {
+            if(_sources.empty())
+            {
+                // the values before the step are gone, start from the ones after it
+                return Begin();
+            }
+            const auto step = uint64_t(_sources.size());
+            for(const auto& changed : runtime::ChangedRegisters())
+            {
+                const auto column = register_column(RegisterInfo{ changed.first });
+                uint64_t value[2];
+                if(column >= kColumnCount || !read_column(column, value))
+                    continue;
+                append(column, step, value);
+            }
+            new_step(source, uintptr_t(address));
+            return true;
+        }
+
+        bool Sync()
+        {
+            if(_sources.empty())
+                return Begin();
+            const auto step = uint64_t(_sources.size());
+            auto changed = false;
+            for(size_t c = 0; c < kColumnCount; ++c)
+            {
+                const auto& col = _columns[c];
+                uint64_t value[2];
+                if(!read_column(c, value))
+                    return false;
+                if(memcmp(value, col._values.data() + col._values.size() - col._words, col._words * sizeof(uint64_t)) != 0)
+                {
+                    append(c, step, value);
+                    changed = true;
+                }
+            }
+            if(changed)
+                new_step(Source::kWrite, 0);
+            return true;
+        }
+
+        void Clear()
+        {
+            for(auto& col : _columns)
+            {
+                col._steps.clear();
+                col._values.clear();
+            }
+            _addresses.clear();
+            _sources.clear();
+        }
+
+        uint64_t Steps()
+        {
+            return _sources.empty() ? 0 : uint64_t(_sources.size() - 1);
+        }
+
+        bool Changes(const RegisterInfo& reg, uint64_t from, uint64_t to, std::vector<change_t>& changes)
+        {
+            changes.clear();
+            const auto column = checked_column(reg);
+            if(column >= kColumnCount || _sources.empty())
+                return false;
+            if(from > to)
+                return true;
+            const auto& steps = _columns[column]._steps;
+            // the value in effect at from is the last change at or before it, step 0 always has one
+            const auto first = std::upper_bound(steps.begin(), steps.end(), from) - 1;
+            const auto last = std::upper_bound(first, steps.end(), to);
+            changes.reserve(size_t(last - first));
+            for(auto entry = first; entry != last; ++entry)
+                changes.push_back(make_change(column, size_t(entry - steps.begin())));
+            resolve_lines(changes);
+            return true;
+        }
+
+        bool LastChange(const RegisterInfo& reg, uint64_t step, change_t& change)
+        {
+            const auto column = checked_column(reg);
+            if(column >= kColumnCount || _sources.empty())
+                return false;
+            const auto& steps = _columns[column]._steps;
+            const auto entry = std::upper_bound(steps.begin(), steps.end(), step) - 1;
+            std::vector<change_t> changes{ make_change(column, size_t(entry - steps.begin())) };
+            resolve_lines(changes);
+            change = changes.front();
+            return true;
+        }
+    }  // namespace history
+}  // namespace inasm64
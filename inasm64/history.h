@@ -0,0 +1,84 @@
+// MIT License
+// Copyright 2019 Jarl Ostensen
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace inasm64
+{
+    ///<summary>
+    /// a time indexed history of the general purpose, xmm and flags registers over a stepping session
+    ///</summary>
+    /// Each register has its own column of (step, value) pairs, appended to from the runtime's changed registers after every step,
+    /// so the log only grows by what changed and a query is a binary search of one column rather than a replay of the session.
+    namespace history
+    {
+        ///<summary>
+        /// what a step in the history is
+        ///</summary>
+        enum class Source
+        {
+            // step 0, the registers when the history began
+            kStart,
+            // a single instruction (runtime::Step)
+            kInstruction,
+            // a runtime::Run, changes are relative to the registers before it
+            kRun,
+            // registers set between steps, e.g. with runtime::SetReg
+            kWrite,
+        };
+        ///<summary>
+        /// a register value and the step that set it
+        ///</summary>
+        struct change_t
+        {
+            uint64_t _step = 0;
+            Source _source = Source::kStart;
+            // the instruction executed, or where a run started, and its line if it is still in the code
+            uintptr_t _address = 0;
+            size_t _line = 0;
+            bool _has_line = false;
+            // xmm registers use both words, the others only the first
+            uint64_t _value[2] = {};
+        };
+        ///<summary>
+        /// start the history from the current registers, as step 0, unless it has already started
+        ///</summary>
+        bool Begin();
+        ///<summary>
+        /// append a step with the registers runtime::ChangedRegisters reports, after runtime::Step (kInstruction) or runtime::Run (kRun) from address
+        ///</summary>
+        bool Record(Source source, const void* address);
+        ///<summary>
+        /// append a kWrite step with the registers whose values differ from the last ones recorded, if any
+        ///</summary>
+        /// Registers set between steps aren't reported as changed by the runtime, so this compares every column. It begins the history if it hasn't started.
+        bool Sync();
+        ///<summary>
+        /// discard the history, e.g. when the code and context are reset
+        ///</summary>
+        void Clear();
+        ///<summary>
+        /// number of the last step recorded
+        ///</summary>
+        uint64_t Steps();
+        ///<summary>
+        /// the values of reg over steps [from, to], starting with the value it had at from
+        ///</summary>
+        /// Sub-registers (eax, al...) are answered for their full register. Only general purpose, xmm and eflags registers have a history,
+        /// others fail with Error::kInvalidRegisterName. O(log n + changes returned) in the number of changes to reg.
+        bool Changes(const RegisterInfo& reg, uint64_t from, uint64_t to, std::vector<change_t>& changes);
+        ///<summary>
+        /// the last change to reg at or before step, O(log n) in the number of changes to reg
+        ///</summary>
+        bool LastChange(const RegisterInfo& reg, uint64_t step, change_t& change);
+    }  // namespace history
+}  // namespace inasm64
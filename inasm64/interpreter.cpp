@@ -0,0 +1,1008 @@
+// MIT License
+// Copyright 2019 Jarl Ostensen
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+// ===================================================================================================================
+// The general purpose part of the interpreter; integer arithmetic, flags, the stack and branches.
+// Vector instructions are handed to the emulator
+
+#include "common.h"
+#include "emulator.h"
+#include "interpreter.h"
+
+extern "C" {
+#include "xed-interface.h"
+}
+
+#include <intrin.h>
+#include <cstring>
+#include <cstdint>
+
+namespace inasm64
+{
+    namespace interpreter
+    {
+        namespace
+        {
+            const xed_state_t _dstate = { XED_MACHINE_MODE_LONG_64, XED_ADDRESS_WIDTH_64b };
+
+            constexpr uint64_t kCF = 0x1;
+            constexpr uint64_t kPF = 0x4;
+            constexpr uint64_t kAF = 0x10;
+            constexpr uint64_t kZF = 0x40;
+            constexpr uint64_t kSF = 0x80;
+            constexpr uint64_t kDF = 0x400;
+            constexpr uint64_t kOF = 0x800;
+            // the flags popfq can change; CF, PF, AF, ZF, SF, DF, OF, AC and ID (but not the trap flag)
+            constexpr uint64_t kPopfMask = 0x240cd5;
+            // pushfq doesn't push RF and VM
+            constexpr uint64_t kPushfMask = ~0x30000ull;
+
+            // indexed by iclass
+            bool _supported[XED_ICLASS_LAST];
+            // condition code (as encoded in the low nibble of jcc, cmovcc, and setcc opcodes) or -1
+            int8_t _conditions[XED_ICLASS_LAST];
+
+            bool initialise()
+            {
+                static auto initialised = false;
+                if(initialised)
+                    return true;
+                xed_tables_init();
+
+                static const xed_iclass_enum_t kSupported[] = {
+                    XED_ICLASS_NOP, XED_ICLASS_PAUSE, XED_ICLASS_LFENCE, XED_ICLASS_MFENCE, XED_ICLASS_SFENCE,
+                    XED_ICLASS_MOV, XED_ICLASS_MOVZX, XED_ICLASS_MOVSX, XED_ICLASS_MOVSXD, XED_ICLASS_LEA, XED_ICLASS_XCHG, XED_ICLASS_BSWAP,
+                    XED_ICLASS_ADD, XED_ICLASS_ADC, XED_ICLASS_SUB, XED_ICLASS_SBB, XED_ICLASS_CMP, XED_ICLASS_AND, XED_ICLASS_OR, XED_ICLASS_XOR, XED_ICLASS_TEST,
+                    XED_ICLASS_INC, XED_ICLASS_DEC, XED_ICLASS_NEG, XED_ICLASS_NOT,
+                    XED_ICLASS_SHL, XED_ICLASS_SHR, XED_ICLASS_SAR, XED_ICLASS_ROL, XED_ICLASS_ROR,
+                    XED_ICLASS_MUL, XED_ICLASS_IMUL, XED_ICLASS_DIV, XED_ICLASS_IDIV,
+                    XED_ICLASS_CBW, XED_ICLASS_CWDE, XED_ICLASS_CDQE, XED_ICLASS_CWD, XED_ICLASS_CDQ, XED_ICLASS_CQO,
+                    XED_ICLASS_BT, XED_ICLASS_BTS, XED_ICLASS_BTR, XED_ICLASS_BTC, XED_ICLASS_BSF, XED_ICLASS_BSR, XED_ICLASS_POPCNT, XED_ICLASS_LZCNT, XED_ICLASS_TZCNT,
+                    XED_ICLASS_CLC, XED_ICLASS_STC, XED_ICLASS_CMC, XED_ICLASS_CLD, XED_ICLASS_STD,
+                    XED_ICLASS_PUSH, XED_ICLASS_POP, XED_ICLASS_PUSHFQ, XED_ICLASS_POPFQ, XED_ICLASS_LEAVE,
+                    XED_ICLASS_CALL_NEAR, XED_ICLASS_RET_NEAR, XED_ICLASS_JMP, XED_ICLASS_LOOP, XED_ICLASS_LOOPE, XED_ICLASS_LOOPNE, XED_ICLASS_JRCXZ,
+                };
+                for(const auto iclass : kSupported)
+                    _supported[iclass] = true;
+
+                memset(_conditions, -1, sizeof(_conditions));
+                const auto set_condition = [](xed_iclass_enum_t jcc, xed_iclass_enum_t cmovcc, xed_iclass_enum_t setcc, int8_t cc) {
+                    _supported[jcc] = _supported[cmovcc] = _supported[setcc] = true;
+                    _conditions[jcc] = _conditions[cmovcc] = _conditions[setcc] = cc;
+                };
+                set_condition(XED_ICLASS_JO, XED_ICLASS_CMOVO, XED_ICLASS_SETO, 0);
+                set_condition(XED_ICLASS_JNO, XED_ICLASS_CMOVNO, XED_ICLASS_SETNO, 1);
+                set_condition(XED_ICLASS_JB, XED_ICLASS_CMOVB, XED_ICLASS_SETB, 2);
+                set_condition(XED_ICLASS_JNB, XED_ICLASS_CMOVNB, XED_ICLASS_SETNB, 3);
+                set_condition(XED_ICLASS_JZ, XED_ICLASS_CMOVZ, XED_ICLASS_SETZ, 4);
+                set_condition(XED_ICLASS_JNZ, XED_ICLASS_CMOVNZ, XED_ICLASS_SETNZ, 5);
+                set_condition(XED_ICLASS_JBE, XED_ICLASS_CMOVBE, XED_ICLASS_SETBE, 6);
+                set_condition(XED_ICLASS_JNBE, XED_ICLASS_CMOVNBE, XED_ICLASS_SETNBE, 7);
+                set_condition(XED_ICLASS_JS, XED_ICLASS_CMOVS, XED_ICLASS_SETS, 8);
+                set_condition(XED_ICLASS_JNS, XED_ICLASS_CMOVNS, XED_ICLASS_SETNS, 9);
+                set_condition(XED_ICLASS_JP, XED_ICLASS_CMOVP, XED_ICLASS_SETP, 10);
+                set_condition(XED_ICLASS_JNP, XED_ICLASS_CMOVNP, XED_ICLASS_SETNP, 11);
+                set_condition(XED_ICLASS_JL, XED_ICLASS_CMOVL, XED_ICLASS_SETL, 12);
+                set_condition(XED_ICLASS_JNL, XED_ICLASS_CMOVNL, XED_ICLASS_SETNL, 13);
+                set_condition(XED_ICLASS_JLE, XED_ICLASS_CMOVLE, XED_ICLASS_SETLE, 14);
+                set_condition(XED_ICLASS_JNLE, XED_ICLASS_CMOVNLE, XED_ICLASS_SETNLE, 15);
+
+                return initialised = true;
+            }
+
+            bool decode(const void* instruction, size_t length, xed_decoded_inst_t& xedd)
+            {
+                initialise();
+                xed_decoded_inst_zero_set_mode(&xedd, &_dstate);
+                xed_decoded_inst_set_input_chip(&xedd, XED_CHIP_ALL);
+                return xed_decode(&xedd, reinterpret_cast<const xed_uint8_t*>(instruction), unsigned(length)) == XED_ERROR_NONE;
+            }
+
+            uint64_t width_mask(unsigned bits)
+            {
+                return bits >= 64 ? ~0ull : ((1ull << bits) - 1);
+            }
+
+            uint64_t sign_bit(unsigned bits)
+            {
+                return 1ull << (bits - 1);
+            }
+
+            uint64_t sign_extend(uint64_t value, unsigned bits)
+            {
+                return bits >= 64 ? value : uint64_t(int64_t(value << (64 - bits)) >> (64 - bits));
+            }
+
+            bool even_parity(uint64_t value)
+            {
+                auto low = uint8_t(value);
+                low ^= low >> 4;
+                low ^= low >> 2;
+                low ^= low >> 1;
+                return !(low & 1);
+            }
+
+            void set_flag(uint64_t& flags, uint64_t flag, bool set)
+            {
+                flags = set ? (flags | flag) : (flags & ~flag);
+            }
+
+            // ZF, SF and PF from a result
+            void set_result_flags(uint64_t& flags, uint64_t result, unsigned bits)
+            {
+                result &= width_mask(bits);
+                set_flag(flags, kZF, !result);
+                set_flag(flags, kSF, (result & sign_bit(bits)) != 0);
+                set_flag(flags, kPF, even_parity(result));
+            }
+
+            uint64_t add_with_flags(uint64_t& flags, uint64_t a, uint64_t b, uint64_t carry, unsigned bits)
+            {
+                const auto mask = width_mask(bits);
+                a &= mask;
+                b &= mask;
+                const auto result = (a + b + carry) & mask;
+                const auto carry_out = bits < 64 ? (((a + b + carry) >> bits) & 1) != 0 : (result < a || (carry && result == a));
+                set_flag(flags, kCF, carry_out);
+                set_flag(flags, kOF, ((a ^ result) & (b ^ result) & sign_bit(bits)) != 0);
+                set_flag(flags, kAF, ((a ^ b ^ result) & 0x10) != 0);
+                set_result_flags(flags, result, bits);
+                return result;
+            }
+
+            uint64_t subtract_with_flags(uint64_t& flags, uint64_t a, uint64_t b, uint64_t borrow, unsigned bits)
+            {
+                const auto mask = width_mask(bits);
+                a &= mask;
+                b &= mask;
+                const auto result = (a - b - borrow) & mask;
+                set_flag(flags, kCF, a < b || (borrow && a == b));
+                set_flag(flags, kOF, ((a ^ b) & (a ^ result) & sign_bit(bits)) != 0);
+                set_flag(flags, kAF, ((a ^ b ^ result) & 0x10) != 0);
+                set_result_flags(flags, result, bits);
+                return result;
+            }
+
+            uint64_t logic_with_flags(uint64_t& flags, uint64_t result, unsigned bits)
+            {
+                flags &= ~(kCF | kOF);
+                set_result_flags(flags, result, bits);
+                return result & width_mask(bits);
+            }
+
+            bool condition(uint64_t flags, int cc)
+            {
+                bool result;
+                switch(cc >> 1)
+                {
+                case 0:
+                    result = (flags & kOF) != 0;
+                    break;
+                case 1:
+                    result = (flags & kCF) != 0;
+                    break;
+                case 2:
+                    result = (flags & kZF) != 0;
+                    break;
+                case 3:
+                    result = (flags & (kCF | kZF)) != 0;
+                    break;
+                case 4:
+                    result = (flags & kSF) != 0;
+                    break;
+                case 5:
+                    result = (flags & kPF) != 0;
+                    break;
+                case 6:
+                    result = ((flags & kSF) != 0) != ((flags & kOF) != 0);
+                    break;
+                default:
+                    result = (flags & kZF) != 0 || ((flags & kSF) != 0) != ((flags & kOF) != 0);
+                    break;
+                }
+                return (cc & 1) ? !result : result;
+            }
+
+            uint64_t& gpr(emulator::ExecutionContext& ctx, xed_reg_enum_t reg)
+            {
+                return ctx._gpr[xed_get_largest_enclosing_register(reg) - XED_REG_RAX];
+            }
+
+            bool is_high_byte(xed_reg_enum_t reg)
+            {
+                return reg >= XED_REG_AH && reg <= XED_REG_BH;
+            }
+
+            uint64_t read_gpr(emulator::ExecutionContext& ctx, xed_reg_enum_t reg)
+            {
+                if(is_high_byte(reg))
+                    return (ctx._gpr[reg - XED_REG_AH] >> 8) & 0xff;
+                return gpr(ctx, reg) & width_mask(xed_get_register_width_bits64(reg));
+            }
+
+            // 32 bit writes zero extend, 8 and 16 bit writes merge
+            void write_gpr(emulator::ExecutionContext& ctx, xed_reg_enum_t reg, uint64_t value)
+            {
+                if(is_high_byte(reg))
+                {
+                    auto& full = ctx._gpr[reg - XED_REG_AH];
+                    full = (full & ~0xff00ull) | ((value & 0xff) << 8);
+                    return;
+                }
+                auto& full = gpr(ctx, reg);
+                const auto bits = xed_get_register_width_bits64(reg);
+                if(bits >= 32)
+                    full = value & width_mask(bits);
+                else
+                    full = (full & ~width_mask(bits)) | (value & width_mask(bits));
+            }
+
+            // the low bits of one of rax, rcx, rdx, rbx
+            void write_gpr_bits(emulator::ExecutionContext& ctx, size_t index, unsigned bits, uint64_t value)
+            {
+                auto& full = ctx._gpr[index];
+                full = bits >= 32 ? (value & width_mask(bits)) : ((full & ~width_mask(bits)) | (value & width_mask(bits)));
+            }
+
+            bool effective_address(emulator::ExecutionContext& ctx, const xed_decoded_inst_t& xedd, uintptr_t& address)
+            {
+                const auto seg = xed_decoded_inst_get_seg_reg(&xedd, 0);
+                if(seg == XED_REG_FS || seg == XED_REG_GS)
+                    // we don't have the segment bases
+                    return false;
+
+                auto ea = uint64_t(xed_decoded_inst_get_memory_displacement(&xedd, 0));
+                const auto base = xed_decoded_inst_get_base_reg(&xedd, 0);
+                if(base == XED_REG_RIP || base == XED_REG_EIP)
+                    ea += ctx._next_rip;
+                else if(base != XED_REG_INVALID)
+                    ea += read_gpr(ctx, base);
+
+                const auto index = xed_decoded_inst_get_index_reg(&xedd, 0);
+                if(index != XED_REG_INVALID)
+                {
+                    if(xed_reg_class(index) != XED_REG_CLASS_GPR)
+                        return false;
+                    ea += read_gpr(ctx, index) * xed_decoded_inst_get_scale(&xedd, 0);
+                }
+
+                if(xed_decoded_inst_get_memop_address_width(&xedd, 0) == 32)
+                    ea &= 0xffffffff;
+                address = uintptr_t(ea);
+                return true;
+            }
+
+            struct operand_t
+            {
+                enum class Kind
+                {
+                    kNone,
+                    kGpr,
+                    kMemory,
+                    // lea
+                    kAddress,
+                    kImmediate,
+                    kBranch,
+                };
+                Kind _kind = Kind::kNone;
+                xed_reg_enum_t _reg = XED_REG_INVALID;
+            };
+
+            // an instruction being executed; its operands, in order, and their effective address
+            struct instruction_t
+            {
+                emulator::ExecutionContext& _ctx;
+                const xed_decoded_inst_t& _xedd;
+                operand_t _operands[4];
+                unsigned _count = 0;
+                // effective operand width
+                unsigned _bits = 0;
+                uintptr_t _address = 0;
+
+                bool collect_operands()
+                {
+                    const auto xi = xed_decoded_inst_inst(&_xedd);
+                    for(unsigned i = 0; i < xed_inst_noperands(xi); ++i)
+                    {
+                        const auto op = xed_inst_operand(xi, i);
+                        if(xed_operand_operand_visibility(op) == XED_OPVIS_SUPPRESSED)
+                            continue;
+                        const auto name = xed_operand_name(op);
+                        operand_t operand;
+                        switch(name)
+                        {
+                        case XED_OPERAND_MEM0:
+                            operand._kind = operand_t::Kind::kMemory;
+                            break;
+                        case XED_OPERAND_AGEN:
+                            operand._kind = operand_t::Kind::kAddress;
+                            break;
+                        case XED_OPERAND_IMM0:
+                            operand._kind = operand_t::Kind::kImmediate;
+                            break;
+                        case XED_OPERAND_RELBR:
+                            operand._kind = operand_t::Kind::kBranch;
+                            break;
+                        default:
+                            if(!xed_operand_is_register(name))
+                                return false;
+                            operand._reg = xed_decoded_inst_get_reg(&_xedd, name);
+                            if(xed_reg_class(operand._reg) != XED_REG_CLASS_GPR)
+                                return false;
+                            operand._kind = operand_t::Kind::kGpr;
+                            break;
+                        }
+                        if(_count == 4)
+                            return false;
+                        _operands[_count++] = operand;
+                    }
+                    _bits = xed_decoded_inst_get_operand_width(&_xedd);
+                    if(xed_decoded_inst_number_of_memory_operands(&_xedd) || xed_decoded_inst_get_base_reg(&_xedd, 0) != XED_REG_INVALID)
+                        return effective_address(_ctx, _xedd, _address);
+                    return true;
+                }
+
+                // width of operand i
+                unsigned operand_bits(unsigned i) const
+                {
+                    switch(_operands[i]._kind)
+                    {
+                    case operand_t::Kind::kGpr:
+                        return xed_get_register_width_bits64(_operands[i]._reg);
+                    case operand_t::Kind::kMemory:
+                        return xed_decoded_inst_get_memory_operand_length(&_xedd, 0) * 8;
+                    default:
+                        return _bits;
+                    }
+                }
+
+                bool read(unsigned i, unsigned bits, uint64_t& value) const
+                {
+                    value = 0;
+                    if(i >= _count)
+                    {
+                        detail::set_error(Error::kUnsupportedInstructionType);
+                        return false;
+                    }
+                    switch(_operands[i]._kind)
+                    {
+                    case operand_t::Kind::kGpr:
+                        value = read_gpr(_ctx, _operands[i]._reg);
+                        break;
+                    case operand_t::Kind::kMemory:
+                        if(!_ctx._read_memory(_address, &value, bits / 8))
+                        {
+                            detail::set_error(Error::kAccessViolation);
+                            return false;
+                        }
+                        break;
+                    case operand_t::Kind::kAddress:
+                        value = _address;
+                        break;
+                    case operand_t::Kind::kImmediate:
+                        value = xed_decoded_inst_get_immediate_is_signed(&_xedd) ? uint64_t(int64_t(xed_decoded_inst_get_signed_immediate(&_xedd))) : xed_decoded_inst_get_unsigned_immediate(&_xedd);
+                        break;
+                    case operand_t::Kind::kBranch:
+                        value = _ctx._next_rip + uint64_t(int64_t(xed_decoded_inst_get_branch_displacement(&_xedd)));
+                        break;
+                    default:
+                        detail::set_error(Error::kUnsupportedInstructionType);
+                        return false;
+                    }
+                    value &= width_mask(bits);
+                    return true;
+                }
+
+                bool write(unsigned i, unsigned bits, uint64_t value)
+                {
+                    switch(i < _count ? _operands[i]._kind : operand_t::Kind::kNone)
+                    {
+                    case operand_t::Kind::kGpr:
+                        write_gpr(_ctx, _operands[i]._reg, value);
+                        return true;
+                    case operand_t::Kind::kMemory:
+                        if(!_ctx._write_memory(_address, &value, bits / 8))
+                        {
+                            detail::set_error(Error::kAccessViolation);
+                            return false;
+                        }
+                        return true;
+                    default:
+                        detail::set_error(Error::kUnsupportedInstructionType);
+                        return false;
+                    }
+                }
+
+                bool push(uint64_t value, unsigned bits)
+                {
+                    const auto rsp = _ctx._gpr[4] - bits / 8;
+                    if(!_ctx._write_memory(uintptr_t(rsp), &value, bits / 8))
+                    {
+                        detail::set_error(Error::kAccessViolation);
+                        return false;
+                    }
+                    _ctx._gpr[4] = rsp;
+                    return true;
+                }
+
+                bool pop(uint64_t& value, unsigned bits)
+                {
+                    value = 0;
+                    if(!_ctx._read_memory(uintptr_t(_ctx._gpr[4]), &value, bits / 8))
+                    {
+                        detail::set_error(Error::kAccessViolation);
+                        return false;
+                    }
+                    _ctx._gpr[4] += bits / 8;
+                    return true;
+                }
+
+                // the count of a shift or rotate; an immediate, cl, or 1
+                uint64_t shift_count() const
+                {
+                    if(_count > 1 && _operands[1]._kind == operand_t::Kind::kImmediate)
+                        return xed_decoded_inst_get_unsigned_immediate(&_xedd);
+                    if(_count > 1 && _operands[1]._kind == operand_t::Kind::kGpr)
+                        return read_gpr(_ctx, _operands[1]._reg);
+                    return 1;
+                }
+            };
+
+            bool divide_error()
+            {
+                detail::set_error(Error::kDivideError);
+                return false;
+            }
+
+            // rdx:rax (or the narrower equivalents, ax for bytes) divided by divisor
+            bool divide(instruction_t& inst, uint64_t divisor, bool is_signed)
+            {
+                auto& ctx = inst._ctx;
+                const auto bits = inst._bits;
+                if(!divisor)
+                    return divide_error();
+                uint64_t quotient, remainder;
+                if(bits == 64)
+                {
+                    const auto high = ctx._gpr[2];
+                    const auto low = ctx._gpr[0];
+                    if(!is_signed)
+                    {
+                        if(high >= divisor)
+                            return divide_error();
+                        quotient = _udiv128(high, low, divisor, &remainder);
+                    }
+                    else
+                    {
+                        // divide the magnitudes, _div128 would fault on overflow
+                        const auto negative_dividend = int64_t(high) < 0;
+                        const auto negative_divisor = int64_t(divisor) < 0;
+                        auto abs_high = high, abs_low = low;
+                        if(negative_dividend)
+                        {
+                            abs_low = ~low + 1;
+                            abs_high = ~high + (abs_low == 0 ? 1 : 0);
+                        }
+                        const auto abs_divisor = negative_divisor ? ~divisor + 1 : divisor;
+                        if(abs_high >= abs_divisor)
+                            return divide_error();
+                        quotient = _udiv128(abs_high, abs_low, abs_divisor, &remainder);
+                        const auto negative_quotient = negative_dividend != negative_divisor;
+                        if(quotient > (negative_quotient ? 0x8000000000000000ull : 0x7fffffffffffffffull))
+                            return divide_error();
+                        if(negative_quotient)
+                            quotient = ~quotient + 1;
+                        if(negative_dividend)
+                            remainder = ~remainder + 1;
+                    }
+                    ctx._gpr[0] = quotient;
+                    ctx._gpr[2] = remainder;
+                    return true;
+                }
+
+                // the dividend fits in 64 bits
+                const auto half = bits == 8 ? 8 : bits;
+                const auto dividend = bits == 8 ? (ctx._gpr[0] & 0xffff) : (((ctx._gpr[2] & width_mask(bits)) << bits) | (ctx._gpr[0] & width_mask(bits)));
+                if(!is_signed)
+                {
+                    quotient = dividend / divisor;
+                    remainder = dividend % divisor;
+                    if(quotient > width_mask(half))
+                        return divide_error();
+                }
+                else
+                {
+                    const auto signed_dividend = int64_t(sign_extend(dividend, 2 * half));
+                    const auto signed_divisor = int64_t(sign_extend(divisor, half));
+                    // the one quotient that overflows int64 as well, which would fault the host
+                    if(signed_dividend == INT64_MIN && signed_divisor == -1)
+                        return divide_error();
+                    const auto signed_quotient = signed_dividend / signed_divisor;
+                    if(signed_quotient > int64_t(width_mask(half - 1)) || signed_quotient < -int64_t(sign_bit(half)))
+                        return divide_error();
+                    quotient = uint64_t(signed_quotient);
+                    remainder = uint64_t(signed_dividend % signed_divisor);
+                }
+                if(bits == 8)
+                {
+                    write_gpr_bits(ctx, 0, 16, (quotient & 0xff) | ((remainder & 0xff) << 8));
+                }
+                else
+                {
+                    write_gpr_bits(ctx, 0, bits, quotient);
+                    write_gpr_bits(ctx, 2, bits, remainder);
+                }
+                return true;
+            }
+
+            // mul and the one operand form of imul, rdx:rax (or the narrower equivalents, ax for bytes) = rax * source
+            void multiply(instruction_t& inst, uint64_t source, bool is_signed)
+            {
+                auto& ctx = inst._ctx;
+                const auto bits = inst._bits;
+                auto& flags = ctx._rflags;
+                uint64_t low, high;
+                bool overflow;
+                if(bits == 64)
+                {
+                    if(is_signed)
+                    {
+                        long long signed_high;
+                        low = uint64_t(_mul128(int64_t(ctx._gpr[0]), int64_t(source), &signed_high));
+                        high = uint64_t(signed_high);
+                        overflow = int64_t(high) != (int64_t(low) >> 63);
+                    }
+                    else
+                    {
+                        low = _umul128(ctx._gpr[0], source, &high);
+                        overflow = high != 0;
+                    }
+                }
+                else
+                {
+                    const auto a = ctx._gpr[0] & width_mask(bits);
+                    const auto product = is_signed ? uint64_t(int64_t(sign_extend(a, bits)) * int64_t(sign_extend(source, bits))) : a * source;
+                    low = product & width_mask(bits);
+                    high = (product >> bits) & width_mask(bits);
+                    overflow = is_signed ? product != sign_extend(low, bits) : high != 0;
+                }
+                if(bits == 8)
+                {
+                    write_gpr_bits(ctx, 0, 16, low | (high << 8));
+                }
+                else
+                {
+                    write_gpr_bits(ctx, 0, bits, low);
+                    write_gpr_bits(ctx, 2, bits, high);
+                }
+                set_flag(flags, kCF, overflow);
+                set_flag(flags, kOF, overflow);
+            }
+
+            unsigned long bit_scan_forward(uint64_t value)
+            {
+                unsigned long index;
+                _BitScanForward64(&index, value);
+                return index;
+            }
+
+            unsigned long bit_scan_reverse(uint64_t value)
+            {
+                unsigned long index;
+                _BitScanReverse64(&index, value);
+                return index;
+            }
+
+            bool execute(instruction_t& inst, xed_iclass_enum_t iclass)
+            {
+                auto& ctx = inst._ctx;
+                auto& flags = ctx._rflags;
+                const auto bits = inst._bits;
+                uint64_t a = 0, b = 0;
+
+                const auto cc = _conditions[iclass];
+                if(cc >= 0)
+                {
+                    const auto taken = condition(flags, cc);
+                    switch(iclass)
+                    {
+                    case XED_ICLASS_CMOVO:
+                    case XED_ICLASS_CMOVNO:
+                    case XED_ICLASS_CMOVB:
+                    case XED_ICLASS_CMOVNB:
+                    case XED_ICLASS_CMOVZ:
+                    case XED_ICLASS_CMOVNZ:
+                    case XED_ICLASS_CMOVBE:
+                    case XED_ICLASS_CMOVNBE:
+                    case XED_ICLASS_CMOVS:
+                    case XED_ICLASS_CMOVNS:
+                    case XED_ICLASS_CMOVP:
+                    case XED_ICLASS_CMOVNP:
+                    case XED_ICLASS_CMOVL:
+                    case XED_ICLASS_CMOVNL:
+                    case XED_ICLASS_CMOVLE:
+                    case XED_ICLASS_CMOVNLE:
+                        // the source is read, and a 32 bit destination zero extended, even if the condition is false
+                        if(!inst.read(0, bits, a) || !inst.read(1, bits, b))
+                            return false;
+                        return inst.write(0, bits, taken ? b : a);
+                    case XED_ICLASS_SETO:
+                    case XED_ICLASS_SETNO:
+                    case XED_ICLASS_SETB:
+                    case XED_ICLASS_SETNB:
+                    case XED_ICLASS_SETZ:
+                    case XED_ICLASS_SETNZ:
+                    case XED_ICLASS_SETBE:
+                    case XED_ICLASS_SETNBE:
+                    case XED_ICLASS_SETS:
+                    case XED_ICLASS_SETNS:
+                    case XED_ICLASS_SETP:
+                    case XED_ICLASS_SETNP:
+                    case XED_ICLASS_SETL:
+                    case XED_ICLASS_SETNL:
+                    case XED_ICLASS_SETLE:
+                    case XED_ICLASS_SETNLE:
+                        return inst.write(0, 8, taken ? 1 : 0);
+                    default:
+                        // jcc
+                        if(!inst.read(0, 64, a))
+                            return false;
+                        if(taken)
+                            ctx._next_rip = a;
+                        return true;
+                    }
+                }
+
+                switch(iclass)
+                {
+                case XED_ICLASS_NOP:
+                case XED_ICLASS_PAUSE:
+                case XED_ICLASS_LFENCE:
+                case XED_ICLASS_MFENCE:
+                case XED_ICLASS_SFENCE:
+                    return true;
+
+                case XED_ICLASS_MOV:
+                    return inst.read(1, bits, a) && inst.write(0, bits, a);
+                case XED_ICLASS_MOVZX:
+                    return inst.read(1, inst.operand_bits(1), a) && inst.write(0, bits, a);
+                case XED_ICLASS_MOVSX:
+                case XED_ICLASS_MOVSXD:
+                    return inst.read(1, inst.operand_bits(1), a) && inst.write(0, bits, sign_extend(a, inst.operand_bits(1)));
+                case XED_ICLASS_LEA:
+                    return inst.read(1, bits, a) && inst.write(0, bits, a);
+                case XED_ICLASS_XCHG:
+                    return inst.read(0, bits, a) && inst.read(1, bits, b) && inst.write(0, bits, b) && inst.write(1, bits, a);
+                case XED_ICLASS_BSWAP:
+                    if(!inst.read(0, bits, a))
+                        return false;
+                    return inst.write(0, bits, bits == 64 ? _byteswap_uint64(a) : _byteswap_ulong(static_cast<unsigned long>(a)));
+
+                case XED_ICLASS_ADD:
+                    return inst.read(0, bits, a) && inst.read(1, bits, b) && inst.write(0, bits, add_with_flags(flags, a, b, 0, bits));
+                case XED_ICLASS_ADC:
+                    return inst.read(0, bits, a) && inst.read(1, bits, b) && inst.write(0, bits, add_with_flags(flags, a, b, flags & kCF, bits));
+                case XED_ICLASS_SUB:
+                    return inst.read(0, bits, a) && inst.read(1, bits, b) && inst.write(0, bits, subtract_with_flags(flags, a, b, 0, bits));
+                case XED_ICLASS_SBB:
+                    return inst.read(0, bits, a) && inst.read(1, bits, b) && inst.write(0, bits, subtract_with_flags(flags, a, b, flags & kCF, bits));
+                case XED_ICLASS_CMP:
+                    if(!inst.read(0, bits, a) || !inst.read(1, bits, b))
+                        return false;
+                    subtract_with_flags(flags, a, b, 0, bits);
+                    return true;
+                case XED_ICLASS_AND:
+                    return inst.read(0, bits, a) && inst.read(1, bits, b) && inst.write(0, bits, logic_with_flags(flags, a & b, bits));
+                case XED_ICLASS_OR:
+                    return inst.read(0, bits, a) && inst.read(1, bits, b) && inst.write(0, bits, logic_with_flags(flags, a | b, bits));
+                case XED_ICLASS_XOR:
+                    return inst.read(0, bits, a) && inst.read(1, bits, b) && inst.write(0, bits, logic_with_flags(flags, a ^ b, bits));
+                case XED_ICLASS_TEST:
+                    if(!inst.read(0, bits, a) || !inst.read(1, bits, b))
+                        return false;
+                    logic_with_flags(flags, a & b, bits);
+                    return true;
+                case XED_ICLASS_INC:
+                case XED_ICLASS_DEC:
+                {
+                    // CF is preserved
+                    if(!inst.read(0, bits, a))
+                        return false;
+                    const auto carry = flags & kCF;
+                    const auto result = iclass == XED_ICLASS_INC ? add_with_flags(flags, a, 1, 0, bits) : subtract_with_flags(flags, a, 1, 0, bits);
+                    flags = (flags & ~kCF) | carry;
+                    return inst.write(0, bits, result);
+                }
+                case XED_ICLASS_NEG:
+                    return inst.read(0, bits, a) && inst.write(0, bits, subtract_with_flags(flags, 0, a, 0, bits));
+                case XED_ICLASS_NOT:
+                    return inst.read(0, bits, a) && inst.write(0, bits, ~a);
+
+                case XED_ICLASS_SHL:
+                case XED_ICLASS_SHR:
+                case XED_ICLASS_SAR:
+                case XED_ICLASS_ROL:
+                case XED_ICLASS_ROR:
+                {
+                    if(!inst.read(0, bits, a))
+                        return false;
+                    const auto count = unsigned(inst.shift_count() & (bits == 64 ? 0x3f : 0x1f));
+                    if(!count)
+                        // the flags are unchanged, but the destination is still written (i.e. zero extended)
+                        return inst.write(0, bits, a);
+                    const auto mask = width_mask(bits);
+                    const auto msb = [bits](uint64_t value) { return (value & sign_bit(bits)) != 0; };
+                    uint64_t result;
+                    switch(iclass)
+                    {
+                    case XED_ICLASS_SHL:
+                    {
+                        result = count < bits ? (a << count) & mask : 0;
+                        const auto carry = count <= bits && ((a >> (bits - count)) & 1);
+                        set_flag(flags, kCF, carry);
+                        set_flag(flags, kOF, msb(result) != carry);
+                        set_result_flags(flags, result, bits);
+                        break;
+                    }
+                    case XED_ICLASS_SHR:
+                        result = count < bits ? a >> count : 0;
+                        set_flag(flags, kCF, ((a >> (count - 1)) & 1) != 0);
+                        set_flag(flags, kOF, msb(a));
+                        set_result_flags(flags, result, bits);
+                        break;
+                    case XED_ICLASS_SAR:
+                    {
+                        const auto signed_a = int64_t(sign_extend(a, bits));
+                        result = uint64_t(signed_a >> count) & mask;
+                        set_flag(flags, kCF, ((signed_a >> (count - 1)) & 1) != 0);
+                        flags &= ~kOF;
+                        set_result_flags(flags, result, bits);
+                        break;
+                    }
+                    case XED_ICLASS_ROL:
+                    {
+                        const auto rotate = count % bits;
+                        result = rotate ? ((a << rotate) | (a >> (bits - rotate))) & mask : a;
+                        set_flag(flags, kCF, (result & 1) != 0);
+                        set_flag(flags, kOF, msb(result) != ((result & 1) != 0));
+                        break;
+                    }
+                    default:
+                    {
+                        const auto rotate = count % bits;
+                        result = rotate ? ((a >> rotate) | (a << (bits - rotate))) & mask : a;
+                        set_flag(flags, kCF, msb(result));
+                        set_flag(flags, kOF, msb(result) != msb(result << 1));
+                        break;
+                    }
+                    }
+                    return inst.write(0, bits, result);
+                }
+
+                case XED_ICLASS_MUL:
+                    if(!inst.read(0, bits, a))
+                        return false;
+                    multiply(inst, a, false);
+                    return true;
+                case XED_ICLASS_IMUL:
+                {
+                    if(inst._count == 1)
+                    {
+                        if(!inst.read(0, bits, a))
+                            return false;
+                        multiply(inst, a, true);
+                        return true;
+                    }
+                    // dest = dest * source, or dest = source * immediate
+                    if(!inst.read(inst._count == 3 ? 1 : 0, bits, a) || !inst.read(inst._count == 3 ? 2 : 1, bits, b))
+                        return false;
+                    uint64_t result;
+                    bool overflow;
+                    if(bits == 64)
+                    {
+                        long long high;
+                        result = uint64_t(_mul128(int64_t(a), int64_t(b), &high));
+                        overflow = high != (int64_t(result) >> 63);
+                    }
+                    else
+                    {
+                        const auto product = int64_t(sign_extend(a, bits)) * int64_t(sign_extend(b, bits));
+                        result = uint64_t(product) & width_mask(bits);
+                        overflow = product != int64_t(sign_extend(result, bits));
+                    }
+                    set_flag(flags, kCF, overflow);
+                    set_flag(flags, kOF, overflow);
+                    return inst.write(0, bits, result);
+                }
+                case XED_ICLASS_DIV:
+                case XED_ICLASS_IDIV:
+                    return inst.read(0, bits, a) && divide(inst, a, iclass == XED_ICLASS_IDIV);
+
+                case XED_ICLASS_CBW:
+                    write_gpr_bits(ctx, 0, 16, sign_extend(ctx._gpr[0] & 0xff, 8));
+                    return true;
+                case XED_ICLASS_CWDE:
+                    write_gpr_bits(ctx, 0, 32, sign_extend(ctx._gpr[0] & 0xffff, 16));
+                    return true;
+                case XED_ICLASS_CDQE:
+                    ctx._gpr[0] = sign_extend(ctx._gpr[0] & 0xffffffff, 32);
+                    return true;
+                case XED_ICLASS_CWD:
+                case XED_ICLASS_CDQ:
+                case XED_ICLASS_CQO:
+                    write_gpr_bits(ctx, 2, bits, (ctx._gpr[0] & sign_bit(bits)) ? ~0ull : 0);
+                    return true;
+
+                case XED_ICLASS_BT:
+                case XED_ICLASS_BTS:
+                case XED_ICLASS_BTR:
+                case XED_ICLASS_BTC:
+                {
+                    if(!inst.read(1, bits, b))
+                        return false;
+                    if(inst._operands[0]._kind == operand_t::Kind::kMemory && inst._operands[1]._kind == operand_t::Kind::kGpr)
+                    {
+                        // a register bit offset can address bits outside of the operand
+                        inst._address += uintptr_t(int64_t(sign_extend(b, bits)) >> (bits == 64 ? 6 : (bits == 32 ? 5 : 4))) * (bits / 8);
+                    }
+                    const auto bit = 1ull << (b & (bits - 1));
+                    if(!inst.read(0, bits, a))
+                        return false;
+                    set_flag(flags, kCF, (a & bit) != 0);
+                    switch(iclass)
+                    {
+                    case XED_ICLASS_BTS:
+                        return inst.write(0, bits, a | bit);
+                    case XED_ICLASS_BTR:
+                        return inst.write(0, bits, a & ~bit);
+                    case XED_ICLASS_BTC:
+                        return inst.write(0, bits, a ^ bit);
+                    default:
+                        return true;
+                    }
+                }
+                case XED_ICLASS_BSF:
+                case XED_ICLASS_BSR:
+                    if(!inst.read(1, bits, b))
+                        return false;
+                    set_flag(flags, kZF, !b);
+                    // the destination is left alone for a 0 source
+                    if(!b)
+                        return true;
+                    return inst.write(0, bits, iclass == XED_ICLASS_BSF ? bit_scan_forward(b) : bit_scan_reverse(b));
+                case XED_ICLASS_POPCNT:
+                    if(!inst.read(1, bits, b))
+                        return false;
+                    flags &= ~(kCF | kPF | kAF | kZF | kSF | kOF);
+                    set_flag(flags, kZF, !b);
+                    return inst.write(0, bits, __popcnt64(b));
+                case XED_ICLASS_LZCNT:
+                case XED_ICLASS_TZCNT:
+                {
+                    if(!inst.read(1, bits, b))
+                        return false;
+                    const auto result = !b ? bits : (iclass == XED_ICLASS_TZCNT ? bit_scan_forward(b) : bits - 1 - bit_scan_reverse(b));
+                    set_flag(flags, kCF, !b);
+                    set_flag(flags, kZF, !result);
+                    return inst.write(0, bits, result);
+                }
+
+                case XED_ICLASS_CLC:
+                    flags &= ~kCF;
+                    return true;
+                case XED_ICLASS_STC:
+                    flags |= kCF;
+                    return true;
+                case XED_ICLASS_CMC:
+                    flags ^= kCF;
+                    return true;
+                case XED_ICLASS_CLD:
+                    flags &= ~kDF;
+                    return true;
+                case XED_ICLASS_STD:
+                    flags |= kDF;
+                    return true;
+
+                case XED_ICLASS_PUSH:
+                    return inst.read(0, bits, a) && inst.push(a, bits);
+                case XED_ICLASS_POP:
+                    return inst.pop(a, bits) && inst.write(0, bits, a);
+                case XED_ICLASS_PUSHFQ:
+                    return inst.push(flags & kPushfMask, 64);
+                case XED_ICLASS_POPFQ:
+                    if(!inst.pop(a, 64))
+                        return false;
+                    flags = (flags & ~kPopfMask) | (a & kPopfMask) | 2;
+                    return true;
+                case XED_ICLASS_LEAVE:
+                    ctx._gpr[4] = ctx._gpr[5];
+                    if(!inst.pop(a, 64))
+                        return false;
+                    ctx._gpr[5] = a;
+                    return true;
+
+                case XED_ICLASS_CALL_NEAR:
+                    if(!inst.read(0, 64, a) || !inst.push(ctx._next_rip, 64))
+                        return false;
+                    ctx._next_rip = a;
+                    return true;
+                case XED_ICLASS_RET_NEAR:
+                    if(!inst.pop(a, 64))
+                        return false;
+                    // ret imm16 releases the arguments
+                    if(inst._count && inst._operands[0]._kind == operand_t::Kind::kImmediate)
+                        ctx._gpr[4] += xed_decoded_inst_get_unsigned_immediate(&inst._xedd);
+                    ctx._next_rip = a;
+                    return true;
+                case XED_ICLASS_JMP:
+                    if(!inst.read(0, 64, a))
+                        return false;
+                    ctx._next_rip = a;
+                    return true;
+                case XED_ICLASS_LOOP:
+                case XED_ICLASS_LOOPE:
+                case XED_ICLASS_LOOPNE:
+                {
+                    if(!inst.read(0, 64, a))
+                        return false;
+                    const auto rcx = --ctx._gpr[1];
+                    auto taken = rcx != 0;
+                    if(iclass == XED_ICLASS_LOOPE)
+                        taken = taken && (flags & kZF);
+                    else if(iclass == XED_ICLASS_LOOPNE)
+                        taken = taken && !(flags & kZF);
+                    if(taken)
+                        ctx._next_rip = a;
+                    return true;
+                }
+                case XED_ICLASS_JRCXZ:
+                    if(!inst.read(0, 64, a))
+                        return false;
+                    if(!ctx._gpr[1])
+                        ctx._next_rip = a;
+                    return true;
+
+                default:
+                    detail::set_error(Error::kUnsupportedInstructionType);
+                    return false;
+                }
+            }
+        }  // namespace
+
+        bool CanInterpret(const void* instruction, size_t length)
+        {
+            xed_decoded_inst_t xedd;
+            if(!decode(instruction, length, xedd))
+                return false;
+            return _supported[xed_decoded_inst_get_iclass(&xedd)] || emulator::CanEmulate(instruction, length);
+        }
+
+        bool Execute(emulator::ExecutionContext& ctx, const void* instruction, size_t length)
+        {
+            xed_decoded_inst_t xedd;
+            if(!decode(instruction, length, xedd))
+            {
+                detail::set_error(Error::kInvalidInstructionFormat);
+                return false;
+            }
+            const auto iclass = xed_decoded_inst_get_iclass(&xedd);
+            if(!_supported[iclass])
+                return emulator::Execute(ctx, instruction, length);
+
+            instruction_t inst{ ctx, xedd };
+            if(!inst.collect_operands())
+            {
+                detail::set_error(Error::kUnsupportedInstructionType);
+                return false;
+            }
+            return execute(inst, iclass);
+        }
+    }  // namespace interpreter
+}  // namespace inasm64
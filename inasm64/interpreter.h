@@ -0,0 +1,32 @@
+// MIT License
+// Copyright 2019 Jarl Ostensen
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+#pragma once
+
+namespace inasm64
+{
+    ///<summary>
+    /// software execution of general purpose, SSE and AVX2 instructions, the runtime's alternative to a debuggee (see runtime::Backend)
+    ///</summary>
+    /// Instructions execute against an emulator::ExecutionContext, i.e. an in-memory register file, and all memory goes through its accessors.
+    namespace interpreter
+    {
+        ///<summary>
+        /// true if the instruction can be executed by the interpreter
+        ///</summary>
+        bool CanInterpret(const void* instruction, size_t length);
+        ///<summary>
+        /// execute a single instruction against ctx, including flags and branches
+        ///</summary>
+        /// On entry ctx._next_rip is the address of the following instruction, on return it is the address execution continues at.
+        /// Flags the SDM leaves undefined are left unchanged. Returns false if the instruction isn't supported, a memory access fails,
+        /// or it faults (i.e. divide by zero), in which case ctx may be partially updated.
+        bool Execute(emulator::ExecutionContext& ctx, const void* instruction, size_t length);
+    }  // namespace interpreter
+}  // namespace inasm64
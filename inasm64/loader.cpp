@@ -0,0 +1,241 @@
+// MIT License
+// Copyright 2019 Jarl Ostensen
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <windows.h>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+#include "common.h"
+#include "x64.h"
+#include "runtime.h"
+#include "decoder.h"
+#include "elf64.h"
+#include "loader.h"
+
+namespace inasm64
+{
+    namespace loader
+    {
+        namespace
+        {
+            // a read-only view of a whole file, the Windows counterpart of mmap
+            struct mapped_file_t
+            {
+                HANDLE _file = INVALID_HANDLE_VALUE;
+                HANDLE _mapping = nullptr;
+                const uint8_t* _view = nullptr;
+                size_t _size = 0;
+
+                bool open(const char* path)
+                {
+                    _file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+                    LARGE_INTEGER size;
+                    if(_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(_file, &size))
+                    {
+                        detail::set_error(Error::kSystemError);
+                        return false;
+                    }
+                    // an empty file can't be mapped
+                    if(!size.QuadPart)
+                    {
+                        detail::set_error(Error::kEmptyInput);
+                        return false;
+                    }
+                    _size = size_t(size.QuadPart);
+                    _mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                    if(_mapping)
+                        _view = reinterpret_cast<const uint8_t*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+                    if(!_view)
+                    {
+                        detail::set_error(Error::kSystemError);
+                        return false;
+                    }
+                    return true;
+                }
+
+                // copy of the value at offset, false if it runs past the end of the file
+                template <typename T>
+                bool read(uint64_t offset, T& value) const
+                {
+                    if(offset > _size || _size - offset < sizeof(T))
+                        return false;
+                    memcpy(&value, _view + offset, sizeof(T));
+                    return true;
+                }
+
+                bool contains(uint64_t offset, uint64_t size) const
+                {
+                    return offset <= _size && size <= _size - offset;
+                }
+
+                ~mapped_file_t()
+                {
+                    if(_view)
+                        UnmapViewOfFile(_view);
+                    if(_mapping)
+                        CloseHandle(_mapping);
+                    if(_file != INVALID_HANDLE_VALUE)
+                        CloseHandle(_file);
+                }
+            };
+
+            // the bytes of a symbol in an executable section, looked up in the symbol table, or the dynamic symbol table if the file is stripped
+            bool find_symbol(const mapped_file_t& file, const char* symbol, const uint8_t*& code, size_t& size)
+            {
+                elf64::header_t header;
+                if(!file.read(0, header) || header._ident[0] != 0x7f || memcmp(header._ident + 1, "ELF", 3) != 0 || header._ident[4] != elf64::kClass64 || header._ident[5] != elf64::kLittleEndian || header._machine != elf64::kMachineX64 || header._shentsize != sizeof(elf64::section_t))
+                {
+                    detail::set_error(Error::kInvalidObjectFile);
+                    return false;
+                }
+                const auto section = [&file, &header](unsigned index, elf64::section_t& info) {
+                    return index < header._shnum && file.read(header._shoff + uint64_t(index) * sizeof(elf64::section_t), info);
+                };
+                // true if a relocation patches [begin, end) of the code section. In an object a relocation section applies to the section in its info
+                // and offsets are into that, elsewhere they are addresses
+                const auto relocated = [&file, &header, &section](unsigned codeSection, uint64_t begin, uint64_t end) {
+                    for(unsigned s = 0; s < header._shnum; ++s)
+                    {
+                        elf64::section_t relocations;
+                        if(!section(s, relocations) || relocations._type != elf64::kRela || relocations._entsize != sizeof(elf64::rela_t) || !file.contains(relocations._offset, relocations._size))
+                            continue;
+                        if(header._type == elf64::kRelocatable && relocations._info != codeSection)
+                            continue;
+                        for(uint64_t offset = 0; offset + sizeof(elf64::rela_t) <= relocations._size; offset += sizeof(elf64::rela_t))
+                        {
+                            elf64::rela_t rela;
+                            file.read(relocations._offset + offset, rela);
+                            if(rela._offset >= begin && rela._offset < end)
+                                return true;
+                        }
+                    }
+                    return false;
+                };
+                const auto name_length = strlen(symbol);
+                for(const auto table_type : { elf64::kSymbolTable, elf64::kDynamicSymbolTable })
+                {
+                    for(unsigned s = 0; s < header._shnum; ++s)
+                    {
+                        elf64::section_t table, names;
+                        if(!section(s, table) || table._type != table_type || table._entsize != sizeof(elf64::symbol_t) || !section(table._link, names) || !file.contains(table._offset, table._size) || !file.contains(names._offset, names._size))
+                            continue;
+                        for(uint64_t offset = 0; offset + sizeof(elf64::symbol_t) <= table._size; offset += sizeof(elf64::symbol_t))
+                        {
+                            elf64::symbol_t sym;
+                            file.read(table._offset + offset, sym);
+                            // the name, including its terminator, has to be inside the string table
+                            if(!sym._size || sym._name >= names._size || names._size - sym._name <= name_length || memcmp(file._view + names._offset + sym._name, symbol, name_length + 1) != 0)
+                                continue;
+                            elf64::section_t code_section;
+                            if(!sym._shndx || sym._shndx >= elf64::kReservedSections || !section(sym._shndx, code_section) || code_section._type == elf64::kNoBits || !(code_section._flags & elf64::kExecutable) || !file.contains(code_section._offset, code_section._size))
+                                continue;
+                            // relocatable objects give the offset into the section, executables and shared objects the address
+                            const auto base = header._type == elf64::kRelocatable ? 0 : code_section._addr;
+                            if(sym._value < base || sym._value - base > code_section._size || sym._size > code_section._size - (sym._value - base))
+                                continue;
+                            // relocations aren't applied, so the code would run with whatever the fields hold before linking
+                            if(relocated(sym._shndx, sym._value, sym._value + sym._size))
+                            {
+                                detail::set_error(Error::kInvalidObjectFile);
+                                return false;
+                            }
+                            code = file._view + code_section._offset + (sym._value - base);
+                            size = size_t(sym._size);
+                            return true;
+                        }
+                    }
+                }
+                detail::set_error(Error::kInvalidObjectFile);
+                return false;
+            }
+        }  // namespace
+
+        bool Load(const char* path, const char* symbol, load_t& result)
+        {
+            result = {};
+            mapped_file_t file;
+            if(!path || !path[0] || !file.open(path))
+                return false;
+            const uint8_t* code = file._view;
+            auto size = file._size;
+            if(symbol && symbol[0] && !find_symbol(file, symbol, code, size))
+                return false;
+
+            // instruction boundaries first, so that branches can be checked before anything is added
+            std::vector<size_t> offsets;
+            for(size_t offset = 0; offset < size;)
+            {
+                const auto length = decoder::InstructionLength(code + offset, size - offset);
+                if(!length)
+                {
+                    detail::set_error(Error::kInvalidInstructionFormat);
+                    return false;
+                }
+                offsets.push_back(offset);
+                offset += length;
+            }
+
+            const auto first_line = runtime::NextInstructionIndex()._line;
+            // the line each relative branch targets, the line after the code if it targets the end
+            constexpr auto kNoBranch = ~size_t(0);
+            std::vector<size_t> target_lines(offsets.size(), kNoBranch);
+            for(size_t i = 0; i < offsets.size(); ++i)
+            {
+                const auto end = i + 1 < offsets.size() ? offsets[i + 1] : size;
+                // data outside the code isn't loaded with it, so a RIP-relative operand can only refer to the code itself
+                decoder::AddressReferenceInfo reference;
+                if(decoder::DecodeAddressReference(code + offsets[i], end - offsets[i], reference) && reference._rip_relative)
+                {
+                    const auto target = (long long)(end) + reference._value;
+                    if(target < 0 || target >= (long long)(size))
+                    {
+                        detail::set_error(Error::kInvalidObjectFile);
+                        return false;
+                    }
+                }
+                decoder::RelativeBranchInfo branch;
+                if(!decoder::DecodeRelativeBranch(code + offsets[i], end - offsets[i], branch))
+                    continue;
+                const auto target = (long long)(end) + branch._displacement;
+                if(target < 0 || target > (long long)(size))
+                {
+                    detail::set_error(Error::kBranchTargetOutOfRange);
+                    return false;
+                }
+                const auto found = std::lower_bound(offsets.begin(), offsets.end(), size_t(target));
+                if(found != offsets.end() && *found != size_t(target))
+                {
+                    detail::set_error(Error::kBranchTargetOutOfRange);
+                    return false;
+                }
+                target_lines[i] = first_line + size_t(found - offsets.begin());
+            }
+
+            for(size_t i = 0; i < offsets.size(); ++i)
+            {
+                const auto end = i + 1 < offsets.size() ? offsets[i + 1] : size;
+                char target[32] = { 0 };
+                if(target_lines[i] != kNoBranch)
+                    sprintf_s(target, "l%zu", target_lines[i]);
+                const auto index = runtime::AddInstruction(code + offsets[i], end - offsets[i], target[0] ? target : nullptr);
+                if(!index._address)
+                    return false;
+                if(!i)
+                    result._address = index._address;
+            }
+            result._first_line = first_line;
+            result._lines = offsets.size();
+            result._size = size;
+            return runtime::CommmitInstructions();
+        }
+    }  // namespace loader
+}  // namespace inasm64
@@ -0,0 +1,45 @@
+// MIT License
+// Copyright 2019 Jarl Ostensen
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+#pragma once
+
+#include <cstdint>
+
+namespace inasm64
+{
+    ///<summary>
+    /// loading machine code produced elsewhere, e.g. by a compiler, into the runtime as lines
+    ///</summary>
+    /// The bytes are split into instructions with XED and added one line each with runtime::AddInstruction, so they can be stepped, listed and edited as if typed.
+    /// Relative branches within the code become branches to lines. The bytes are loaded as they are in the file, so code that needs relocating,
+    /// or has RIP-relative operands that point outside of it, is rejected rather than loaded with addresses that lead nowhere.
+    namespace loader
+    {
+        ///<summary>
+        /// result of Load
+        ///</summary>
+        struct load_t
+        {
+            // lines [_first_line, _first_line + _lines)
+            size_t _first_line = 0;
+            size_t _lines = 0;
+            uintptr_t _address = 0;
+            size_t _size = 0;
+        };
+        ///<summary>
+        /// load code from a file, from the next line on (see runtime::NextInstructionIndex), and commit it
+        ///</summary>
+        /// Without a symbol the whole file is flat binary code. With a symbol the file is a 64 bit x86-64 ELF object, executable or shared object,
+        /// and the code is the symbol's bytes in its section; it fails with Error::kInvalidObjectFile if the symbol isn't in the symbol table with a size in an executable section,
+        /// or if a relocation (SHT_RELA entry) applies to its bytes. Either way, a RIP-relative operand that points outside the code fails with Error::kInvalidObjectFile.
+        /// The file is mapped rather than read. It fails with Error::kInvalidInstructionFormat if the bytes don't decode all the way to the end, and with Error::kBranchTargetOutOfRange
+        /// if a relative branch targets anything but the start of an instruction or the end of the code. Lines added before a failing AddInstruction stay.
+        bool Load(const char* path, const char* symbol, load_t& result);
+    }  // namespace loader
+}  // namespace inasm64
@@ -0,0 +1,134 @@
+// MIT License
+// Copyright 2019 Jarl Ostensen
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+#include <emmintrin.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "common.h"
+#include "x64.h"
+#include "runtime.h"
+#include "globvars.h"
+#include "memdiff.h"
+
+namespace inasm64
+{
+    namespace memdiff
+    {
+        namespace
+        {
+            struct variable_address_t
+            {
+                std::string _name;
+                uintptr_t _address = 0;
+            };
+
+            void add_range(std::vector<range_t>& ranges, size_t offset, size_t size)
+            {
+                if(!ranges.empty() && ranges.back()._offset + ranges.back()._size == offset)
+                    ranges.back()._size += size;
+                else
+                    ranges.push_back({ offset, size });
+            }
+        }  // namespace
+
+        bool Begin()
+        {
+            return runtime::TrackWrites(true);
+        }
+
+        bool End()
+        {
+            return runtime::TrackWrites(false);
+        }
+
+        void ChangedRanges(const uint8_t* before, const uint8_t* after, size_t size, size_t base, std::vector<range_t>& ranges)
+        {
+            size_t i = 0;
+            for(; i + 16 <= size; i += 16)
+            {
+                const auto equal = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(before + i)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(after + i)));
+                auto mask = unsigned(_mm_movemask_epi8(equal)) ^ 0xffffu;
+                if(!mask)
+                    continue;
+                if(mask == 0xffffu)
+                {
+                    add_range(ranges, base + i, 16);
+                    continue;
+                }
+                for(size_t b = 0; mask; ++b, mask >>= 1)
+                {
+                    if(mask & 1)
+                        add_range(ranges, base + i + b, 1);
+                }
+            }
+            for(; i < size; ++i)
+            {
+                if(before[i] != after[i])
+                    add_range(ranges, base + i, 1);
+            }
+        }
+
+        bool Diff(diff_t& result)
+        {
+            result = {};
+            std::vector<runtime::written_page_t> pages;
+            if(!runtime::WrittenPages(pages))
+                return false;
+
+            // changed bytes by address, a run crossing into the next page carries on
+            std::vector<range_t> changed;
+            std::vector<uint8_t> current;
+            for(const auto& page : pages)
+            {
+                current.resize(page._original.size());
+                if(!runtime::ReadBytes(page._handle, page._offset, current.data(), current.size()))
+                    return false;
+                ChangedRanges(page._original.data(), current.data(), current.size(), uintptr_t(page._handle) + page._offset, changed);
+                ++result._pages;
+                result._compared += current.size();
+            }
+
+            std::vector<variable_address_t> variables;
+            for(const auto& variable : globvars::All())
+            {
+                if(runtime::FindAllocation(variable.second))
+                    variables.push_back({ variable.first, variable.second });
+            }
+            std::sort(variables.begin(), variables.end(), [](const variable_address_t& a, const variable_address_t& b) { return a._address < b._address; });
+
+            // split the runs between the variables they fall in, in address order so a variable's ranges are contiguous in the result
+            for(const auto& range : changed)
+            {
+                auto start = range._offset;
+                const auto end = range._offset + range._size;
+                while(start < end)
+                {
+                    const auto handle = uintptr_t(runtime::FindAllocation(start));
+                    auto stop = std::min(end, handle + runtime::AllocationSize(reinterpret_cast<const void*>(handle)));
+                    const auto next = std::upper_bound(variables.begin(), variables.end(), start, [](uintptr_t address, const variable_address_t& variable) { return address < variable._address; });
+                    if(next != variables.end() && next->_address < stop)
+                        stop = next->_address;
+                    variable_address_t owner{ std::string{}, handle };
+                    if(next != variables.begin() && std::prev(next)->_address >= handle)
+                        owner = *std::prev(next);
+                    if(result._variables.empty() || result._variables.back()._address != owner._address || result._variables.back()._name != owner._name)
+                        result._variables.push_back({ owner._name, owner._address });
+                    auto& variable = result._variables.back();
+                    add_range(variable._ranges, start - owner._address, stop - start);
+                    variable._changed += stop - start;
+                    start = stop;
+                }
+            }
+            return true;
+        }
+    }  // namespace memdiff
+}  // namespace inasm64
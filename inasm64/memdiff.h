@@ -0,0 +1,70 @@
+// MIT License
+// Copyright 2019 Jarl Ostensen
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace inasm64
+{
+    ///<summary>
+    /// which bytes of which variables the code changed, found from the pages written while the runtime tracks writes (see runtime::TrackWrites)
+    ///</summary>
+    namespace memdiff
+    {
+        ///<summary>
+        /// a run of changed bytes, at an offset from the variable
+        ///</summary>
+        struct range_t
+        {
+            size_t _offset = 0;
+            size_t _size = 0;
+        };
+        ///<summary>
+        /// the changes to a variable, or to the part of an allocation before the first variable in it (with an empty name)
+        ///</summary>
+        struct variable_t
+        {
+            std::string _name;
+            uintptr_t _address = 0;
+            std::vector<range_t> _ranges;
+            size_t _changed = 0;
+        };
+        ///<summary>
+        /// result of Diff
+        ///</summary>
+        struct diff_t
+        {
+            std::vector<variable_t> _variables;
+            // pages written, and the bytes of them compared
+            size_t _pages = 0;
+            size_t _compared = 0;
+        };
+        ///<summary>
+        /// start tracking writes to the allocations from their current contents, see runtime::TrackWrites
+        ///</summary>
+        bool Begin();
+        ///<summary>
+        /// stop tracking writes
+        ///</summary>
+        bool End();
+        ///<summary>
+        /// compare the pages written since Begin with their contents before the first write
+        ///</summary>
+        /// Only written pages are read and compared, 16 bytes at a time, so the cost follows what the code wrote rather than the size of the allocations.
+        /// A change belongs to the variable at or below it in the same allocation, variables are the ones pointing into an allocation (see globvars::All).
+        bool Diff(diff_t& result);
+        ///<summary>
+        /// append the runs of bytes that differ between before and after, at offsets from base, merging a run that continues one at the end of ranges
+        ///</summary>
+        void ChangedRanges(const uint8_t* before, const uint8_t* after, size_t size, size_t base, std::vector<range_t>& ranges);
+    }  // namespace memdiff
+}  // namespace inasm64
@@ -0,0 +1,180 @@
+// MIT License
+// Copyright 2019 Jarl Ostensen
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <windows.h>
+#include <intrin.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include "common.h"
+#include "perfmap.h"
+
+namespace inasm64
+{
+    namespace perfmap
+    {
+        namespace
+        {
+            // see tools/perf/Documentation/jitdump-specification.txt in the Linux sources
+            constexpr uint32_t kJitdumpMagic = 0x4a695444;
+            constexpr uint32_t kJitdumpVersion = 1;
+            constexpr uint32_t kElfMachineX64 = 62;
+            constexpr uint64_t kJitdumpArchTimestamp = 1;
+            constexpr uint32_t kJitCodeLoad = 0;
+            constexpr uint32_t kJitCodeClose = 3;
+
+            struct jitdump_header_t
+            {
+                uint32_t _magic;
+                uint32_t _version;
+                uint32_t _total_size;
+                uint32_t _elf_mach;
+                uint32_t _pad1;
+                uint32_t _pid;
+                uint64_t _timestamp;
+                uint64_t _flags;
+            };
+            static_assert(sizeof(jitdump_header_t) == 40, "jitdump header layout");
+            struct record_header_t
+            {
+                uint32_t _id;
+                uint32_t _total_size;
+                uint64_t _timestamp;
+            };
+            struct code_load_t
+            {
+                record_header_t _header;
+                uint32_t _pid;
+                uint32_t _tid;
+                uint64_t _vma;
+                uint64_t _code_addr;
+                uint64_t _code_size;
+                uint64_t _code_index;
+                // followed by the name, 0 terminated, and the code
+            };
+            static_assert(sizeof(code_load_t) == 56, "jitdump code load record layout");
+
+            unsigned _pid = 0;
+            unsigned _tid = 0;
+            bool _open = false;
+            files_t _files;
+            std::ofstream _jitdump;
+            // unique per code load record
+            uint64_t _code_index = 0;
+
+            std::string temp_path(const char* prefix, unsigned pid, const char* extension)
+            {
+                char directory[MAX_PATH + 1] = { 0 };
+                if(!GetTempPathA(DWORD(sizeof(directory)), directory))
+                    return {};
+                char name[64];
+                sprintf_s(name, "%s-%u.%s", prefix, pid, extension);
+                return std::string(directory) + name;
+            }
+        }  // namespace
+
+        bool Open(unsigned pid, unsigned tid, bool jitdump, files_t& files)
+        {
+            if(_open && pid == _pid && jitdump == _jitdump.is_open())
+            {
+                _tid = tid;
+                files = _files;
+                return true;
+            }
+            Close();
+            _files = {};
+            _files._map = temp_path("perf", pid, "map");
+            if(_files._map.empty())
+            {
+                detail::set_error(Error::kSystemError);
+                return false;
+            }
+            if(jitdump)
+            {
+                _files._jitdump = temp_path("jit", pid, "dump");
+                _jitdump.open(_files._jitdump, std::ios::binary | std::ios::trunc);
+                const jitdump_header_t header = { kJitdumpMagic, kJitdumpVersion, sizeof(jitdump_header_t), kElfMachineX64, 0, pid, __rdtsc(), kJitdumpArchTimestamp };
+                _jitdump.write(reinterpret_cast<const char*>(&header), sizeof(header));
+                if(!_jitdump)
+                {
+                    _jitdump.close();
+                    detail::set_error(Error::kSystemError);
+                    return false;
+                }
+            }
+            _pid = pid;
+            _tid = tid;
+            _code_index = 0;
+            _open = true;
+            files = _files;
+            return true;
+        }
+
+        bool Publish(const std::vector<symbol_t>& symbols)
+        {
+            if(!_open)
+            {
+                detail::set_error(Error::kRuntimeUninitialised);
+                return false;
+            }
+            // the map describes the code as it is now, so it is rewritten rather than appended to
+            std::ofstream map{ _files._map, std::ios::trunc };
+            char line[32];
+            for(const auto& symbol : symbols)
+            {
+                sprintf_s(line, "%llx %zx ", static_cast<unsigned long long>(symbol._address), symbol._code.size());
+                map << line << symbol._name << "\n";
+            }
+            if(!map)
+            {
+                detail::set_error(Error::kSystemError);
+                return false;
+            }
+
+            if(_jitdump.is_open())
+            {
+                const auto timestamp = __rdtsc();
+                for(const auto& symbol : symbols)
+                {
+                    code_load_t record;
+                    record._header = { kJitCodeLoad, uint32_t(sizeof(code_load_t) + symbol._name.size() + 1 + symbol._code.size()), timestamp };
+                    record._pid = _pid;
+                    record._tid = _tid;
+                    record._vma = record._code_addr = symbol._address;
+                    record._code_size = symbol._code.size();
+                    record._code_index = _code_index++;
+                    _jitdump.write(reinterpret_cast<const char*>(&record), sizeof(record));
+                    _jitdump.write(symbol._name.c_str(), std::streamsize(symbol._name.size() + 1));
+                    _jitdump.write(reinterpret_cast<const char*>(symbol._code.data()), std::streamsize(symbol._code.size()));
+                }
+                _jitdump.flush();
+                if(!_jitdump)
+                {
+                    detail::set_error(Error::kSystemError);
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        void Close()
+        {
+            if(_jitdump.is_open())
+            {
+                const record_header_t close = { kJitCodeClose, sizeof(record_header_t), __rdtsc() };
+                _jitdump.write(reinterpret_cast<const char*>(&close), sizeof(close));
+                _jitdump.close();
+            }
+            _open = false;
+        }
+    }  // namespace perfmap
+}  // namespace inasm64
@@ -0,0 +1,58 @@
+// MIT License
+// Copyright 2019 Jarl Ostensen
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace inasm64
+{
+    ///<summary>
+    /// symbols for profilers, for the code of a process that has no image to look them up in
+    ///</summary>
+    /// Writes the two files Linux perf reads for JIT code: a perf map, perf-<pid>.map, with a line of "address size name" per symbol and rewritten
+    /// whenever the code changes, and optionally a jitdump, jit-<pid>.dump, with a code load record (address, name and the bytes) per symbol appended each time.
+    /// The files go in the temporary directory (%TEMP%) rather than /tmp, and jitdump timestamps are TSC ticks (the jitdump "arch timestamp" flag).
+    /// The runtime publishes its code through this on every commit, see runtime::SetPerfMap.
+    namespace perfmap
+    {
+        ///<summary>
+        /// a named range of code, and its bytes for the jitdump
+        ///</summary>
+        struct symbol_t
+        {
+            uintptr_t _address = 0;
+            std::string _name;
+            std::vector<uint8_t> _code;
+        };
+        ///<summary>
+        /// the files written, empty if not written
+        ///</summary>
+        struct files_t
+        {
+            std::string _map;
+            std::string _jitdump;
+        };
+        ///<summary>
+        /// start publishing the code of process pid, running on thread tid, creating the files (the jitdump only if asked for)
+        ///</summary>
+        /// Publishing for another process, or with jitdump changing, closes the files open before.
+        bool Open(unsigned pid, unsigned tid, bool jitdump, files_t& files);
+        ///<summary>
+        /// rewrite the map with symbols, and append a code load record for each of them to the jitdump
+        ///</summary>
+        bool Publish(const std::vector<symbol_t>& symbols);
+        ///<summary>
+        /// end the jitdump and stop publishing, the files are left for the profiler
+        ///</summary>
+        void Close();
+    }  // namespace perfmap
+}  // namespace inasm64
@@ -15,6 +15,7 @@
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #include <debugapi.h>
+#include <psapi.h>
 #include <unordered_map>
 #include <cassert>
 
@@ -22,9 +23,14 @@
 #include <immintrin.h>
 
 #include <memory>
+#include <algorithm>
 #include "common.h"
 #include "x64.h"
 #include "decoder.h"
+#include "emulator.h"
+#include "interpreter.h"
+#include "assembler.h"
+#include "perfmap.h"
 #include "runtime.h"
 
 #if !defined(_WIN64)
@@ -40,21 +46,46 @@ namespace inasm64
 {
     namespace runtime
     {
-        static union {
-            STARTUPINFOA _startupinfo_a;
-            STARTUPINFOW _startupinfo_w;
-        };
         PROCESS_INFORMATION _processinfo = { 0 };
         // process handle with virtual memory access privileges
         HANDLE _process_vm = nullptr;
+        // the debuggee executable we prefer, see debuggee_path
+        constexpr char kStubDebuggeeName[] = "inasm64_stub.exe";
+
+        // a launched debuggee, hanging at its first breakpoint
+        struct debuggee_t
+        {
+            PROCESS_INFORMATION _processinfo = { 0 };
+            HANDLE _process_vm = nullptr;
+            // the breakpoint event
+            DEBUG_EVENT _dbg_event = { 0 };
+        };
+        // debuggees launched ahead of Start, see WarmDebuggeePool
+        std::vector<debuggee_t> _debuggee_pool;
+        size_t _debuggee_pool_size = 0;
         // track allocations in process memory
-        std::unordered_map<uintptr_t, size_t> _allocations;
+        struct allocation_t
+        {
+            size_t _size;
+            allocation_options_t _options;
+            CacheState _cache_state = CacheState::kAsIs;
+        };
+        std::unordered_map<uintptr_t, allocation_t> _allocations;
+        // see TrackWrites
+        bool _tracking_writes = false;
+        std::vector<written_page_t> _written_pages;
+        // page size used for allocation_options_t::PageSize::kHuge
+        constexpr size_t kHugePageSize = 1ull << 30;
+        // the stripe allocation_options_t::NumaPolicy::kInterleave deals out to the nodes in turn, the allocation granularity
+        constexpr size_t kInterleaveStripeSize = 0x10000;
 
         // runtime variables, such as "execip" and "codesize", etc.
         inasm64::detail::char_string_map_t _variables;
         const char* kVariables[] = {
             "execip",
             "codesize",
+            "stack",
+            "stacktop",
         };
 
         struct instruction_line_info_t
@@ -63,23 +94,102 @@ namespace inasm64
             uintptr_t _address;
             size_t _instruction_size;
             uint8_t _instruction_bytes[kMaxAssembledInstructionSize];
+            // not supported by the CPU; committed as a trapping marker and executed by the emulator
+            bool _emulated = false;
+            // relative branches: size of the displacement, which is always the last bytes of the instruction, or 0 if this isn't a branch
+            unsigned _branch_displacement_bytes = 0;
+            // label, or line (l<N>), of the branch target and the line it resolved to when the code was last committed
+            char _branch_target[32] = { 0 };
+            size_t _branch_target_line = 0;
+            // a relative call, i.e. a branch that pushes a return address
+            bool _call = false;
+            // the int3 line in front of a procedure (see BeginProc)
+            bool _fence = false;
         };
         std::vector<instruction_line_info_t> _loaded_instructions;
         size_t _instruction_line = 0;
         size_t _first_instruction_line = 0;
         size_t _last_instruction_line = 0;
-        size_t _commit_size = 0;
+        // label -> line
+        std::unordered_map<std::string, size_t> _labels;
+        // name of the procedure being added, if any
+        std::string _open_proc;
+        // names of all procedures, in the order they were begun
+        std::vector<std::string> _procedures;
+        // what is published for profilers on every commit
+        PerfMap _perf_map = PerfMap::kOff;
+        // see PerfMapError
+        Error _perf_map_error = Error::kNoError;
+        const uint8_t kProcFence = 0xcc;
+
+        // the stack the code runs on
+        uintptr_t _stack = 0;
+        uintptr_t _stack_top = 0;
 
         struct
         {
             bool _started : 1;
             bool _running : 1;
         } _flags = { 0 };
+        Backend _backend = Backend::kDebuggee;
 
+        // the code region is reserved up front and committed on demand as code is added.
+        // If it needs to grow beyond the reservation it is moved to a larger one (see relocate_code_region)
+        constexpr size_t kCodeReserveSize = 64ull << 20;
         unsigned char* _scratch_memory = nullptr;
+        // committed size
         size_t _scratch_size = 0;
+        // reserved size
+        size_t _scratch_reserved = 0;
         unsigned char* _code = nullptr;
         unsigned char* _code_end = nullptr;
+        // where the OS supports it the code region is a section mapped twice: read-execute in the debuggee and writable here (_code_view),
+        // so that commits are a memcpy and no page is ever writable and executable. Otherwise it is a PAGE_EXECUTE_READWRITE allocation written with WriteProcessMemory.
+        // The interpreter's code region is plain read-write memory in this process, which is its own view
+        HANDLE _code_section = nullptr;
+        unsigned char* _code_view = nullptr;
+        // int3, written after the last line so that Run stops when execution leaves the code
+        constexpr uint8_t kCodeSentinel = 0xcc;
+
+        // the top of the code reservation holds the thunks used by Run: one thunk per guarded branch for the iteration guard,
+        // and one thunk per breakpoint in the upper half
+        constexpr size_t kGuardAreaSize = 0x10000;
+        constexpr size_t kGuardThunkOffset = 0;
+        constexpr size_t kGuardThunkStride = 32;
+        constexpr size_t kBreakpointThunkOffset = kGuardAreaSize / 2;
+        constexpr size_t kBreakpointThunkStride = 128;
+        // the data the thunks write, the iteration guard's countdown counter at the start and the breakpoint thunks' saved flags from kBreakpointFlagsOffset,
+        // is in a read-write page of the debuggee's own (the guard data) within rel32 reach of the code, since the debuggee's view of the code region is read-execute
+        constexpr size_t kGuardDataSize = 0x1000;
+        constexpr size_t kBreakpointFlagsOffset = 64;
+        uintptr_t _guard_data = 0;
+        // size of the jmp rel32 that routes a breakpoint line through its thunk
+        constexpr size_t kBreakpointPatchSize = 5;
+        // pushfq, dec qword ptr [counter], jz trip, popfq, jmp target, trip: popfq, int3
+        constexpr size_t kGuardThunkTripOffset = 21;
+        struct
+        {
+            // lines whose (rel32) branches are redirected through a thunk, in thunk order
+            std::vector<size_t> _thunked_lines;
+            // lines with a hardware execute breakpoint, in debug register order. Used for rel8 branches that can't reach a thunk
+            std::vector<size_t> _breakpoint_lines;
+        } _iteration_guard;
+
+        struct breakpoint_t
+        {
+            // cmp instruction and the jcc that skips the trap when the condition is false, empty if unconditional
+            std::string _compare;
+            std::string _skip_jcc;
+            // the assembled compare and skip jcc the interpreter evaluates the condition with, see interpreted_condition
+            std::vector<uint8_t> _compare_bytes;
+            std::vector<uint8_t> _skip_jcc_bytes;
+            // set while Run has the breakpoint installed
+            uintptr_t _trap = 0;
+            uintptr_t _skip = 0;
+            size_t _end_line = 0;
+        };
+        // line -> breakpoint
+        std::unordered_map<size_t, breakpoint_t> _breakpoints;
 
         DEBUG_EVENT _dbg_event = { 0 };
         DWORD _continue_status = DBG_CONTINUE;
@@ -93,6 +203,12 @@ namespace inasm64
         // ymm registers, the lower 128 bits are aliased into the xmm registers
         PM128A _ymm = nullptr;
 
+        // register state for emulated instructions. Any part of it the hardware doesn't have (i.e. zmm16-31 and opmasks without AVX-512)
+        // lives only here, the rest is loaded from, and stored back to, the thread context around each emulated instruction
+        emulator::ExecutionContext _emulated_state;
+        // ud2, the marker committed in place of emulated instructions (and padded with nops)
+        const uint8_t kEmulationMarker[] = { 0x0f, 0x0b };
+
         constexpr auto kRaxIndex = static_cast<size_t>(RegisterInfo::Register::rax);
         constexpr auto kRegisterCount = static_cast<size_t>(RegisterInfo::Register::kInvalid) - kRaxIndex;
         uint64_t _changed_registers[kRegisterCount];
@@ -240,7 +356,8 @@ namespace inasm64
             }
         }  // namespace runtime
 
-        bool load_context(HANDLE thread)
+        // allocate the contexts, if needed, and prepare the active context for a full load
+        void prepare_context()
         {
             if(!_active_ctx)
             {
@@ -294,6 +411,11 @@ namespace inasm64
                 }
             }
 
+        }
+
+        bool load_context(HANDLE thread)
+        {
+            prepare_context();
             // update tracking context
             CopyContext(_prev_ctx, _ctx_flags, _active_ctx);
             const auto result = GetThreadContext(thread, _active_ctx) == TRUE;
@@ -320,324 +442,1267 @@ namespace inasm64
             return OpenThread(THREAD_GET_CONTEXT | THREAD_SET_CONTEXT, FALSE, _dbg_event.dwThreadId);
         }
 
-        bool Start(size_t scratchPadSize)
+        // the loaded instruction at address, if any
+        instruction_line_info_t* find_line(uintptr_t address)
         {
-            if(_flags._running)
-                return false;
+            const auto i = std::lower_bound(_loaded_instructions.begin(), _loaded_instructions.end(), address, [](const instruction_line_info_t& line, uintptr_t at) {
+                return line._address < at;
+            });
+            return (i != _loaded_instructions.end() && i->_address == address) ? &*i : nullptr;
+        }
 
-            ZeroMemory(&_flags, sizeof(_flags));
+        // address following the last line
+        uintptr_t code_end_address()
+        {
+            if(!_last_instruction_line)
+                return uintptr_t(_scratch_memory);
+            const auto& last = _loaded_instructions[_last_instruction_line - 1];
+            return last._address + last._instruction_size;
+        }
 
-            char exeFilePathName[MAX_PATH];
-            if(GetModuleFileNameA(nullptr, exeFilePathName, sizeof(exeFilePathName)))
+        // the line a branch target name refers to, the end of the code is line _last_instruction_line
+        bool find_branch_target(const char* name, size_t& line)
+        {
+            const auto label = _labels.find(name);
+            if(label != _labels.end())
             {
-                _startupinfo_a = { 0 };
-                _startupinfo_a.cb = sizeof(_startupinfo_a);
-                _processinfo = { 0 };
-
-                // see inasm64::kTrapModeArgumentValue
-                static auto debuggeeCommandLine = "262";
-                _flags._running = CreateProcessA(exeFilePathName, const_cast<LPSTR>(debuggeeCommandLine), nullptr, nullptr, FALSE, DEBUG_ONLY_THIS_PROCESS, nullptr, nullptr, &_startupinfo_a, &_processinfo) == TRUE ? true : false;
-
-                if(!_flags._running)
+                line = label->second;
+            }
+            else
+            {
+                if(name[0] != 'l' || !isdigit(name[1]))
                     return false;
+                char* end;
+                line = size_t(::strtoull(name + 1, &end, 10));
+                if(end[0])
+                    return false;
+            }
+            return line <= _last_instruction_line;
+        }
 
-                // cycle through debug events to load the application up to the first breakpoint in ntdll!LdrpDoCodeRunnerBreak, then initialise the process scratch memory
-                // and leave the process hanging until someone calls Step (or quits)
-                while(!_flags._started && _flags._running)
+        // resolve the targets of all branches and patch their displacements. Lines that change are written out again on commit
+        bool resolve_branches()
+        {
+            for(size_t l = 0; l < _last_instruction_line; ++l)
+            {
+                auto& line = _loaded_instructions[l];
+                if(!line._branch_displacement_bytes)
+                    continue;
+                size_t target_line;
+                if(!find_branch_target(line._branch_target, target_line))
+                {
+                    detail::set_error(Error::kUndefinedBranchTarget);
+                    return false;
+                }
+                const auto target = target_line == _last_instruction_line ? code_end_address() : _loaded_instructions[target_line]._address;
+                const auto displacement = (long long)(target) - (long long)(line._address + line._instruction_size);
+                const auto limit = 1ll << (line._branch_displacement_bytes * 8 - 1);
+                if(displacement < -limit || displacement >= limit)
+                {
+                    detail::set_error(Error::kBranchTargetOutOfRange);
+                    return false;
+                }
+                // little endian, so the low bytes of displacement are the encoded displacement
+                const auto encoded = line._instruction_bytes + line._instruction_size - line._branch_displacement_bytes;
+                if(memcmp(encoded, &displacement, line._branch_displacement_bytes))
                 {
-                    WaitForDebugEvent(&_dbg_event, INFINITE);
+                    memcpy(encoded, &displacement, line._branch_displacement_bytes);
+                    _first_instruction_line = std::min(_first_instruction_line, l);
+                }
+                line._branch_target_line = target_line;
+            }
+            return true;
+        }
 
-                    switch(_dbg_event.dwDebugEventCode)
-                    {
-                    case EXCEPTION_DEBUG_EVENT:
-                    {
-                        _continue_status = DBG_EXCEPTION_HANDLED;
-                        switch(_dbg_event.u.Exception.ExceptionRecord.ExceptionCode)
-                        {
-                        case EXCEPTION_BREAKPOINT:
-                        {
-                            if(!_flags._started)
-                            {
-                                // get full access handle to the process
-                                _process_vm = OpenProcess(PROCESS_VM_OPERATION | PROCESS_VM_READ | PROCESS_VM_WRITE | PROCESS_QUERY_INFORMATION | PROCESS_TERMINATE, FALSE, _processinfo.dwProcessId);
-
-                                _scratch_size = scratchPadSize;
-                                _scratch_memory = _code = _code_end = reinterpret_cast<unsigned char*>(VirtualAllocEx(_process_vm, nullptr, SIZE_T(scratchPadSize), MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE));
-                                if(_scratch_memory)
-                                {
-                                    const auto thread = active_thread();
-
-                                    // set the trap flag so that the first instruction in the code scratch area will be intercepted when it executes
-                                    if(load_context(thread))
-                                    {
-                                        // set the next instruction to the beginning of the code scratch area (expecting it will be filled with valid code by someone calling AddCode shortly)
-                                        set_next_instruction_address(_code);
-                                        enable_trap_flag();
-                                        SetThreadContext(thread, _active_ctx);
-                                        _ctx_changed = false;
-
-                                        _variables["execip"] = uintptr_t(_code);
-                                        _variables["codesize"] = 0;
-                                    }
-                                    // else a serious error, report or silentl ignore?
-
-                                    CloseHandle(thread);
-                                }
-                                else
-                                {
-                                    detail::set_error(Error::kSystemError);
-                                    return false;
-                                }
-
-                                _flags._started = true;
-                            }
-                            // else: we ignore any other breakpoints since we don't set any explicitly ourselves
-                        }
-                        break;
-                        default:
-                            break;
-                        }
-                    }
-                    break;
+        // the AVX-512 parts of the thread context, if the hardware has them
+        struct avx512_context_t
+        {
+            uint64_t* _k = nullptr;
+            // upper 256 bits of zmm0-15
+            uint8_t* _zmm_h = nullptr;
+            // zmm16-31
+            uint8_t* _zmm_hi16 = nullptr;
+        };
 
-                    case EXIT_PROCESS_DEBUG_EVENT:
-                        _flags._running = false;
-                        break;
+        avx512_context_t locate_avx512_context()
+        {
+            avx512_context_t avx512;
+            if((GetEnabledXStateFeatures() & XSTATE_MASK_AVX512) == XSTATE_MASK_AVX512)
+            {
+                DWORD length;
+                avx512._k = reinterpret_cast<uint64_t*>(LocateXStateFeature(_active_ctx, XSTATE_AVX512_KMASK, &length));
+                avx512._zmm_h = reinterpret_cast<uint8_t*>(LocateXStateFeature(_active_ctx, XSTATE_AVX512_ZMM_H, &length));
+                avx512._zmm_hi16 = reinterpret_cast<uint8_t*>(LocateXStateFeature(_active_ctx, XSTATE_AVX512_ZMM, &length));
+            }
+            return avx512;
+        }
 
-                    default:
-                        break;
-                    }
+        // copy the active context into the emulator's register state
+        void load_emulated_state(uintptr_t nextRip)
+        {
+            // CONTEXT keeps the GPRs in encoding order, just like the emulator
+            memcpy(_emulated_state._gpr, &_active_ctx->Rax, sizeof(_emulated_state._gpr));
+            _emulated_state._next_rip = nextRip;
+            _emulated_state._rflags = _active_ctx->EFlags;
+            for(size_t r = 0; r < 16; ++r)
+            {
+                memcpy(_emulated_state._zmm[r], &_active_ctx->Xmm0 + r, sizeof(M128A));
+                if(_ymm)
+                    memcpy(_emulated_state._zmm[r] + sizeof(M128A), _ymm + r, sizeof(M128A));
+            }
 
-                    // only continune until we get the first breakpoint, afterwards we deliberately "hang" the debugeee
-                    if(!_flags._started)
-                    {
-                        ContinueDebugEvent(_dbg_event.dwProcessId,
-                            _dbg_event.dwThreadId,
-                            _continue_status);
-                    }
+            DWORD64 featuremask = 0;
+            GetXStateFeaturesMask(_active_ctx, &featuremask);
+            const auto avx512 = locate_avx512_context();
+            if(avx512._k && avx512._zmm_h && avx512._zmm_hi16)
+            {
+                // if the thread hasn't touched the AVX-512 state yet it is in its initial, zeroed, configuration
+                const auto in_use = (featuremask & XSTATE_MASK_AVX512) == XSTATE_MASK_AVX512;
+                for(size_t r = 0; r < 16; ++r)
+                {
+                    if(in_use)
+                        memcpy(_emulated_state._zmm[r] + 32, avx512._zmm_h + r * 32, 32);
+                    else
+                        memset(_emulated_state._zmm[r] + 32, 0, 32);
+                }
+                if(in_use)
+                {
+                    memcpy(_emulated_state._zmm[16], avx512._zmm_hi16, 16 * 64);
+                    memcpy(_emulated_state._k, avx512._k, sizeof(_emulated_state._k));
+                }
+                else
+                {
+                    memset(_emulated_state._zmm[16], 0, 16 * 64);
+                    memset(_emulated_state._k, 0, sizeof(_emulated_state._k));
                 }
             }
-            else
+        }
+
+        // copy the emulator's register state back into the active context
+        void store_emulated_state()
+        {
+            memcpy(&_active_ctx->Rax, _emulated_state._gpr, sizeof(_emulated_state._gpr));
+            _active_ctx->EFlags = DWORD(_emulated_state._rflags);
+            for(size_t r = 0; r < 16; ++r)
             {
-                detail::set_error(Error::kSystemError);
+                memcpy(&_active_ctx->Xmm0 + r, _emulated_state._zmm[r], sizeof(M128A));
+                if(_ymm)
+                    memcpy(_ymm + r, _emulated_state._zmm[r] + sizeof(M128A), sizeof(M128A));
             }
 
-            return _flags._started;
-        }
-        void Shutdown()
-        {
-            if(_flags._running)
+            DWORD64 featuremask = 0;
+            GetXStateFeaturesMask(_active_ctx, &featuremask);
+            SetXStateFeaturesMask(_active_ctx, featuremask | XSTATE_MASK_AVX512);
+            const auto avx512 = locate_avx512_context();
+            if(avx512._k && avx512._zmm_h && avx512._zmm_hi16)
             {
-                VirtualFreeEx(_process_vm, _scratch_memory, 0, MEM_RELEASE);
-                CloseHandle(_process_vm);
-                TerminateProcess(_process_vm, 1);
-                CloseHandle(_processinfo.hThread);
-                CloseHandle(_processinfo.hProcess);
-                _code = _scratch_memory = nullptr;
-                _scratch_size = 0;
-                free(_active_ctx);
-                _active_ctx = nullptr;
+                for(size_t r = 0; r < 16; ++r)
+                    memcpy(avx512._zmm_h + r * 32, _emulated_state._zmm[r] + 32, 32);
+                memcpy(avx512._zmm_hi16, _emulated_state._zmm[16], 16 * 64);
+                memcpy(avx512._k, _emulated_state._k, sizeof(_emulated_state._k));
             }
-            ZeroMemory(&_flags, sizeof(_flags));
+            _ctx_changed = true;
         }
 
-        void Reset()
+        // natively executed VEX instructions zero the upper bits of the zmm registers they write to. When the CPU doesn't have those bits
+        // they only exist in _emulated_state, so we approximate this by clearing them for any xmm register that changed.
+        //NOTE: legacy SSE instructions preserve the upper bits, so this can be wrong for those
+        void clear_emulated_upper_state()
         {
-            if(!_flags._started)
+            if(ExtendedCpuFeatureSupported(ExtendedCpuFeature::kAvx512f))
                 return;
-            _code = _scratch_memory;
-            //ZZZ: untested
-            _instruction_line = _first_instruction_line = _last_instruction_line = 0;
+            const auto hardware_bytes = _ymm ? 2 * sizeof(M128A) : sizeof(M128A);
+            for(size_t r = 0; r < 16; ++r)
+            {
+                if(_changed_registers[static_cast<size_t>(RegisterInfo::Register::xmm0) + r - kRaxIndex])
+                    memset(_emulated_state._zmm[r] + hardware_bytes, 0, sizeof(_emulated_state._zmm[r]) - hardware_bytes);
+            }
         }
 
-        instruction_index_t AddInstruction(const void* bytes, size_t size)
+        // execute an emulated line against the active context and move the context past it, the error is set by the emulator if it fails
+        bool execute_emulated_line(const instruction_line_info_t& line)
         {
-            if(!size)
-                return {};
+            const auto next_instr = line._address + line._instruction_size;
+            load_emulated_state(next_instr);
+            if(!emulator::Execute(_emulated_state, line._instruction_bytes, line._instruction_size))
+                return false;
+            store_emulated_state();
+            set_next_instruction_address(LPCVOID(next_instr));
+            return true;
+        }
+
+        // MapViewOfFile2 (an inline wrapper for MapViewOfFileNuma2) and UnmapViewOfFile2 aren't available on all versions of Windows so we look them up dynamically
+        using map_view_of_file_numa_2_t = PVOID(WINAPI*)(HANDLE, HANDLE, ULONG64, PVOID, SIZE_T, ULONG, ULONG, ULONG);
+        using unmap_view_of_file_2_t = BOOL(WINAPI*)(HANDLE, PVOID, ULONG);
+        const auto _map_view_of_file_numa_2 = reinterpret_cast<map_view_of_file_numa_2_t>(GetProcAddress(GetModuleHandleA("kernelbase.dll"), "MapViewOfFileNuma2"));
+        const auto _unmap_view_of_file_2 = reinterpret_cast<unmap_view_of_file_2_t>(GetProcAddress(GetModuleHandleA("kernelbase.dll"), "UnmapViewOfFile2"));
 
-            if(_commit_size + size > _scratch_size)
+        // reserve size bytes of code region in the debuggee, dual mapped if possible (see _code_section)
+        unsigned char* reserve_code_region(size_t size, HANDLE& section, unsigned char*& view)
+        {
+            section = nullptr;
+            view = nullptr;
+            if(_backend == Backend::kInterpreter)
             {
-                detail::set_error(Error::kCodeBufferOverflow);
-                return {};
+                view = reinterpret_cast<unsigned char*>(VirtualAlloc(nullptr, SIZE_T(size), MEM_RESERVE, PAGE_READWRITE));
+                return view;
             }
-
-            // decode the instruction bytes to check for unsupported instructions
-            // NOTE: this will be where we inject markers for emulation when the underlying CPU doesn'ts support the required instruction
-            const auto decoded = decoder::Decode(bytes, size);
-            if(!decoded._supported ||
-                decoded._ring0 ||
-                decoded._class == decoder::InstructionInfo::InstructionClass::kBranching ||
-                decoded._class == decoder::InstructionInfo::InstructionClass::kSyscall ||
-                decoded._class == decoder::InstructionInfo::InstructionClass::kVmcall)
+            if(_map_view_of_file_numa_2 && _unmap_view_of_file_2)
             {
-                detail::set_error(Error::kUnsupportedInstructionType);
-                return {};
+                // the section's protection is the most any view can have, each view is mapped with less
+                section = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_EXECUTE_READWRITE | SEC_RESERVE, DWORD(uint64_t(size) >> 32), DWORD(size), nullptr);
+                if(section)
+                {
+                    view = reinterpret_cast<unsigned char*>(MapViewOfFile(section, FILE_MAP_WRITE, 0, 0, SIZE_T(size)));
+                    const auto memory = view ? _map_view_of_file_numa_2(section, _process_vm, 0, nullptr, SIZE_T(size), 0, PAGE_EXECUTE_READ, NUMA_NO_PREFERRED_NODE) : nullptr;
+                    if(memory)
+                        return reinterpret_cast<unsigned char*>(memory);
+                    if(view)
+                        UnmapViewOfFile(view);
+                    CloseHandle(section);
+                    section = nullptr;
+                    view = nullptr;
+                }
             }
+            return reinterpret_cast<unsigned char*>(VirtualAllocEx(_process_vm, nullptr, SIZE_T(size), MEM_RESERVE, PAGE_EXECUTE_READWRITE));
+        }
 
-            instruction_line_info_t line;
-            line._line = _instruction_line;
-            memcpy(line._instruction_bytes, bytes, size);
-            line._instruction_size = size;
-            // relative to previous instruction, or just start of code buffer
-            line._address = _instruction_line ? (_loaded_instructions[_instruction_line - 1]._address + _loaded_instructions[_instruction_line - 1]._instruction_size) : uintptr_t(_code);
-            _commit_size += size;
-
-            if(_instruction_line == _last_instruction_line)
+        void release_code_region(unsigned char* memory, HANDLE section, unsigned char* view)
+        {
+            if(section)
             {
-                _loaded_instructions.emplace_back(std::move(line));
-                _instruction_line = ++_last_instruction_line;
+                _unmap_view_of_file_2(_process_vm, memory, 0);
+                UnmapViewOfFile(view);
+                CloseHandle(section);
             }
             else
+                VirtualFreeEx(_process_vm, memory, 0, MEM_RELEASE);
+        }
+
+        // commit [address, address + size) of a code region from reserve_code_region
+        bool commit_region_range(unsigned char* memory, HANDLE section, unsigned char* view, uintptr_t address, size_t size)
+        {
+            if(_backend == Backend::kInterpreter)
+                return VirtualAlloc(LPVOID(address), SIZE_T(size), MEM_COMMIT, PAGE_READWRITE) != nullptr;
+            if(!section)
+                return VirtualAllocEx(_process_vm, LPVOID(address), SIZE_T(size), MEM_COMMIT, PAGE_EXECUTE_READWRITE) != nullptr;
+            // committing through one view commits the section, we commit the debuggee's view as well to give its pages their protection
+            return VirtualAlloc(view + (address - uintptr_t(memory)), SIZE_T(size), MEM_COMMIT, PAGE_READWRITE) &&
+                   VirtualAllocEx(_process_vm, LPVOID(address), SIZE_T(size), MEM_COMMIT, PAGE_EXECUTE_READ);
+        }
+
+        // commit [address, address + size) of the code region
+        bool commit_code_range(uintptr_t address, size_t size)
+        {
+            return commit_region_range(_scratch_memory, _code_section, _code_view, address, size);
+        }
+
+        // a read-write allocation of size bytes in the debuggee, after end and within rel32 reach of all of [begin, end), or 0 if there is no room
+        uintptr_t allocate_near(uintptr_t begin, uintptr_t end, size_t size)
+        {
+            SYSTEM_INFO system_info;
+            GetSystemInfo(&system_info);
+            const auto granularity = uintptr_t(system_info.dwAllocationGranularity);
+            constexpr uintptr_t kRel32Reach = 0x7fffffff;
+            for(auto address = (end + granularity - 1) & ~(granularity - 1); address + size - begin <= kRel32Reach;)
             {
-                const auto instruction_size_delta = int(size) - int(_loaded_instructions[_instruction_line]._instruction_size);
-                _loaded_instructions[_instruction_line] = std::move(line);
-                if(instruction_size_delta)
+                MEMORY_BASIC_INFORMATION region;
+                if(!VirtualQueryEx(_process_vm, LPCVOID(address), &region, sizeof(region)))
+                    break;
+                const auto region_end = uintptr_t(region.BaseAddress) + region.RegionSize;
+                if(region.State == MEM_FREE && region_end >= address + size)
                 {
-                    // fix up all subsequent instruction addresses if the new instruction is different in size from what it was previously
-                    for(size_t l = _instruction_line + 1ull; l < _last_instruction_line; ++l)
-                    {
-                        _loaded_instructions[l]._address = uintptr_t((long long)(_loaded_instructions[l]._address) + instruction_size_delta);
-                    }
+                    if(const auto allocation = VirtualAllocEx(_process_vm, LPVOID(address), SIZE_T(size), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE))
+                        return uintptr_t(allocation);
                 }
-                //NOTE: _first_instruction_line is modified by SetInstructionLine
-                ++_instruction_line;
+                address = (region_end + granularity - 1) & ~(granularity - 1);
             }
-            return { line._line, line._address };
+            return 0;
         }
 
-        bool SetInstructionLine(size_t line)
+        // write to a code region from reserve_code_region
+        bool write_region(unsigned char* memory, unsigned char* view, uintptr_t address, const void* src, size_t size)
         {
-            if(line > _last_instruction_line)
-                return false;
-            if(line < _first_instruction_line)
-                _first_instruction_line = line;
-            _instruction_line = line;
-            return true;
+            if(view)
+            {
+                memcpy(view + (address - uintptr_t(memory)), src, size);
+                return true;
+            }
+            SIZE_T written;
+            return WriteProcessMemory(_process_vm, LPVOID(address), src, SIZE_T(size), &written) == TRUE && size_t(written) == size;
         }
 
-        instruction_index_t NextInstructionIndex()
+        // write to the code region
+        bool write_code(uintptr_t address, const void* src, size_t size)
         {
-            if(_loaded_instructions.empty() || !_instruction_line)
-                return {
-                    0,
-                    uintptr_t(_code)
-                };
-            return {
-                _instruction_line,
-                _loaded_instructions[_instruction_line - 1]._address + _loaded_instructions[_instruction_line - 1]._instruction_size
-            };
+            return write_region(_scratch_memory, _code_view, address, src, size);
         }
 
-        bool SetNextExecuteLine(size_t line)
+        // the bytes a line is committed as: emulated instructions are replaced with a marker that traps, padded with nops to keep the layout
+        const uint8_t* committed_bytes(const instruction_line_info_t& line, uint8_t (&marker)[kMaxAssembledInstructionSize])
         {
-            if(line >= _last_instruction_line)
+            if(!line._emulated)
+                return line._instruction_bytes;
+            assert(line._instruction_size >= sizeof(kEmulationMarker));
+            memset(marker, 0x90, sizeof(marker));
+            memcpy(marker, kEmulationMarker, sizeof(kEmulationMarker));
+            return marker;
+        }
+
+        // make writes to the code region visible to the debuggee before it runs again.
+        // x64 instruction fetch is coherent with stores and the debuggee only resumes through a (serialising) kernel transition, the fence orders
+        // any non-temporal stores memcpy used. WriteProcessMemory flushes the instruction cache itself
+        void code_barrier()
+        {
+            if(_code_section)
+                _mm_sfence();
+        }
+
+        // make sure at least size bytes of the code region are committed
+        bool commit_code_pages(size_t size)
+        {
+            if(size <= _scratch_size)
+                return true;
+            // commit in allocation granularity sized chunks to keep the number of calls down
+            constexpr size_t kCommitGranularity = 0x10000;
+            const auto commit_size = std::min<size_t>((size + kCommitGranularity - 1) & ~(kCommitGranularity - 1), _scratch_reserved);
+            if(!commit_code_range(uintptr_t(_scratch_memory + _scratch_size), commit_size - _scratch_size))
             {
-                detail::set_error(Error::kInvalidAddress);
+                detail::set_error(Error::kSystemError);
                 return false;
             }
-            set_next_instruction_address(LPCVOID(_loaded_instructions[line]._address));
-            _code = reinterpret_cast<unsigned char*>(_loaded_instructions[line]._address);
-            _variables["execip"] = uintptr_t(_code);
+            _scratch_size = commit_size;
             return true;
         }
 
-        bool GetVariable(const char* name, uintptr_t& value)
+        // move all code to a new, larger, reservation of at least requiredSize bytes.
+        // RIP relative instructions are re-encoded to keep referencing the same data, and the debuggee's instruction pointer is moved along with the code
+        bool relocate_code_region(size_t requiredSize)
         {
-            // check line number variables first
-            if(name[0] == 'l')
+            auto reserve = _scratch_reserved;
+            while(reserve - kGuardAreaSize < requiredSize)
+                reserve *= 2;
+
+            HANDLE new_section;
+            unsigned char* new_view;
+            const auto new_memory = reserve_code_region(reserve, new_section, new_view);
+            if(!new_memory)
             {
-                char buffer[12];
-                auto rp = name + 1;
-                auto bp = buffer;
-                while(rp[0] && isdigit(rp[0]))
-                {
-                    *bp++ = *rp++;
-                }
-                bp[0] = 0;
-                if(size_t(bp) - size_t(buffer) > 0)
+                detail::set_error(Error::kCodeBufferOverflow);
+                return false;
+            }
+            const auto old_begin = uintptr_t(_scratch_memory);
+            const auto old_end = old_begin + _scratch_reserved;
+            const auto new_begin = uintptr_t(new_memory);
+
+            // re-encode everything for the new location before we commit to anything, so that we can back out
+            auto relocated = _loaded_instructions;
+            for(auto& line : relocated)
+            {
+                const auto new_address = line._address - old_begin + new_begin;
+                if(!decoder::Relocate(line._instruction_bytes, line._instruction_size, line._address, new_address, old_begin, old_end))
                 {
-                    const auto index = ::strtol(bp, nullptr, 10);
-                    if(!errno && index >= 0 && index < _last_instruction_line)
-                    {
-                        value = uintptr_t(_loaded_instructions[index]._address);
-                        return true;
-                    }
+                    release_code_region(new_memory, new_section, new_view);
+                    detail::set_error(Error::kCodeBufferOverflow);
+                    return false;
                 }
+                line._address = new_address;
             }
-            else
+
+            // the thunks have to reach their data from the new region
+            uintptr_t guard_data = 0;
+            if(_guard_data)
             {
-                const auto i = _variables.find(name);
-                if(i != _variables.end())
+                guard_data = allocate_near(new_begin, new_begin + reserve, kGuardDataSize);
+                if(!guard_data)
                 {
-                    value = i->second;
-                    return true;
+                    release_code_region(new_memory, new_section, new_view);
+                    detail::set_error(Error::kCodeBufferOverflow);
+                    return false;
                 }
             }
-            detail::set_error(Error::kUndefinedVariable);
-            return false;
-        }
 
-        bool CommmitInstructions()
-        {
-            if(_last_instruction_line == _first_instruction_line)
+            // the new region is committed and holds the code before anything of the old one is let go, so a failure leaves the runtime where it was
+            auto written = commit_region_range(new_memory, new_section, new_view, new_begin, _scratch_size);
+            // (lines from _first_instruction_line on haven't been committed, and may not fit in what is)
+            for(size_t l = 0; written && l < _first_instruction_line; ++l)
             {
-                detail::set_error(Error::kNoMoreCode);
-                return false;
+                uint8_t marker[kMaxAssembledInstructionSize];
+                written = write_region(new_memory, new_view, relocated[l]._address, committed_bytes(relocated[l], marker), relocated[l]._instruction_size);
             }
-
-            if(!_flags._started)
+            if(!written)
             {
-                detail::set_error(Error::kRuntimeUninitialised);
+                release_code_region(new_memory, new_section, new_view);
+                if(guard_data)
+                    VirtualFreeEx(_process_vm, LPVOID(guard_data), 0, MEM_RELEASE);
+                detail::set_error(Error::kSystemError);
                 return false;
             }
 
-            for(size_t l = _first_instruction_line; l < _last_instruction_line; ++l)
+            // nothing can fail from here on
+            release_code_region(_scratch_memory, _code_section, _code_view);
+            if(_guard_data)
+                VirtualFreeEx(_process_vm, LPVOID(_guard_data), 0, MEM_RELEASE);
+            _guard_data = guard_data;
+            _code = new_memory + (_code - _scratch_memory);
+            _code_end = new_memory + (_code_end - _scratch_memory);
+            _scratch_memory = new_memory;
+            _code_section = new_section;
+            _code_view = new_view;
+            _scratch_reserved = reserve;
+
+            _loaded_instructions = std::move(relocated);
+            // branches are resolved, and everything written out, again on the next commit
+            _first_instruction_line = 0;
+
+            if(_active_ctx && _active_ctx->Rip >= old_begin && _active_ctx->Rip < old_end)
+                set_next_instruction_address(LPCVOID(_active_ctx->Rip - old_begin + new_begin));
+            // return addresses on the stack move with the code.
+            //NOTE: we can't tell them apart from data that happens to look like a code address
+            if(_active_ctx && _active_ctx->Rsp >= _stack && _active_ctx->Rsp < _stack_top)
             {
-                SIZE_T written;
-                if(WriteProcessMemory(_process_vm, LPVOID(_loaded_instructions[l]._address),
-                       _loaded_instructions[l]._instruction_bytes,
-                       SIZE_T(_loaded_instructions[l]._instruction_size), &written) == TRUE &&
-                    size_t(written) != _loaded_instructions[l]._instruction_size)
+                std::vector<uint64_t> stack((_stack_top - (_active_ctx->Rsp & ~7ull)) / sizeof(uint64_t));
+                const auto stack_at = LPVOID(_active_ctx->Rsp & ~7ull);
+                SIZE_T transferred;
+                if(ReadProcessMemory(_process_vm, stack_at, stack.data(), stack.size() * sizeof(uint64_t), &transferred))
                 {
-                    detail::set_error(Error::kSystemError);
-                    return false;
+                    for(auto& value : stack)
+                    {
+                        if(value >= old_begin && value < old_end)
+                            value = value - old_begin + new_begin;
+                    }
+                    WriteProcessMemory(_process_vm, stack_at, stack.data(), stack.size() * sizeof(uint64_t), &transferred);
                 }
             }
-
-            _instruction_line = _first_instruction_line = _last_instruction_line;
-            if(_loaded_instructions[_last_instruction_line - 1]._address >= uintptr_t(_code_end))
-                _code_end = reinterpret_cast<unsigned char*>(_loaded_instructions[_last_instruction_line - 1]._address + _loaded_instructions[_last_instruction_line - 1]._instruction_size);
-            _commit_size = 0;
+            _variables["execip"] = uintptr_t(_code);
             return true;
         }
 
-        bool Step()
+        // find the debuggee executable: the minimal stub if it has been built alongside us, otherwise we relaunch ourselves
+        bool debuggee_path(char (&path)[MAX_PATH])
         {
-            // not started
-            if(!_flags._started)
-            {
-                detail::set_error(Error::kRuntimeUninitialised);
+            const auto length = GetModuleFileNameA(nullptr, path, sizeof(path));
+            if(!length || length == sizeof(path))
                 return false;
-            }
+            char stub_path[MAX_PATH];
+            strcpy_s(stub_path, path);
+            const auto separator = strrchr(stub_path, '\\');
+            const auto name = separator ? separator + 1 : stub_path;
+            if(strcpy_s(name, sizeof(stub_path) - size_t(name - stub_path), kStubDebuggeeName) == 0 && GetFileAttributesA(stub_path) != INVALID_FILE_ATTRIBUTES)
+                strcpy_s(path, stub_path);
+            return true;
+        }
 
-            // no more code to execute
-            if(_code == _code_end)
+        // launch count debuggees and cycle through their debug events until each one is at its first breakpoint (in ntdll!LdrpDoDebuggerBreak),
+        // where they are left hanging. The debuggees are launched together so that their start up overlaps
+        bool launch_debuggees(size_t count, std::vector<debuggee_t>& debuggees)
+        {
+            char exe_path[MAX_PATH];
+            if(!debuggee_path(exe_path))
             {
-                detail::set_error(Error::kNoMoreCode);
+                detail::set_error(Error::kSystemError);
                 return false;
             }
 
-            if(_ctx_changed)
+            std::vector<debuggee_t> launched;
+            for(size_t n = 0; n < count; ++n)
             {
-                // update thread context before we execute, if there are changes
-                SetThreadContext(active_thread(), _active_ctx);
-                _ctx_changed = false;
+                STARTUPINFOA startupinfo = { 0 };
+                startupinfo.cb = sizeof(startupinfo);
+                // see inasm64::kTrapModeArgumentValue
+                char command_line[] = "262";
+                debuggee_t debuggee;
+                if(!CreateProcessA(exe_path, command_line, nullptr, nullptr, FALSE, DEBUG_ONLY_THIS_PROCESS, nullptr, nullptr, &startupinfo, &debuggee._processinfo))
+                    break;
+                launched.push_back(debuggee);
             }
 
-            auto stepped = false;
-            while(!stepped && _flags._running)
+            size_t stopped = 0;
+            while(stopped < launched.size())
             {
-                // debuggee is always suspended when we get here, so let it run up to the next event.
+                DEBUG_EVENT dbg_event;
+                if(!WaitForDebugEvent(&dbg_event, INFINITE))
+                    break;
+                const auto debuggee = std::find_if(launched.begin(), launched.end(), [&dbg_event](const debuggee_t& d) {
+                    return d._processinfo.dwProcessId == dbg_event.dwProcessId;
+                });
+                auto continue_status = DWORD(DBG_CONTINUE);
+                switch(dbg_event.dwDebugEventCode)
+                {
+                case EXCEPTION_DEBUG_EVENT:
+                    continue_status = DBG_EXCEPTION_HANDLED;
+                    if(debuggee != launched.end() && !debuggee->_process_vm && dbg_event.u.Exception.ExceptionRecord.ExceptionCode == EXCEPTION_BREAKPOINT)
+                    {
+                        // get full access handle to the process, and leave it hanging
+                        debuggee->_process_vm = OpenProcess(PROCESS_VM_OPERATION | PROCESS_VM_READ | PROCESS_VM_WRITE | PROCESS_QUERY_INFORMATION | PROCESS_TERMINATE, FALSE, dbg_event.dwProcessId);
+                        debuggee->_dbg_event = dbg_event;
+                        ++stopped;
+                        continue;
+                    }
+                    break;
+                case CREATE_PROCESS_DEBUG_EVENT:
+                    CloseHandle(dbg_event.u.CreateProcessInfo.hFile);
+                    break;
+                case LOAD_DLL_DEBUG_EVENT:
+                    CloseHandle(dbg_event.u.LoadDll.hFile);
+                    break;
+                case EXIT_PROCESS_DEBUG_EVENT:
+                    // didn't make it to the first breakpoint
+                    if(debuggee != launched.end())
+                    {
+                        CloseHandle(debuggee->_processinfo.hThread);
+                        CloseHandle(debuggee->_processinfo.hProcess);
+                        launched.erase(debuggee);
+                    }
+                    break;
+                default:
+                    break;
+                }
+                ContinueDebugEvent(dbg_event.dwProcessId, dbg_event.dwThreadId, continue_status);
+            }
+
+            const auto launched_count = launched.size();
+            debuggees.insert(debuggees.end(), launched.begin(), launched.end());
+            if(launched_count < count)
+            {
+                detail::set_error(Error::kSystemError);
+                return false;
+            }
+            return true;
+        }
+
+        // terminate a debuggee and let it run down; it can't exit while it has a debug event pending
+        void terminate_debuggee(const debuggee_t& debuggee)
+        {
+            TerminateProcess(debuggee._processinfo.hProcess, 1);
+            auto dbg_event = debuggee._dbg_event;
+            auto exited = false;
+            while(!exited)
+            {
+                ContinueDebugEvent(dbg_event.dwProcessId, dbg_event.dwThreadId, DBG_CONTINUE);
+                // any other debuggee is hanging on its first breakpoint, so all events are from this one
+                if(!WaitForDebugEvent(&dbg_event, 1000))
+                    break;
+                exited = dbg_event.dwDebugEventCode == EXIT_PROCESS_DEBUG_EVENT && dbg_event.dwProcessId == debuggee._processinfo.dwProcessId;
+            }
+            if(exited)
+                ContinueDebugEvent(dbg_event.dwProcessId, dbg_event.dwThreadId, DBG_CONTINUE);
+            CloseHandle(debuggee._process_vm);
+            CloseHandle(debuggee._processinfo.hThread);
+            CloseHandle(debuggee._processinfo.hProcess);
+        }
+
+        bool WarmDebuggeePool(size_t count)
+        {
+            _debuggee_pool_size = count;
+            while(_debuggee_pool.size() > count)
+            {
+                terminate_debuggee(_debuggee_pool.back());
+                _debuggee_pool.pop_back();
+            }
+            if(_debuggee_pool.size() < count)
+                return launch_debuggees(count - _debuggee_pool.size(), _debuggee_pool);
+            return true;
+        }
+
+        size_t DebuggeePoolSize()
+        {
+            return _debuggee_pool.size();
+        }
+
+        Backend ActiveBackend()
+        {
+            return _backend;
+        }
+
+        // true if [address, address + size) is memory the interpreted code is allowed to access; the committed code region, the stack, or an allocation
+        bool is_interpreter_memory(uintptr_t address, size_t size)
+        {
+            const auto inside = [address, size](uintptr_t begin, size_t length) {
+                return address >= begin && size <= length && address - begin <= length - size;
+            };
+            if(inside(uintptr_t(_scratch_memory), _scratch_size) || inside(_stack, kStackSize))
+                return true;
+            for(const auto& allocation : _allocations)
+            {
+                if(inside(allocation.first, allocation.second._size))
+                    return true;
+            }
+            return false;
+        }
+
+        bool Start(size_t scratchPadSize, Backend backend)
+        {
+            if(_flags._running)
+                return false;
+
+            ZeroMemory(&_flags, sizeof(_flags));
+            _backend = backend;
+
+            _emulated_state = {};
+            if(backend == Backend::kInterpreter)
+            {
+                // everything lives in this process
+                ZeroMemory(&_processinfo, sizeof(_processinfo));
+                _processinfo.hProcess = _process_vm = GetCurrentProcess();
+                _processinfo.hThread = GetCurrentThread();
+                _processinfo.dwProcessId = GetCurrentProcessId();
+                _processinfo.dwThreadId = GetCurrentThreadId();
+                _emulated_state._read_memory = [](uintptr_t address, void* dest, size_t size) {
+                    if(!is_interpreter_memory(address, size))
+                        return false;
+                    memcpy(dest, reinterpret_cast<const void*>(address), size);
+                    return true;
+                };
+                _emulated_state._write_memory = [](uintptr_t address, const void* src, size_t size) {
+                    if(!is_interpreter_memory(address, size))
+                        return false;
+                    memcpy(reinterpret_cast<void*>(address), src, size);
+                    return true;
+                };
+            }
+            else
+            {
+                // take a debuggee from the pool if we can, otherwise launch one now
+                debuggee_t debuggee;
+                if(!_debuggee_pool.empty())
+                {
+                    debuggee = _debuggee_pool.back();
+                    _debuggee_pool.pop_back();
+                }
+                else
+                {
+                    std::vector<debuggee_t> launched;
+                    if(!launch_debuggees(1, launched))
+                        return false;
+                    debuggee = launched.front();
+                }
+                _processinfo = debuggee._processinfo;
+                _process_vm = debuggee._process_vm;
+                _dbg_event = debuggee._dbg_event;
+                _continue_status = DBG_EXCEPTION_HANDLED;
+
+                _emulated_state._read_memory = [](uintptr_t address, void* dest, size_t size) {
+                    SIZE_T read;
+                    return ReadProcessMemory(_process_vm, LPCVOID(address), dest, SIZE_T(size), &read) == TRUE && size_t(read) == size;
+                };
+                _emulated_state._write_memory = [](uintptr_t address, const void* src, size_t size) {
+                    SIZE_T written;
+                    return WriteProcessMemory(_process_vm, LPVOID(address), src, SIZE_T(size), &written) == TRUE && size_t(written) == size;
+                };
+            }
+            _flags._running = true;
+
+            // initialise the process scratch memory and leave the process hanging until someone calls Step (or quits)
+
+            _scratch_size = 0;
+            _scratch_reserved = std::max<size_t>(kCodeReserveSize, scratchPadSize + kGuardAreaSize);
+            _scratch_memory = _code = _code_end = reserve_code_region(_scratch_reserved, _code_section, _code_view);
+            if(!_scratch_memory || !commit_code_pages(scratchPadSize))
+            {
+                detail::set_error(Error::kSystemError);
+                return false;
+            }
+            if(backend != Backend::kInterpreter)
+            {
+                _guard_data = allocate_near(uintptr_t(_scratch_memory), uintptr_t(_scratch_memory) + _scratch_reserved, kGuardDataSize);
+                if(!_guard_data)
+                {
+                    detail::set_error(Error::kSystemError);
+                    return false;
+                }
+            }
+
+            // the code gets its own stack rather than running on whatever the loader left behind
+            _stack = uintptr_t(VirtualAllocEx(_process_vm, nullptr, SIZE_T(kStackSize), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+            if(!_stack)
+            {
+                detail::set_error(Error::kSystemError);
+                return false;
+            }
+            _stack_top = _stack + kStackSize;
+            _variables["stack"] = _stack;
+            _variables["stacktop"] = _stack_top;
+
+            if(backend == Backend::kInterpreter)
+            {
+                // a fresh register file, as the debuggee would have it apart from the registers the loader leaves behind
+                prepare_context();
+                _active_ctx->Rip = DWORD64(_code);
+                _active_ctx->Rsp = _stack_top;
+                _active_ctx->EFlags = 0x202;
+                _active_ctx->MxCsr = 0x1f80;
+                CopyContext(_prev_ctx, _ctx_flags, _active_ctx);
+                _ctx_changed = false;
+                _variables["execip"] = uintptr_t(_code);
+                _variables["codesize"] = 0;
+                _flags._started = true;
+                return true;
+            }
+
+            const auto thread = active_thread();
+            // set the trap flag so that the first instruction in the code scratch area will be intercepted when it executes
+            if(load_context(thread))
+            {
+                // set the next instruction to the beginning of the code scratch area (expecting it will be filled with valid code by someone calling AddCode shortly)
+                set_next_instruction_address(_code);
+                _active_ctx->Rsp = _stack_top;
+                enable_trap_flag();
+                SetThreadContext(thread, _active_ctx);
+                _ctx_changed = false;
+
+                _variables["execip"] = uintptr_t(_code);
+                _variables["codesize"] = 0;
+            }
+            // else a serious error, report or silentl ignore?
+
+            CloseHandle(thread);
+            _flags._started = true;
+            return true;
+        }
+
+        void Shutdown(bool restart)
+        {
+            if(_flags._running)
+            {
+                release_code_region(_scratch_memory, _code_section, _code_view);
+                if(_backend == Backend::kInterpreter)
+                {
+                    // the stack and allocations are ours to free, a debuggee takes them with it
+                    VirtualFree(LPVOID(_stack), 0, MEM_RELEASE);
+                    for(const auto& allocation : _allocations)
+                        VirtualFree(LPVOID(allocation.first), 0, MEM_RELEASE);
+                }
+                else
+                    terminate_debuggee({ _processinfo, _process_vm, _dbg_event });
+                _code = _code_end = _scratch_memory = _code_view = nullptr;
+                _code_section = nullptr;
+                _guard_data = 0;
+                _scratch_size = _scratch_reserved = 0;
+                free(_active_ctx);
+                free(_prev_ctx);
+                _active_ctx = _prev_ctx = nullptr;
+                _ymm = nullptr;
+            }
+            // nothing of the session survives into the next one
+            _loaded_instructions.clear();
+            _instruction_line = _first_instruction_line = _last_instruction_line = 0;
+            _labels.clear();
+            _breakpoints.clear();
+            _open_proc.clear();
+            _procedures.clear();
+            _allocations.clear();
+            _tracking_writes = false;
+            _written_pages.clear();
+            _perf_map = PerfMap::kOff;
+            _perf_map_error = Error::kNoError;
+            perfmap::Close();
+            _stack = _stack_top = 0;
+            ZeroMemory(&_flags, sizeof(_flags));
+
+            // top the pool back up, this is where the cost of launching a debuggee is paid when the pool is used, unless no Start will follow
+            if(!restart)
+                WarmDebuggeePool(0);
+            else if(_debuggee_pool.size() < _debuggee_pool_size)
+                launch_debuggees(_debuggee_pool_size - _debuggee_pool.size(), _debuggee_pool);
+        }
+
+        void Reset()
+        {
+            if(!_flags._started)
+                return;
+            _code = _scratch_memory;
+            //ZZZ: untested
+            _instruction_line = _first_instruction_line = _last_instruction_line = 0;
+            _loaded_instructions.clear();
+            _labels.clear();
+            _breakpoints.clear();
+            _open_proc.clear();
+            _procedures.clear();
+            // and an empty stack
+            if(_active_ctx)
+            {
+                _active_ctx->Rsp = _stack_top;
+                _ctx_changed = true;
+            }
+        }
+
+        bool is_valid_label(const char* name)
+        {
+            // l<N> is reserved for line numbers
+            return name && isalpha(name[0]) && !(name[0] == 'l' && isdigit(name[1])) && strlen(name) < sizeof(instruction_line_info_t::_branch_target);
+        }
+
+        bool AddLabel(const char* name)
+        {
+            if(!is_valid_label(name))
+            {
+                detail::set_error(Error::kInvalidInstructionFormat);
+                return false;
+            }
+            _labels[name] = _instruction_line;
+            return true;
+        }
+
+        // add a line at the current line number. Procedure fences are int3 lines, which aren't allowed as instructions, so they skip the checks
+        instruction_index_t add_line(const void* bytes, size_t size, const char* branchTarget, bool fence)
+        {
+            if(!size)
+                return {};
+
+            // decode the instruction bytes to check for unsupported instructions.
+            // Instructions the CPU doesn't support are emulated, if possible, by committing a trapping marker in their place (see CommmitInstructions and Step)
+            // With the interpreter nothing runs natively, so all that matters is whether the interpreter supports it
+            const auto decoded = decoder::Decode(bytes, size);
+            const auto interpreted = _backend == Backend::kInterpreter;
+            const auto emulated = !interpreted && !decoded._supported && emulator::CanEmulate(bytes, size);
+            // only relative branches and calls, their targets are tracked by line so that they stay inside the code.
+            //NOTE: not all relative branches are classified as kBranching (loop for example)
+            decoder::RelativeBranchInfo branch;
+            const auto relative_branch = !fence && decoder::DecodeRelativeBranch(bytes, size, branch);
+            if(!fence &&
+                ((interpreted ? !interpreter::CanInterpret(bytes, size) : (!decoded._supported && !emulated)) ||
+                    decoded._ring0 ||
+                    (decoded._class == decoder::InstructionInfo::InstructionClass::kBranching && !relative_branch) ||
+                    decoded._class == decoder::InstructionInfo::InstructionClass::kSyscall ||
+                    decoded._class == decoder::InstructionInfo::InstructionClass::kVmcall))
+            {
+                detail::set_error(Error::kUnsupportedInstructionType);
+                return {};
+            }
+
+            instruction_line_info_t line;
+            line._line = _instruction_line;
+            memcpy(line._instruction_bytes, bytes, size);
+            line._instruction_size = size;
+            line._emulated = emulated;
+            line._fence = fence;
+            line._call = relative_branch && branch._call;
+            // relative to previous instruction, or just start of code buffer
+            line._address = _instruction_line ? (_loaded_instructions[_instruction_line - 1]._address + _loaded_instructions[_instruction_line - 1]._instruction_size) : uintptr_t(_code);
+
+            // total code size once this instruction is in, if it doesn't fit in the reservation we have to move
+            const auto code_size = _last_instruction_line ? (_loaded_instructions[_last_instruction_line - 1]._address + _loaded_instructions[_last_instruction_line - 1]._instruction_size - uintptr_t(_scratch_memory)) : 0;
+            const auto replaced_size = _instruction_line < _last_instruction_line ? _loaded_instructions[_instruction_line]._instruction_size : 0;
+            // (and the sentinel)
+            const auto required_size = code_size - replaced_size + size + 1;
+            if(required_size > _scratch_reserved - kGuardAreaSize)
+            {
+                const auto old_begin = uintptr_t(_scratch_memory);
+                const auto old_end = old_begin + _scratch_reserved;
+                if(!relocate_code_region(required_size))
+                    return {};
+                // the instruction was assembled for the old location too
+                const auto new_address = line._address - old_begin + uintptr_t(_scratch_memory);
+                if(!decoder::Relocate(line._instruction_bytes, size, line._address, new_address, old_begin, old_end))
+                {
+                    detail::set_error(Error::kCodeBufferOverflow);
+                    return {};
+                }
+                line._address = new_address;
+            }
+
+            if(relative_branch)
+            {
+                line._branch_displacement_bytes = branch._displacement_bytes;
+                if(branchTarget && branchTarget[0])
+                {
+                    strncpy_s(line._branch_target, sizeof(line._branch_target), branchTarget, _TRUNCATE);
+                }
+                else
+                {
+                    // an absolute target has to be the start of a line, or the end of the code, so that we can keep track of it if the code changes
+                    const auto next_address = line._address + size;
+                    const auto target = uintptr_t((long long)(next_address) + branch._displacement);
+                    const auto appending = _instruction_line == _last_instruction_line;
+                    size_t target_line;
+                    if(target == line._address)
+                    {
+                        target_line = _instruction_line;
+                    }
+                    else if(appending && target == next_address)
+                    {
+                        target_line = _instruction_line + 1;
+                    }
+                    else if(!appending && target == code_end_address())
+                    {
+                        target_line = _last_instruction_line;
+                    }
+                    else
+                    {
+                        const auto target_info = find_line(target);
+                        if(!target_info)
+                        {
+                            detail::set_error(Error::kBranchTargetOutOfRange);
+                            return {};
+                        }
+                        target_line = target_info->_line;
+                    }
+                    sprintf_s(line._branch_target, "l%zu", target_line);
+                }
+            }
+
+            if(_instruction_line == _last_instruction_line)
+            {
+                _loaded_instructions.emplace_back(std::move(line));
+                _instruction_line = ++_last_instruction_line;
+            }
+            else
+            {
+                const auto instruction_size_delta = int(size) - int(_loaded_instructions[_instruction_line]._instruction_size);
+                _loaded_instructions[_instruction_line] = std::move(line);
+                if(instruction_size_delta)
+                {
+                    // fix up all subsequent instruction addresses if the new instruction is different in size from what it was previously
+                    for(size_t l = _instruction_line + 1ull; l < _last_instruction_line; ++l)
+                    {
+                        _loaded_instructions[l]._address = uintptr_t((long long)(_loaded_instructions[l]._address) + instruction_size_delta);
+                    }
+                }
+                //NOTE: _first_instruction_line is modified by SetInstructionLine
+                ++_instruction_line;
+            }
+            return { line._line, line._address };
+        }
+
+        instruction_index_t AddInstruction(const void* bytes, size_t size, const char* branchTarget)
+        {
+            return add_line(bytes, size, branchTarget, false);
+        }
+
+        bool BeginProc(const char* name)
+        {
+            if(!_open_proc.empty())
+            {
+                detail::set_error(Error::kInvalidProcedure);
+                return false;
+            }
+            if(!is_valid_label(name))
+            {
+                detail::set_error(Error::kInvalidInstructionFormat);
+                return false;
+            }
+            if(!add_line(&kProcFence, sizeof(kProcFence), nullptr, true)._address)
+                return false;
+            _labels[name] = _instruction_line;
+            _open_proc = name;
+            if(std::find(_procedures.begin(), _procedures.end(), _open_proc) == _procedures.end())
+                _procedures.push_back(_open_proc);
+            return true;
+        }
+
+        bool EndProc()
+        {
+            if(_open_proc.empty())
+            {
+                detail::set_error(Error::kInvalidProcedure);
+                return false;
+            }
+            _open_proc.clear();
+            return true;
+        }
+
+        bool SetInstructionLine(size_t line)
+        {
+            if(line > _last_instruction_line)
+                return false;
+            if(line < _first_instruction_line)
+                _first_instruction_line = line;
+            _instruction_line = line;
+            return true;
+        }
+
+        instruction_index_t NextInstructionIndex()
+        {
+            if(_loaded_instructions.empty() || !_instruction_line)
+                return {
+                    0,
+                    uintptr_t(_code)
+                };
+            return {
+                _instruction_line,
+                _loaded_instructions[_instruction_line - 1]._address + _loaded_instructions[_instruction_line - 1]._instruction_size
+            };
+        }
+
+        bool SetNextExecuteLine(size_t line)
+        {
+            if(line >= _last_instruction_line)
+            {
+                detail::set_error(Error::kInvalidAddress);
+                return false;
+            }
+            set_next_instruction_address(LPCVOID(_loaded_instructions[line]._address));
+            _code = reinterpret_cast<unsigned char*>(_loaded_instructions[line]._address);
+            _variables["execip"] = uintptr_t(_code);
+            return true;
+        }
+
+        bool GetVariable(const char* name, uintptr_t& value)
+        {
+            // check line number variables first
+            if(name[0] == 'l')
+            {
+                char buffer[12];
+                auto rp = name + 1;
+                auto bp = buffer;
+                while(rp[0] && isdigit(rp[0]))
+                {
+                    *bp++ = *rp++;
+                }
+                bp[0] = 0;
+                if(size_t(bp) - size_t(buffer) > 0)
+                {
+                    const auto index = ::strtol(buffer, nullptr, 10);
+                    if(!errno && index >= 0 && index < _last_instruction_line)
+                    {
+                        value = uintptr_t(_loaded_instructions[index]._address);
+                        return true;
+                    }
+                }
+            }
+            else
+            {
+                const auto i = _variables.find(name);
+                if(i != _variables.end())
+                {
+                    value = i->second;
+                    return true;
+                }
+            }
+            detail::set_error(Error::kUndefinedVariable);
+            return false;
+        }
+
+        // symbols for all the lines, or blocks, to perfmap
+        bool publish_perf_map()
+        {
+            std::vector<procedure_t> procedures;
+            if(!Procedures(procedures))
+                return false;
+            // the main code is the lines up to the first fence
+            procedure_t main_code;
+            main_code._name = "main";
+            while(main_code._end_line < _last_instruction_line && !_loaded_instructions[main_code._end_line]._fence)
+                ++main_code._end_line;
+            procedures.insert(procedures.begin(), main_code);
+
+            std::vector<perfmap::symbol_t> symbols;
+            for(const auto& procedure : procedures)
+            {
+                for(auto l = procedure._first_line; l < procedure._end_line; ++l)
+                {
+                    const auto& line = _loaded_instructions[l];
+                    if(_perf_map == PerfMap::kLines || l == procedure._first_line)
+                    {
+                        symbols.emplace_back();
+                        symbols.back()._address = line._address;
+                        symbols.back()._name = "inasm64::" + procedure._name;
+                        if(_perf_map == PerfMap::kLines)
+                            symbols.back()._name += " l" + std::to_string(l);
+                    }
+                    symbols.back()._code.insert(symbols.back()._code.end(), line._instruction_bytes, line._instruction_bytes + line._instruction_size);
+                }
+            }
+            return perfmap::Publish(symbols);
+        }
+
+        bool SetPerfMap(PerfMap map, bool jitdump, std::string& mapPath, std::string& jitdumpPath)
+        {
+            mapPath.clear();
+            jitdumpPath.clear();
+            if(!_flags._started)
+            {
+                detail::set_error(Error::kRuntimeUninitialised);
+                return false;
+            }
+            if(_backend == Backend::kInterpreter)
+            {
+                detail::set_error(Error::kUnsupportedByBackend);
+                return false;
+            }
+            _perf_map = map;
+            if(map == PerfMap::kOff)
+            {
+                perfmap::Close();
+                return true;
+            }
+            perfmap::files_t files;
+            if(!perfmap::Open(_processinfo.dwProcessId, _processinfo.dwThreadId, jitdump, files))
+            {
+                _perf_map = PerfMap::kOff;
+                return false;
+            }
+            mapPath = files._map;
+            jitdumpPath = files._jitdump;
+            return publish_perf_map();
+        }
+
+        bool CommmitInstructions()
+        {
+            if(_last_instruction_line == _first_instruction_line)
+            {
+                detail::set_error(Error::kNoMoreCode);
+                return false;
+            }
+
+            if(!_flags._started)
+            {
+                detail::set_error(Error::kRuntimeUninitialised);
+                return false;
+            }
+
+            // branch targets may have moved, this can pull _first_instruction_line back
+            if(!resolve_branches())
+                return false;
+
+            // (including the sentinel)
+            if(!commit_code_pages(code_end_address() + 1 - uintptr_t(_scratch_memory)))
+                return false;
+
+            for(size_t l = _first_instruction_line; l < _last_instruction_line; ++l)
+            {
+                uint8_t marker[kMaxAssembledInstructionSize];
+                if(!write_code(_loaded_instructions[l]._address, committed_bytes(_loaded_instructions[l], marker), _loaded_instructions[l]._instruction_size))
+                {
+                    detail::set_error(Error::kSystemError);
+                    return false;
+                }
+            }
+
+            if(!write_code(code_end_address(), &kCodeSentinel, 1))
+            {
+                detail::set_error(Error::kSystemError);
+                return false;
+            }
+            code_barrier();
+
+            _instruction_line = _first_instruction_line = _last_instruction_line;
+            if(_loaded_instructions[_last_instruction_line - 1]._address >= uintptr_t(_code_end))
+                _code_end = reinterpret_cast<unsigned char*>(_loaded_instructions[_last_instruction_line - 1]._address + _loaded_instructions[_last_instruction_line - 1]._instruction_size);
+            // the code is committed whether profilers get to see it or not, a failure to publish is reported through PerfMapError instead
+            _perf_map_error = Error::kNoError;
+            if(_perf_map != PerfMap::kOff && !publish_perf_map())
+                _perf_map_error = GetError();
+            return true;
+        }
+
+        Error PerfMapError()
+        {
+            return _perf_map_error;
+        }
+
+        // Step for the interpreter, the instruction executes directly against the active context
+        bool step_interpreted(const instruction_line_info_t* line)
+        {
+            if(!line)
+            {
+                detail::set_error(Error::kInvalidAddress);
+                return false;
+            }
+            CopyContext(_prev_ctx, _ctx_flags, _active_ctx);
+            load_emulated_state(line->_address + line->_instruction_size);
+            if(!interpreter::Execute(_emulated_state, line->_instruction_bytes, line->_instruction_size))
+                // the context is left on the line, the error is set by the interpreter
+                return false;
+            store_emulated_state();
+            _active_ctx->Rip = _emulated_state._next_rip;
+            _code = reinterpret_cast<unsigned char*>(_active_ctx->Rip);
+            _ctx_changed = false;
+            check_register_changes();
+            return true;
+        }
+
+        // the size of the pages backing an allocation
+        size_t allocation_page_size(const allocation_options_t& options)
+        {
+            switch(options._page_size)
+            {
+            case allocation_options_t::PageSize::kLarge:
+                return GetLargePageMinimum();
+            case allocation_options_t::PageSize::kHuge:
+                return kHugePageSize;
+            default:
+            {
+                SYSTEM_INFO system_info;
+                GetSystemInfo(&system_info);
+                return system_info.dwPageSize;
+            }
+            }
+        }
+
+        // keep a copy of the page of a tracked allocation at offset, if we haven't already, and make it writable again
+        bool track_write(uintptr_t handle, const allocation_t& allocation, size_t offset)
+        {
+            const auto page_size = allocation_page_size(allocation._options);
+            offset &= ~(page_size - 1);
+            const auto written = std::lower_bound(_written_pages.begin(), _written_pages.end(), handle + offset, [](const written_page_t& page, uintptr_t address) {
+                return uintptr_t(page._handle) + page._offset < address;
+            });
+            if(written != _written_pages.end() && uintptr_t(written->_handle) + written->_offset == handle + offset)
+                return true;
+            written_page_t page;
+            page._handle = reinterpret_cast<const void*>(handle);
+            page._offset = offset;
+            page._original.resize(std::min(page_size, allocation._size - offset));
+            SIZE_T read;
+            DWORD protection;
+            if(!ReadProcessMemory(_process_vm, LPCVOID(handle + offset), page._original.data(), page._original.size(), &read) || read != page._original.size()
+                || !VirtualProtectEx(_process_vm, LPVOID(handle + offset), SIZE_T(page_size), PAGE_READWRITE, &protection))
+                return false;
+            _written_pages.insert(written, std::move(page));
+            return true;
+        }
+
+        // a write fault in a page of a tracked allocation, which is let through once the page has been copied
+        bool track_write_fault(const EXCEPTION_RECORD& record)
+        {
+            // the first parameter is 1 for a write, the second the address written
+            if(!_tracking_writes || record.NumberParameters < 2 || record.ExceptionInformation[0] != 1)
+                return false;
+            const auto address = uintptr_t(record.ExceptionInformation[1]);
+            for(const auto& allocation : _allocations)
+            {
+                // the whole of the last page is protected, not just up to the size asked for
+                const auto page_size = allocation_page_size(allocation.second._options);
+                const auto protected_size = (allocation.second._size + page_size - 1) & ~(page_size - 1);
+                if(address >= allocation.first && address < allocation.first + protected_size)
+                    return track_write(allocation.first, allocation.second, address - allocation.first);
+            }
+            return false;
+        }
+
+        bool Step()
+        {
+            // not started
+            if(!_flags._started)
+            {
+                detail::set_error(Error::kRuntimeUninitialised);
+                return false;
+            }
+
+            // no more code to execute, or we would fall into a procedure
+            const auto at = find_line(uintptr_t(_code));
+            if(_code == _code_end || (at && at->_fence))
+            {
+                detail::set_error(Error::kNoMoreCode);
+                return false;
+            }
+
+            if(_backend == Backend::kInterpreter)
+                return step_interpreted(at);
+
+            if(_ctx_changed)
+            {
+                // update thread context before we execute, if there are changes
+                SetThreadContext(active_thread(), _active_ctx);
+                _ctx_changed = false;
+            }
+
+            auto stepped = false;
+            while(!stepped && _flags._running)
+            {
+                // debuggee is always suspended when we get here, so let it run up to the next event.
                 // when stepping this executes the current instruction and traps
                 ContinueDebugEvent(_dbg_event.dwProcessId,
                     _dbg_event.dwThreadId,
@@ -652,41 +1717,1036 @@ namespace inasm64
                     _continue_status = DBG_EXCEPTION_HANDLED;
                     switch(_dbg_event.u.Exception.ExceptionRecord.ExceptionCode)
                     {
-                    // the ones we care about
+                    // the ones we care about
+                    case EXCEPTION_SINGLE_STEP:
+                    {
+                        const auto thread = active_thread();
+                        if(!thread)
+                        {
+                            detail::set_error(Error::kSystemError);
+                            return false;
+                        }
+
+                        // advance the code pointer to the next instruction
+                        const auto next_instr = reinterpret_cast<unsigned char*>(_dbg_event.u.Exception.ExceptionRecord.ExceptionAddress);
+                        _code = next_instr;
+
+                        // refresh the context and re-set the trap flag
+                        if(load_context(thread))
+                        {
+                            clear_emulated_upper_state();
+                            enable_trap_flag();
+                            SetThreadContext(thread, _active_ctx);
+                        }
+
+                        CloseHandle(thread);
+                        stepped = true;
+                    }
+                    break;
+                    case EXCEPTION_ILLEGAL_INSTRUCTION:
+                    {
+                        // is this the marker for an emulated instruction?
+                        const auto address = uintptr_t(_dbg_event.u.Exception.ExceptionRecord.ExceptionAddress);
+                        const auto line = find_line(address);
+                        if(!line || !line->_emulated)
+                        {
+                            detail::set_error(Error::kUnsupportedInstructionType);
+                            _flags._running = false;
+                            break;
+                        }
+
+                        const auto thread = active_thread();
+                        if(!thread || !load_context(thread))
+                        {
+                            if(thread)
+                                CloseHandle(thread);
+                            detail::set_error(Error::kSystemError);
+                            return false;
+                        }
+
+                        // execute the real instruction against the faulting context and resume after it
+                        if(!execute_emulated_line(*line))
+                        {
+                            // leave the debuggee on the marker; the error is set by the emulator
+                            CloseHandle(thread);
+                            return false;
+                        }
+                        _code = reinterpret_cast<unsigned char*>(_active_ctx->Rip);
+                        // changes are relative to the context before the instruction, which load_context kept in _prev_ctx
+                        check_register_changes();
+
+                        enable_trap_flag();
+                        SetThreadContext(thread, _active_ctx);
+                        _ctx_changed = false;
+                        CloseHandle(thread);
+                        stepped = true;
+                    }
+                    break;
+                    case STATUS_ACCESS_VIOLATION:
+                        // the first write to a page of a tracked allocation is let through
+                        if(track_write_fault(_dbg_event.u.Exception.ExceptionRecord))
+                            break;
+                        //TODO: handle this nicely, report back etc.
+                        detail::set_error(Error::kAccessViolation);
+                        _flags._running = false;
+                        break;
+                    case STATUS_SEGMENT_NOTIFICATION:
+                        /*
+                        {SEGMENT LOAD}A VIRTUAL DOS MACHINE (VDM) IS LOADING, UNLOADING, OR MOVING AN MS-DOS OR WIN16 PROGRAM SEGMENT IMAGE.
+                        AN EXCEPTION IS RAISED SO A DEBUGGER CAN LOAD, UNLOAD OR TRACK SYMBOLS AND BREAKPOINTS WITHIN THESE 16-BIT SEGMENTS.
+                        */
+                    default:
+                        _continue_status = DBG_CONTINUE;
+                        break;
+                    }
+                }
+                break;
+                case EXIT_PROCESS_DEBUG_EVENT:
+                    _flags._running = false;
+                default:
+                    _continue_status = DBG_CONTINUE;
+                    break;
+                }
+            }
+
+            return _flags._running && stepped;
+        }
+
+        // reload the active context during Run, without touching the change tracking
+        bool refresh_context(HANDLE thread)
+        {
+            _active_ctx->ContextFlags = _ctx_flags;
+            SetXStateFeaturesMask(_active_ctx, XSTATE_MASK_AVX | XSTATE_MASK_AVX512);
+            return GetThreadContext(thread, _active_ctx) == TRUE;
+        }
+
+        uintptr_t guard_area()
+        {
+            return uintptr_t(_scratch_memory) + _scratch_reserved - kGuardAreaSize;
+        }
+
+        bool write_guard_data(uintptr_t address, const void* src, size_t size)
+        {
+            SIZE_T written;
+            return WriteProcessMemory(_process_vm, LPVOID(address), src, SIZE_T(size), &written) == TRUE && size_t(written) == size;
+        }
+
+        bool write_guard_counter(uint64_t value)
+        {
+            return write_guard_data(_guard_data, &value, sizeof(value));
+        }
+
+        // point a branch line at target, without changing the line itself
+        bool write_branch_displacement(const instruction_line_info_t& line, uintptr_t target)
+        {
+            const auto displacement = (long long)(target) - (long long)(line._address + line._instruction_size);
+            return write_code(line._address + line._instruction_size - line._branch_displacement_bytes, &displacement, line._branch_displacement_bytes);
+        }
+
+        // install the iteration guard for Run.
+        // Backward rel32 branches are redirected through thunks in the guard area that count down a shared counter and trap when it reaches zero,
+        // so that guarded loops run at (almost) full speed. rel8 branches (loop, jrcxz) can't reach a thunk; instead each gets a hardware
+        // execute breakpoint and the debugger counts them down, which limits us to four of those.
+        //NOTE: the thunks push the flags on the stack of the code under test, so rsp has to point at valid memory
+        bool install_iteration_guard(uint64_t iterationLimit)
+        {
+            _iteration_guard._thunked_lines.clear();
+            _iteration_guard._breakpoint_lines.clear();
+            for(size_t l = 0; l < _last_instruction_line; ++l)
+            {
+                const auto& line = _loaded_instructions[l];
+                // calls have pushed their return address before they get to a thunk, so we can't stop on them
+                if(!line._branch_displacement_bytes || line._call || line._branch_target_line > l)
+                    continue;
+                if(line._branch_displacement_bytes == 4)
+                    _iteration_guard._thunked_lines.push_back(l);
+                else
+                    _iteration_guard._breakpoint_lines.push_back(l);
+            }
+            if(_iteration_guard._breakpoint_lines.size() > 4)
+            {
+                detail::set_error(Error::kUnsupportedInstructionType);
+                return false;
+            }
+            if(kGuardThunkOffset + _iteration_guard._thunked_lines.size() * kGuardThunkStride > kBreakpointThunkOffset)
+            {
+                detail::set_error(Error::kCodeBufferOverflow);
+                return false;
+            }
+            if(!commit_code_range(guard_area(), kGuardAreaSize) || !write_guard_counter(iterationLimit))
+            {
+                detail::set_error(Error::kSystemError);
+                return false;
+            }
+
+            const auto counter = _guard_data;
+            for(size_t t = 0; t < _iteration_guard._thunked_lines.size(); ++t)
+            {
+                const auto& line = _loaded_instructions[_iteration_guard._thunked_lines[t]];
+                const auto thunk = guard_area() + kGuardThunkOffset + t * kGuardThunkStride;
+                const auto target = line._branch_target_line == _last_instruction_line ? code_end_address() : _loaded_instructions[line._branch_target_line]._address;
+                uint8_t code[kGuardThunkStride] = {
+                    0x9c,                          // pushfq
+                    0x48, 0xff, 0x0d, 0, 0, 0, 0,  // dec qword ptr [rip + counter]
+                    0x0f, 0x84, 6, 0, 0, 0,        // jz trip
+                    0x9d,                          // popfq
+                    0xe9, 0, 0, 0, 0,              // jmp target
+                    0x9d,                          // trip: popfq
+                    0xcc,                          // int3
+                };
+                const auto counter_rel = int32_t((long long)(counter) - (long long)(thunk + 8));
+                const auto target_rel = int32_t((long long)(target) - (long long)(thunk + 20));
+                memcpy(code + 4, &counter_rel, sizeof(counter_rel));
+                memcpy(code + 16, &target_rel, sizeof(target_rel));
+                if(!write_code(thunk, code, sizeof(code)) || !write_branch_displacement(line, thunk))
+                {
+                    detail::set_error(Error::kSystemError);
+                    return false;
+                }
+            }
+
+            for(size_t b = 0; b < _iteration_guard._breakpoint_lines.size(); ++b)
+            {
+                (&_active_ctx->Dr0)[b] = _loaded_instructions[_iteration_guard._breakpoint_lines[b]]._address;
+                // local enable, break on execution (R/W and LEN bits 0)
+                _active_ctx->Dr7 &= ~(DWORD64(0xf) << (16 + 4 * b));
+                _active_ctx->Dr7 |= DWORD64(1) << (2 * b);
+            }
+            _active_ctx->Dr6 = 0;
+            return true;
+        }
+
+        void remove_iteration_guard()
+        {
+            for(const auto l : _iteration_guard._thunked_lines)
+            {
+                const auto& line = _loaded_instructions[l];
+                const auto target = line._branch_target_line == _last_instruction_line ? code_end_address() : _loaded_instructions[line._branch_target_line]._address;
+                write_branch_displacement(line, target);
+            }
+            for(size_t b = 0; b < _iteration_guard._breakpoint_lines.size(); ++b)
+            {
+                (&_active_ctx->Dr0)[b] = 0;
+                _active_ctx->Dr7 &= ~(DWORD64(3) << (2 * b));
+            }
+            _active_ctx->Dr6 = 0;
+            _iteration_guard._thunked_lines.clear();
+            _iteration_guard._breakpoint_lines.clear();
+        }
+
+        // the debugger's half of the iteration guard, count down for a hardware breakpoint hit. Returns false if the limit has been reached
+        bool count_guard_breakpoint()
+        {
+            uint64_t remaining;
+            SIZE_T read;
+            if(!ReadProcessMemory(_process_vm, LPCVOID(_guard_data), &remaining, sizeof(remaining), &read) || !--remaining)
+                return false;
+            return write_guard_counter(remaining);
+        }
+
+        // "lhs op rhs" -> "cmp lhs, rhs" and the (inverse) jcc that skips the trap
+        bool compile_condition(const char* condition, breakpoint_t& bp)
+        {
+            static const std::pair<const char*, const char*> kOperators[] = {
+                { "==", "jne" },
+                { "!=", "je" },
+                { "<=", "ja" },
+                { ">=", "jb" },
+                { "<", "jae" },
+                { ">", "jbe" },
+            };
+            const std::string expression = condition;
+            for(const auto& op : kOperators)
+            {
+                const auto at = expression.find(op.first);
+                if(at == std::string::npos)
+                    continue;
+                const auto trim = [](std::string str) {
+                    str.erase(0, str.find_first_not_of(' '));
+                    str.erase(str.find_last_not_of(' ') + 1);
+                    return str;
+                };
+                const auto lhs = trim(expression.substr(0, at));
+                const auto rhs = trim(expression.substr(at + strlen(op.first)));
+                if(lhs.empty() || rhs.empty())
+                    return false;
+                bp._compare = "cmp " + lhs + ", " + rhs;
+                bp._skip_jcc = op.second;
+                return true;
+            }
+            return false;
+        }
+
+        // true if a branch targets line
+        bool is_branch_target(size_t line)
+        {
+            for(size_t l = 0; l < _last_instruction_line; ++l)
+            {
+                if(_loaded_instructions[l]._branch_displacement_bytes && _loaded_instructions[l]._branch_target_line == line)
+                    return true;
+            }
+            return false;
+        }
+
+        // the lines [line, end_line) a breakpoint at line moves into its thunk to make room for the jump, false if they can't be moved
+        bool displaced_lines(size_t line, size_t& end_line)
+        {
+            size_t displaced = 0;
+            end_line = line;
+            while(displaced < kBreakpointPatchSize)
+            {
+                if(end_line == _last_instruction_line)
+                    return false;
+                const auto& displaced_line = _loaded_instructions[end_line];
+                if(displaced_line._branch_displacement_bytes || displaced_line._emulated || displaced_line._fence || (end_line > line && is_branch_target(end_line)))
+                    return false;
+                displaced += displaced_line._instruction_size;
+                ++end_line;
+            }
+            return true;
+        }
+
+        // true if a breakpoint at line would move the line of another breakpoint, or is on a line another one moves
+        bool overlaps_breakpoint(size_t line)
+        {
+            size_t end_line;
+            for(const auto& breakpoint : _breakpoints)
+            {
+                if(breakpoint.first == line)
+                    continue;
+                if(breakpoint.first > line && displaced_lines(line, end_line) && breakpoint.first < end_line)
+                    return true;
+                if(breakpoint.first < line && displaced_lines(breakpoint.first, end_line) && line < end_line)
+                    return true;
+            }
+            return false;
+        }
+
+        // build the thunk for a breakpoint at line and route the line through it:
+        //
+        //  pushfq
+        //  pop [flags]
+        //  cmp lhs, rhs
+        //  j<not cc> skip
+        //  push [flags]
+        //  popfq
+        //  int3                   <- the trap
+        // skip:
+        //  push [flags]
+        //  popfq
+        //  <the displaced lines>
+        //  jmp <line after the displaced lines>
+        //
+        // The flags are kept in a slot of the guard area's data page rather than on the stack, so the condition sees rsp as the line does.
+        // (an unconditional breakpoint is just the int3.) rip is used to skip the trap if execution starts at the breakpoint
+        bool install_breakpoint(size_t line, breakpoint_t& bp, uintptr_t thunk, uintptr_t flags, uintptr_t rip)
+        {
+            size_t end_line;
+            if(!displaced_lines(line, end_line))
+                return false;
+            // we can't patch over code we're about to execute from the middle of
+            for(auto l = line + 1; l < end_line; ++l)
+            {
+                if(rip == _loaded_instructions[l]._address)
+                    return false;
+            }
+
+            uint8_t code[kBreakpointThunkStride];
+            size_t size = 0;
+            const auto append_assembled = [&code, &size, thunk](const std::string& statement) {
+                assembler::AssembledInstructionInfo info;
+                if(!assembler::Assemble(statement.c_str(), info, thunk + size) || size + info._size > sizeof(code))
+                    return false;
+                memcpy(code + size, info._instruction, info._size);
+                size += info._size;
+                return true;
+            };
+            // push/pop qword [rip + flags]
+            constexpr size_t kRipRelativeSize = 6;
+            const auto append_flags_access = [&code, &size, thunk, flags](uint8_t opcode, uint8_t modrm) {
+                code[size++] = opcode;
+                code[size++] = modrm;
+                const auto rel = int32_t((long long)(flags) - (long long)(thunk + size + sizeof(int32_t)));
+                memcpy(code + size, &rel, sizeof(rel));
+                size += sizeof(rel);
+            };
+            if(!bp._compare.empty())
+            {
+                code[size++] = 0x9c;
+                append_flags_access(0x8f, 0x05);
+                if(!append_assembled(bp._compare))
+                    return false;
+                // jcc is always rel32, see assembler::Assemble
+                constexpr size_t kJccSize = 6;
+                char skip_jcc[32];
+                sprintf_s(skip_jcc, "%s 0x%llx", bp._skip_jcc.c_str(), (unsigned long long)(thunk + size + kJccSize + kRipRelativeSize + 2));
+                if(!append_assembled(skip_jcc))
+                    return false;
+                append_flags_access(0xff, 0x35);
+                code[size++] = 0x9d;
+                bp._trap = thunk + size;
+                code[size++] = 0xcc;
+                bp._skip = thunk + size;
+                append_flags_access(0xff, 0x35);
+                code[size++] = 0x9d;
+            }
+            else
+            {
+                bp._trap = thunk + size;
+                code[size++] = 0xcc;
+                bp._skip = thunk + size;
+            }
+            for(auto l = line; l < end_line; ++l)
+            {
+                const auto& displaced_line = _loaded_instructions[l];
+                if(size + displaced_line._instruction_size + kBreakpointPatchSize > sizeof(code))
+                    return false;
+                memcpy(code + size, displaced_line._instruction_bytes, displaced_line._instruction_size);
+                if(!decoder::Relocate(code + size, displaced_line._instruction_size, displaced_line._address, thunk + size, 0, 0))
+                    return false;
+                size += displaced_line._instruction_size;
+            }
+            const auto resume = _loaded_instructions[end_line - 1]._address + _loaded_instructions[end_line - 1]._instruction_size;
+            code[size] = 0xe9;
+            const auto resume_rel = int32_t((long long)(resume) - (long long)(thunk + size + kBreakpointPatchSize));
+            memcpy(code + size + 1, &resume_rel, sizeof(resume_rel));
+            size += kBreakpointPatchSize;
+
+            const auto address = _loaded_instructions[line]._address;
+            uint8_t patch[kBreakpointPatchSize] = { 0xe9 };
+            const auto thunk_rel = int32_t((long long)(thunk) - (long long)(address + kBreakpointPatchSize));
+            memcpy(patch + 1, &thunk_rel, sizeof(thunk_rel));
+            if(!write_code(thunk, code, size) || !write_code(address, patch, sizeof(patch)))
+                return false;
+            bp._end_line = end_line;
+            return true;
+        }
+
+        // install all breakpoints for Run
+        bool install_breakpoints()
+        {
+            if(_breakpoints.empty())
+                return true;
+            if(_breakpoints.size() > (kGuardAreaSize - kBreakpointThunkOffset) / kBreakpointThunkStride || _breakpoints.size() > (kGuardDataSize - kBreakpointFlagsOffset) / sizeof(uint64_t) ||
+                !commit_code_range(guard_area(), kGuardAreaSize))
+            {
+                detail::set_error(Error::kInvalidBreakpoint);
+                return false;
+            }
+            // lines may have changed size since the breakpoints were set, so they are checked for overlaps again before anything is patched
+            for(const auto& breakpoint : _breakpoints)
+            {
+                if(breakpoint.first >= _last_instruction_line || overlaps_breakpoint(breakpoint.first))
+                {
+                    detail::set_error(Error::kInvalidBreakpoint);
+                    return false;
+                }
+            }
+            auto thunk = guard_area() + kBreakpointThunkOffset;
+            auto flags = _guard_data + kBreakpointFlagsOffset;
+            for(auto& breakpoint : _breakpoints)
+            {
+                if(!install_breakpoint(breakpoint.first, breakpoint.second, thunk, flags, _active_ctx->Rip))
+                {
+                    detail::set_error(Error::kInvalidBreakpoint);
+                    return false;
+                }
+                // execution starts at the breakpoint, so it has to be allowed to pass it once
+                if(_active_ctx->Rip == _loaded_instructions[breakpoint.first]._address)
+                    set_next_instruction_address(LPCVOID(breakpoint.second._skip));
+                thunk += kBreakpointThunkStride;
+                flags += sizeof(uint64_t);
+            }
+            return true;
+        }
+
+        // write the original lines back
+        void remove_breakpoints()
+        {
+            for(auto& breakpoint : _breakpoints)
+            {
+                auto& bp = breakpoint.second;
+                for(auto l = breakpoint.first; l < bp._end_line; ++l)
+                {
+                    const auto& line = _loaded_instructions[l];
+                    write_code(line._address, line._instruction_bytes, line._instruction_size);
+                }
+                bp._trap = bp._skip = 0;
+                bp._end_line = 0;
+            }
+        }
+
+        bool SetBreakpoint(size_t line, const char* condition)
+        {
+            if(line >= _last_instruction_line)
+            {
+                detail::set_error(Error::kInvalidAddress);
+                return false;
+            }
+            // a breakpoint's jump can't be patched over the lines another one moves into its thunk
+            if(overlaps_breakpoint(line))
+            {
+                detail::set_error(Error::kInvalidBreakpoint);
+                return false;
+            }
+            breakpoint_t bp;
+            if(condition && condition[0])
+            {
+                // check that it assembles, now rather than when we run
+                assembler::AssembledInstructionInfo info;
+                if(!compile_condition(condition, bp) || !assembler::Assemble(bp._compare.c_str(), info, _loaded_instructions[line]._address))
+                {
+                    detail::set_error(Error::kInvalidBreakpoint);
+                    return false;
+                }
+            }
+            _breakpoints[line] = std::move(bp);
+            return true;
+        }
+
+        bool ClearBreakpoint(size_t line)
+        {
+            if(!_breakpoints.erase(line))
+            {
+                detail::set_error(Error::kInvalidAddress);
+                return false;
+            }
+            return true;
+        }
+
+        // assemble the condition of a breakpoint for the interpreter; the compare at the line, followed by the skip jcc
+        bool compile_interpreted_condition(size_t line, breakpoint_t& bp)
+        {
+            bp._compare_bytes.clear();
+            bp._skip_jcc_bytes.clear();
+            if(bp._compare.empty())
+                return true;
+            const auto address = _loaded_instructions[line]._address;
+            assembler::AssembledInstructionInfo compare;
+            if(!assembler::Assemble(bp._compare.c_str(), compare, address))
+                return false;
+            bp._compare_bytes.assign(compare._instruction, compare._instruction + compare._size);
+            // any target other than the following instruction will do, we only look at whether it is taken
+            const auto jcc_address = address + compare._size;
+            char skip_jcc[32];
+            sprintf_s(skip_jcc, "%s 0x%llx", bp._skip_jcc.c_str(), (unsigned long long)(jcc_address + 0x100));
+            assembler::AssembledInstructionInfo jcc;
+            if(!assembler::Assemble(skip_jcc, jcc, jcc_address))
+                return false;
+            bp._skip_jcc_bytes.assign(jcc._instruction, jcc._instruction + jcc._size);
+            return true;
+        }
+
+        // true if the condition of a breakpoint holds for the interpreter's state, which is left unchanged
+        bool interpreted_condition(const instruction_line_info_t& line, const breakpoint_t& bp)
+        {
+            if(bp._compare_bytes.empty())
+                return true;
+            const auto flags = _emulated_state._rflags;
+            const auto next_rip = _emulated_state._next_rip;
+            const auto jcc_address = line._address + bp._compare_bytes.size();
+            const auto fall_through = jcc_address + bp._skip_jcc_bytes.size();
+            _emulated_state._next_rip = jcc_address;
+            auto result = interpreter::Execute(_emulated_state, bp._compare_bytes.data(), bp._compare_bytes.size());
+            if(result)
+            {
+                _emulated_state._next_rip = fall_through;
+                // the skip jcc is taken when the condition is false
+                result = interpreter::Execute(_emulated_state, bp._skip_jcc_bytes.data(), bp._skip_jcc_bytes.size()) && _emulated_state._next_rip == fall_through;
+            }
+            _emulated_state._rflags = flags;
+            _emulated_state._next_rip = next_rip;
+            return result;
+        }
+
+        // Run for the interpreter. The state stays in _emulated_state, where _next_rip is the address of the next line, for the duration of the run.
+        // It stops where the debuggee would; at the end of the code, a fence, a breakpoint, a fault, or when the iteration limit is reached
+        bool run_interpreted(uint64_t iterationLimit)
+        {
+            for(auto& bp : _breakpoints)
+            {
+                if(!compile_interpreted_condition(bp.first, bp.second))
+                {
+                    detail::set_error(Error::kInvalidBreakpoint);
+                    return false;
+                }
+            }
+
+            CopyContext(_prev_ctx, _ctx_flags, _active_ctx);
+            load_emulated_state(_active_ctx->Rip);
+            const auto code_end = code_end_address();
+            uint64_t iterations = 0;
+            auto result = false;
+            // a breakpoint at the line we start on doesn't stop us, just like the debuggee
+            auto first = true;
+            while(true)
+            {
+                const auto rip = _emulated_state._next_rip;
+                if(rip == code_end)
+                {
+                    result = true;
+                    break;
+                }
+                const auto line = find_line(rip);
+                if(!line)
+                {
+                    detail::set_error(Error::kInvalidAddress);
+                    break;
+                }
+                if(line->_fence)
+                {
+                    result = true;
+                    break;
+                }
+                if(!first)
+                {
+                    const auto bp = _breakpoints.find(line->_line);
+                    if(bp != _breakpoints.end() && interpreted_condition(*line, bp->second))
+                    {
+                        result = true;
+                        break;
+                    }
+                }
+                first = false;
+
+                _emulated_state._next_rip = rip + line->_instruction_size;
+                // loop and jrcxz decrement or test rcx, so we keep it to be able to back out of a branch
+                const auto rcx = _emulated_state._gpr[1];
+                if(!interpreter::Execute(_emulated_state, line->_instruction_bytes, line->_instruction_size))
+                {
+                    // left on the line, the error is set by the interpreter
+                    _emulated_state._next_rip = rip;
+                    break;
+                }
+                if(iterationLimit && line->_branch_displacement_bytes && !line->_call && _emulated_state._next_rip <= rip && ++iterations >= iterationLimit)
+                {
+                    _emulated_state._gpr[1] = rcx;
+                    _emulated_state._next_rip = rip;
+                    detail::set_error(Error::kIterationLimitReached);
+                    break;
+                }
+            }
+
+            store_emulated_state();
+            _active_ctx->Rip = _emulated_state._next_rip;
+            _code = reinterpret_cast<unsigned char*>(_active_ctx->Rip);
+            _ctx_changed = false;
+            check_register_changes();
+            return result;
+        }
+
+        bool Run(uint64_t iterationLimit)
+        {
+            if(!_flags._started)
+            {
+                detail::set_error(Error::kRuntimeUninitialised);
+                return false;
+            }
+            // anything not yet committed would not be executed
+            if(_first_instruction_line < _last_instruction_line && !CommmitInstructions())
+                return false;
+            if(_code == _code_end)
+            {
+                detail::set_error(Error::kNoMoreCode);
+                return false;
+            }
+            if(_backend == Backend::kInterpreter)
+                return run_interpreted(iterationLimit);
+
+            const auto thread = active_thread();
+            if(!thread)
+            {
+                detail::set_error(Error::kSystemError);
+                return false;
+            }
+
+            // the run is reported as a single step, i.e. changes are relative to the context we start with
+            CopyContext(_prev_ctx, _ctx_flags, _active_ctx);
+            _active_ctx->EFlags &= ~0x100;
+            if((iterationLimit && !install_iteration_guard(iterationLimit)) || !install_breakpoints())
+            {
+                remove_breakpoints();
+                remove_iteration_guard();
+                set_next_instruction_address(LPCVOID(_prev_ctx->Rip));
+                CloseHandle(thread);
+                return false;
+            }
+            SetThreadContext(thread, _active_ctx);
+            _ctx_changed = false;
+            code_barrier();
+
+            const auto code_end = code_end_address();
+            auto result = false;
+            auto done = false;
+            while(!done && _flags._running)
+            {
+                ContinueDebugEvent(_dbg_event.dwProcessId,
+                    _dbg_event.dwThreadId,
+                    _continue_status);
+
+                WaitForDebugEvent(&_dbg_event, INFINITE);
+
+                switch(_dbg_event.dwDebugEventCode)
+                {
+                case EXCEPTION_DEBUG_EVENT:
+                {
+                    _continue_status = DBG_EXCEPTION_HANDLED;
+                    const auto address = uintptr_t(_dbg_event.u.Exception.ExceptionRecord.ExceptionAddress);
+                    switch(_dbg_event.u.Exception.ExceptionRecord.ExceptionCode)
+                    {
+                    case EXCEPTION_BREAKPOINT:
+                    {
+                        refresh_context(thread);
+                        const auto thunks = guard_area() + kGuardThunkOffset;
+                        const auto breakpoint = std::find_if(_breakpoints.begin(), _breakpoints.end(), [address](const std::pair<const size_t, breakpoint_t>& bp) {
+                            return bp.second._trap == address;
+                        });
+                        const auto fence = find_line(address);
+                        if(address == code_end || (fence && fence->_fence))
+                        {
+                            // ran off the end of the code, or into a procedure
+                            set_next_instruction_address(LPCVOID(address));
+                            result = true;
+                        }
+                        else if(breakpoint != _breakpoints.end())
+                        {
+                            // the condition is true, the flags have been restored so we put the debuggee back on the line
+                            set_next_instruction_address(LPCVOID(_loaded_instructions[breakpoint->first]._address));
+                            result = true;
+                        }
+                        else if(address >= thunks && address < thunks + _iteration_guard._thunked_lines.size() * kGuardThunkStride)
+                        {
+                            // the thunk has restored the flags, so we just put the debuggee back on the branch
+                            const auto t = (address - thunks) / kGuardThunkStride;
+                            set_next_instruction_address(LPCVOID(_loaded_instructions[_iteration_guard._thunked_lines[t]]._address));
+                            detail::set_error(Error::kIterationLimitReached);
+                        }
+                        else
+                        {
+                            // an int3 in the code, we stop after it
+                            set_next_instruction_address(LPCVOID(address + 1));
+                            result = true;
+                        }
+                        done = true;
+                    }
+                    break;
                     case EXCEPTION_SINGLE_STEP:
                     {
-                        const auto thread = active_thread();
-                        if(!thread)
+                        refresh_context(thread);
+                        if(!(_active_ctx->Dr6 & 0xf))
+                            break;
+                        // one of the guarded rel8 branches
+                        _active_ctx->Dr6 = 0;
+                        if(count_guard_breakpoint())
                         {
-                            detail::set_error(Error::kSystemError);
-                            return false;
+                            // resume flag, so that the breakpoint doesn't trigger again as soon as we continue
+                            _active_ctx->EFlags |= 0x10000;
+                            SetThreadContext(thread, _active_ctx);
+                        }
+                        else
+                        {
+                            detail::set_error(Error::kIterationLimitReached);
+                            done = true;
+                        }
+                    }
+                    break;
+                    case EXCEPTION_ILLEGAL_INSTRUCTION:
+                    {
+                        const auto line = find_line(address);
+                        refresh_context(thread);
+                        if(!line || !line->_emulated)
+                        {
+                            detail::set_error(Error::kUnsupportedInstructionType);
+                            _flags._running = false;
+                        }
+                        else if(execute_emulated_line(*line))
+                        {
+                            SetThreadContext(thread, _active_ctx);
+                            _ctx_changed = false;
+                        }
+                        else
+                        {
+                            // leave the debuggee on the marker; the error is set by the emulator
+                            done = true;
                         }
+                    }
+                    break;
+                    case STATUS_ACCESS_VIOLATION:
+                        if(track_write_fault(_dbg_event.u.Exception.ExceptionRecord))
+                            break;
+                        detail::set_error(Error::kAccessViolation);
+                        _flags._running = false;
+                        break;
+                    default:
+                        _continue_status = DBG_CONTINUE;
+                        break;
+                    }
+                }
+                break;
+                case EXIT_PROCESS_DEBUG_EVENT:
+                    _flags._running = false;
+                default:
+                    _continue_status = DBG_CONTINUE;
+                    break;
+                }
+            }
 
-                        // advance the code pointer to the next instruction
-                        const auto next_instr = reinterpret_cast<unsigned char*>(_dbg_event.u.Exception.ExceptionRecord.ExceptionAddress);
-                        _code = next_instr;
+            if(_flags._running)
+            {
+                remove_breakpoints();
+                remove_iteration_guard();
+                _code = reinterpret_cast<unsigned char*>(_active_ctx->Rip);
+                check_register_changes();
+                clear_emulated_upper_state();
+                // back to single stepping
+                enable_trap_flag();
+                SetThreadContext(thread, _active_ctx);
+                _ctx_changed = false;
+            }
+            CloseHandle(thread);
+            return _flags._running && result;
+        }
 
-                        // refresh the context and re-set the trap flag
-                        if(load_context(thread))
+        bool LabelAddress(const char* name, uintptr_t& address)
+        {
+            size_t line;
+            if(!_flags._started || !name || !find_branch_target(name, line))
+            {
+                detail::set_error(Error::kUndefinedBranchTarget);
+                return false;
+            }
+            address = line == _last_instruction_line ? code_end_address() : _loaded_instructions[line]._address;
+            return true;
+        }
+
+        bool HarnessArea(size_t codeSize, harness_area_t& area)
+        {
+            if(!_flags._started)
+            {
+                detail::set_error(Error::kRuntimeUninitialised);
+                return false;
+            }
+            if(_backend == Backend::kInterpreter)
+            {
+                detail::set_error(Error::kUnsupportedByBackend);
+                return false;
+            }
+            // past the sentinel, cache line aligned
+            const auto code = (code_end_address() + 1 + 63) & ~uintptr_t(63);
+            if(code + codeSize > guard_area())
+            {
+                detail::set_error(Error::kCodeBufferOverflow);
+                return false;
+            }
+            if(!commit_code_pages(code + codeSize - uintptr_t(_scratch_memory)))
+                return false;
+            if(!commit_code_range(guard_area(), kGuardAreaSize))
+            {
+                detail::set_error(Error::kSystemError);
+                return false;
+            }
+            area._code = code;
+            area._code_size = codeSize;
+            area._data = _guard_data;
+            area._data_size = kGuardDataSize;
+            return true;
+        }
+
+        bool RelocatedMainCode(uintptr_t address, std::vector<uint8_t>& code)
+        {
+            if(!_flags._started)
+            {
+                detail::set_error(Error::kRuntimeUninitialised);
+                return false;
+            }
+            if(_first_instruction_line < _last_instruction_line && !CommmitInstructions())
+                return false;
+            size_t end_line = 0;
+            while(end_line < _last_instruction_line && !_loaded_instructions[end_line]._fence)
+                ++end_line;
+            if(!end_line)
+            {
+                detail::set_error(Error::kNoMoreCode);
+                return false;
+            }
+
+            const auto begin = _loaded_instructions[0]._address;
+            const auto end = end_line == _last_instruction_line ? code_end_address() : _loaded_instructions[end_line]._address;
+            code.clear();
+            for(size_t l = 0; l < end_line; ++l)
+            {
+                const auto& line = _loaded_instructions[l];
+                if(line._emulated)
+                {
+                    // there is nothing to trap to outside of the debugger
+                    detail::set_error(Error::kUnsupportedInstructionType);
+                    return false;
+                }
+                uint8_t bytes[kMaxAssembledInstructionSize];
+                memcpy(bytes, line._instruction_bytes, line._instruction_size);
+                const auto new_address = address + (line._address - begin);
+                // (a reference to the end of the main code moves with it)
+                if(!decoder::Relocate(bytes, line._instruction_size, line._address, new_address, begin, end + 1))
+                {
+                    detail::set_error(Error::kBranchTargetOutOfRange);
+                    return false;
+                }
+                if(line._branch_displacement_bytes)
+                {
+                    const auto target = line._branch_target_line == _last_instruction_line ? code_end_address() : _loaded_instructions[line._branch_target_line]._address;
+                    if(target < begin || target > end)
+                    {
+                        const auto displacement = (long long)(target) - (long long)(new_address + line._instruction_size);
+                        const auto limit = 1ll << (line._branch_displacement_bytes * 8 - 1);
+                        if(displacement < -limit || displacement >= limit)
                         {
-                            enable_trap_flag();
-                            SetThreadContext(thread, _active_ctx);
+                            detail::set_error(Error::kBranchTargetOutOfRange);
+                            return false;
                         }
+                        memcpy(bytes + line._instruction_size - line._branch_displacement_bytes, &displacement, line._branch_displacement_bytes);
+                    }
+                }
+                code.insert(code.end(), bytes, bytes + line._instruction_size);
+            }
+            return true;
+        }
+
+        // true if [address, address + size) is in the committed code region, or the guard data if data is true
+        bool is_harness_range(uintptr_t address, size_t size, bool data)
+        {
+            const auto scratch = uintptr_t(_scratch_memory);
+            const auto in = [address, size](uintptr_t begin, uintptr_t end) {
+                return address >= begin && address + size >= address && address + size <= end;
+            };
+            return data ? in(_guard_data, _guard_data + kGuardDataSize) : in(scratch, scratch + _scratch_size);
+        }
+
+        bool WriteHarness(uintptr_t address, const void* src, size_t size)
+        {
+            const auto data = _flags._started && is_harness_range(address, size, true);
+            if(!_flags._started || (!data && !is_harness_range(address, size, false)))
+            {
+                detail::set_error(Error::kInvalidAddress);
+                return false;
+            }
+            if(!(data ? write_guard_data(address, src, size) : write_code(address, src, size)))
+            {
+                detail::set_error(Error::kSystemError);
+                return false;
+            }
+            return true;
+        }
+
+        bool ReadHarness(uintptr_t address, void* dest, size_t size)
+        {
+            if(!_flags._started || (!is_harness_range(address, size, true) && !is_harness_range(address, size, false)))
+            {
+                detail::set_error(Error::kInvalidAddress);
+                return false;
+            }
+            SIZE_T read;
+            if(!ReadProcessMemory(_process_vm, LPCVOID(address), dest, SIZE_T(size), &read) || size_t(read) != size)
+            {
+                detail::set_error(Error::kSystemError);
+                return false;
+            }
+            return true;
+        }
+
+        bool ExecuteHarness(uintptr_t entry, uintptr_t exit, unsigned timeoutMs)
+        {
+            if(!_flags._started)
+            {
+                detail::set_error(Error::kRuntimeUninitialised);
+                return false;
+            }
+            if(_backend == Backend::kInterpreter)
+            {
+                detail::set_error(Error::kUnsupportedByBackend);
+                return false;
+            }
+            const auto thread = active_thread();
+            if(!thread)
+            {
+                detail::set_error(Error::kSystemError);
+                return false;
+            }
+
+            // the harness runs on a copy of the active context, which is put back afterwards
+            DWORD context_size = _context_size;
+            std::vector<uint8_t> buffer(context_size);
+            PCONTEXT harness_ctx = nullptr;
+            if(!InitializeContext(buffer.data(), _ctx_flags, &harness_ctx, &context_size) || !CopyContext(harness_ctx, _ctx_flags, _active_ctx))
+            {
+                CloseHandle(thread);
+                detail::set_error(Error::kSystemError);
+                return false;
+            }
+            harness_ctx->Rip = entry;
+            harness_ctx->EFlags &= ~0x100;
+            SetThreadContext(thread, harness_ctx);
+            code_barrier();
+
+            auto result = false;
+            auto done = false;
+            auto timed_out = false;
+            // false while the last wait timed out, since there is no event to continue then
+            auto pending = true;
+            const auto deadline = GetTickCount64() + timeoutMs;
+            while(!done && _flags._running)
+            {
+                if(pending)
+                {
+                    ContinueDebugEvent(_dbg_event.dwProcessId,
+                        _dbg_event.dwThreadId,
+                        _continue_status);
+                }
 
-                        CloseHandle(thread);
-                        stepped = true;
-                    }
-                    break;
+                auto wait = DWORD(INFINITE);
+                if(timeoutMs && !timed_out)
+                {
+                    const auto now = GetTickCount64();
+                    wait = DWORD(deadline > now ? deadline - now : 0);
+                }
+                pending = WaitForDebugEvent(&_dbg_event, wait) != FALSE;
+                if(!pending)
+                {
+                    // it's stuck in a loop that doesn't end, so it's sent to the exit trap (with the registers it started with) to get it back
+                    timed_out = true;
+                    harness_ctx->Rip = exit;
+                    SuspendThread(thread);
+                    SetThreadContext(thread, harness_ctx);
+                    ResumeThread(thread);
+                    continue;
+                }
+
+                switch(_dbg_event.dwDebugEventCode)
+                {
+                case EXCEPTION_DEBUG_EVENT:
+                {
+                    _continue_status = DBG_EXCEPTION_HANDLED;
+                    const auto address = uintptr_t(_dbg_event.u.Exception.ExceptionRecord.ExceptionAddress);
+                    switch(_dbg_event.u.Exception.ExceptionRecord.ExceptionCode)
+                    {
+                    case EXCEPTION_BREAKPOINT:
+                        result = address == exit && !timed_out;
+                        if(!result)
+                            detail::set_error(timed_out ? Error::kIterationLimitReached : Error::kUnsupportedInstructionType);
+                        done = true;
+                        break;
+                    case EXCEPTION_SINGLE_STEP:
+                        // a leftover trap
+                        break;
+                    case EXCEPTION_ILLEGAL_INSTRUCTION:
+                        detail::set_error(Error::kUnsupportedInstructionType);
+                        done = true;
+                        break;
                     case STATUS_ACCESS_VIOLATION:
-                        //TODO: handle this nicely, report back etc.
+                        if(track_write_fault(_dbg_event.u.Exception.ExceptionRecord))
+                            break;
                         detail::set_error(Error::kAccessViolation);
-                        _flags._running = false;
+                        done = true;
                         break;
-                    case STATUS_SEGMENT_NOTIFICATION:
-                        /*
-                        {SEGMENT LOAD}A VIRTUAL DOS MACHINE (VDM) IS LOADING, UNLOADING, OR MOVING AN MS-DOS OR WIN16 PROGRAM SEGMENT IMAGE.
-                        AN EXCEPTION IS RAISED SO A DEBUGGER CAN LOAD, UNLOAD OR TRACK SYMBOLS AND BREAKPOINTS WITHIN THESE 16-BIT SEGMENTS.
-                        */
                     default:
                         _continue_status = DBG_CONTINUE;
                         break;
@@ -701,7 +2761,119 @@ namespace inasm64
                 }
             }
 
-            return _flags._running && stepped;
+            if(_flags._running)
+            {
+                // the faulting thread might not be ours (i.e. a co-runner), but ours is put back on track either way
+                SetThreadContext(thread, _active_ctx);
+                _ctx_changed = false;
+            }
+            CloseHandle(thread);
+            return _flags._running && result;
+        }
+
+        bool RuntimeProcess(void*& process, void*& thread)
+        {
+            if(!_flags._started)
+            {
+                detail::set_error(Error::kRuntimeUninitialised);
+                return false;
+            }
+            if(_backend == Backend::kInterpreter)
+            {
+                detail::set_error(Error::kUnsupportedByBackend);
+                return false;
+            }
+            process = _processinfo.hProcess;
+            thread = _processinfo.hThread;
+            return true;
+        }
+
+        bool CommittedLines(std::vector<line_t>& lines)
+        {
+            if(!_flags._started)
+            {
+                detail::set_error(Error::kRuntimeUninitialised);
+                return false;
+            }
+            if(_first_instruction_line < _last_instruction_line && !CommmitInstructions())
+                return false;
+            lines.resize(_last_instruction_line);
+            for(size_t l = 0; l < _last_instruction_line; ++l)
+            {
+                const auto& loaded = _loaded_instructions[l];
+                auto& line = lines[l];
+                line._line = l;
+                line._address = loaded._address;
+                line._size = loaded._instruction_size;
+                memcpy(line._bytes, loaded._instruction_bytes, loaded._instruction_size);
+                line._fence = loaded._fence;
+            }
+            return true;
+        }
+
+        bool LineAt(uintptr_t address, size_t& line)
+        {
+            if(!_flags._started)
+            {
+                detail::set_error(Error::kRuntimeUninitialised);
+                return false;
+            }
+            const auto found = find_line(address);
+            if(!found || size_t(found - _loaded_instructions.data()) >= _last_instruction_line)
+            {
+                detail::set_error(Error::kInvalidAddress);
+                return false;
+            }
+            line = size_t(found - _loaded_instructions.data());
+            return true;
+        }
+
+        bool Procedures(std::vector<procedure_t>& procedures)
+        {
+            if(!_flags._started)
+            {
+                detail::set_error(Error::kRuntimeUninitialised);
+                return false;
+            }
+            procedures.clear();
+            for(const auto& name : _procedures)
+            {
+                const auto label = _labels.find(name);
+                if(label == _labels.end())
+                    continue;
+                procedure_t procedure;
+                procedure._name = name;
+                procedure._first_line = procedure._end_line = label->second;
+                // up to the next fence, or the end of the code
+                while(procedure._end_line < _last_instruction_line && !_loaded_instructions[procedure._end_line]._fence)
+                    ++procedure._end_line;
+                procedures.emplace_back(std::move(procedure));
+            }
+            std::sort(procedures.begin(), procedures.end(), [](const procedure_t& a, const procedure_t& b) { return a._first_line < b._first_line; });
+            return true;
+        }
+
+        bool GetMxcsr(uint32_t& mxcsr)
+        {
+            if(!_flags._started)
+            {
+                detail::set_error(Error::kRuntimeUninitialised);
+                return false;
+            }
+            mxcsr = _active_ctx->MxCsr;
+            return true;
+        }
+
+        bool SetMxcsr(uint32_t mxcsr)
+        {
+            if(!_flags._started)
+            {
+                detail::set_error(Error::kRuntimeUninitialised);
+                return false;
+            }
+            _active_ctx->MxCsr = DWORD(mxcsr);
+            _ctx_changed = true;
+            return true;
         }
 
         const void* InstructionPointer()
@@ -719,6 +2891,13 @@ namespace inasm64
                 detail::set_error(Error::kInvalidAddress);
                 return false;
             }
+            if(_backend == Backend::kInterpreter)
+            {
+                set_next_instruction_address(at);
+                _code = reinterpret_cast<unsigned char*>(_active_ctx->Rip);
+                _ctx_changed = false;
+                return true;
+            }
 
             const auto thread = active_thread();
             if(thread)
@@ -737,25 +2916,201 @@ namespace inasm64
 
         const void* AllocateMemory(size_t size)
         {
-            const auto handle = VirtualAllocEx(_process_vm, nullptr, SIZE_T(size), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+            return AllocateMemory(size, {});
+        }
+
+        // large- and huge page allocations require the "lock pages in memory" privilege to be enabled for *this* process
+        bool enable_lock_memory_privilege()
+        {
+            static auto enabled = false;
+            if(enabled)
+                return true;
+            HANDLE token;
+            if(!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+                return false;
+            TOKEN_PRIVILEGES privileges = { 0 };
+            privileges.PrivilegeCount = 1;
+            privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+            if(LookupPrivilegeValueA(nullptr, "SeLockMemoryPrivilege", &privileges.Privileges[0].Luid))
+            {
+                AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr);
+                // AdjustTokenPrivileges "succeeds" even if the privilege hasn't been granted to the user
+                enabled = GetLastError() == ERROR_SUCCESS;
+            }
+            CloseHandle(token);
+            return enabled;
+        }
+
+        // NUMA node the debuggee's main thread prefers
+        DWORD debuggee_numa_node()
+        {
+            PROCESSOR_NUMBER processor;
+            USHORT node;
+            if(GetThreadIdealProcessorEx(_processinfo.hThread, &processor) && GetNumaProcessorNodeEx(&processor, &node))
+                return DWORD(node);
+            return NUMA_NO_PREFERRED_NODE;
+        }
+
+        // 1GB pages can only be allocated through VirtualAlloc2, which isn't available on all versions of Windows so we look it up dynamically
+        void* allocate_huge_pages(size_t size, DWORD node)
+        {
+            using virtual_alloc_2_t = PVOID(WINAPI*)(HANDLE, PVOID, SIZE_T, ULONG, ULONG, MEM_EXTENDED_PARAMETER*, ULONG);
+            static const auto virtual_alloc_2 = reinterpret_cast<virtual_alloc_2_t>(GetProcAddress(GetModuleHandleA("kernelbase.dll"), "VirtualAlloc2"));
+            if(!virtual_alloc_2)
+                return nullptr;
+            MEM_EXTENDED_PARAMETER parameters[2] = { 0 };
+            parameters[0].Type = MemExtendedParameterAttributeFlags;
+            parameters[0].ULong64 = MEM_EXTENDED_PARAMETER_NONPAGED_HUGE;
+            parameters[1].Type = MemExtendedParameterNumaNode;
+            parameters[1].ULong = node;
+            return virtual_alloc_2(_process_vm, nullptr, SIZE_T(size), MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, parameters, node == NUMA_NO_PREFERRED_NODE ? 1 : 2);
+        }
+
+        const void* AllocateMemory(size_t size, const allocation_options_t& options)
+        {
+            using PageSize = allocation_options_t::PageSize;
+            using NumaPolicy = allocation_options_t::NumaPolicy;
+
+            SYSTEM_INFO system_info;
+            GetSystemInfo(&system_info);
+            size_t page_size = system_info.dwPageSize;
+            if(options._page_size != PageSize::kDefault)
+            {
+                if(!enable_lock_memory_privilege())
+                {
+                    detail::set_error(Error::kUnsupportedAllocationOptions);
+                    return nullptr;
+                }
+                page_size = options._page_size == PageSize::kHuge ? kHugePageSize : GetLargePageMinimum();
+            }
+            const auto alloc_size = (size + page_size - 1) & ~(page_size - 1);
+
+            ULONG highest_node = 0;
+            GetNumaHighestNodeNumber(&highest_node);
+            DWORD node = NUMA_NO_PREFERRED_NODE;
+            switch(options._numa_policy)
+            {
+            case NumaPolicy::kNone:
+                break;
+            case NumaPolicy::kLocal:
+                node = debuggee_numa_node();
+                break;
+            case NumaPolicy::kNode:
+                if(options._node > highest_node)
+                {
+                    detail::set_error(Error::kUnsupportedAllocationOptions);
+                    return nullptr;
+                }
+                node = DWORD(options._node);
+                break;
+            case NumaPolicy::kInterleave:
+                // large pages have to be reserved and committed in one go, so they can't be spread over nodes
+                if(options._page_size != PageSize::kDefault)
+                {
+                    detail::set_error(Error::kUnsupportedAllocationOptions);
+                    return nullptr;
+                }
+                break;
+            }
+
+            void* handle = nullptr;
+            switch(options._page_size)
+            {
+            case PageSize::kDefault:
+                if(options._numa_policy == NumaPolicy::kInterleave)
+                {
+                    // reserve the whole range, then commit it a stripe at a time on each node in turn, one call per stripe rather than per page
+                    const auto nodes = size_t(highest_node) + 1;
+                    handle = VirtualAllocEx(_process_vm, nullptr, SIZE_T(alloc_size), MEM_RESERVE, PAGE_READWRITE);
+                    for(size_t offset = 0, stripe = 0; handle && offset < alloc_size; offset += kInterleaveStripeSize, ++stripe)
+                    {
+                        const auto commit_size = std::min(kInterleaveStripeSize, alloc_size - offset);
+                        if(!VirtualAllocExNuma(_process_vm, reinterpret_cast<char*>(handle) + offset, SIZE_T(commit_size), MEM_COMMIT, PAGE_READWRITE, DWORD(stripe % nodes)))
+                        {
+                            VirtualFreeEx(_process_vm, handle, 0, MEM_RELEASE);
+                            handle = nullptr;
+                        }
+                    }
+                }
+                else
+                {
+                    handle = VirtualAllocExNuma(_process_vm, nullptr, SIZE_T(alloc_size), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE, node);
+                }
+                break;
+            case PageSize::kLarge:
+                handle = VirtualAllocExNuma(_process_vm, nullptr, SIZE_T(alloc_size), MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE, node);
+                break;
+            case PageSize::kHuge:
+                handle = allocate_huge_pages(alloc_size, node);
+                break;
+            }
+
             if(handle)
             {
-                _allocations[uintptr_t(handle)] = size;
+                _allocations[uintptr_t(handle)] = { size, options };
                 return handle;
             }
-            detail::set_error(Error::kSystemError);
+            detail::set_error(options._page_size == PageSize::kDefault ? Error::kSystemError : Error::kUnsupportedAllocationOptions);
             return nullptr;
         }
 
+        bool QueryAllocation(const void* handle, allocation_info_t& info)
+        {
+            const auto i = _allocations.find(uintptr_t(handle));
+            if(i == _allocations.end())
+            {
+                detail::set_error(Error::kInvalidAddress);
+                return false;
+            }
+            info._size = i->second._size;
+            info._options = i->second._options;
+            info._cache_state = i->second._cache_state;
+
+            SYSTEM_INFO system_info;
+            GetSystemInfo(&system_info);
+            info._page_size = system_info.dwPageSize;
+            info._node = -1;
+
+            PSAPI_WORKING_SET_EX_INFORMATION ws_info = { 0 };
+            ws_info.VirtualAddress = const_cast<void*>(handle);
+            if(QueryWorkingSetEx(_process_vm, &ws_info, sizeof(ws_info)) && ws_info.VirtualAttributes.Valid)
+            {
+                if(ws_info.VirtualAttributes.LargePage)
+                {
+                    //NOTE: the working set information doesn't distinguish between 2MB and 1GB pages, but a huge page request either succeeds or fails outright
+                    info._page_size = i->second._options._page_size == allocation_options_t::PageSize::kHuge ? kHugePageSize : GetLargePageMinimum();
+                }
+                info._node = int(ws_info.VirtualAttributes.Node);
+            }
+            return true;
+        }
+
         bool WriteBytes(const void* handle, const void* src, size_t length)
+        {
+            return WriteBytes(handle, 0, src, length);
+        }
+
+        bool WriteBytes(const void* handle, size_t offset, const void* src, size_t length)
         {
             const auto i = _allocations.find(uintptr_t(handle));
             if(i != _allocations.end())
             {
-                if(length <= i->second)
+                if(offset <= i->second._size && length <= i->second._size - offset)
                 {
+                    if(_tracking_writes)
+                    {
+                        const auto page_size = allocation_page_size(i->second._options);
+                        for(auto page = offset & ~(page_size - 1); page < offset + length; page += page_size)
+                        {
+                            if(!track_write(i->first, i->second, page))
+                            {
+                                detail::set_error(Error::kSystemError);
+                                return false;
+                            }
+                        }
+                    }
                     SIZE_T written;
-                    WriteProcessMemory(_process_vm, LPVOID(handle), src, length, &written);
+                    WriteProcessMemory(_process_vm, LPVOID(uintptr_t(handle) + offset), src, length, &written);
                     return written == length;
                 }
                 detail::set_error(Error::kMemoryWriteSizeMismatch);
@@ -768,7 +3123,7 @@ namespace inasm64
             const auto i = _allocations.find(uintptr_t(handle));
             if(i != _allocations.end())
             {
-                if(length <= i->second)
+                if(length <= i->second._size)
                 {
                     SIZE_T read;
                     ReadProcessMemory(_process_vm, LPVOID(handle), dest, length, &read);
@@ -779,14 +3134,124 @@ namespace inasm64
             return false;
         }
 
+        bool ReadBytes(const void* handle, size_t offset, void* dest, size_t length)
+        {
+            const auto i = _allocations.find(uintptr_t(handle));
+            if(i != _allocations.end())
+            {
+                if(offset <= i->second._size && length <= i->second._size - offset)
+                {
+                    SIZE_T read;
+                    ReadProcessMemory(_process_vm, LPVOID(uintptr_t(handle) + offset), dest, length, &read);
+                    return read == length;
+                }
+                detail::set_error(Error::kMemoryReadSizeMismatch);
+            }
+            return false;
+        }
+
         size_t AllocationSize(const void* handle)
         {
             const auto i = _allocations.find(uintptr_t(handle));
             if(i != _allocations.end())
-                return i->second;
+                return i->second._size;
             return 0;
         }
 
+        const void* FindAllocation(uintptr_t address)
+        {
+            for(const auto& allocation : _allocations)
+            {
+                if(address >= allocation.first && address < allocation.first + allocation.second._size)
+                    return reinterpret_cast<const void*>(allocation.first);
+            }
+            return nullptr;
+        }
+
+        bool FreeMemory(const void* handle)
+        {
+            const auto i = _allocations.find(uintptr_t(handle));
+            if(i == _allocations.end())
+            {
+                detail::set_error(Error::kInvalidAddress);
+                return false;
+            }
+            // with the interpreter backend _process_vm is this process, so this covers both
+            VirtualFreeEx(_process_vm, LPVOID(handle), 0, MEM_RELEASE);
+            _allocations.erase(i);
+            _written_pages.erase(std::remove_if(_written_pages.begin(), _written_pages.end(), [handle](const written_page_t& page) { return page._handle == handle; }), _written_pages.end());
+            return true;
+        }
+
+        bool SetCacheState(const void* handle, CacheState state)
+        {
+            const auto i = _allocations.find(uintptr_t(handle));
+            if(i == _allocations.end())
+            {
+                detail::set_error(Error::kInvalidAddress);
+                return false;
+            }
+            i->second._cache_state = state;
+            return true;
+        }
+
+        std::vector<buffer_cache_state_t> BufferCacheStates()
+        {
+            std::vector<buffer_cache_state_t> states;
+            for(const auto& allocation : _allocations)
+            {
+                if(allocation.second._cache_state != CacheState::kAsIs)
+                    states.push_back({ reinterpret_cast<const void*>(allocation.first), allocation.second._size, allocation.second._cache_state });
+            }
+            return states;
+        }
+
+        bool TrackWrites(bool enable)
+        {
+            if(!_flags._started)
+            {
+                detail::set_error(Error::kRuntimeUninitialised);
+                return false;
+            }
+            if(_backend == Backend::kInterpreter)
+            {
+                // the allocations are in this process, and the interpreter's writes to them would fault here
+                detail::set_error(Error::kUnsupportedByBackend);
+                return false;
+            }
+            _written_pages.clear();
+            _tracking_writes = false;
+            auto ok = true;
+            for(const auto& allocation : _allocations)
+            {
+                const auto page_size = allocation_page_size(allocation.second._options);
+                const auto protected_size = (allocation.second._size + page_size - 1) & ~(page_size - 1);
+                DWORD protection;
+                // protecting a page that is already read-only is harmless, as is unprotecting one that has been written
+                ok = VirtualProtectEx(_process_vm, LPVOID(allocation.first), SIZE_T(protected_size), enable ? PAGE_READONLY : PAGE_READWRITE, &protection) && ok;
+            }
+            if(!ok)
+            {
+                if(enable)
+                    TrackWrites(false);
+                detail::set_error(Error::kSystemError);
+                return false;
+            }
+            _tracking_writes = enable;
+            return true;
+        }
+
+        bool WrittenPages(std::vector<written_page_t>& pages)
+        {
+            if(!_tracking_writes)
+            {
+                detail::set_error(Error::kWritesNotTracked);
+                return false;
+            }
+            pages = _written_pages;
+            return true;
+        }
+
         bool SetReg(const RegisterInfo& reg, const void* data, size_t size)
         {
             assert(reg._bit_width / 8 <= size);
@@ -1041,8 +3506,22 @@ namespace inasm64
                 // just set them to 0 if not initialised
                 memset(data, 0, size);
             }
-            //TODO:
-            assert(reg._class != RegisterInfo::RegClass::kZmm);
+            if(reg._class == RegisterInfo::RegClass::kZmm || reg._class == RegisterInfo::RegClass::kOpmask)
+            {
+                // these may only exist in the emulator's state, which is refreshed from the context where the hardware has them
+                load_emulated_state(uintptr_t(_active_ctx->Rip));
+                if(reg._class == RegisterInfo::RegClass::kZmm)
+                {
+                    const auto ord = static_cast<size_t>(reg._register) - static_cast<size_t>(RegisterInfo::Register::zmm0);
+                    memcpy(data, _emulated_state._zmm[ord], std::min<size_t>(size, sizeof(_emulated_state._zmm[ord])));
+                }
+                else
+                {
+                    const auto ord = static_cast<size_t>(reg._register) - static_cast<size_t>(RegisterInfo::Register::k0);
+                    memcpy(data, _emulated_state._k + ord, std::min<size_t>(size, sizeof(_emulated_state._k[ord])));
+                }
+                return true;
+            }
 
             const uint8_t* reg_ptr = nullptr;
             switch(reg._class)
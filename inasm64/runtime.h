@@ -12,6 +12,8 @@
 
 //TODO: sort out PCH/Intellisense issues (but some are known bugs in VS)
 #include <cstdint>
+#include <string>
+#include <vector>
 
 namespace inasm64
 {
@@ -53,14 +55,51 @@ namespace inasm64
     namespace runtime
     {
         ///<summary>
-        /// start the runtime with the given memory size for assembled instructions
+        /// what executes the code
         ///</summary>
-        /// This will launch a copy of this process in suspended mode to use as a target for the runtime single stepping debuggger.
-        bool Start(size_t scratchPadSize = 8192);
+        enum class Backend
+        {
+            // a debuggee process, single stepped by the runtime's debugger
+            kDebuggee,
+            // the software interpreter (see interpreter.h), running in this process against an in-memory register file.
+            // Only general purpose, SSE and AVX2 instructions are supported and memory accesses are limited to the code, the stack and AllocateMemory blocks,
+            // but stepping doesn't involve the OS at all and no debug privileges are needed
+            kInterpreter,
+        };
+        ///<summary>
+        /// start the runtime with the given initial memory size for assembled instructions
+        ///</summary>
+        /// With Backend::kDebuggee this will launch a copy of this process in suspended mode to use as a target for the runtime single stepping debuggger.
+        /// The code region grows on demand beyond scratchPadSize, and is moved (re-encoding RIP relative instructions) if it outgrows its reservation.
+        /// Where the OS supports it (Windows 10 1703 and later) the code region is mapped read-execute in the debuggee and written through a second, writable, mapping here.
+        /// The code runs on a stack managed by the runtime (see kStackSize), with rsp 64 byte aligned at the start and after Reset.
+        /// With Backend::kInterpreter the code region is plain read-write memory in this process, the rest of the runtime API behaves the same.
+        bool Start(size_t scratchPadSize = 8192, Backend backend = Backend::kDebuggee);
+        ///<summary>
+        /// the backend the runtime was started with
+        ///</summary>
+        Backend ActiveBackend();
+        ///<summary>
+        /// size of the stack the runtime allocates for the code, available as the runtime variables "stack" (lowest address) and "stacktop"
+        ///</summary>
+        constexpr size_t kStackSize = 1ull << 20;
         ///<summary>
         /// terminate the runtime process
         ///</summary>
-        void Shutdown();
+        /// If a debuggee pool is in use and restart is true it is topped up again here, so that the cost of launching a debuggee is paid outside of the next Start.
+        /// On final teardown (restart false) the pooled debuggees are terminated instead.
+        void Shutdown(bool restart = true);
+        ///<summary>
+        /// keep count debuggees launched and waiting at their first breakpoint, so that Start only has to take one
+        ///</summary>
+        /// Debuggees are launched from the minimal stub (inasm64_stub.exe) if it is next to this executable, otherwise from this executable.
+        /// A count of 0 terminates any pooled debuggees.
+        ///NOTE: debug events are delivered to the thread that launched the debuggee, so this has to be called from the thread that calls Start and Step
+        bool WarmDebuggeePool(size_t count);
+        ///<summary>
+        /// number of debuggees currently waiting in the pool
+        ///</summary>
+        size_t DebuggeePoolSize();
         ///<summary>
         /// reset all existing code (but does not discard allocated memory)
         ///</summary>
@@ -80,7 +119,23 @@ namespace inasm64
         ///</summary>
         /// returns information about the logical line, and target address, of the instruction
         /// to commit instructions to runtime memory, call CommitInstructions
-        instruction_index_t AddInstruction(const void* bytes, size_t size);
+        /// Relative branches (including calls) can target a label, or a line (l<N>), given by branchTarget, in which case the displacement is resolved at commit time.
+        /// Without a branchTarget the encoded displacement has to point at the start of a line, or the end of the code.
+        instruction_index_t AddInstruction(const void* bytes, size_t size, const char* branchTarget = nullptr);
+        ///<summary>
+        /// label the line of the next AddInstruction, a label at the end of the code refers to the end of the code
+        ///</summary>
+        bool AddLabel(const char* name);
+        ///<summary>
+        /// start a named procedure at the next line, it ends with EndProc
+        ///</summary>
+        /// The procedure is fenced off from the code before it by an int3 line so that execution can't fall into it, Step and Run stop at the fence.
+        /// The name is a label for the first line of the procedure, so it can be called with "call name" from anywhere in the code. Procedures don't nest.
+        bool BeginProc(const char* name);
+        ///<summary>
+        /// end the current procedure
+        ///</summary>
+        bool EndProc();
         ///<summary>
         /// set the line number for the next AddInstruction
         ///</summary>
@@ -107,32 +162,282 @@ namespace inasm64
         /// Use Context() to get information about registers, the executed instruction bytes, etc.
         bool Step();
         ///<summary>
+        /// default number of loop iterations Run allows before it stops the debuggee
+        ///</summary>
+        constexpr uint64_t kDefaultIterationLimit = 1000000;
+        ///<summary>
+        /// run from the current execute address until execution leaves the end of the code, hits a breakpoint, faults, or the iteration limit is reached
+        ///</summary>
+        /// Each taken backward branch (and each execution of a backward loop/jrcxz instruction) counts as one iteration, 0 means no limit.
+        /// If the limit is reached the execute address is left at the branch, Run returns false and the error is Error::kIterationLimitReached.
+        /// Changed registers are reported relative to the context before the run, as if it was a single Step.
+        bool Run(uint64_t iterationLimit = kDefaultIterationLimit);
+        ///<summary>
+        /// set a breakpoint at a line, Run stops before the line executes if condition is true (or always, if there is no condition)
+        ///</summary>
+        /// A condition is "<operand> <op> <operand>" where the operands are anything cmp accepts and op is one of ==, !=, <, <=, >, >= (unsigned),
+        /// e.g. "rcx == 0" or "dword [rax] > 10". It is assembled into a compare-and-trap thunk that the line is routed through while Run executes,
+        /// so the condition is evaluated at native speed and the debugger is only involved when it is true.
+        /// The thunk moves the line, and any lines following it needed to make room for a jump, so those lines can't be branches, emulated, or targeted by a branch.
+        /// Breakpoints are ignored by Step.
+        bool SetBreakpoint(size_t line, const char* condition = nullptr);
+        ///<summary>
+        /// remove the breakpoint at line
+        ///</summary>
+        bool ClearBreakpoint(size_t line);
+        ///<summary>
+        /// address of a label (including procedure names), or a line (l<N>)
+        ///</summary>
+        bool LabelAddress(const char* name, uintptr_t& address);
+        ///<summary>
+        /// executable memory in the runtime process for a native harness around the code, and a page of data it can address RIP relative
+        ///</summary>
+        struct harness_area_t
+        {
+            uintptr_t _code = 0;
+            size_t _code_size = 0;
+            uintptr_t _data = 0;
+            size_t _data_size = 0;
+        };
+        ///<summary>
+        /// commit and return an area for a native harness of at least codeSize bytes, following the code
+        ///</summary>
+        /// The area is only valid until the code changes, and its data is shared with the iteration guard so it is only valid outside of Run.
+        /// Native harnesses need the debuggee, with the interpreter backend this fails with Error::kUnsupportedByBackend.
+        bool HarnessArea(size_t codeSize, harness_area_t& area);
+        ///<summary>
+        /// the main code (the lines before the first procedure) re-encoded to run at address
+        ///</summary>
+        /// Branches within the main code move with it, so a branch to the end of the main code lands at the end of the returned bytes, while calls into procedures keep their targets.
+        /// Pending instructions are committed first.
+        bool RelocatedMainCode(uintptr_t address, std::vector<uint8_t>& code);
+        ///<summary>
+        /// write to, or read from, a harness area
+        ///</summary>
+        bool WriteHarness(uintptr_t address, const void* src, size_t size);
+        bool ReadHarness(uintptr_t address, void* dest, size_t size);
+        ///<summary>
+        /// run the runtime thread natively from entry until it executes the int3 at exit
+        ///</summary>
+        /// The register context is restored afterwards, changes to memory are not. Any other threads in the runtime process run alongside the harness.
+        /// If timeoutMs isn't 0 and the harness hasn't reached exit by then, the thread is sent to exit and it fails with Error::kIterationLimitReached.
+        bool ExecuteHarness(uintptr_t entry, uintptr_t exit, unsigned timeoutMs = 0);
+        ///<summary>
+        /// handles to the runtime process and its thread, e.g. for affinity and co-runner threads
+        ///</summary>
+        bool RuntimeProcess(void*& process, void*& thread);
+        ///<summary>
         /// iterator over changed registers between last two calls to Step
         ///</summary>
         detail::changed_registers ChangedRegisters();
         ///<summary>
+        /// a committed line
+        ///</summary>
+        struct line_t
+        {
+            size_t _line = 0;
+            uintptr_t _address = 0;
+            size_t _size = 0;
+            uint8_t _bytes[kMaxAssembledInstructionSize] = { 0 };
+            // the int3 line in front of a procedure (see BeginProc)
+            bool _fence = false;
+        };
+        ///<summary>
+        /// all committed lines, in line order. Pending instructions are committed first
+        ///</summary>
+        bool CommittedLines(std::vector<line_t>& lines);
+        ///<summary>
+        /// the committed line at an address, fails with Error::kInvalidAddress if no line starts there
+        ///</summary>
+        bool LineAt(uintptr_t address, size_t& line);
+        ///<summary>
+        /// a procedure (see BeginProc), lines [_first_line, _end_line) excluding its fence
+        ///</summary>
+        struct procedure_t
+        {
+            std::string _name;
+            size_t _first_line = 0;
+            size_t _end_line = 0;
+        };
+        ///<summary>
+        /// all procedures, in line order
+        ///</summary>
+        bool Procedures(std::vector<procedure_t>& procedures);
+        ///<summary>
+        /// what the runtime publishes for profilers, see perfmap
+        ///</summary>
+        enum class PerfMap
+        {
+            kOff,
+            // a symbol per line, "inasm64::<block> l<N>"
+            kLines,
+            // a symbol per block, "inasm64::main" for the main code and "inasm64::<name>" for each procedure
+            kBlocks,
+        };
+        ///<summary>
+        /// publish the code for profilers on every commit, starting with the code added so far, and to a jitdump as well if asked for
+        ///</summary>
+        /// mapPath and jitdumpPath are set to the files written, if any. Off until set, and again after Shutdown.
+        /// The interpreter backend never runs the code natively, so with it this fails with Error::kUnsupportedByBackend.
+        bool SetPerfMap(PerfMap map, bool jitdump, std::string& mapPath, std::string& jitdumpPath);
+        ///<summary>
+        /// why publishing the code for profilers failed on the last commit, or Error::kNoError if it didn't
+        ///</summary>
+        /// CommmitInstructions succeeds regardless, the code is committed and runs, profilers just don't see the latest of it.
+        Error PerfMapError();
+        ///<summary>
+        /// MXCSR of the runtime context
+        ///</summary>
+        /// The interpreter backend keeps it in the context but doesn't honour it, see emulator::Execute.
+        bool GetMxcsr(uint32_t& mxcsr);
+        bool SetMxcsr(uint32_t mxcsr);
+        ///<summary>
         /// address of next instruction to be executed
         ///</summary>
         ///NOTE: this address is *not* in the memory space of this process, and accessing it will cause an exception
         const void* InstructionPointer();
         ///<summary>
+        /// page size and NUMA placement requested for an allocation
+        ///</summary>
+        struct allocation_options_t
+        {
+            enum class PageSize
+            {
+                // whatever the OS gives us, normally 4K
+                kDefault,
+                // 2MB large pages (requires SeLockMemoryPrivilege)
+                kLarge,
+                // 1GB huge pages (requires SeLockMemoryPrivilege and VirtualAlloc2 support)
+                kHuge,
+            };
+            enum class NumaPolicy
+            {
+                // wherever the OS puts the pages
+                kNone,
+                // the node the debuggee thread runs on
+                kLocal,
+                // a specific node, see _node
+                kNode,
+                // 64K stripes of the buffer dealt out to the nodes round-robin
+                kInterleave,
+            };
+            PageSize _page_size = PageSize::kDefault;
+            NumaPolicy _numa_policy = NumaPolicy::kNone;
+            // only used with NumaPolicy::kNode
+            unsigned _node = 0;
+        };
+        ///<summary>
+        /// the state native harnesses put an allocation's cache lines in before each timed run, see benchmark::MeasureCacheStates
+        ///</summary>
+        enum class CacheState
+        {
+            // left alone
+            kAsIs,
+            // flushed from all levels (clflushopt)
+            kCold,
+            // read, i.e. in L1 as far as it fits
+            kWarm,
+            // read and then pushed out of L1 by reading an eviction buffer twice its size
+            kL2,
+            // read and then pushed out of L2 the same way
+            kL3,
+        };
+        ///<summary>
+        /// information about the memory actually backing an allocation
+        ///</summary>
+        struct allocation_info_t
+        {
+            size_t _size = 0;
+            // page size reported by the OS for the first page of the allocation
+            size_t _page_size = 0;
+            // NUMA node of the first page, or -1 if not (yet) resident
+            int _node = -1;
+            allocation_options_t _options;
+            CacheState _cache_state = CacheState::kAsIs;
+        };
+        ///<summary>
         /// allocates a block of memory in the execution context and returns a handle to it
         ///</summary>
         ///NOTE: use WriteBytes/ReadBytes to access, the handle itself is not usable
         const void* AllocateMemory(size_t);
         ///<summary>
+        /// allocates a block of memory in the execution context with the given page size and NUMA placement
+        ///</summary>
+        /// the size is rounded up to a whole number of the requested pages
+        const void* AllocateMemory(size_t size, const allocation_options_t& options);
+        ///<summary>
+        /// query the page size and NUMA node backing an allocation
+        ///</summary>
+        bool QueryAllocation(const void* handle, allocation_info_t& info);
+        ///<summary>
         /// write length bytes from src into the memory location managed by handle
         ///</summary>
         bool WriteBytes(const void* handle, const void* src, size_t length);
         ///<summary>
+        /// write length bytes from src at offset into the memory location managed by handle
+        ///</summary>
+        bool WriteBytes(const void* handle, size_t offset, const void* src, size_t length);
+        ///<summary>
         /// read length bytes into dest into the memory location managed by handle
         ///</summary>
         bool ReadBytes(const void* handle, void* dest, size_t length);
         ///<summary>
+        /// read length bytes at offset into dest from the memory location managed by handle
+        ///</summary>
+        bool ReadBytes(const void* handle, size_t offset, void* dest, size_t length);
+        ///<summary>
         /// returns the size of the given allocation, or 0 if not found
         ///</summary>
         size_t AllocationSize(const void* handle);
         ///<summary>
+        /// returns the handle of the allocation containing address, or nullptr if there isn't one
+        ///</summary>
+        const void* FindAllocation(uintptr_t address);
+        ///<summary>
+        /// release an allocation, the handle is invalid afterwards
+        ///</summary>
+        bool FreeMemory(const void* handle);
+        ///<summary>
+        /// set the cache state of an allocation
+        ///</summary>
+        bool SetCacheState(const void* handle, CacheState state);
+        ///<summary>
+        /// an allocation with a cache state other than CacheState::kAsIs
+        ///</summary>
+        struct buffer_cache_state_t
+        {
+            const void* _handle = nullptr;
+            size_t _size = 0;
+            CacheState _state = CacheState::kAsIs;
+        };
+        ///<summary>
+        /// all allocations with a cache state other than CacheState::kAsIs
+        ///</summary>
+        std::vector<buffer_cache_state_t> BufferCacheStates();
+        ///<summary>
+        /// a page of an allocation written to while tracking writes, and what it held before the first write
+        ///</summary>
+        struct written_page_t
+        {
+            const void* _handle = nullptr;
+            size_t _offset = 0;
+            // the page size of the allocation, or less for its last page
+            std::vector<uint8_t> _original;
+        };
+        ///<summary>
+        /// start (or restart) tracking writes to the allocations, or stop tracking them
+        ///</summary>
+        /// The allocations are made read-only in the debuggee, so the first write to a page faults, the debugger keeps a copy of the page and makes it writable again,
+        /// and the write goes ahead. Tracking costs a fault and a page copy per page written, whatever the size of the allocations.
+        /// WriteBytes is tracked the same way, allocations made while tracking aren't tracked, and stopping discards the pages.
+        /// With the interpreter backend this fails with Error::kUnsupportedByBackend.
+        bool TrackWrites(bool enable);
+        ///<summary>
+        /// pages written since TrackWrites(true), sorted by address
+        ///</summary>
+        /// Fails with Error::kWritesNotTracked if writes aren't being tracked.
+        bool WrittenPages(std::vector<written_page_t>& pages);
+        ///<summary>
         /// set the value of the given register in the runtime context
         ///</summary>
         bool SetReg(const RegisterInfo& reg, const void* data, size_t size);
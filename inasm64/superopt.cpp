@@ -0,0 +1,563 @@
+// MIT License
+// Copyright 2019 Jarl Ostensen
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+// ===================================================================================================================
+// Superoptimiser; candidates are assembled from the iclass table and tested with the interpreter on worker threads
+
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_set>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+#include "common.h"
+#include "x64.h"
+#include "runtime.h"
+#include "emulator.h"
+#include "interpreter.h"
+#include "decoder.h"
+#include "assembler.h"
+#include "xed_iclass_instruction_set.h"
+#include "superopt.h"
+
+namespace inasm64
+{
+    namespace superopt
+    {
+        namespace
+        {
+            constexpr uint8_t kRsp = 4;
+            constexpr uint64_t kArithmeticFlags = 0x8d5;
+            // the body a search starts from
+            constexpr size_t kMaxTargetLength = 8;
+            // every candidate is tested against the first vectors, and one that passes them against the rest
+            constexpr size_t kVectors = 16;
+            constexpr size_t kConfirmVectors = 1024;
+            // passing candidates kept by each worker before ranking
+            constexpr size_t kMaxKept = 4096;
+
+            const char* kGpr64[16] = { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15" };
+            const char* kGpr32[16] = { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi", "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d" };
+            const char* kGpr16[16] = { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di", "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w" };
+            const char* kGpr8[16] = { "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil", "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b" };
+
+            enum class Operand
+            {
+                kR64,
+                kR32,
+                kR16,
+                kR8,
+                kImmediate,
+                kCl,
+                // the address operand of lea
+                kAddress,
+            };
+            // operand shapes tried for every iclass, the ones an iclass assembles with are expanded over all the operands
+            const std::vector<std::vector<Operand>> kForms = {
+                {},
+                { Operand::kR64 },
+                { Operand::kR32 },
+                { Operand::kR8 },
+                { Operand::kR64, Operand::kR64 },
+                { Operand::kR32, Operand::kR32 },
+                { Operand::kR64, Operand::kImmediate },
+                { Operand::kR32, Operand::kImmediate },
+                { Operand::kR64, Operand::kCl },
+                { Operand::kR32, Operand::kCl },
+                { Operand::kR64, Operand::kR64, Operand::kImmediate },
+                { Operand::kR32, Operand::kR32, Operand::kImmediate },
+                { Operand::kR64, Operand::kR32 },
+                { Operand::kR64, Operand::kR16 },
+                { Operand::kR32, Operand::kR16 },
+                { Operand::kR64, Operand::kR8 },
+                { Operand::kR32, Operand::kR8 },
+                { Operand::kR64, Operand::kAddress },
+                { Operand::kR32, Operand::kAddress },
+            };
+
+            struct instruction_t
+            {
+                uint8_t _bytes[kMaxAssembledInstructionSize] = { 0 };
+                size_t _size = 0;
+                std::string _text;
+                cost_t _cost;
+            };
+
+            // all the state a general purpose instruction can change
+            struct state_t
+            {
+                uint64_t _gpr[16] = { 0 };
+                uint64_t _rflags = 0;
+
+                void load(emulator::ExecutionContext& ctx) const
+                {
+                    memcpy(ctx._gpr, _gpr, sizeof(_gpr));
+                    ctx._rflags = _rflags;
+                }
+                void store(const emulator::ExecutionContext& ctx)
+                {
+                    memcpy(_gpr, ctx._gpr, sizeof(_gpr));
+                    _rflags = ctx._rflags;
+                }
+            };
+
+            bool same(const state_t& a, const state_t& b, bool flags)
+            {
+                for(uint8_t gpr = 0; gpr < 16; ++gpr)
+                {
+                    if(gpr != kRsp && a._gpr[gpr] != b._gpr[gpr])
+                        return false;
+                }
+                return !flags || !((a._rflags ^ b._rflags) & kArithmeticFlags);
+            }
+
+            bool cheaper(const cost_t& a, const cost_t& b)
+            {
+                return a._latency < b._latency || (a._latency == b._latency && a._size < b._size);
+            }
+
+            cost_t add(cost_t a, const cost_t& b)
+            {
+                a._latency += b._latency;
+                a._size += b._size;
+                return a;
+            }
+
+            // Skylake latencies (from the optimization reference manual) of the interpreted instructions that take more than a cycle, given the Intel syntax text
+            unsigned latency(const std::string& text)
+            {
+                static const std::pair<const char*, unsigned> kLatencies[] = {
+                    { "imul", 3 }, { "mul", 3 }, { "div", 26 }, { "idiv", 26 }, { "popcnt", 3 }, { "lzcnt", 3 }, { "tzcnt", 3 }, { "bsf", 3 }, { "bsr", 3 }, { "xchg", 2 }, { "bswap", 2 }
+                };
+                const auto mnemonic = text.substr(0, text.find(' '));
+                for(const auto& entry : kLatencies)
+                {
+                    if(mnemonic == entry.first)
+                        return entry.second;
+                }
+                const auto address = text.find('[');
+                if(mnemonic == "lea" && address != std::string::npos)
+                {
+                    // base, index, and displacement
+                    const auto terms = std::count(text.begin() + address, text.end(), '+') + std::count(text.begin() + address, text.end(), '-');
+                    return terms >= 2 ? 3 : 1;
+                }
+                const auto by_cl = text.size() > 4 && text.compare(text.size() - 4, 4, ", cl") == 0;
+                if(by_cl && (mnemonic == "shl" || mnemonic == "shr" || mnemonic == "sar" || mnemonic == "rol" || mnemonic == "ror"))
+                    return 2;
+                return 1;
+            }
+
+            bool disassemble(instruction_t& instruction)
+            {
+                char text[128];
+                if(!decoder::Disassemble(instruction._bytes, instruction._size, 0, text, sizeof(text)))
+                    return false;
+                instruction._text = text;
+                instruction._cost = { latency(instruction._text), instruction._size };
+                return true;
+            }
+
+            // a general purpose instruction without branches or memory accesses, that the CPU supports and the interpreter executes
+            bool usable(const uint8_t* bytes, size_t size, decoder::GprOperandsInfo& operands)
+            {
+                const auto info = decoder::Decode(bytes, size);
+                return info._supported && info._class == decoder::InstructionInfo::InstructionClass::kUnknown && interpreter::CanInterpret(bytes, size) &&
+                       decoder::DecodeGprOperands(bytes, size, operands) && !operands._memory;
+            }
+
+            // the immediates the body uses, from the disassembly
+            void add_immediates(const std::string& text, std::vector<int64_t>& immediates)
+            {
+                for(auto at = text.find("0x"); at != std::string::npos; at = text.find("0x", at + 2))
+                {
+                    const auto value = int64_t(strtoull(text.c_str() + at + 2, nullptr, 16));
+                    if(std::find(immediates.begin(), immediates.end(), value) == immediates.end())
+                        immediates.push_back(value);
+                }
+            }
+
+            std::string displacement(int64_t value)
+            {
+                return (value < 0 ? "-" : "+") + std::to_string(value < 0 ? -value : value);
+            }
+
+            // the address operands lea is tried with
+            std::vector<std::string> addresses(const std::vector<uint8_t>& registers, const std::vector<int64_t>& displacements)
+            {
+                std::vector<std::string> result;
+                for(auto base : registers)
+                {
+                    for(auto disp : displacements)
+                        result.push_back(std::string("[") + kGpr64[base] + displacement(disp) + "]");
+                    for(auto index : registers)
+                    {
+                        for(auto scale : { 1, 2, 4, 8 })
+                        {
+                            const auto base_index = std::string("[") + kGpr64[base] + "+" + kGpr64[index] + "*" + std::to_string(scale);
+                            result.push_back(base_index + "]");
+                            for(auto disp : displacements)
+                                result.push_back(base_index + displacement(disp) + "]");
+                        }
+                    }
+                }
+                for(auto index : registers)
+                {
+                    for(auto scale : { 2, 4, 8 })
+                    {
+                        const auto scaled = std::string("[") + kGpr64[index] + "*" + std::to_string(scale);
+                        result.push_back(scaled + "]");
+                        for(auto disp : displacements)
+                            result.push_back(scaled + displacement(disp) + "]");
+                    }
+                }
+                return result;
+            }
+
+            // the texts of an operand kind
+            std::vector<std::string> operand_texts(Operand operand, const std::vector<uint8_t>& registers, const std::vector<int64_t>& immediates, const std::vector<std::string>& address_texts)
+            {
+                std::vector<std::string> texts;
+                switch(operand)
+                {
+                case Operand::kR64:
+                case Operand::kR32:
+                case Operand::kR16:
+                case Operand::kR8:
+                {
+                    const auto names = operand == Operand::kR64 ? kGpr64 : (operand == Operand::kR32 ? kGpr32 : (operand == Operand::kR16 ? kGpr16 : kGpr8));
+                    for(auto reg : registers)
+                        texts.push_back(names[reg]);
+                }
+                break;
+                case Operand::kImmediate:
+                    for(auto value : immediates)
+                    {
+                        char text[24];
+                        if(value < 0)
+                            snprintf(text, sizeof(text), "%lld", (long long)value);
+                        else
+                            snprintf(text, sizeof(text), "0x%llx", (unsigned long long)value);
+                        texts.push_back(text);
+                    }
+                    break;
+                case Operand::kCl:
+                    texts.push_back("cl");
+                    break;
+                case Operand::kAddress:
+                    texts = address_texts;
+                    break;
+                }
+                return texts;
+            }
+
+            // every instruction the search can use: each iclass with each operand form it assembles with, expanded over the body's registers and the immediates
+            std::vector<instruction_t> build_pool(uint16_t registerMask, const std::vector<int64_t>& immediates, bool flags)
+            {
+                std::vector<uint8_t> registers;
+                for(uint8_t reg = 0; reg < 16; ++reg)
+                {
+                    if(registerMask & (1u << reg))
+                        registers.push_back(reg);
+                }
+                std::vector<int64_t> displacements = { 1, -1 };
+                for(auto value : immediates)
+                {
+                    if(value > 1 && value < 0x80000000ll)
+                        displacements.push_back(value);
+                }
+                const auto address_texts = addresses(registers, displacements);
+                // rax, rcx, and rdx for the probes
+                const std::vector<uint8_t> probe_registers = { 0, 1, 2 };
+                const std::vector<int64_t> probe_immediates = { 1 };
+                const std::vector<std::string> probe_addresses = { "[rcx+rdx*2+1]" };
+
+                std::vector<instruction_t> pool;
+                std::unordered_set<std::string> encodings;
+                for(const auto name : xed_instruction_table)
+                {
+                    // lock and rep variants
+                    if(strchr(name, '_'))
+                        continue;
+                    // a divide costs more than anything it could replace, and faults on many of the edge values the inputs favour (see random_input)
+                    if(strcmp(name, "div") == 0 || strcmp(name, "idiv") == 0)
+                        continue;
+                    for(const auto& form : kForms)
+                    {
+                        // probe the form with a single set of operands before expanding it
+                        auto probe = std::string(name);
+                        for(size_t n = 0; n < form.size(); ++n)
+                            probe += (n ? ", " : " ") + operand_texts(form[n], { probe_registers[n] }, probe_immediates, probe_addresses)[0];
+                        assembler::AssembledInstructionInfo info;
+                        decoder::GprOperandsInfo operands;
+                        if(!assembler::Assemble(probe.c_str(), info, 0) || !usable(info._instruction, info._size, operands))
+                            continue;
+
+                        std::vector<std::string> texts = { name };
+                        for(size_t n = 0; n < form.size(); ++n)
+                        {
+                            std::vector<std::string> expanded;
+                            for(const auto& text : texts)
+                            {
+                                for(const auto& operand : operand_texts(form[n], registers, immediates, address_texts))
+                                    expanded.push_back(text + (n ? ", " : " ") + operand);
+                            }
+                            texts.swap(expanded);
+                        }
+                        for(const auto& text : texts)
+                        {
+                            assembler::AssembledInstructionInfo assembled;
+                            if(!assembler::Assemble(text.c_str(), assembled, 0) || !usable(assembled._instruction, assembled._size, operands))
+                                continue;
+                            // only the body's registers, and it has to change something
+                            if(((operands._read | operands._written) & ~registerMask) || !(operands._written || (flags && operands._writes_flags)))
+                                continue;
+                            const auto encoding = std::string(reinterpret_cast<const char*>(assembled._instruction), assembled._size);
+                            if(!encodings.insert(encoding).second)
+                                continue;
+                            instruction_t instruction;
+                            memcpy(instruction._bytes, assembled._instruction, assembled._size);
+                            instruction._size = assembled._size;
+                            if(disassemble(instruction))
+                                pool.push_back(std::move(instruction));
+                        }
+                    }
+                }
+                return pool;
+            }
+
+            // an input value with a good chance of being small or an edge case
+            uint64_t random_input(std::mt19937_64& random)
+            {
+                static const uint64_t kEdges[] = { 0, 1, ~0ull, 0x8000000000000000ull, 0x7fffffffffffffffull, 0xffffffffull, 0x80000000ull };
+                switch(random() & 3)
+                {
+                case 0:
+                    return random() & 0xff;
+                case 1:
+                    return kEdges[random() % (sizeof(kEdges) / sizeof(kEdges[0]))];
+                default:
+                    return random();
+                }
+            }
+
+            // depth first search over sequences for one worker thread, pruned by cost and tested against the first vector as each instruction is added
+            struct searcher_t
+            {
+                const std::vector<instruction_t>& _pool;
+                const std::vector<state_t>& _inputs;
+                const std::vector<state_t>& _outputs;
+                cost_t _target_cost;
+                unsigned _max_length = 0;
+                bool _flags = false;
+
+                emulator::ExecutionContext _ctx;
+                std::vector<size_t> _sequence;
+                uint64_t _tested = 0;
+                std::vector<std::vector<size_t>> _found;
+
+                searcher_t(const std::vector<instruction_t>& pool, const std::vector<state_t>& inputs, const std::vector<state_t>& outputs)
+                    : _pool{ pool }
+                    , _inputs{ inputs }
+                    , _outputs{ outputs }
+                {
+                    _ctx._read_memory = [](uintptr_t, void*, size_t) { return false; };
+                    _ctx._write_memory = [](uintptr_t, const void*, size_t) { return false; };
+                }
+
+                bool execute(const instruction_t& instruction)
+                {
+                    _ctx._next_rip = 0;
+                    return interpreter::Execute(_ctx, instruction._bytes, instruction._size);
+                }
+
+                // the whole sequence against the rest of the vectors
+                bool passes()
+                {
+                    for(size_t vector = 1; vector < _inputs.size(); ++vector)
+                    {
+                        _inputs[vector].load(_ctx);
+                        for(auto index : _sequence)
+                        {
+                            if(!execute(_pool[index]))
+                                return false;
+                        }
+                        state_t output;
+                        output.store(_ctx);
+                        if(!same(output, _outputs[vector], _flags))
+                            return false;
+                    }
+                    return true;
+                }
+
+                void extend(size_t index, const state_t& state, const cost_t& cost)
+                {
+                    const auto& instruction = _pool[index];
+                    const auto total = add(cost, instruction._cost);
+                    // costs only go up from here
+                    if(!cheaper(total, _target_cost))
+                        return;
+                    state.load(_ctx);
+                    if(!execute(instruction))
+                        return;
+                    ++_tested;
+                    state_t after;
+                    after.store(_ctx);
+                    _sequence.push_back(index);
+                    if(same(after, _outputs[0], _flags) && _found.size() < kMaxKept && passes())
+                        _found.push_back(_sequence);
+                    if(_sequence.size() < _max_length)
+                    {
+                        for(size_t next = 0; next < _pool.size(); ++next)
+                            extend(next, after, total);
+                    }
+                    _sequence.pop_back();
+                }
+            };
+        }  // namespace
+
+        bool Search(const char* procedure, const options_t& options, search_t& result)
+        {
+            if(!options._max_length || options._max_length > kMaxLength)
+            {
+                detail::set_error(Error::kInvalidCommandFormat);
+                return false;
+            }
+            const auto start = std::chrono::steady_clock::now();
+            uintptr_t address;
+            std::vector<runtime::line_t> lines;
+            if(!runtime::LabelAddress(procedure, address) || !runtime::CommittedLines(lines))
+                return false;
+            auto line = std::find_if(lines.begin(), lines.end(), [address](const runtime::line_t& l) { return l._address == address; });
+
+            // the body, up to the ret
+            result = {};
+            std::vector<instruction_t> target;
+            uint16_t registers = 0;
+            std::vector<int64_t> immediates = { 1, 2, 3, 4, 8, -1 };
+            for(; line != lines.end() && !line->_fence; ++line)
+            {
+                instruction_t instruction;
+                memcpy(instruction._bytes, line->_bytes, line->_size);
+                instruction._size = line->_size;
+                if(!disassemble(instruction))
+                {
+                    detail::set_error(Error::kInvalidInstructionFormat);
+                    return false;
+                }
+                if(instruction._text.compare(0, 3, "ret") == 0)
+                    break;
+                decoder::GprOperandsInfo operands;
+                if(!usable(instruction._bytes, instruction._size, operands) || ((operands._read | operands._written) & (1u << kRsp)))
+                {
+                    detail::set_error(Error::kUnsupportedInstructionType);
+                    return false;
+                }
+                registers |= operands._read | operands._written;
+                add_immediates(instruction._text, immediates);
+                result._target.push_back(instruction._text);
+                result._target_cost = add(result._target_cost, instruction._cost);
+                target.push_back(std::move(instruction));
+            }
+            if(target.empty() || target.size() > kMaxTargetLength)
+            {
+                detail::set_error(Error::kInvalidProcedure);
+                return false;
+            }
+
+            // the test vectors, and what the body makes of them. Inputs the body faults on (i.e. a divide by 0) are skipped
+            std::mt19937_64 random(0x696e61736d3634);
+            std::vector<state_t> inputs, outputs;
+            emulator::ExecutionContext ctx;
+            ctx._read_memory = [](uintptr_t, void*, size_t) { return false; };
+            ctx._write_memory = [](uintptr_t, const void*, size_t) { return false; };
+            for(size_t attempt = 0; inputs.size() < kVectors + kConfirmVectors && attempt < 4 * (kVectors + kConfirmVectors); ++attempt)
+            {
+                state_t input;
+                for(uint8_t gpr = 0; gpr < 16; ++gpr)
+                    input._gpr[gpr] = gpr == kRsp ? 0 : random_input(random);
+                input._rflags = 0x202 | (random() & kArithmeticFlags);
+                input.load(ctx);
+                auto executed = true;
+                for(const auto& instruction : target)
+                {
+                    ctx._next_rip = 0;
+                    executed = executed && interpreter::Execute(ctx, instruction._bytes, instruction._size);
+                }
+                if(!executed)
+                    continue;
+                state_t output;
+                output.store(ctx);
+                inputs.push_back(input);
+                outputs.push_back(output);
+            }
+            // too few inputs the reference runs on to tell candidates apart
+            if(inputs.size() < kVectors)
+            {
+                detail::set_error(Error::kUnsupportedInstructionType);
+                return false;
+            }
+
+            const auto pool = build_pool(registers, immediates, options._flags);
+            result._pool = pool.size();
+            auto threads = options._max_threads ? options._max_threads : (std::max)(1u, std::thread::hardware_concurrency());
+            threads = unsigned((std::min)(size_t(threads), (std::max)(size_t(1), pool.size())));
+            result._threads = threads;
+
+            // workers take the first instruction of the sequences they search from a shared counter
+            std::atomic<size_t> next_first{ 0 };
+            std::vector<std::unique_ptr<searcher_t>> searchers;
+            std::vector<std::thread> workers;
+            for(unsigned n = 0; n < threads; ++n)
+            {
+                searchers.emplace_back(std::make_unique<searcher_t>(pool, inputs, outputs));
+                auto& searcher = *searchers.back();
+                searcher._target_cost = result._target_cost;
+                searcher._max_length = options._max_length;
+                searcher._flags = options._flags;
+                workers.emplace_back([&searcher, &next_first, &inputs, &pool]() {
+                    for(auto first = next_first++; first < pool.size(); first = next_first++)
+                        searcher.extend(first, inputs[0], {});
+                });
+            }
+            for(auto& worker : workers)
+                worker.join();
+
+            for(const auto& searcher : searchers)
+            {
+                result._tested += searcher->_tested;
+                for(const auto& sequence : searcher->_found)
+                {
+                    candidate_t candidate;
+                    for(auto index : sequence)
+                    {
+                        candidate._instructions.push_back(pool[index]._text);
+                        candidate._cost = add(candidate._cost, pool[index]._cost);
+                    }
+                    result._candidates.push_back(std::move(candidate));
+                }
+            }
+            std::stable_sort(result._candidates.begin(), result._candidates.end(), [](const candidate_t& a, const candidate_t& b) {
+                return cheaper(a._cost, b._cost) || (!cheaper(b._cost, a._cost) && a._instructions.size() < b._instructions.size());
+            });
+            if(result._candidates.size() > options._max_results)
+                result._candidates.resize(options._max_results);
+            result._ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            return true;
+        }
+    }  // namespace superopt
+}  // namespace inasm64
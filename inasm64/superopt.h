@@ -0,0 +1,83 @@
+// MIT License
+// Copyright 2019 Jarl Ostensen
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace inasm64
+{
+    ///<summary>
+    /// a bounded superoptimiser, searching for cheaper instruction sequences that compute the same as a short block of general purpose code
+    ///</summary>
+    /// Candidates are built from the XED iclass table (see xed_instruction_table), limited to what the interpreter executes and the CPU supports (less div and idiv),
+    /// and tested with the interpreter against randomised inputs. Passing the tests makes a candidate likely, not certain, to be equivalent;
+    /// check it natively with benchmark::Verify before using it.
+    namespace superopt
+    {
+        ///<summary>
+        /// longest candidate sequence searched for
+        ///</summary>
+        constexpr unsigned kMaxLength = 3;
+        ///<summary>
+        /// what Search looks for
+        ///</summary>
+        struct options_t
+        {
+            // candidates of 1.._max_length instructions
+            unsigned _max_length = 2;
+            // the arithmetic flags are outputs as well, otherwise they are assumed to be dead after the block
+            bool _flags = false;
+            size_t _max_results = 10;
+            // 0 means one per logical processor
+            unsigned _max_threads = 0;
+        };
+        ///<summary>
+        /// cost of a sequence, latencies are summed as if each instruction depends on the one before it
+        ///</summary>
+        struct cost_t
+        {
+            unsigned _latency = 0;
+            size_t _size = 0;
+        };
+        ///<summary>
+        /// a sequence that passed all the tests
+        ///</summary>
+        struct candidate_t
+        {
+            std::vector<std::string> _instructions;
+            cost_t _cost;
+        };
+        ///<summary>
+        /// result of Search
+        ///</summary>
+        struct search_t
+        {
+            std::vector<std::string> _target;
+            cost_t _target_cost;
+            // instructions candidates are built from, and the sequences executed
+            size_t _pool = 0;
+            uint64_t _tested = 0;
+            unsigned _threads = 0;
+            double _ms = 0;
+            // cheapest first
+            std::vector<candidate_t> _candidates;
+        };
+        ///<summary>
+        /// search for sequences cheaper than the body of a procedure (see runtime::BeginProc), up to its ret
+        ///</summary>
+        /// The body must be a few general purpose instructions the interpreter executes, without branches, memory operands, or rsp.
+        /// Its outputs are all the general purpose registers (and optionally the flags), so a candidate may only change the registers the body changes.
+        /// Operands are the registers the body uses, small immediates and the body's own immediates. Only sequences strictly cheaper than the body,
+        /// by latency and then by size, are tested, and the search is spread over all logical processors.
+        bool Search(const char* procedure, const options_t& options, search_t& result);
+    }  // namespace superopt
+}  // namespace inasm64
@@ -0,0 +1,347 @@
+// MIT License
+// Copyright 2019 Jarl Ostensen
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+// ===================================================================================================================
+// Autotuner; variants of a template are expanded and assembled on worker threads and timed natively by benchmark::TimeVariants
+
+#include <cstring>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+
+#include "common.h"
+#include "x64.h"
+#include "runtime.h"
+#include "decoder.h"
+#include "assembler.h"
+#include "benchmark.h"
+#include "tune.h"
+
+namespace inasm64
+{
+    namespace tune
+    {
+        namespace
+        {
+            // repetitions of a single .rep
+            constexpr int64_t kMaxRepeat = 1024;
+
+            std::vector<std::string> _template;
+
+            const char* skip_blanks(const char* at)
+            {
+                while(at[0] == ' ' || at[0] == '\t')
+                    ++at;
+                return at;
+            }
+
+            // the directive a line starts with, if it's .rep or .endr
+            bool is_directive(const std::string& line, const char* directive)
+            {
+                const auto at = skip_blanks(line.c_str());
+                const auto length = strlen(directive);
+                return _strnicmp(at, directive, length) == 0 && (!at[length] || at[length] == ' ' || at[length] == '\t');
+            }
+
+            // terms (parameters, numbers, and #) combined with + - and *, where * binds tighter
+            bool evaluate(const std::string& expression, const std::vector<parameter_t>& grid, const std::vector<int64_t>& values, const std::vector<int64_t>& indices, int64_t& value)
+            {
+                auto at = skip_blanks(expression.c_str());
+                int64_t sum = 0;
+                int64_t product = 1;
+                auto sign = 1ll;
+                if(at[0] == '-')
+                {
+                    sign = -1;
+                    at = skip_blanks(at + 1);
+                }
+                while(true)
+                {
+                    int64_t term;
+                    if(at[0] == '#')
+                    {
+                        if(indices.empty())
+                            return false;
+                        term = indices.back();
+                        ++at;
+                    }
+                    else if(isdigit(int(at[0])))
+                    {
+                        char* end;
+                        term = int64_t(::strtoll(at, &end, 0));
+                        at = end;
+                    }
+                    else if(isalpha(int(at[0])) || at[0] == '_')
+                    {
+                        auto end = at;
+                        while(isalnum(int(end[0])) || end[0] == '_')
+                            ++end;
+                        const std::string name(at, end);
+                        const auto parameter = std::find_if(grid.begin(), grid.end(), [&name](const parameter_t& p) { return _stricmp(p._name.c_str(), name.c_str()) == 0; });
+                        if(parameter == grid.end())
+                            return false;
+                        term = values[parameter - grid.begin()];
+                        at = end;
+                    }
+                    else
+                        return false;
+
+                    product *= term;
+                    at = skip_blanks(at);
+                    if(at[0] == '*')
+                    {
+                        at = skip_blanks(at + 1);
+                        continue;
+                    }
+                    sum += sign * product;
+                    product = 1;
+                    if(!at[0])
+                        break;
+                    if(at[0] != '+' && at[0] != '-')
+                        return false;
+                    sign = at[0] == '-' ? -1 : 1;
+                    at = skip_blanks(at + 1);
+                }
+                value = sum;
+                return true;
+            }
+
+            // the line with every placeholder replaced by its value, in decimal
+            bool substitute(const std::string& line, const std::vector<parameter_t>& grid, const std::vector<int64_t>& values, const std::vector<int64_t>& indices, std::string& substituted)
+            {
+                substituted.clear();
+                size_t at = 0;
+                while(true)
+                {
+                    const auto open = line.find("{{", at);
+                    if(open == std::string::npos)
+                        break;
+                    const auto close = line.find("}}", open + 2);
+                    int64_t value;
+                    if(close == std::string::npos || !evaluate(line.substr(open + 2, close - open - 2), grid, values, indices, value))
+                        return false;
+                    substituted.append(line, at, open - at);
+                    substituted += std::to_string(value);
+                    at = close + 2;
+                }
+                substituted.append(line, at, std::string::npos);
+                return true;
+            }
+
+            // the template lines from begin to end, with each .rep block repeated and # the index of its repetition
+            bool expand(size_t begin, size_t end, const std::vector<parameter_t>& grid, const std::vector<int64_t>& values, std::vector<int64_t>& indices, std::vector<std::string>& lines)
+            {
+                std::string substituted;
+                for(auto l = begin; l < end; ++l)
+                {
+                    if(!substitute(_template[l], grid, values, indices, substituted) || is_directive(substituted, ".endr"))
+                        return false;
+                    if(!is_directive(substituted, ".rep"))
+                    {
+                        lines.push_back(substituted);
+                        continue;
+                    }
+                    char* count_end;
+                    const auto count = int64_t(::strtoll(skip_blanks(skip_blanks(substituted.c_str()) + 4), &count_end, 0));
+                    if(skip_blanks(count_end)[0] || count < 0 || count > kMaxRepeat)
+                        return false;
+                    // the matching .endr
+                    auto close = l + 1;
+                    for(auto depth = 1; close < end; ++close)
+                    {
+                        if(is_directive(_template[close], ".rep"))
+                            ++depth;
+                        else if(is_directive(_template[close], ".endr") && !--depth)
+                            break;
+                    }
+                    if(close == end)
+                        return false;
+                    for(int64_t index = 0; index < count; ++index)
+                    {
+                        indices.push_back(index);
+                        const auto expanded = expand(l + 1, close, grid, values, indices, lines);
+                        indices.pop_back();
+                        if(!expanded)
+                            return false;
+                    }
+                    l = close;
+                }
+                return true;
+            }
+
+            // a branch to a label, patched once the variant is assembled
+            struct fixup_t
+            {
+                // the end of the instruction, which the displacement is relative to
+                size_t _end = 0;
+                unsigned _displacement_bytes = 0;
+                std::string _target;
+            };
+
+            // assemble a variant to run at address. Labels are resolved within the variant first, a label at the end of it is the end of the code,
+            // then with the runtime. The runtime's labels don't change while tuning so they can be looked up from the worker threads
+            bool assemble_variant(const std::vector<std::string>& lines, uintptr_t address, std::vector<uint8_t>& code)
+            {
+                std::unordered_map<std::string, size_t> labels;
+                std::vector<fixup_t> fixups;
+                code.clear();
+                for(const auto& line : lines)
+                {
+                    auto instruction = skip_blanks(line.c_str());
+                    const auto token_length = strcspn(instruction, " \t");
+                    if(token_length > 1 && instruction[token_length - 1] == ':')
+                    {
+                        std::string label(instruction, token_length - 1);
+                        std::transform(label.begin(), label.end(), label.begin(), [](char c) { return char(tolower(c)); });
+                        if(!labels.emplace(label, code.size()).second)
+                        {
+                            detail::set_error(Error::kInvalidTemplate);
+                            return false;
+                        }
+                        instruction = skip_blanks(instruction + token_length);
+                    }
+                    if(!instruction[0])
+                        continue;
+
+                    assembler::AssembledInstructionInfo asm_info;
+                    if(!assembler::Assemble(instruction, asm_info, address + code.size()))
+                        return false;
+                    decoder::RelativeBranchInfo branch;
+                    if(asm_info._branch_target[0] && decoder::DecodeRelativeBranch(asm_info._instruction, asm_info._size, branch))
+                        fixups.push_back({ code.size() + asm_info._size, branch._displacement_bytes, asm_info._branch_target });
+                    code.insert(code.end(), asm_info._instruction, asm_info._instruction + asm_info._size);
+                }
+
+                for(const auto& fixup : fixups)
+                {
+                    uintptr_t target;
+                    const auto label = labels.find(fixup._target);
+                    if(label != labels.end())
+                        target = address + label->second;
+                    else if(!runtime::LabelAddress(fixup._target.c_str(), target))
+                    {
+                        detail::set_error(Error::kUndefinedBranchTarget);
+                        return false;
+                    }
+                    const auto displacement = (long long)(target) - (long long)(address + fixup._end);
+                    const auto limit = 1ll << (fixup._displacement_bytes * 8 - 1);
+                    if(displacement < -limit || displacement >= limit)
+                    {
+                        detail::set_error(Error::kBranchTargetOutOfRange);
+                        return false;
+                    }
+                    // little endian, so the low bytes of displacement are the encoded displacement
+                    memcpy(code.data() + fixup._end - fixup._displacement_bytes, &displacement, fixup._displacement_bytes);
+                }
+                return true;
+            }
+        }  // namespace
+
+        void AddTemplateLine(const char* line, bool newTemplate)
+        {
+            if(newTemplate)
+                _template.clear();
+            _template.emplace_back(line);
+        }
+
+        const std::vector<std::string>& TemplateLines()
+        {
+            return _template;
+        }
+
+        bool IsTemplateLine(const char* line)
+        {
+            return strstr(line, "{{") || is_directive(line, ".rep") || is_directive(line, ".endr");
+        }
+
+        bool Expand(const std::vector<parameter_t>& grid, const std::vector<int64_t>& values, std::vector<std::string>& lines)
+        {
+            std::vector<int64_t> indices;
+            lines.clear();
+            if(values.size() != grid.size() || !expand(0, _template.size(), grid, values, indices, lines))
+            {
+                detail::set_error(Error::kInvalidTemplate);
+                return false;
+            }
+            return true;
+        }
+
+        bool Tune(const std::vector<parameter_t>& grid, uint64_t iterations, tuning_t& result)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            if(_template.empty())
+            {
+                detail::set_error(Error::kInvalidTemplate);
+                return false;
+            }
+            size_t variants = 1;
+            for(const auto& parameter : grid)
+            {
+                variants *= parameter._values.size();
+                if(!variants || variants > kMaxVariants)
+                {
+                    detail::set_error(Error::kInvalidCommandFormat);
+                    return false;
+                }
+            }
+
+            result = {};
+            result._iterations = iterations;
+            for(const auto& parameter : grid)
+                result._parameters.push_back(parameter._name);
+            // the parameter values of a variant, the last parameter varies fastest
+            const auto values_of = [&grid](size_t variant) {
+                std::vector<int64_t> values(grid.size());
+                for(auto p = grid.size(); p--;)
+                {
+                    values[p] = grid[p]._values[variant % grid[p]._values.size()];
+                    variant /= grid[p]._values.size();
+                }
+                return values;
+            };
+            // a template that doesn't expand for one variant is unlikely to for any, so it fails here rather than for every variant
+            std::vector<std::string> lines;
+            if(!Expand(grid, values_of(0), lines))
+                return false;
+
+            result._threads = unsigned((std::min)(size_t((std::max)(2u, std::thread::hardware_concurrency()) - 1), variants));
+            std::vector<benchmark::variant_timing_t> timings;
+            const auto assembler = [&values_of, &grid](size_t variant, uintptr_t address, std::vector<uint8_t>& code) {
+                std::vector<std::string> lines;
+                return Expand(grid, values_of(variant), lines) && assemble_variant(lines, address, code);
+            };
+            if(!benchmark::TimeVariants(variants, assembler, iterations, result._threads, kVariantTimeoutMs, timings, result._overhead))
+                return false;
+
+            for(size_t variant = 0; variant < variants; ++variant)
+            {
+                const auto& timing = timings[variant];
+                if(!timing._timed)
+                {
+                    if(!result._failed++)
+                    {
+                        result._first_failed = values_of(variant);
+                        result._error = timing._error;
+                    }
+                    continue;
+                }
+                result._ranked.push_back({ values_of(variant), timing._size, timing._ticks });
+            }
+            std::stable_sort(result._ranked.begin(), result._ranked.end(), [](const variant_t& a, const variant_t& b) { return a._ticks < b._ticks; });
+            result._ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            return true;
+        }
+    }  // namespace tune
+}  // namespace inasm64
@@ -0,0 +1,96 @@
+// MIT License
+// Copyright 2019 Jarl Ostensen
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace inasm64
+{
+    ///<summary>
+    /// an autotuner, timing the variants of a template of assembly lines over a grid of parameter values
+    ///</summary>
+    /// A template line can have placeholders, {{expression}}, where an expression is parameter names, decimal numbers and # combined with + - and *,
+    /// e.g. "add rsi, {{U*64}}". Lines between ".rep {{U}}" and ".endr" are repeated, and # is the index of the repetition (of the innermost .rep),
+    /// e.g. "vmovaps ymm{{#}}, [rsi + {{#*32}}]". Labels are local to a variant, branches to any other name go to the runtime's labels and procedures.
+    namespace tune
+    {
+        ///<summary>
+        /// the most variants a grid can have
+        ///</summary>
+        constexpr size_t kMaxVariants = 4096;
+        ///<summary>
+        /// how long a run of a variant's loop may take before the variant is counted as failed, e.g. if it doesn't terminate
+        ///</summary>
+        constexpr unsigned kVariantTimeoutMs = 10000;
+        ///<summary>
+        /// a parameter and the values it takes
+        ///</summary>
+        struct parameter_t
+        {
+            std::string _name;
+            std::vector<int64_t> _values;
+        };
+        ///<summary>
+        /// a variant that was timed
+        ///</summary>
+        struct variant_t
+        {
+            // a value for each parameter, in grid order
+            std::vector<int64_t> _values;
+            size_t _size = 0;
+            // ticks per iteration, less the empty loop's
+            double _ticks = 0;
+        };
+        ///<summary>
+        /// result of Tune
+        ///</summary>
+        struct tuning_t
+        {
+            std::vector<std::string> _parameters;
+            uint64_t _iterations = 0;
+            // ticks per iteration of the empty loop
+            double _overhead = 0;
+            unsigned _threads = 0;
+            double _ms = 0;
+            // fastest first
+            std::vector<variant_t> _ranked;
+            // variants that didn't assemble, or faulted, and the first of them with its error
+            size_t _failed = 0;
+            std::vector<int64_t> _first_failed;
+            Error _error = Error::kNoError;
+        };
+
+        ///<summary>
+        /// add a line to the template, or start a new one
+        ///</summary>
+        void AddTemplateLine(const char* line, bool newTemplate);
+        ///<summary>
+        /// the template as entered
+        ///</summary>
+        const std::vector<std::string>& TemplateLines();
+        ///<summary>
+        /// true if a line of assembly input is a template line, i.e. it has a placeholder or is a .rep or .endr
+        ///</summary>
+        bool IsTemplateLine(const char* line);
+        ///<summary>
+        /// the lines of the variant for one value of each parameter
+        ///</summary>
+        /// Fails with Error::kInvalidTemplate if a placeholder names something that isn't a parameter, or .rep and .endr don't pair up.
+        bool Expand(const std::vector<parameter_t>& grid, const std::vector<int64_t>& values, std::vector<std::string>& lines);
+        ///<summary>
+        /// assemble and time the template for every combination of parameter values natively, each variant in a loop of iterations
+        ///</summary>
+        /// Variants are expanded and assembled on worker threads while the runtime thread times them, see benchmark::TimeVariants.
+        /// A variant that fails to assemble, faults, or runs for longer than kVariantTimeoutMs is counted as failed, the rest are still timed.
+        bool Tune(const std::vector<parameter_t>& grid, uint64_t iterations, tuning_t& result);
+    }  // namespace tune
+}  // namespace inasm64
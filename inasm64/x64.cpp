@@ -9,6 +9,7 @@
 //
 
 #include <string>
+#include <cstdint>
 #include "x64.h"
 
 #include <intrin.h>
@@ -102,6 +103,7 @@ namespace inasm64
             bool _avx512vl : 1;
             bool _avx512vnni : 1;
             bool _gfni : 1;
+            bool _clflushopt : 1;
             bool _vaes : 1;
             bool _aes : 1;
             bool _fma : 1;
@@ -171,6 +173,7 @@ namespace inasm64
                 }
             }
             _sys_flags._gfni = (regs[2] & (1 << 8)) != 0;
+            _sys_flags._clflushopt = (regs[1] & (1 << 23)) != 0;
             _sys_flags._vaes = (regs[2] & (1 << 9)) != 0;
 
             _sys_flags._checked = true;
@@ -527,7 +530,126 @@ namespace inasm64
             return _sys_flags._aes;
         case ExtendedCpuFeature::kFma:
             return _sys_flags._fma;
+        case ExtendedCpuFeature::kClflushopt:
+            return _sys_flags._clflushopt;
         }
         return false;
     }
-}  // namespace inasm64
\ No newline at end of file
+
+    size_t GetCacheInfo(CacheInfo* caches, size_t maxCaches)
+    {
+        int regs[4] = { 0 };
+        cpuid(0, 0, regs);
+        const auto max_leaf = regs[0];
+        // "GenuineIntel"
+        const auto intel = regs[1] == 0x756e6547 && regs[3] == 0x49656e69 && regs[2] == 0x6c65746e;
+
+        int leaf = 0;
+        if(intel && max_leaf >= 4)
+        {
+            leaf = 4;
+        }
+        else
+        {
+            // AMD reports the same layout through an extended leaf, if it has topology extensions
+            cpuid(0x80000000, 0, regs);
+            if(unsigned(regs[0]) >= 0x8000001d)
+            {
+                cpuid(0x80000001, 0, regs);
+                if(regs[2] & (1 << 22))
+                    leaf = int(0x8000001d);
+            }
+        }
+        if(!leaf)
+            return 0;
+
+        size_t count = 0;
+        for(auto subleaf = 0; count < maxCaches; ++subleaf)
+        {
+            cpuid(leaf, subleaf, regs);
+            const auto type = regs[0] & 0x1f;
+            // type 0 terminates the list
+            if(!type)
+                break;
+            const auto ebx = unsigned(regs[1]);
+            auto& cache = caches[count++];
+            cache._type = static_cast<CacheInfo::Type>(type);
+            cache._level = (regs[0] >> 5) & 7;
+            cache._shared_by = ((regs[0] >> 14) & 0xfff) + 1;
+            cache._line_size = (ebx & 0xfff) + 1;
+            const auto partitions = ((ebx >> 12) & 0x3ff) + 1;
+            cache._ways = int((ebx >> 22) + 1);
+            const auto sets = size_t(unsigned(regs[2])) + 1;
+            cache._size = size_t(cache._ways) * partitions * cache._line_size * sets;
+        }
+        return count;
+    }
+
+    bool GetCoreInfo(CoreInfo& info)
+    {
+        info = {};
+        Cpuid cpuid;
+        cpuid(0, 0);
+        const auto max_leaf = cpuid._regs[0];
+        if(max_leaf >= 0x1a)
+        {
+            // leaf 7 EDX bit 15: hybrid part, i.e. leaf 0x1A is meaningful
+            cpuid(7, 0);
+            if(cpuid._regs[3] & (1 << 15))
+            {
+                cpuid(0x1a, 0);
+                const auto eax = unsigned(cpuid._regs[0]);
+                info._type = static_cast<CoreInfo::Type>(eax >> 24);
+                info._native_model = eax & 0xffffff;
+            }
+        }
+
+        // 0x1F is the extended form of 0xB, with module, tile, and die levels between core and package
+        auto leaf = 0;
+        if(max_leaf >= 0x1f)
+        {
+            cpuid(0x1f, 0);
+            if(cpuid._regs[1])
+                leaf = 0x1f;
+        }
+        if(!leaf && max_leaf >= 0xb)
+        {
+            cpuid(0xb, 0);
+            if(cpuid._regs[1])
+                leaf = 0xb;
+        }
+        if(!leaf)
+        {
+            cpuid(1, 0);
+            info._x2apic_id = info._core_id = unsigned(cpuid._regs[1]) >> 24;
+            return false;
+        }
+
+        // each level reports the shift of the x2APIC ID to the next level up, the last one to the package
+        unsigned smt_shift = 0;
+        unsigned core_shift = 0;
+        unsigned package_shift = 0;
+        for(auto subleaf = 0;; ++subleaf)
+        {
+            cpuid(leaf, subleaf);
+            const auto level_type = (unsigned(cpuid._regs[2]) >> 8) & 0xff;
+            // level type 0 terminates the list
+            if(!level_type)
+                break;
+            const auto shift = unsigned(cpuid._regs[0]) & 0x1f;
+            if(level_type == 1)
+                smt_shift = shift;
+            else if(level_type == 2)
+                core_shift = shift;
+            package_shift = shift;
+            info._x2apic_id = unsigned(cpuid._regs[3]);
+        }
+        if(!core_shift)
+            core_shift = package_shift;
+        const auto x2apic_id = uint64_t(info._x2apic_id);
+        info._smt_id = unsigned(x2apic_id & ((uint64_t(1) << smt_shift) - 1));
+        info._core_id = unsigned((x2apic_id >> smt_shift) & ((uint64_t(1) << (core_shift - smt_shift)) - 1));
+        info._package_id = unsigned(x2apic_id >> package_shift);
+        return true;
+    }
+}  // namespace inasm64
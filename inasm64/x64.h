@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <cstddef>
+
 namespace inasm64
 {
     ///<summary>
@@ -19,7 +21,8 @@ namespace inasm64
     struct Cpuid
     {
         int _regs[4] = { 0 };
-        int _leaf = 0;
+        // no leaf yet, so that the first call always issues
+        int _leaf = -1;
         int _subleaf = 0;
         void operator()(int leaf, int subleaf);
     };
@@ -223,7 +226,60 @@ namespace inasm64
         kVaes,
         kGfni,
         kAes,
-        kFma
+        kFma,
+        kClflushopt
     };
     bool ExtendedCpuFeatureSupported(ExtendedCpuFeature level);
+
+    ///<summary>
+    /// a cache as reported by CPUID leaf 4 (Intel) or 0x8000001d (AMD)
+    ///</summary>
+    struct CacheInfo
+    {
+        enum class Type
+        {
+            kData = 1,
+            kInstruction,
+            kUnified,
+        };
+        Type _type = Type::kData;
+        int _level = 0;
+        size_t _size = 0;
+        size_t _line_size = 0;
+        int _ways = 0;
+        // maximum number of logical processors sharing it
+        int _shared_by = 0;
+    };
+    ///<summary>
+    /// fill caches with up to maxCaches entries, in CPUID order (i.e. L1 first), and return the number found
+    ///</summary>
+    /// returns 0 if the CPU doesn't report its cache parameters through either leaf
+    size_t GetCacheInfo(CacheInfo* caches, size_t maxCaches);
+
+    ///<summary>
+    /// the logical processor the calling thread runs on, as reported by CPUID leaves 0x1A and 0x1F (or 0xB)
+    ///</summary>
+    struct CoreInfo
+    {
+        // leaf 0x1A core type, only reported by hybrid parts
+        enum class Type
+        {
+            kUnknown = 0,
+            kAtom = 0x20,
+            kCore = 0x40,
+        };
+        Type _type = Type::kUnknown;
+        // leaf 0x1A native model ID of the core, 0 if unknown
+        unsigned _native_model = 0;
+        unsigned _x2apic_id = 0;
+        // the x2APIC ID split into its topology levels; any levels between core and package (module, tile, die) are folded into the package
+        unsigned _package_id = 0;
+        unsigned _core_id = 0;
+        unsigned _smt_id = 0;
+    };
+    ///<summary>
+    /// fill info for the logical processor the calling thread runs on, pin the thread first for the answer to stay true
+    ///</summary>
+    /// returns false if the CPU has no topology leaf, in which case only the initial APIC ID from leaf 1 is set (as the x2APIC and core IDs)
+    bool GetCoreInfo(CoreInfo& info);
 }  // namespace inasm64
@@ -46,7 +46,10 @@ namespace inasm64
                 xed_encoder_request_t req;
                 xed_encoder_request_zero_set_mode(&req, &_state64);
                 if(statement._operand_count)
-                    xed_encoder_request_set_effective_operand_width(&req, statement._operands[0]._width_bits);
+                {
+                    // branches use the default 64 bit operand size, the width of the relative operand is the width of the displacement
+                    xed_encoder_request_set_effective_operand_width(&req, statement._operands[0]._type == Statement::kRel ? 64 : statement._operands[0]._width_bits);
+                }
 
                 char uc_buffer[64];
                 const auto uc_string = [&uc_buffer](const char* str, const char* prefix = nullptr) {
@@ -254,6 +257,13 @@ namespace inasm64
                         xed_encoder_request_set_operand_order(&req, op_order, XED_OPERAND_IMM0);
                     }
                     break;
+                    case Statement::kRel:
+                    {
+                        xed_encoder_request_set_relbr(&req);
+                        xed_encoder_request_set_branch_displacement(&req, xed_int32_t(op._op._imm), unsigned(width_bits / 8));
+                        xed_encoder_request_set_operand_order(&req, op_order, XED_OPERAND_RELBR);
+                    }
+                    break;
                     default:
                         break;
                     }
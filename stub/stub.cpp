@@ -0,0 +1,24 @@
+// MIT License
+// Copyright 2019 Jarl Ostensen
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+// ===================================================================================================================
+// Minimal debuggee for the runtime.
+// The runtime launches this under the debugger, stops it at the loader's first breakpoint and redirects the main thread to its code buffer,
+// so none of the code below normally runs. It is built without the CRT and only imports kernel32, which keeps the debuggee's address space
+// down to ntdll, kernel32 and kernelbase: less to load when it is launched, and less in the way of measurements.
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+extern "C" void __stdcall stub_main()
+{
+    // only reached when launched outside of the runtime
+    ExitProcess(0);
+}
@@ -4,7 +4,17 @@
 #include "../inasm64/common.h"
 #include "../inasm64/x64.h"
 #include "../inasm64/runtime.h"
+#include "../inasm64/benchmark.h"
+#include "../inasm64/hazards.h"
+#include "../inasm64/superopt.h"
+#include "../inasm64/tune.h"
+#include "../inasm64/loader.h"
+#include "../inasm64/exporter.h"
+#include "../inasm64/history.h"
+#include "../inasm64/memdiff.h"
+#include "../inasm64/globvars.h"
 #include "../inasm64/assembler.h"
+#include "../inasm64/emulator.h"
 #include "../inasm64/cli.h"
 #include "../inasm64/xed_iclass_instruction_set.h"
 #include "../console.h"
@@ -18,6 +28,7 @@
 #include <fstream>
 #include <sstream>
 #include <algorithm>
+#include <chrono>
 
 void cinsout(const inasm64::assembler::AssembledInstructionInfo& info)
 {
@@ -42,6 +53,24 @@ void test_assemble(const std::string& statement)
         cinsout(info);
 }
 
+// assemble a statement at the next line and add it to the runtime
+bool add(const char* statement)
+{
+    using namespace inasm64;
+    assembler::AssembledInstructionInfo info;
+    return assembler::Assemble(statement, info, runtime::NextInstructionIndex()._address) && runtime::AddInstruction(info._instruction, info._size, info._branch_target)._address;
+}
+
+// start the runtime for a test, reporting the error under the test's name if it doesn't
+bool start(const char* test, inasm64::runtime::Backend backend = inasm64::runtime::Backend::kDebuggee)
+{
+    using namespace inasm64;
+    if(runtime::Start(8192, backend))
+        return true;
+    std::cerr << test << ": " << ErrorMessage(GetError()) << std::endl;
+    return false;
+}
+
 void generate_instruction_set()
 {
     std::ifstream instrf{ "../assets/iclass_instruction_set.txt" };
@@ -132,6 +161,548 @@ void test_xed_instruction_lookup(const char* xed_instruction)
     }
 }
 
+// checks emulated vpdpbusd against a scalar reference and measures the throughput of a few emulated instructions
+void test_emulator_throughput()
+{
+    using namespace inasm64;
+    emulator::ExecutionContext ctx;
+    std::vector<uint8_t> memory(4096);
+    const auto base = uintptr_t(memory.data());
+    ctx._read_memory = [&memory, base](uintptr_t address, void* dest, size_t size) {
+        if(address < base || address + size > base + memory.size())
+            return false;
+        memcpy(dest, reinterpret_cast<const void*>(address), size);
+        return true;
+    };
+    ctx._write_memory = [&memory, base](uintptr_t address, const void* src, size_t size) {
+        if(address < base || address + size > base + memory.size())
+            return false;
+        memcpy(reinterpret_cast<void*>(address), src, size);
+        return true;
+    };
+    // rax
+    ctx._gpr[0] = base;
+
+    // vpdpbusd zmm0, zmm1, zmm2
+    const uint8_t vpdpbusd[] = { 0x62, 0xf2, 0x75, 0x48, 0x50, 0xc2 };
+    // vpdpbusd zmm0, zmm1, [rax]
+    const uint8_t vpdpbusd_mem[] = { 0x62, 0xf2, 0x75, 0x48, 0x50, 0x00 };
+    // vaddps zmm0, zmm1, zmm2
+    const uint8_t vaddps[] = { 0x62, 0xf1, 0x74, 0x48, 0x58, 0xc2 };
+
+    for(auto i = 0; i < 64; ++i)
+    {
+        ctx._zmm[0][i] = 0;
+        ctx._zmm[1][i] = uint8_t(i * 7);
+        ctx._zmm[2][i] = uint8_t(0x80 + i);
+    }
+    int32_t expected[16];
+    for(auto lane = 0; lane < 16; ++lane)
+    {
+        expected[lane] = 0;
+        for(auto j = 0; j < 4; ++j)
+            expected[lane] += int32_t(ctx._zmm[1][lane * 4 + j]) * int32_t(int8_t(ctx._zmm[2][lane * 4 + j]));
+    }
+    if(!emulator::Execute(ctx, vpdpbusd, sizeof(vpdpbusd)))
+    {
+        std::cerr << "emulator: " << ErrorMessage(GetError()) << std::endl;
+        return;
+    }
+    std::cout << "emulated vpdpbusd " << (memcmp(ctx._zmm[0], expected, sizeof(expected)) == 0 ? "matches" : "DOES NOT match") << " the reference\n";
+
+    const auto benchmark = [&ctx](const char* name, const uint8_t* instruction, size_t length) {
+        constexpr auto kIterations = 1000000;
+        const auto start = std::chrono::high_resolution_clock::now();
+        for(auto n = 0; n < kIterations; ++n)
+            emulator::Execute(ctx, instruction, length);
+        const auto seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        std::cout << std::dec << name << ": " << (double(kIterations) / seconds / 1e6) << " M instructions/s, " << (seconds * 1e9 / kIterations) << " ns per instruction\n";
+    };
+    benchmark("vpdpbusd zmm0, zmm1, zmm2", vpdpbusd, sizeof(vpdpbusd));
+    benchmark("vpdpbusd zmm0, zmm1, [rax]", vpdpbusd_mem, sizeof(vpdpbusd_mem));
+    benchmark("vaddps zmm0, zmm1, zmm2", vaddps, sizeof(vaddps));
+}
+
+// compares runtime::Start latency with a cold launch and with a warm debuggee pool
+void test_debuggee_pool()
+{
+    using namespace inasm64;
+    const auto time_start = [](const char* name) {
+        const auto start = std::chrono::high_resolution_clock::now();
+        const auto started = runtime::Start();
+        const auto microseconds = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+        std::cout << std::dec << name << ": " << (started ? "" : "FAILED ") << microseconds << " us\n";
+        runtime::Shutdown();
+    };
+    time_start("cold start");
+    if(!runtime::WarmDebuggeePool(4))
+    {
+        std::cerr << "debuggee pool: " << ErrorMessage(GetError()) << std::endl;
+        return;
+    }
+    for(auto n = 0; n < 4; ++n)
+        time_start("pooled start");
+    runtime::WarmDebuggeePool(0);
+}
+
+// runs the same code through the debuggee and the interpreter, compares the resulting registers and times interpreted steps
+void test_interpreter_differential()
+{
+    using namespace inasm64;
+    const char* program[] = {
+        "mov rax, 0x123456789abcdef0",
+        "mov ecx, 10",
+        "xor rbx, rbx",
+        "mov rdx, -3",
+        // the debuggee starts with whatever the loader left in the other registers
+        "xor esi, esi",
+        "mov rdi, rax",
+        "xor r9d, r9d",
+        "xor r10d, r10d",
+        "mov r11, rdx",
+        "add rbx, rax",
+        "rol rax, 13",
+        "imul rdx, rbx, 7",
+        "sub rbx, rcx",
+        "adc rsi, rdx",
+        "shr rdi, 3",
+        "sar rdx, 5",
+        "bsr r8, rax",
+        "setc r9b",
+        "cmovs r10, rbx",
+        "movq xmm0, rax",
+        "movq xmm1, rbx",
+        "paddd xmm0, xmm1",
+        "addps xmm1, xmm0",
+        "dec ecx",
+        "jnz l9",
+        "neg r11",
+        "cqo",
+    };
+    const char* registers[] = { "rax", "rbx", "rcx", "rdx", "rsi", "rdi", "r8", "r9", "r10", "r11", "xmm0", "xmm1" };
+    struct state_t
+    {
+        uint64_t _regs[14][2] = {};
+        uint32_t _eflags = 0;
+        size_t _steps = 0;
+        double _step_ns = 0;
+    } states[2];
+
+    const runtime::Backend backends[] = { runtime::Backend::kDebuggee, runtime::Backend::kInterpreter };
+    for(auto b = 0; b < 2; ++b)
+    {
+        if(!runtime::Start(8192, backends[b]))
+        {
+            std::cerr << "interpreter differential: " << ErrorMessage(GetError()) << std::endl;
+            return;
+        }
+        for(const auto statement : program)
+        {
+            assembler::AssembledInstructionInfo info;
+            if(!assembler::Assemble(statement, info, runtime::NextInstructionIndex()._address) || !runtime::AddInstruction(info._instruction, info._size, info._branch_target)._address)
+            {
+                std::cerr << "interpreter differential: " << statement << ": " << ErrorMessage(GetError()) << std::endl;
+                runtime::Shutdown();
+                return;
+            }
+        }
+        runtime::CommmitInstructions();
+        auto& state = states[b];
+        const auto start = std::chrono::high_resolution_clock::now();
+        while(runtime::Step())
+            ++state._steps;
+        state._step_ns = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count() / double(state._steps ? state._steps : 1);
+        for(auto r = 0; r < _countof(registers); ++r)
+            runtime::GetReg(GetRegisterInfo(registers[r]), state._regs[r], GetRegisterInfo(registers[r])._bit_width / 8);
+        runtime::GetReg(GetRegisterInfo("eflags"), state._eflags);
+        runtime::Shutdown();
+    }
+
+    // CF, PF, ZF, SF and OF; the rest are either undefined for some of the instructions or system flags
+    constexpr uint32_t kFlagsMask = 0x8c5;
+    auto matches = states[0]._steps == states[1]._steps && (states[0]._eflags & kFlagsMask) == (states[1]._eflags & kFlagsMask);
+    for(auto r = 0; r < _countof(registers); ++r)
+    {
+        if(memcmp(states[0]._regs[r], states[1]._regs[r], sizeof(states[0]._regs[r])))
+        {
+            std::cout << registers[r] << " differs: " << std::hex << states[0]._regs[r][0] << " vs " << states[1]._regs[r][0] << "\n";
+            matches = false;
+        }
+    }
+    std::cout << "interpreter " << (matches ? "matches" : "DOES NOT match") << " native execution, " << std::dec << states[1]._steps << " steps\n";
+    std::cout << "step: " << states[0]._step_ns << " ns native, " << states[1]._step_ns << " ns interpreted\n";
+
+    // edx:eax = 0x80000000:00000000 over -1 overflows, which has to be a divide error for the code rather than a fault in the host
+    if(!start("interpreter idiv overflow", runtime::Backend::kInterpreter))
+        return;
+    size_t steps = 0;
+    if(add("mov edx, 0x80000000") && add("xor eax, eax") && add("mov ecx, -1") && add("idiv ecx") && runtime::CommmitInstructions())
+    {
+        while(runtime::Step())
+            ++steps;
+    }
+    std::cout << "interpreter idiv overflow: " << ((steps == 3 && GetError() == Error::kDivideError) ? "ok" : "wrong") << "\n";
+    runtime::Shutdown();
+}
+
+// times a multiply chain alone and with a divider hog on the SMT sibling
+void test_smt_interference()
+{
+    using namespace inasm64;
+    if(!start("smt interference"))
+        return;
+    auto added = add("imul rax, rax") && add("imul rbx, rbx") && add("imul rcx, rcx") && runtime::BeginProc("hog");
+    added = added && add("xor edx, edx") && add("mov eax, 1000") && add("mov ecx, 7") && add("div rcx") && add("ret") && runtime::EndProc();
+    benchmark::interference_t result;
+    if(!added || !runtime::CommmitInstructions() || !benchmark::MeasureInterference("hog", benchmark::kDefaultIterations, result))
+    {
+        std::cerr << "smt interference: " << ErrorMessage(GetError()) << std::endl;
+        runtime::Shutdown();
+        return;
+    }
+    std::cout << "imul chain: " << result._alone << " ticks alone, " << result._shared << " ticks with a divider hog on the sibling\n";
+    runtime::Shutdown();
+}
+
+void test_cores()
+{
+    using namespace inasm64;
+    CoreInfo info;
+    if(GetCoreInfo(info))
+        std::cout << "core info: x2apic " << info._x2apic_id << " is package " << info._package_id << " core " << info._core_id << " smt " << info._smt_id << ", type 0x" << std::hex << int(info._type) << std::dec << "\n";
+    if(!start("cores"))
+        return;
+    assembler::AssembledInstructionInfo assembled;
+    benchmark::core_timings_t result;
+    if(!assembler::Assemble("imul rax, rax", assembled, runtime::NextInstructionIndex()._address) || !runtime::AddInstruction(assembled._instruction, assembled._size)._address || !runtime::CommmitInstructions() || !benchmark::MeasureCores(benchmark::kDefaultIterations, result))
+    {
+        std::cerr << "cores: " << ErrorMessage(GetError()) << std::endl;
+        runtime::Shutdown();
+        return;
+    }
+    unsigned processors = 0;
+    for(const auto& group : result._groups)
+        processors += group._processors;
+    if(result._processors.empty() || processors != result._processors.size())
+        std::cerr << "cores: " << result._processors.size() << " processors timed but " << processors << " grouped\n";
+    for(const auto& group : result._groups)
+        std::cout << "cores: " << group._processors << " of type 0x" << std::hex << int(group._type) << std::dec << " (class " << int(group._efficiency_class) << "), " << group._mean << " ticks mean\n";
+    runtime::Shutdown();
+}
+
+void test_pointer_chain()
+{
+    using namespace inasm64;
+    if(!start("pointer chain"))
+        return;
+    // every element must be visited exactly once before the chain returns to the start
+    constexpr size_t kSize = 64 * 1024;
+    constexpr size_t kStride = 64;
+    const auto handle = runtime::AllocateMemory(kSize);
+    runtime::allocation_info_t info;
+    runtime::QueryAllocation(handle, info);
+    std::vector<uint8_t> chain(kSize);
+    for(auto crossing : { benchmark::PageCrossing::kRandom, benchmark::PageCrossing::kWithinPage, benchmark::PageCrossing::kEveryLoad })
+    {
+        if(!benchmark::BuildPointerChain(handle, kSize, kStride, crossing) || !runtime::ReadBytes(handle, chain.data(), kSize))
+        {
+            std::cerr << "pointer chain: " << ErrorMessage(GetError()) << std::endl;
+            break;
+        }
+        std::vector<bool> visited(kSize / kStride);
+        size_t count = 0;
+        auto offset = size_t(0);
+        // and with kEveryLoad no two consecutive elements, the last and the first included, may share a page
+        auto crosses = true;
+        do
+        {
+            visited[offset / kStride] = true;
+            ++count;
+            uint64_t next;
+            memcpy(&next, chain.data() + offset, sizeof(next));
+            const auto previous = offset;
+            offset = size_t(next - uint64_t(handle));
+            crosses = crosses && (crossing != benchmark::PageCrossing::kEveryLoad || offset / info._page_size != previous / info._page_size);
+        } while(offset && offset < kSize && count <= visited.size());
+        const auto all = std::find(visited.begin(), visited.end(), false) == visited.end();
+        std::cout << "pointer chain " << int(crossing) << ": " << (offset == 0 && count == visited.size() && all && crosses ? "ok" : "broken") << "\n";
+    }
+    runtime::FreeMemory(handle);
+    runtime::Shutdown();
+}
+
+void test_sse_avx_transitions()
+{
+    using namespace inasm64;
+    if(!start("sse/avx transitions"))
+        return;
+    // line 2 follows a 256 bit instruction, line 5 is preceded by vzeroupper
+    const auto added = add("vaddps ymm0, ymm1, ymm2") && add("vaddps xmm3, xmm1, xmm2") && add("addps xmm0, xmm1") && add("vmulps ymm1, ymm1, ymm1") && add("vzeroupper") && add("mulps xmm0, xmm0");
+    std::vector<hazards::transition_t> transitions;
+    if(!added || !hazards::FindSseAvxTransitions(transitions))
+        std::cerr << "sse/avx transitions: " << ErrorMessage(GetError()) << std::endl;
+    else
+        std::cout << "sse/avx transitions: " << ((transitions.size() == 1 && transitions[0]._line == 2 && transitions[0]._dirty_line == 0) ? "ok" : "wrong") << "\n";
+    runtime::Shutdown();
+}
+
+void test_flush_to_zero()
+{
+    using namespace inasm64;
+    if(!start("flush to zero"))
+        return;
+    // the smallest normal float squared is a denormal, which is only flushed if the MXCSR set before the steps reaches the thread
+    constexpr uint32_t kFtzDaz = 0x8040;
+    uint32_t mxcsr = 0;
+    uint32_t xmm0[4] = { ~0u };
+    const auto stepped = add("mov eax, 0x00800000") && add("movd xmm0, eax") && add("mulss xmm0, xmm0") && runtime::CommmitInstructions() &&
+                         runtime::GetMxcsr(mxcsr) && runtime::SetMxcsr(mxcsr | kFtzDaz) && runtime::Step() && runtime::Step() && runtime::Step();
+    if(!stepped || !runtime::GetReg(GetRegisterInfo("xmm0"), xmm0) || !runtime::GetMxcsr(mxcsr))
+        std::cerr << "flush to zero: " << ErrorMessage(GetError()) << std::endl;
+    else
+        std::cout << "flush to zero: " << ((mxcsr & kFtzDaz) == kFtzDaz && !xmm0[0] ? "ok" : "wrong") << "\n";
+    runtime::Shutdown();
+}
+
+// an equivalent and a non-equivalent rewrite of rax = 2 * rcx + 1
+void test_verify()
+{
+    using namespace inasm64;
+    if(!start("verify"))
+        return;
+    auto added = add("nop") && runtime::BeginProc("reference") && add("lea rax, [rcx + rcx + 1]") && add("ret") && runtime::EndProc();
+    added = added && runtime::BeginProc("same") && add("mov rax, rcx") && add("shl rax, 1") && add("inc rax") && add("ret") && runtime::EndProc();
+    added = added && runtime::BeginProc("different") && add("mov eax, ecx") && add("add eax, eax") && add("inc eax") && add("ret") && runtime::EndProc();
+    benchmark::verify_options_t options;
+    options._registers.push_back(GetRegisterInfo("rax"));
+    benchmark::verify_t same, different;
+    if(!added || !runtime::CommmitInstructions() || !benchmark::Verify("reference", "same", options, same) || !benchmark::Verify("reference", "different", options, different))
+        std::cerr << "verify: " << ErrorMessage(GetError()) << std::endl;
+    else
+        std::cout << "verify: " << ((same._equivalent && !different._equivalent) ? "ok" : "wrong") << ", " << same._trials << " trials in " << same._run_ms << " ms\n";
+    runtime::Shutdown();
+}
+
+// mov + shl + add should come back as a single lea
+void test_superopt()
+{
+    using namespace inasm64;
+    if(!start("superopt", runtime::Backend::kInterpreter))
+        return;
+    const auto added = add("nop") && runtime::BeginProc("times5") && add("mov rax, rcx") && add("shl rax, 2") && add("add rax, rcx") && add("ret") && runtime::EndProc();
+    superopt::options_t options;
+    options._max_length = 1;
+    superopt::search_t result;
+    if(!added || !runtime::CommmitInstructions() || !superopt::Search("times5", options, result))
+        std::cerr << "superopt: " << ErrorMessage(GetError()) << std::endl;
+    else
+        std::cout << "superopt: " << (!result._candidates.empty() && result._candidates[0]._instructions[0].compare(0, 3, "lea") == 0 ? "ok" : "wrong") << ", " << result._tested << " sequences in " << result._ms << " ms\n";
+    // the edge values the inputs favour (rcx = 0x80000000, rsi = ~0) make this idiv overflow, which the search has to survive as a fault of the input
+    const auto divides = add("nop") && runtime::BeginProc("quotient") && add("mov edx, ecx") && add("xor eax, eax") && add("idiv esi") && add("ret") && runtime::EndProc();
+    const auto searched = divides && runtime::CommmitInstructions() && superopt::Search("quotient", options, result);
+    std::cout << "superopt idiv: " << ((searched || GetError() != Error::kNoError) ? "ok" : "wrong") << "\n";
+    runtime::Shutdown();
+}
+
+// store buffering: with an mfence between the store and the load both loads can't read 0
+void test_litmus()
+{
+    using namespace inasm64;
+    if(!start("litmus"))
+        return;
+    auto added = add("nop") && runtime::BeginProc("sb0") && add("mov qword [rsi], 1") && add("mfence") && add("mov rax, [rdi]") && add("ret") && runtime::EndProc();
+    added = added && runtime::BeginProc("sb1") && add("mov qword [rdi], 1") && add("mfence") && add("mov rax, [rsi]") && add("ret") && runtime::EndProc();
+    // x and y on separate lines of a zeroed buffer
+    const auto buffer = runtime::AllocateMemory(128);
+    const auto x = uint64_t(buffer);
+    const auto y = x + 64;
+    benchmark::litmus_options_t options;
+    options._iterations = 100000;
+    benchmark::litmus_t result;
+    if(!added || !buffer || !runtime::CommmitInstructions() || !runtime::SetReg(RegisterInfo{ RegisterInfo::Register::rsi }, &x, sizeof(x)) ||
+        !runtime::SetReg(RegisterInfo{ RegisterInfo::Register::rdi }, &y, sizeof(y)) || !benchmark::Litmus({ "sb0", "sb1" }, options, result))
+        std::cerr << "litmus: " << ErrorMessage(GetError()) << std::endl;
+    else
+    {
+        const auto reordered = std::find_if(result._outcomes.begin(), result._outcomes.end(), [](const benchmark::litmus_outcome_t& o) { return o._values[0] == 0 && o._values[1] == 0; });
+        std::cout << "litmus: " << (reordered == result._outcomes.end() && result._variables == 1 ? "ok" : "wrong") << ", " << result._outcomes.size() << " outcomes in " << result._ms << " ms\n";
+    }
+    runtime::Shutdown();
+}
+
+// an unrolled template expands to one load per repetition, then tune times U = 1, 2, 4
+void test_tune()
+{
+    using namespace inasm64;
+    tune::AddTemplateLine(".rep {{U}}", true);
+    tune::AddTemplateLine("mov rax, [rsi + rcx + {{#*8}}]", false);
+    tune::AddTemplateLine(".endr", false);
+    tune::AddTemplateLine("add rcx, {{U*8}}", false);
+    tune::AddTemplateLine("and rcx, 0xfff", false);
+    const std::vector<tune::parameter_t> grid = { { "U", { 1, 2, 4 } } };
+    std::vector<std::string> lines;
+    if(!tune::Expand(grid, { 4 }, lines) || lines.size() != 6 || lines[3] != "mov rax, [rsi + rcx + 24]" || lines[4] != "add rcx, 32")
+    {
+        std::cerr << "tune: expansion is wrong" << std::endl;
+        return;
+    }
+    if(!start("tune"))
+        return;
+    // rsi is a 4K buffer (and a bit, for the last repetitions) that rcx walks
+    const auto buffer = runtime::AllocateMemory(4096 + 64);
+    const auto rsi = uint64_t(buffer);
+    const uint64_t rcx = 0;
+    tune::tuning_t result;
+    if(!buffer || !runtime::SetReg(RegisterInfo{ RegisterInfo::Register::rsi }, &rsi, sizeof(rsi)) || !runtime::SetReg(RegisterInfo{ RegisterInfo::Register::rcx }, &rcx, sizeof(rcx)) ||
+        !tune::Tune(grid, 10000, result))
+        std::cerr << "tune: " << ErrorMessage(GetError()) << std::endl;
+    else
+        std::cout << "tune: " << (result._ranked.size() == 3 ? "ok" : "wrong") << ", fastest U=" << result._ranked[0]._values[0] << " in " << result._ms << " ms\n";
+    runtime::Shutdown();
+}
+
+void test_load()
+{
+    using namespace inasm64;
+    // mov ecx, 3; l1: dec ecx; jnz l1; add eax, 1
+    const uint8_t code[] = { 0xb9, 0x03, 0x00, 0x00, 0x00, 0xff, 0xc9, 0x75, 0xfc, 0x83, 0xc0, 0x01 };
+    {
+        std::ofstream file{ "test_load.bin", std::ios::binary };
+        file.write(reinterpret_cast<const char*>(code), sizeof(code));
+    }
+    if(!start("load"))
+        return;
+    loader::load_t result;
+    uint64_t rcx = ~0ull;
+    if(!loader::Load("test_load.bin", nullptr, result) || !runtime::Run() || !runtime::GetReg(GetRegisterInfo("rcx"), rcx))
+        std::cerr << "load: " << ErrorMessage(GetError()) << std::endl;
+    else
+        std::cout << "load: " << ((result._lines == 4 && result._size == sizeof(code) && !rcx) ? "ok" : "wrong") << "\n";
+    // lea rax, [rip + 0x100] refers to bytes that aren't loaded
+    const uint8_t outside[] = { 0x48, 0x8d, 0x05, 0x00, 0x01, 0x00, 0x00 };
+    {
+        std::ofstream file{ "test_load.bin", std::ios::binary };
+        file.write(reinterpret_cast<const char*>(outside), sizeof(outside));
+    }
+    const auto rejected = !loader::Load("test_load.bin", nullptr, result) && GetError() == Error::kInvalidObjectFile;
+    std::cout << "load outside reference: " << (rejected ? "ok" : "wrong") << "\n";
+    runtime::Shutdown();
+    DeleteFileA("test_load.bin");
+}
+
+void test_export()
+{
+    using namespace inasm64;
+    if(!start("export"))
+        return;
+    auto added = add("mov eax, 21") && add("call twice") && runtime::BeginProc("twice") && add("add eax, eax") && add("ret") && runtime::EndProc();
+    exporter::export_t result;
+    loader::load_t loaded;
+    // the procedure comes back the same from the object
+    if(!added || !exporter::Export("test_export.o", {}, result) || !loader::Load("test_export.o", "twice", loaded))
+        std::cerr << "export: " << ErrorMessage(GetError()) << std::endl;
+    else
+        std::cout << "export: " << ((result._symbols.size() == 2 && result._symbols[0] == "test_export" && loaded._lines == 2) ? "ok" : "wrong") << "\n";
+    runtime::Shutdown();
+    DeleteFileA("test_export.o");
+    DeleteFileA("test_export.o.inasm64.s");
+}
+
+void test_perf_map()
+{
+    using namespace inasm64;
+    if(!start("perf map"))
+        return;
+    std::string map_path, jitdump_path;
+    // one line is published when set, the other two on commit
+    if(!add("xor eax, eax") || !runtime::SetPerfMap(runtime::PerfMap::kLines, true, map_path, jitdump_path) || !add("inc eax") || !add("inc eax") || !runtime::CommmitInstructions() ||
+       runtime::PerfMapError() != Error::kNoError)
+    {
+        std::cerr << "perf map: " << ErrorMessage(GetError()) << std::endl;
+        runtime::Shutdown();
+        return;
+    }
+    std::ifstream map{ map_path };
+    size_t symbols = 0;
+    for(std::string line; std::getline(map, line);)
+        ++symbols;
+    std::cout << "perf map: " << (symbols == 3 && !jitdump_path.empty() ? "ok" : "wrong") << ", " << map_path << "\n";
+    runtime::Shutdown();
+}
+
+void test_history()
+{
+    using namespace inasm64;
+    if(!start("history"))
+        return;
+    if(!add("mov eax, 1") || !add("add eax, 2") || !add("mov ecx, 7") || !add("add eax, 3") || !runtime::CommmitInstructions())
+    {
+        std::cerr << "history: " << ErrorMessage(GetError()) << std::endl;
+        runtime::Shutdown();
+        return;
+    }
+    history::Clear();
+    history::Begin();
+    for(auto n = 0; n < 4; ++n)
+    {
+        const auto address = runtime::InstructionPointer();
+        if(!runtime::Step() || !history::Record(history::Source::kInstruction, address))
+        {
+            std::cerr << "history: " << ErrorMessage(GetError()) << std::endl;
+            runtime::Shutdown();
+            return;
+        }
+    }
+    std::vector<history::change_t> changes;
+    history::change_t rax_at_3, ecx;
+    const auto ok = history::Changes(GetRegisterInfo("rax"), 2, history::Steps(), changes) && history::LastChange(GetRegisterInfo("rax"), 3, rax_at_3) && history::LastChange(GetRegisterInfo("ecx"), history::Steps(), ecx);
+    // rax is 3 at step 2 and 6 at step 4, rcx was last changed by the mov at step 3
+    const auto expected = ok && changes.size() == 2 && changes[0]._value[0] == 3 && changes[1]._step == 4 && changes[1]._value[0] == 6 && rax_at_3._step == 2 && rax_at_3._has_line && ecx._step == 3 && ecx._value[0] == 7;
+    std::cout << "history: " << (expected ? "ok" : "wrong") << "\n";
+    history::Clear();
+    runtime::Shutdown();
+}
+
+// two writes to a three page buffer, the second one in a page with its own variable
+void test_memory_diff()
+{
+    using namespace inasm64;
+    if(!start("memory diff"))
+        return;
+    const auto buffer = runtime::AllocateMemory(3 * 4096);
+    const auto rsi = uint64_t(buffer);
+    memdiff::diff_t result;
+    if(!buffer || !add("mov dword [rsi + 8], 1") || !add("mov byte [rsi + 8193], 2") || !runtime::CommmitInstructions() || !runtime::SetReg(RegisterInfo{ RegisterInfo::Register::rsi }, &rsi, sizeof(rsi)) ||
+        !globvars::Set("mdiff_buffer", rsi) || !globvars::Set("mdiff_tail", rsi + 8192) || !memdiff::Begin() || !runtime::Run() || !memdiff::Diff(result))
+    {
+        std::cerr << "memory diff: " << ErrorMessage(GetError()) << std::endl;
+        runtime::Shutdown();
+        return;
+    }
+    // only the low byte of the dword changes
+    const auto expected = result._pages == 2 && result._variables.size() == 2 && result._variables[0]._name == "mdiff_buffer" && result._variables[0]._ranges.size() == 1 &&
+                          result._variables[0]._ranges[0]._offset == 8 && result._variables[0]._changed == 1 && result._variables[1]._name == "mdiff_tail" && result._variables[1]._ranges[0]._offset == 1;
+    std::cout << "memory diff: " << (expected ? "ok" : "wrong") << ", " << result._compared << " bytes compared\n";
+    memdiff::End();
+    runtime::Shutdown();
+}
+
+// commands registered before and after bp, and type-1 commands, all have to be matched
+void test_cli_dispatch()
+{
+    using namespace inasm64;
+    if(!start("cli dispatch"))
+        return;
+    cli::Initialise();
+    auto variable_set = false;
+    cli::OnDataValueSet = [&variable_set](const char*, uintptr_t) { variable_set = true; };
+    const auto dispatched = cli::Execute("a") && cli::Execute("nop") && cli::Execute("nop") && cli::Execute("nop") && cli::Execute("nop") && cli::Execute("nop") && cli::Execute("") &&
+                            cli::Execute("bp 0") && cli::Execute("bc 0") && cli::Execute("x db 1") && !cli::Execute("nosuchcommand");
+    std::cout << "cli dispatch: " << ((dispatched && variable_set) ? "ok" : "wrong") << "\n";
+    cli::OnDataValueSet = nullptr;
+    runtime::Shutdown();
+}
+
 int main()
 {
     /*std::vector<std::string> lines;
@@ -198,4 +769,26 @@ int main()
     test_assemble("add eax, dword es:[rdx - 0x11223344]");
     test_assemble("jmp qword [0x11223344]");
     test_assemble("mov ax, word [ebx]");
+    test_assemble("jnz loop_top");
+    test_assemble("loop l0");
+    test_assemble("jmp rax");
+
+    test_emulator_throughput();
+    test_debuggee_pool();
+    test_interpreter_differential();
+    test_smt_interference();
+    test_cores();
+    test_pointer_chain();
+    test_sse_avx_transitions();
+    test_flush_to_zero();
+    test_verify();
+    test_superopt();
+    test_litmus();
+    test_tune();
+    test_load();
+    test_export();
+    test_perf_map();
+    test_history();
+    test_memory_diff();
+    test_cli_dispatch();
 }